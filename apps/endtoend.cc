@@ -1,13 +1,16 @@
 #include "address.hh"
 #include "arp_message.hh"
 #include "bidirectional_stream_copy.hh"
+#include "buffer_pool.hh"
 #include "exception.hh"
 #include "helpers.hh"
 #include "router.hh"
 #include "tcp_minnow_socket_impl.hh"
 #include "tcp_over_ip.hh"
 
+#include <csignal>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
 #include <thread>
 #include <utility>
@@ -41,14 +44,12 @@ EthernetAddress random_router_ethernet_address()
 
 optional<EthernetFrame> maybe_receive_frame( FileDescriptor& fd )
 {
-  vector<string> strs( 4 );
-  strs.at( 0 ).resize( EthernetHeader::LENGTH );
-  strs.at( 1 ).resize( IPv4Header::LENGTH );
-  strs.at( 2 ).resize( TCPSegment::HEADER_LENGTH );
-  fd.read( strs );
+  auto buffers
+    = BufferPool::take_for_headers( { EthernetHeader::LENGTH, IPv4Header::LENGTH, TCPSegment::HEADER_LENGTH } );
+  fd.read( buffers );
 
   EthernetFrame frame;
-  if ( not parse( frame, move( strs ) ) ) {
+  if ( not parse( frame, move( buffers ) ) ) {
     return {};
   }
 
@@ -71,7 +72,7 @@ private:
 
     void transmit( const NetworkInterface& n [[maybe_unused]], const EthernetFrame& x ) override
     {
-      sockets.first.write( serialize( x ) );
+      sockets.first.queue_write( serialize( x ) ); // (flushed by TCPMinnowSocket's event loop)
     }
   };
 
@@ -115,11 +116,13 @@ public:
 class TCPSocketEndToEnd : public TCPMinnowSocket<NetworkInterfaceAdapter>
 {
   Address _local_address;
+  bool _checksum_trusted;
 
 public:
-  TCPSocketEndToEnd( const Address& ip_address, const Address& next_hop )
+  TCPSocketEndToEnd( const Address& ip_address, const Address& next_hop, const bool checksum_trusted )
     : TCPMinnowSocket<NetworkInterfaceAdapter>( NetworkInterfaceAdapter( ip_address, next_hop ) )
     , _local_address( ip_address )
+    , _checksum_trusted( checksum_trusted )
   {}
 
   void connect( const Address& address )
@@ -130,6 +133,7 @@ public:
     cerr << "DEBUG: Connecting from " << _local_address.to_string() << "...\n";
     multiplexer_config.source = _local_address;
     multiplexer_config.destination = address;
+    multiplexer_config.checksum_trusted = _checksum_trusted;
 
     TCPMinnowSocket<NetworkInterfaceAdapter>::connect( {}, multiplexer_config );
   }
@@ -146,6 +150,7 @@ public:
   {
     FdAdapterConfig multiplexer_config;
     multiplexer_config.source = _local_address;
+    multiplexer_config.checksum_trusted = _checksum_trusted;
     TCPMinnowSocket<NetworkInterfaceAdapter>::listen_and_accept( {}, multiplexer_config );
   }
 
@@ -153,7 +158,11 @@ public:
 };
 
 // NOLINTBEGIN(*-cognitive-complexity)
-void program_body( bool is_client, const string& bounce_host, const string& bounce_port, const bool debug )
+void program_body( bool is_client,
+                   const string& bounce_host,
+                   const string& bounce_port,
+                   const bool debug,
+                   const bool checksum_trusted )
 {
   class FramesOut : public NetworkInterface::OutputPort
   {
@@ -179,6 +188,7 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
 
   /* set up the router */
   Router router;
+  router.set_forwarding( true ); // (the router only passes datagrams on, so leave them serialized)
 
   unsigned int host_side {};
   unsigned int internet_side {};
@@ -202,8 +212,9 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
   }
 
   /* set up the client */
-  TCPSocketEndToEnd sock = is_client ? TCPSocketEndToEnd { Address { "192.168.0.50" }, Address { "192.168.0.1" } }
-                                     : TCPSocketEndToEnd { Address { "172.16.0.100" }, Address { "172.16.0.1" } };
+  TCPSocketEndToEnd sock
+    = is_client ? TCPSocketEndToEnd { Address { "192.168.0.50" }, Address { "192.168.0.1" }, checksum_trusted }
+                : TCPSocketEndToEnd { Address { "172.16.0.100" }, Address { "172.16.0.1" }, checksum_trusted };
 
   atomic<bool> exit_flag {};
 
@@ -240,32 +251,50 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
         },
         [&] { return not router_to_host->frames.empty(); } );
 
-      // Frames from router to Internet
+      // Frames from router to Internet (up to a batch at a time, in one system call)
+      constexpr size_t internet_batch_size = 32;
+      DatagramSocket::Batch outbound { internet_batch_size };
+      deque<EthernetFrame> outbound_frames; // (taken from the router's queue, and kept until sent)
+      vector<vector<Ref<string>>> outbound_buffers;
       event_loop.add_rule(
         "frames from router to Internet",
         internet_socket,
         Direction::Out,
         [&] {
           auto& f = router_to_internet;
-          if ( debug ) {
-            cerr << "     Router->Internet: " << summary( f->frames.front() ) << "\n";
+          while ( outbound_frames.size() < internet_batch_size and not f->frames.empty() ) {
+            if ( debug ) {
+              cerr << "     Router->Internet: " << summary( f->frames.front() ) << "\n";
+            }
+            outbound_frames.push_back( move( f->frames.front() ) );
+            f->frames.pop();
           }
-          internet_socket.write( serialize( f->frames.front() ) );
-          f->frames.pop();
+
+          outbound.clear();
+          outbound_buffers.clear();
+          for ( const auto& frame : outbound_frames ) {
+            outbound_buffers.push_back( serialize( frame ) );
+            outbound.push_back( outbound_buffers.back() );
+          }
+          const size_t sent = internet_socket.send_batch( outbound );
+          outbound_frames.erase( outbound_frames.begin(), outbound_frames.begin() + sent );
         },
-        [&] { return not router_to_internet->frames.empty(); } );
+        [&] { return not router_to_internet->frames.empty() or not outbound_frames.empty(); } );
 
-      // Frames from Internet to router
+      // Frames from Internet to router (everything waiting, in one system call)
+      DatagramSocket::Batch inbound { internet_batch_size };
       event_loop.add_rule( "frames from Internet to router", internet_socket, Direction::In, [&] {
-        auto frame_opt = maybe_receive_frame( internet_socket );
-        if ( not frame_opt ) {
-          return;
-        }
-        EthernetFrame frame = move( frame_opt.value() );
-        if ( debug ) {
-          cerr << "     Internet->router: " << summary( frame ) << "\n";
+        const size_t count = internet_socket.recv_batch( inbound );
+        for ( size_t i = 0; i < count; i++ ) {
+          EthernetFrame frame;
+          if ( not parse( frame, vector { string { inbound.payload( i ) } } ) ) {
+            continue;
+          }
+          if ( debug ) {
+            cerr << "     Internet->router: " << summary( frame ) << "\n";
+          }
+          router.interface( internet_side )->recv_frame( move( frame ) );
         }
-        router.interface( internet_side )->recv_frame( move( frame ) );
         router.route();
       } );
 
@@ -309,8 +338,10 @@ void program_body( bool is_client, const string& bounce_host, const string& boun
 
 void print_usage( const string& argv0 )
 {
-  cerr << "Usage: " << argv0 << " client HOST PORT [debug]\n";
-  cerr << "or     " << argv0 << " server HOST PORT [debug]\n";
+  cerr << "Usage: " << argv0 << " client HOST PORT [debug] [profile] [trusted]\n";
+  cerr << "or     " << argv0 << " server HOST PORT [debug] [profile] [trusted]\n";
+  cerr << "(profile: print event loop timings on SIGUSR1 and when each loop ends)\n";
+  cerr << "(trusted: skip TCP checksums; both ends must say so)\n";
 }
 
 int main( int argc, char* argv[] )
@@ -326,17 +357,32 @@ int main( int argc, char* argv[] )
       abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
     }
 
-    if ( argc != 4 and argc != 5 ) {
+    if ( argc < 4 or argc > 7 ) {
       print_usage( args[0] );
       return EXIT_FAILURE;
     }
 
+    bool debug = false;
+    bool checksum_trusted = false;
+    for ( const char* option : args.subspan( 4 ) ) {
+      if ( option == "debug"s ) {
+        debug = true;
+      } else if ( option == "trusted"s ) {
+        checksum_trusted = true;
+      } else if ( option == "profile"s ) {
+        EventLoop::enable_profiling( SIGUSR1 );
+      } else {
+        print_usage( args[0] );
+        return EXIT_FAILURE;
+      }
+    }
+
     if ( args[1] != "client"s and args[1] != "server"s ) {
       print_usage( args[0] );
       return EXIT_FAILURE;
     }
 
-    program_body( args[1] == "client"s, args[2], args[3], argc == 5 );
+    program_body( args[1] == "client"s, args[2], args[3], debug, checksum_trusted );
   } catch ( const exception& e ) {
     cerr << e.what() << "\n";
     return EXIT_FAILURE;
@@ -1,11 +1,17 @@
 #include "bidirectional_stream_copy.hh"
+#include "eventloop.hh"
 #include "tcp_config.hh"
+#include "tcp_minnow_listener.hh"
 #include "tcp_minnow_socket.hh"
 #include "tun.hh"
 
+#include <chrono>
+#include <csignal>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <random>
 #include <span>
@@ -16,6 +22,7 @@ using namespace std;
 
 constexpr const char* TUN_DFLT = "tun144";
 constexpr const char* LOCAL_ADDRESS_DFLT = "169.254.144.9";
+constexpr size_t MAX_ECHO_CONNECTIONS = 64;
 
 namespace {
 void show_usage( const char* argv0, const char* msg )
@@ -27,6 +34,9 @@ void show_usage( const char* argv0, const char* msg )
        << "   -l              Server (listen) mode.                           (client mode)\n"
        << "                   In server mode, <host>:<port> is the address to bind.\n\n"
 
+       << "   -e              Echo server mode: accept connections (up to     (off)\n"
+       << "                   " << MAX_ECHO_CONNECTIONS << " at a time) and echo their bytes back.\n\n"
+
        << "   -a <addr>       Set source address (client mode only)           " << LOCAL_ADDRESS_DFLT << "\n"
        << "   -s <port>       Set source port (client mode only)              (random)\n\n"
 
@@ -37,9 +47,24 @@ void show_usage( const char* argv0, const char* msg )
 
        << "   -d <tundev>     Connect to tun <tundev>                         " << TUN_DFLT << "\n\n"
 
+       << "   -r <dev>        Send Ethernet frames through a packet ring on   (use a tun)\n"
+       << "                   device <dev> (e.g. one end of a veth pair)\n"
+       << "                   instead (client mode only).\n"
+       << "   -g <addr>       With -r, send datagrams to (and ARP for)        (<host>)\n"
+       << "                   <addr>, e.g. a router's, instead of <host>.\n\n"
+
+       << "   -V              Offload TCP checksums to the kernel with a      (off)\n"
+       << "                   virtio-net header (client mode only).\n\n"
+
+       << "   -G              Like -V, and also exchange TCP super-segments   (off)\n"
+       << "                   of up to 64 KiB with the kernel (GSO/GRO).\n\n"
+
        << "   -Lu <loss>      Set uplink loss to <rate> (float in 0..1)       (no loss)\n"
        << "   -Ld <loss>      Set downlink loss to <rate> (float in 0..1)     (no loss)\n\n"
 
+       << "   -P              Profile event loops: print per-category         (off)\n"
+       << "                   timings on SIGUSR1 and when each loop ends.\n\n"
+
        << "   -h              Show this message.\n\n";
 
   if ( msg != nullptr ) {
@@ -56,7 +81,15 @@ void check_argc( const span<char*>& args, size_t curr, const char* err )
   }
 }
 
-tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char*>& args )
+//! How to reach the network without a TUN device (see -r)
+struct RingLink
+{
+  const char* device = nullptr;
+  const char* next_hop = nullptr; //!< (null: the destination itself)
+};
+
+tuple<TCPConfig, FdAdapterConfig, bool, bool, const char*, TunTapOptions, RingLink> get_config(
+  const span<char*>& args )
 {
   TCPConfig c_fsm {};
   c_fsm.isn = Wrap32 { random_device()() };
@@ -66,6 +99,9 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
 
   size_t curr = 1;
   bool listen = false;
+  bool echo = false;
+  TunTapOptions tun_options {};
+  RingLink ring {};
   const size_t argc = args.size();
 
   string source_address = LOCAL_ADDRESS_DFLT;
@@ -76,6 +112,11 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
       listen = true;
       curr += 1;
 
+    } else if ( strncmp( "-e", args[curr], 3 ) == 0 ) {
+      listen = true;
+      echo = true;
+      curr += 1;
+
     } else if ( strncmp( "-a", args[curr], 3 ) == 0 ) {
       check_argc( args, curr, "ERROR: -a requires one argument." );
       source_address = args[curr + 1];
@@ -101,6 +142,26 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
       tundev = args[curr + 1];
       curr += 2;
 
+    } else if ( strncmp( "-r", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -r requires one argument." );
+      ring.device = args[curr + 1];
+      curr += 2;
+
+    } else if ( strncmp( "-g", args[curr], 3 ) == 0 ) {
+      check_argc( args, curr, "ERROR: -g requires one argument." );
+      ring.next_hop = args[curr + 1];
+      curr += 2;
+
+    } else if ( strncmp( "-V", args[curr], 3 ) == 0 ) {
+      tun_options.vnet_hdr = true;
+      curr += 1;
+
+    } else if ( strncmp( "-G", args[curr], 3 ) == 0 ) {
+      tun_options.vnet_hdr = true;
+      tun_options.gso = true;
+      c_fsm.super_segment_size = TCPConfig::MAX_SUPER_SEGMENT_SIZE;
+      curr += 1;
+
     } else if ( strncmp( "-Lu", args[curr], 3 ) == 0 ) {
       check_argc( args, curr, "ERROR: -Lu requires one argument." );
       const float lossrate = strtof( args[curr + 1], nullptr );
@@ -117,6 +178,10 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
         = static_cast<LossRateDnT>( static_cast<float>( numeric_limits<LossRateDnT>::max() ) * lossrate );
       curr += 2;
 
+    } else if ( strncmp( "-P", args[curr], 3 ) == 0 ) {
+      EventLoop::enable_profiling( SIGUSR1 );
+      curr += 1;
+
     } else if ( strncmp( "-h", args[curr], 3 ) == 0 ) {
       show_usage( args[0], nullptr );
       exit( 0 );
@@ -127,6 +192,21 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
     }
   }
 
+  if ( listen and tun_options.vnet_hdr ) {
+    show_usage( args[0], "ERROR: -V and -G are supported in client mode only." );
+    exit( 1 );
+  }
+
+  if ( ring.device != nullptr
+       and ( listen or tun_options.vnet_hdr or c_filt.loss_rate_up != 0 or c_filt.loss_rate_dn != 0 ) ) {
+    show_usage( args[0], "ERROR: -r is supported in client mode only, without -V, -G, -Lu or -Ld." );
+    exit( 1 );
+  }
+  if ( ring.next_hop != nullptr and ring.device == nullptr ) {
+    show_usage( args[0], "ERROR: -g requires -r." );
+    exit( 1 );
+  }
+
   // parse positional command-line arguments
   if ( listen ) {
     c_filt.source = { "0", args[curr + 1] };
@@ -139,7 +219,69 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
     c_filt.source = { source_address, source_port };
   }
 
-  return make_tuple( c_fsm, c_filt, listen, tundev );
+  return make_tuple( c_fsm, c_filt, listen, echo, tundev, tun_options, ring );
+}
+
+// Echo everything a connection sends back to it, until the peer finishes sending
+void echo_connection( TCPMinnowConnection connection )
+{
+  try {
+    string buffer;
+    while ( not connection.eof() ) {
+      buffer.clear();
+      connection.read( buffer );
+      string_view remaining = buffer;
+      while ( not remaining.empty() ) {
+        remaining.remove_prefix( connection.write( remaining ) );
+      }
+    }
+    connection.wait_until_closed();
+  } catch ( const exception& e ) {
+    cerr << "Exception in echo connection to " << connection.peer_address().to_string() << ": " << e.what() << "\n";
+  }
+}
+
+// A random private, unicast Ethernet address
+EthernetAddress random_ethernet_address()
+{
+  EthernetAddress addr;
+  for ( auto& byte : addr ) {
+    byte = random_device()();
+  }
+  addr.at( 0 ) |= 0x02; // "10" in last two binary digits marks a private Ethernet address
+  addr.at( 0 ) &= 0xfe;
+  return addr;
+}
+
+// Run a client connection over a packet ring, with a NetworkInterface of its own
+void run_over_ring( const TCPConfig& c_fsm, const FdAdapterConfig& c_filt, const RingLink& ring )
+{
+  const Address next_hop = ring.next_hop == nullptr ? c_filt.destination : Address { ring.next_hop };
+  TCPOverEthernetMinnowSocket tcp_socket( TCPOverIPv4OverPacketRingAdapter(
+    ring.device, random_ethernet_address(), Address { c_filt.source.ip() }, next_hop ) );
+  tcp_socket.connect( c_fsm, c_filt );
+
+  bidirectional_stream_copy( tcp_socket, tcp_socket.peer_address().to_string() );
+  tcp_socket.wait_until_closed();
+}
+
+// Accept connections forever, serving each one from its own thread (at most MAX_ECHO_CONNECTIONS at a time)
+void serve_echo( const TCPConfig& c_fsm, const FdAdapterConfig& c_filt, const char* tun_dev_name )
+{
+  // (declared before the listener, so that if accept() throws, the listener abandons the remaining connections,
+  // ending their streams, before their threads are joined)
+  deque<future<void>> echoes;
+  TCPMinnowListener listener { TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ) };
+  listener.listen( c_fsm, c_filt );
+
+  while ( true ) {
+    erase_if( echoes, []( const future<void>& echo ) { return echo.wait_for( 0s ) == future_status::ready; } );
+    if ( echoes.size() >= MAX_ECHO_CONNECTIONS ) {
+      echoes.pop_front(); // waits for the oldest connection to finish
+      continue;
+    }
+    echoes.push_back( async( launch::async, echo_connection, listener.accept() ) );
+  }
 }
 } // namespace
 
@@ -157,18 +299,27 @@ int main( int argc, char** argv )
       return EXIT_FAILURE;
     }
 
-    auto [c_fsm, c_filt, listen, tun_dev_name] = get_config( args );
-    LossyTCPOverIPv4MinnowSocket tcp_socket( LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>(
-      TCPOverIPv4OverTunFdAdapter( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ) ) ) );
+    auto [c_fsm, c_filt, listen, echo, tun_dev_name, tun_options, ring] = get_config( args );
 
-    if ( listen ) {
-      tcp_socket.listen_and_accept( c_fsm, c_filt );
+    if ( ring.device != nullptr ) {
+      run_over_ring( c_fsm, c_filt, ring );
+    } else if ( echo ) {
+      serve_echo( c_fsm, c_filt, tun_dev_name );
+    } else if ( listen ) {
+      TCPMinnowListener listener { TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ) };
+      listener.listen( c_fsm, c_filt );
+      TCPMinnowConnection connection = listener.accept();
+
+      bidirectional_stream_copy( connection, connection.peer_address().to_string() );
+      connection.wait_until_closed();
     } else {
+      LossyTCPOverIPv4MinnowSocket tcp_socket( LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>(
+        TCPOverIPv4OverTunFdAdapter( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name, tun_options ) ) ) );
       tcp_socket.connect( c_fsm, c_filt );
-    }
 
-    bidirectional_stream_copy( tcp_socket, tcp_socket.peer_address().to_string() );
-    tcp_socket.wait_until_closed();
+      bidirectional_stream_copy( tcp_socket, tcp_socket.peer_address().to_string() );
+      tcp_socket.wait_until_closed();
+    }
   } catch ( const exception& e ) {
     cerr << "Exception: " << e.what() << "\n";
     return EXIT_FAILURE;
@@ -0,0 +1,212 @@
+#include "address.hh"
+#include "eventloop_pool.hh"
+#include "exception.hh"
+#include "socket.hh"
+#include "tun.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <span>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+struct Options
+{
+  size_t queues = 1;
+  size_t datagram_size = 1400;
+  size_t flows = 64;
+  double seconds = 3;
+  TunTapOptions tun {};
+  string tun_device {};
+  string destination {};
+};
+
+void show_usage( const char* argv0, const char* msg )
+{
+  cout << "Usage: " << argv0 << " [options] <tundev> <destination>\n\n"
+       << "Sends UDP datagrams to <destination> (an address routed to <tundev>, a multi-queue TUN device), and\n"
+       << "reads them from the device's queues, each on a thread of its own. Reports packets and bytes read.\n\n"
+       << "   Option                                                          Default\n"
+       << "   --                                                              --\n\n"
+       << "   -q <queues>     Open <queues> queues of the device              1\n"
+       << "   -s <size>       Send datagrams of <size> bytes                  1400\n"
+       << "   -f <flows>      Spread the datagrams over <flows> source ports  64\n"
+       << "   -t <seconds>    Send for <seconds> seconds                      3\n"
+       << "   -V              Read with a virtio-net header                   (off)\n"
+       << "   -G              Like -V, and send 64 KiB super-datagrams, which (off)\n"
+       << "                   the device may hand over whole (UDP GSO)\n\n";
+
+  if ( msg != nullptr ) {
+    cout << msg << "\n";
+  }
+}
+
+Options get_options( const span<char*> args )
+{
+  Options options;
+  size_t curr = 1;
+  const auto argument = [&]( const char* err ) -> const char* {
+    if ( curr + 3 >= args.size() ) {
+      show_usage( args.front(), err );
+      exit( EXIT_FAILURE );
+    }
+    curr += 2;
+    return args[curr - 1];
+  };
+
+  while ( args.size() - curr > 2 ) {
+    if ( strncmp( "-q", args[curr], 3 ) == 0 ) {
+      options.queues = strtoul( argument( "ERROR: -q requires one argument." ), nullptr, 0 );
+    } else if ( strncmp( "-s", args[curr], 3 ) == 0 ) {
+      options.datagram_size = strtoul( argument( "ERROR: -s requires one argument." ), nullptr, 0 );
+    } else if ( strncmp( "-f", args[curr], 3 ) == 0 ) {
+      options.flows = strtoul( argument( "ERROR: -f requires one argument." ), nullptr, 0 );
+    } else if ( strncmp( "-t", args[curr], 3 ) == 0 ) {
+      options.seconds = strtod( argument( "ERROR: -t requires one argument." ), nullptr );
+    } else if ( strncmp( "-V", args[curr], 3 ) == 0 ) {
+      options.tun.vnet_hdr = true;
+      curr += 1;
+    } else if ( strncmp( "-G", args[curr], 3 ) == 0 ) {
+      options.tun.vnet_hdr = true;
+      options.tun.gso = true;
+      curr += 1;
+    } else {
+      show_usage( args[0], string( "ERROR: unrecognized option " + string( args[curr] ) ).c_str() );
+      exit( EXIT_FAILURE );
+    }
+  }
+
+  if ( args.size() - curr != 2 or options.queues == 0 or options.flows == 0 or options.datagram_size == 0 ) {
+    show_usage( args[0], "ERROR: bad arguments." );
+    exit( EXIT_FAILURE );
+  }
+  options.tun_device = args[curr];
+  options.destination = args[curr + 1];
+  return options;
+}
+
+//! What one queue's thread has read (on a cache line of its own, as each thread updates only its own)
+struct alignas( 64 ) QueueCounters
+{
+  atomic<uint64_t> packets { 0 };
+  atomic<uint64_t> bytes { 0 };
+  atomic<uint64_t> super_packets { 0 }; //!< Packets the kernel handed over whole, to be segmented (GSO)
+};
+
+//! Reads every packet from `queue` on one of the pool's threads, counting them
+void read_on_shard( EventLoopPool& pool, const size_t shard, TunFD&& queue, QueueCounters& counters )
+{
+  auto fd = make_shared<TunFD>( move( queue ) );
+  pool.post( shard, [fd, &counters]( EventLoop& loop ) {
+    loop.add_rule( "read TUN queue", *fd, Direction::In, [fd, &counters, buffer = string {}]() mutable {
+      buffer.resize( TunTapFD::MAX_GSO_PACKET );
+      fd->read( buffer );
+      size_t packet_size = buffer.size();
+      if ( fd->vnet_hdr() and packet_size >= sizeof( VirtioNetHeader ) ) {
+        VirtioNetHeader header {};
+        memcpy( &header, buffer.data(), sizeof( header ) );
+        if ( header.gso_type != VirtioNetHeader::GSO_NONE ) {
+          counters.super_packets.fetch_add( 1, memory_order_relaxed );
+        }
+        packet_size -= sizeof( header );
+      }
+      counters.packets.fetch_add( 1, memory_order_relaxed );
+      counters.bytes.fetch_add( packet_size, memory_order_relaxed );
+    } );
+  } );
+}
+
+//! Sends datagrams to the destination, over `flows` source ports, until `seconds` have passed; returns the
+//! number of payload bytes sent
+uint64_t send_datagrams( const Options& options )
+{
+  // with segmentation offload, each send is as many datagram_size datagrams as fit in 64 KiB
+  const size_t segments = options.tun.gso ? max<size_t>( 1, 65000 / options.datagram_size ) : 1;
+  const string payload( options.datagram_size * segments, 'x' );
+
+  vector<UDPSocket> sockets;
+  for ( size_t i = 0; i < options.flows; i++ ) {
+    UDPSocket& socket = sockets.emplace_back();
+    socket.connect( Address { options.destination, static_cast<uint16_t>( 9000 + i ) } );
+    if ( options.tun.gso ) {
+      const int gso_size = static_cast<int>( options.datagram_size );
+      CheckSystemCall( "setsockopt",
+                       setsockopt( socket.fd_num(), SOL_UDP, UDP_SEGMENT, &gso_size, sizeof( gso_size ) ) );
+    }
+  }
+
+  uint64_t bytes_sent = 0;
+  const auto deadline = steady_clock::now() + duration<double>( options.seconds );
+  while ( steady_clock::now() < deadline ) {
+    for ( auto& socket : sockets ) {
+      socket.send( payload );
+      bytes_sent += payload.size();
+    }
+  }
+  return bytes_sent;
+}
+
+void program_body( const Options& options )
+{
+  auto queues = TunFD::open_queues( options.tun_device, options.queues, options.tun );
+  vector<QueueCounters> counters( options.queues );
+  EventLoopPool pool { options.queues };
+  for ( size_t i = 0; i < options.queues; i++ ) {
+    read_on_shard( pool, i, move( queues[i] ), counters[i] );
+  }
+
+  const auto start_time = steady_clock::now();
+  const uint64_t bytes_sent = send_datagrams( options );
+  this_thread::sleep_for( milliseconds( 100 ) ); // (let the readers drain the queues)
+  const double seconds = duration<double>( steady_clock::now() - start_time ).count();
+
+  uint64_t packets = 0;
+  uint64_t bytes = 0;
+  uint64_t super_packets = 0;
+  cout << fixed << setprecision( 2 );
+  for ( size_t i = 0; i < options.queues; i++ ) {
+    const uint64_t queue_packets = counters[i].packets.load();
+    packets += queue_packets;
+    bytes += counters[i].bytes.load();
+    super_packets += counters[i].super_packets.load();
+    cout << "queue " << i << ": " << queue_packets << " packets\n";
+  }
+
+  cout << options.queues << " queue(s)" << ( options.tun.gso ? ", GSO" : options.tun.vnet_hdr ? ", vnet" : "" )
+       << ": " << static_cast<double>( packets ) / seconds / 1e6 << " M packets/s read, "
+       << static_cast<double>( bytes ) * 8 / seconds / 1e9 << " Gbit/s read (" << super_packets
+       << " super-packets), of " << static_cast<double>( bytes_sent ) * 8 / seconds / 1e9 << " Gbit/s sent\n";
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+    program_body( get_options( span( argv, argc ) ) );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,3 +1,5 @@
+#include "eventloop.hh"
+#include "task.hh"
 #include "tcp_minnow_socket.hh"
 
 #include <cstdlib>
@@ -7,24 +9,29 @@
 
 using namespace std;
 
-void get_URL( const string& host, const string& path )
+// send the request and copy the response to stdout, as a coroutine on the EventLoop
+Task fetch( CS144TCPSocket& socket, const string& host, const string& path )
 {
-  // cerr << "Function called: get_URL(" << host << ", " << path << ")\n";
-  // cerr << "Warning: get_URL() has not been implemented yet.\n";
-  CS144TCPSocket socket {};
-  socket.connect( Address( host, "http" ) );
-  // socket.write("GET" + path +"HTTP/1.1\r\nHost: "+ host + "\r\nConnection: close\r\n\r\n");
-  socket.write( "GET " + path + " HTTP/1.1\r\n" );
-  socket.write( "HOST: " + host + "\r\n" );
-  socket.write( "Connection: close\r\n" );
-  socket.write( "\r\n" );
+  co_await socket.async_write( "GET " + path + " HTTP/1.1\r\n" + "HOST: " + host + "\r\n"
+                               + "Connection: close\r\n\r\n" );
   string buffer {};
   while ( !socket.eof() ) {
-    socket.read( buffer );
+    buffer.clear();
+    co_await socket.async_read( buffer );
     cout << buffer;
   }
-  // cout<<buffer;
-  socket.close();
+}
+
+void get_URL( const string& host, const string& path )
+{
+  CS144TCPSocket socket {};
+  socket.connect( Address( host, "http" ) );
+  socket.set_blocking( false );
+
+  EventLoop eventloop {};
+  eventloop.spawn( fetch( socket, host, path ) );
+  while ( eventloop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {}
+
   socket.wait_until_closed();
 }
 
@@ -60,6 +60,18 @@ ttest(router)
 
 ttest(no_skip)
 
+ttest(checksum_fuzz)
+
+ttest(receive_coalescing)
+
+ttest(tcp_listener)
+
+ttest(timer_wheel)
+
+ttest(eventloop)
+
+ttest(parser)
+
 add_custom_target (check0 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 15 -R 'webget|^byte_stream_|^no_skip')
 
 add_custom_target (check_byte_stream COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 15 -R '^byte_stream_|^no_skip')
@@ -94,3 +106,13 @@ set_tests_properties(${compile_name_opt} PROPERTIES FIXTURES_SETUP compile_opt)
 
 stest(byte_stream_speed_test)
 stest(reassembler_speed_test)
+stest(syn_flood_speed_test)
+stest(eventloop_speed_test)
+stest(batch_io_speed_test)
+stest(eventloop_pool_speed_test)
+stest(work_stealing_speed_test)
+stest(parser_speed_test)
+stest(checksum_speed_test)
+stest(router_speed_test)
+stest(trusted_link_speed_test)
+stest(packet_ring_link_speed_test)
@@ -3,13 +3,14 @@
 TUN_IP_PREFIX=169.254
 
 show_usage () {
-    echo "Usage: $0 <start | stop | restart | check> [tunnum ...]"
+    echo "Usage: $0 <start | stop | restart | check | bench> [tunnum ...]"
+    echo "       bench: measure reading from a multi-queue tun<tunnum> (default 146) with build/apps/tun_bench"
     exit 1
 }
 
 start_tun () {
-    local TUNNUM="$1" TUNDEV="tun$1"
-    ip tuntap add mode tun user "${SUDO_USER}" name "${TUNDEV}"
+    local TUNNUM="$1" TUNDEV="tun$1" FLAGS="$2"
+    ip tuntap add mode tun ${FLAGS} user "${SUDO_USER}" name "${TUNDEV}"
     ip addr add "${TUN_IP_PREFIX}.${TUNNUM}.1/24" dev "${TUNDEV}"
     ip link set dev "${TUNDEV}" up
     ip route change "${TUN_IP_PREFIX}.${TUNNUM}.0/24" dev "${TUNDEV}" rto_min 10ms
@@ -21,10 +22,10 @@ start_tun () {
 }
 
 stop_tun () {
-    local TUNDEV="tun$1"
+    local TUNDEV="tun$1" FLAGS="$2"
     iptables -t nat -D PREROUTING -s ${TUN_IP_PREFIX}.${1}.0/24 -j CONNMARK --set-mark ${1}
     iptables -t nat -D POSTROUTING -j MASQUERADE -m connmark --mark ${1}
-    ip tuntap del mode tun name "$TUNDEV"
+    ip tuntap del mode tun ${FLAGS} name "$TUNDEV"
 }
 
 start_all () {
@@ -46,6 +47,30 @@ restart_all() {
     start_all "$@"
 }
 
+# packets per second and throughput read from a multi-queue device, by queue count and offload
+bench_tun () {
+    local TUNNUM="$1" TUNDEV="tun$1"
+    local BENCH="$(dirname "$(readlink -f "$0")")/../build/apps/tun_bench"
+    [ -x "${BENCH}" ] || { echo "${BENCH} not found (build it first)"; exit 1; }
+
+    start_tun "${TUNNUM}" multi_queue
+    for OFFLOAD in "" -V -G; do
+        for QUEUES in 1 2 4 8; do
+            [ "${QUEUES}" -gt "$(nproc)" ] && [ "${QUEUES}" != 1 ] && break
+            sudo -u "${SUDO_USER}" "${BENCH}" -q "${QUEUES}" ${OFFLOAD} "${TUNDEV}" "${TUN_IP_PREFIX}.${TUNNUM}.2" \
+                | tail -n 1
+        done
+    done
+    stop_tun "${TUNNUM}" multi_queue
+}
+
+bench_all () {
+    while [ ! -z "$1" ]; do
+        local INTF="$1"; shift
+        bench_tun "$INTF"
+    done
+}
+
 check_tun () {
     [ "$#" != 1 ] && { echo "bad params in check_tun"; exit 1; }
     local TUNDEV="tun${1}"
@@ -66,13 +91,16 @@ check_sudo () {
 }
 
 # check arguments
-if [ -z "$1" ] || ([ "$1" != "start" ] && [ "$1" != "stop" ] && [ "$1" != "restart" ] && [ "$1" != "check" ]); then
+if [ -z "$1" ] || ([ "$1" != "start" ] && [ "$1" != "stop" ] && [ "$1" != "restart" ] && [ "$1" != "check" ] \
+    && [ "$1" != "bench" ]); then
     show_usage
 fi
 MODE=$1; shift
 
 # set default argument
-if [ "$#" = "0" ]; then
+if [ "$#" = "0" ] && [ "$MODE" = "bench" ]; then
+    set -- 146
+elif [ "$#" = "0" ]; then
     set -- 144 145
 fi
 
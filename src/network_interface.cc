@@ -9,6 +9,20 @@
 
 using namespace std;
 
+namespace {
+constexpr uint64_t ms_mapping_ttl = 30'000, ms_arp_resend = 5'000;
+
+// 帧中数据的总字节数
+size_t payload_size( const vector<Ref<string>>& payload )
+{
+  size_t size = 0;
+  for ( const auto& buffer : payload ) {
+    size += buffer->size();
+  }
+  return size;
+}
+} // namespace
+
 //! \param[in] ethernet_address Ethernet (what ARP calls "hardware") address of the interface
 //! \param[in] ip_address IP (what ARP calls "protocol") address of the interface
 NetworkInterface::NetworkInterface( string_view name,
@@ -48,7 +62,9 @@ void NetworkInterface::send_datagram( const InternetDatagram& dgram, const Addre
     if ( arp_request_buffer_.find( target_ip ) == arp_request_buffer_.end() ) {
       transmit( make_ethernet_frame( EthernetHeader::TYPE_ARP,
                                      serialize( make_arp_message( ARPMessage::OPCODE_REQUEST, target_ip ) ) ) );
-      arp_request_buffer_.emplace( target_ip, 0 );
+      const uint64_t expires_at = ms_now_ + ms_arp_resend + 1;
+      arp_request_buffer_.emplace( target_ip, expires_at );
+      arp_request_timers_.schedule( expires_at, target_ip );
     }
   } else {
     EthernetAddress ether_addr = iter->second.get_ether();
@@ -56,6 +72,22 @@ void NetworkInterface::send_datagram( const InternetDatagram& dgram, const Addre
   }
 }
 
+//! \param[in] dgram the serialized IPv4 datagram to be sent (in buffers the NetworkInterface may keep)
+//! \param[in] next_hop the IP address of the interface to send it to
+void NetworkInterface::send_serialized_datagram( vector<Ref<string>> dgram, const Address& next_hop )
+{
+  auto iter = addr_mapping_.find( next_hop.ipv4_numeric() );
+  if ( iter == addr_mapping_.end() ) {
+    // 还不知道下一跳的mac地址，解析成数据报后和其他数据报一样缓存起来，等待arp响应
+    InternetDatagram parsed;
+    if ( parse( parsed, move( dgram ) ) ) {
+      send_datagram( parsed, next_hop );
+    }
+    return;
+  }
+  transmit( make_ethernet_frame( EthernetHeader::TYPE_IPv4, move( dgram ), iter->second.get_ether() ) );
+}
+
 //! \param[in] frame the incoming Ethernet frame
 void NetworkInterface::recv_frame( EthernetFrame frame )
 {
@@ -65,6 +97,16 @@ void NetworkInterface::recv_frame( EthernetFrame frame )
   }
 
   if ( frame.header.type == EthernetHeader::TYPE_IPv4 ) {
+    // 转发模式下只检查首部（首部需要完整地在第一个缓冲区里），去掉以太网帧末尾可能的填充后原样排队；
+    // 总长度超出帧的数据报交给完整解析去拒绝
+    if ( forwarding_ && !frame.payload.empty() && IPv4HeaderView { frame.payload.front().get() }.valid()
+         && IPv4HeaderView { frame.payload.front().get() }.len() <= payload_size( frame.payload ) ) {
+      const uint16_t len = IPv4HeaderView { frame.payload.front().get() }.len();
+      Parser parser { move( frame.payload ) };
+      parser.truncate( len );
+      parser.all_remaining( serialized_datagrams_received_.emplace() );
+      return;
+    }
     InternetDatagram ip_data;
     if ( !parse( ip_data, frame.payload ) ) {
       return;
@@ -88,7 +130,10 @@ void NetworkInterface::recv_frame( EthernetFrame frame )
           bufferd_ip_data_.erase( head, tail );
     };
     
-    addr_mapping_.insert_or_assign( arp_msg.sender_ip_address, address_mapping( arp_msg.sender_ethernet_address ) );
+    const uint64_t expires_at = ms_now_ + ms_mapping_ttl + 1;
+    addr_mapping_.insert_or_assign( arp_msg.sender_ip_address,
+                                    address_mapping( arp_msg.sender_ethernet_address, expires_at ) );
+    addr_mapping_timers_.schedule( expires_at, arp_msg.sender_ip_address );
     if ( arp_msg.opcode == ARPMessage::OPCODE_REQUEST ) {
       if ( arp_msg.target_ip_address == ip_address_.ipv4_numeric() ) {
         transmit( make_ethernet_frame( EthernetHeader::TYPE_ARP,
@@ -109,22 +154,23 @@ void NetworkInterface::recv_frame( EthernetFrame frame )
 //! \param[in] ms_since_last_tick the number of milliseconds since the last call to this method
 void NetworkInterface::tick( const size_t ms_since_last_tick )
 {
-  constexpr size_t ms_mapping_ttl = 30'000, ms_arp_resend = 5'000;
-  auto flush_timer = [&ms_since_last_tick, this]( auto& table, size_t deadline ) -> void {
-    for ( auto iter = table.begin(); iter != table.end(); ) {
-      if ( ( iter->second += ms_since_last_tick ) > deadline ) {
-        if(deadline == 5'000){
-          // 如果这个arp请求超时了，那么丢弃之前放在待处理的缓存中的表项
-          bufferd_ip_data_.erase(iter->first);
-        }
-        iter = table.erase( iter );
-      } else {
-        iter++;
-      }
+  ms_now_ += ms_since_last_tick;
+
+  // 表项存在超过ttl之后删除，只处理到期的定时器
+  addr_mapping_timers_.advance( ms_now_, [this]( uint64_t deadline, uint32_t ip ) -> void {
+    auto iter = addr_mapping_.find( ip );
+    if ( iter != addr_mapping_.end() && iter->second.expires_at() == deadline ) {
+      addr_mapping_.erase( iter );
+    }
+  } );
+  arp_request_timers_.advance( ms_now_, [this]( uint64_t deadline, uint32_t ip ) -> void {
+    auto iter = arp_request_buffer_.find( ip );
+    if ( iter != arp_request_buffer_.end() && iter->second == deadline ) {
+      // 如果这个arp请求超时了，那么丢弃之前放在待处理的缓存中的表项
+      bufferd_ip_data_.erase( ip );
+      arp_request_buffer_.erase( iter );
     }
-  };
-  flush_timer( addr_mapping_, ms_mapping_ttl );
-  flush_timer( arp_request_buffer_, ms_arp_resend );
+  } );
 }
 
 EthernetFrame NetworkInterface::make_ethernet_frame( const uint16_t& type,
@@ -147,9 +193,3 @@ ARPMessage NetworkInterface::make_arp_message( const uint16_t& type,
            .target_ethernet_address = target_mac.has_value() ? std::move( *target_mac ) : EthernetAddress {},
            .target_ip_address = target_ip };
 }
-
-NetworkInterface::address_mapping& NetworkInterface::address_mapping::tick( const size_t ms_time_passed ) noexcept
-{
-  timer_ += ms_time_passed;
-  return *this;
-}
\ No newline at end of file
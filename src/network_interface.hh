@@ -4,6 +4,7 @@
 #include "ethernet_frame.hh"
 #include "ipv4_datagram.hh"
 #include "arp_message.hh"
+#include "timer_wheel.hh"
 
 #include <algorithm>
 #include <memory>
@@ -57,12 +58,21 @@ public:
   // hop. Sending is accomplished by calling `transmit()` (a member variable) on the frame.
   void send_datagram( const InternetDatagram& dgram, const Address& next_hop );
 
+  // Sends an Internet datagram that is already serialized (e.g. one from serialized_datagrams_received(), being
+  // forwarded) as it is, without parsing or re-serializing it (unless it has to wait for ARP).
+  void send_serialized_datagram( std::vector<Ref<std::string>> dgram, const Address& next_hop );
+
   // Receives an Ethernet frame and responds appropriately.
   // If type is IPv4, pushes the datagram to the datagrams_in queue.
   // If type is ARP request, learn a mapping from the "sender" fields, and send an ARP reply.
   // If type is ARP reply, learn a mapping from the "sender" fields.
   void recv_frame( EthernetFrame frame );
 
+  // If set, recv_frame() checks only the header of each arriving IPv4 datagram, and queues the datagram still
+  // serialized, in serialized_datagrams_received() (for a router, which passes datagrams on without looking
+  // inside them)
+  void set_forwarding( bool forwarding ) { forwarding_ = forwarding; }
+
   // Called periodically when time elapses
   void tick( size_t ms_since_last_tick );
 
@@ -71,6 +81,10 @@ public:
   const OutputPort& output() const { return *port_; }
   OutputPort& output() { return *port_; }
   std::queue<InternetDatagram>& datagrams_received() { return datagrams_received_; }
+  std::queue<std::vector<Ref<std::string>>>& serialized_datagrams_received()
+  {
+    return serialized_datagrams_received_;
+  }
 
 private:
   // 由网络层数据生成链路层帧
@@ -86,14 +100,13 @@ private:
   class address_mapping
   {
     EthernetAddress ether_addr_ {};
-    size_t timer_ {};
+    uint64_t expires_at_ {};
 
   public:
-    explicit address_mapping( EthernetAddress ether_addr ) : ether_addr_ { std::move( ether_addr ) }, timer_ {} {};
+    address_mapping( EthernetAddress ether_addr, uint64_t expires_at )
+      : ether_addr_ { std::move( ether_addr ) }, expires_at_ { expires_at } {};
     EthernetAddress get_ether() const noexcept { return ether_addr_; };
-    address_mapping& tick( const size_t ms_time_passed ) noexcept;
-    address_mapping& operator+=( const size_t ms_time_passed ) noexcept { return tick( ms_time_passed ); };
-    auto operator<=>( const size_t deadline ) const { return timer_ <=> deadline; };
+    uint64_t expires_at() const noexcept { return expires_at_; };
   };
   // Human-readable name of the interface
   std::string name_;
@@ -111,6 +124,10 @@ private:
   // Datagrams that have been received
   std::queue<InternetDatagram> datagrams_received_ {};
 
+  // 转发模式下收到的数据报，只检查过首部，仍是序列化的形式
+  bool forwarding_ {};
+  std::queue<std::vector<Ref<std::string>>> serialized_datagrams_received_ {};
+
   // 为了在数据链路层传输，需要一个表单来存储ip地址到mac地址的映射，
   std::unordered_map<uint32_t, address_mapping> addr_mapping_ {};
 
@@ -118,6 +135,12 @@ private:
   // 因为可能一份ip对应多个数据报，所以使用multimap
   std::multimap<uint32_t, InternetDatagram> bufferd_ip_data_ {};
 
-  // 将5s(lab5要求)内发送过arp请求的ip数据报加入表单中防止arp泛洪，value表示计时器
-  std::unordered_map<uint32_t, size_t> arp_request_buffer_ {};
+  // 将5s(lab5要求)内发送过arp请求的ip数据报加入表单中防止arp泛洪，value表示这条记录的过期时间
+  std::unordered_map<uint32_t, uint64_t> arp_request_buffer_ {};
+
+  // tick累计经过的时间，以及两张表中表项的过期时间轮，使tick的开销只和过期的表项数目有关
+  // 表项被刷新后旧的定时器不会被删除，到期时和表中记录的过期时间不一致的定时器直接忽略
+  uint64_t ms_now_ {};
+  TimerWheel<uint32_t> addr_mapping_timers_ {};
+  TimerWheel<uint32_t> arp_request_timers_ {};
 };
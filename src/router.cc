@@ -37,8 +37,7 @@ void Router::route()
         received_data.pop();
         continue;
       }
-      --dgram.header.ttl;
-      dgram.header.compute_checksum();
+      dgram.header.decrement_ttl();
       const auto& [interface_num, next_hop] = item->second;
 
       interface(interface_num) ->send_datagram(
@@ -47,6 +46,24 @@ void Router::route()
       );
       received_data.pop();
     }
+
+    // 转发模式下收到的数据报：只读取首部中需要的字段，直接在收到的缓冲区里修改TTL和校验和，不必重新序列化
+    auto& serialized_data = cur_interface->serialized_datagrams_received();
+    while(!serialized_data.empty()){
+      auto& dgram = serialized_data.front();
+      const IPv4HeaderView header { dgram.front().get() };
+      const uint32_t dst = header.dst();
+      const auto& item = match_max_prefix(dst);
+      if(item != router_map_.cend() && header.ttl() > 1){
+        MutableIPv4HeaderView { dgram.front().get_mut() }.decrement_ttl();
+        const auto& [interface_num, next_hop] = item->second;
+        interface(interface_num)->send_serialized_datagram(
+          std::move(dgram),
+          next_hop.has_value() ? *next_hop : Address::from_ipv4_numeric(dst)
+        );
+      }
+      serialized_data.pop();
+    }
   });
 }
 
@@ -16,12 +16,28 @@ public:
   // Add an interface to the router
   // \param[in] interface an already-constructed network interface
   // \returns The index of the interface after it has been added to the router
+  // (If the router forwards serialized datagrams, see set_forwarding(), so will the interface.)
   size_t add_interface( std::shared_ptr<NetworkInterface> interface )
   {
     interfaces_.push_back( notnull( "add_interface", std::move( interface ) ) );
+    if ( forwarding_ ) {
+      interfaces_.back()->set_forwarding( true );
+    }
     return interfaces_.size() - 1;
   }
 
+  // Pass datagrams on still serialized, without parsing or re-serializing them (off by default)
+  // This calls NetworkInterface::set_forwarding() on every interface, including those added later, so
+  // their arriving datagrams go to serialized_datagrams_received() instead of datagrams_received(). Only
+  // turn it on if nothing else reads the interfaces' datagrams_received().
+  void set_forwarding( bool forwarding )
+  {
+    forwarding_ = forwarding;
+    for ( const auto& interface : interfaces_ ) {
+      interface->set_forwarding( forwarding );
+    }
+  }
+
   // Access an interface by index
   std::shared_ptr<NetworkInterface> interface( const size_t N ) { return interfaces_.at( N ); }
 
@@ -54,4 +70,6 @@ private:
 
   // The router's collection of network interfaces
   std::vector<std::shared_ptr<NetworkInterface>> interfaces_ {};
+
+  bool forwarding_ {}; // see set_forwarding()
 };
@@ -1,4 +1,5 @@
 #include "tcp_sender.hh"
+#include "checksum.hh"
 #include "debug.hh"
 #include "tcp_config.hh"
 
@@ -40,6 +41,14 @@ uint64_t TCPSender::consecutive_retransmissions() const
   return consecutive_retransmissions_;
 }
 
+optional<uint64_t> TCPSender::ms_until_retransmission() const
+{
+  if ( !timer_.is_open() ) {
+    return nullopt;
+  }
+  return timer_.remaining();
+}
+
 void TCPSender::push( const TransmitFunction& transmit )
 {
   Reader& read_bytes = input_.reader();
@@ -48,6 +57,17 @@ void TCPSender::push( const TransmitFunction& transmit )
     return;
   }
 
+  // 连续的满载分段先合并成超级分段再交给transmit；outstanding_segment_里仍是一个个分段，重传的粒度不变
+  const TCPSenderMessage* unsent = nullptr; // 第一个还没交给transmit的分段（deque的元素不会因emplace而移动）
+  TCPSenderMessage super_segment {};        // 从unsent开始合并的超级分段，segment_size有值时才用
+  const auto flush = [&] {
+    if ( unsent != nullptr ) {
+      transmit( super_segment.segment_size.has_value() ? super_segment : *unsent );
+      super_segment.segment_size.reset();
+      unsent = nullptr;
+    }
+  };
+
   // 只要有数据可以发送就发送，发送过FIN之后无法再发送数据
   while ( seq_num_in_flight_ < window_size_ && !send_FIN_ ) {
     string_view byte_to_trans = read_bytes.peek();
@@ -59,6 +79,7 @@ void TCPSender::push( const TransmitFunction& transmit )
 
     // 发送字符串，payload表示目前还可以发送的字符串
     std::string payload {};
+    InternetChecksum payload_sum {}; // 在拷贝payload的同时计算其校验和，封装时不必再读一遍
     while ( payload.length() + seq_num_in_flight_ + !send_SYN_ < window_size_
             && payload.length() < TCPConfig::MAX_PAYLOAD_SIZE ) {
       // 组装payload
@@ -77,7 +98,7 @@ void TCPSender::push( const TransmitFunction& transmit )
         byte_to_trans.remove_suffix( byte_to_trans.length() - available_size );
       }
 
-      payload.append( byte_to_trans );
+      payload_sum.add_and_append( byte_to_trans, payload );
       read_bytes.pop( byte_to_trans.length() );
       FIN_ |= read_bytes.is_finished();
       byte_to_trans = read_bytes.peek();
@@ -86,6 +107,7 @@ void TCPSender::push( const TransmitFunction& transmit )
     if ( !send_FIN_ ) {
       size_t len = payload.length();
       auto& msg = outstanding_segment_.emplace( make_message( seq_num_, !send_SYN_, std::move( payload ), FIN_ ) );
+      msg.payload_sum = payload_sum.partial();
       SYN_ = true;
       // 当窗口足够时，可以同时将数据和FIN_发送出去
       if ( FIN_ && len < window_size_ ) {
@@ -97,13 +119,38 @@ void TCPSender::push( const TransmitFunction& transmit )
       seq_num_in_flight_ += len + !send_SYN_;
       seq_num_ += len + !send_SYN_;
       send_SYN_ = true;
-      transmit( msg );
       timer_.open();
+      if ( super_segment_size_ == 0 ) {
+        transmit( msg );
+        continue;
+      }
+
+      // 之前的分段都是满载的（且没有SYN），合并后也不超过上限，才能把msg合并进去
+      size_t unsent_size = unsent != nullptr ? unsent->payload.size() : 0;
+      if ( super_segment.segment_size.has_value() ) {
+        unsent_size = super_segment.payload.size();
+      }
+      if ( unsent_size == 0 || unsent->SYN || msg.payload.empty() || unsent_size % TCPConfig::MAX_PAYLOAD_SIZE != 0
+           || unsent_size + msg.payload.size() > super_segment_size_ ) {
+        flush();
+        unsent = &msg;
+        continue;
+      }
+      if ( !super_segment.segment_size.has_value() ) {
+        super_segment.payload.reserve( super_segment_size_ );
+        super_segment.payload.assign( unsent->payload );
+        super_segment.seqno = unsent->seqno;
+        super_segment.RST = unsent->RST;
+        super_segment.segment_size = TCPConfig::MAX_PAYLOAD_SIZE;
+      }
+      super_segment.payload += msg.payload;
+      super_segment.FIN = msg.FIN;
     } else {
       // 如果已经发送过了FIN的话，不可以发送任何其他数据，直接break
       break;
     }
   }
+  flush();
 }
 
 TCPSenderMessage TCPSender::make_empty_message() const
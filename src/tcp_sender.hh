@@ -6,6 +6,7 @@
 
 #include <functional>
 #include <iostream>
+#include <optional>
 #include <queue>
 #include <string_view>
 
@@ -15,6 +16,8 @@ public:
   explicit ReTreansmitTimer( uint64_t init_rto_time ) : RTO_( init_rto_time ) {};
   bool is_expired() const { return is_open_ && allTime_passed_ >= RTO_; }
   bool is_open() const { return is_open_; }
+  // 距离超时还剩多少时间
+  uint64_t remaining() const { return allTime_passed_ >= RTO_ ? 0 : RTO_ - allTime_passed_; }
   // 激活一个分组的计时器，返回引用可以支持链式调用
   ReTreansmitTimer& open();
   // 将超时重传时间变为两倍
@@ -33,9 +36,13 @@ private:
 class TCPSender
 {
 public:
-  /* Construct TCP sender with given default Retransmission Timeout and possible ISN */
-  TCPSender( ByteStream&& input, Wrap32 isn, uint64_t initial_RTO_ms )
-    : input_( std::move( input ) ), isn_( isn ), initial_RTO_ms_( initial_RTO_ms )
+  /* Construct TCP sender with given default Retransmission Timeout and possible ISN (and, optionally, the
+     largest super-segment to send; see TCPConfig::super_segment_size) */
+  TCPSender( ByteStream&& input, Wrap32 isn, uint64_t initial_RTO_ms, size_t super_segment_size = 0 )
+    : input_( std::move( input ) )
+    , isn_( isn )
+    , initial_RTO_ms_( initial_RTO_ms )
+    , super_segment_size_( super_segment_size )
   {}
 
   /* Generate an empty TCPSenderMessage */
@@ -56,6 +63,7 @@ public:
   // Accessors
   uint64_t sequence_numbers_in_flight() const;  // For testing: how many sequence numbers are outstanding?
   uint64_t consecutive_retransmissions() const; // For testing: how many consecutive retransmissions have happened?
+  std::optional<uint64_t> ms_until_retransmission() const; // How long until tick() would retransmit (if ever)?
   const Writer& writer() const { return input_.writer(); }
   const Reader& reader() const { return input_.reader(); }
   Writer& writer() { return input_.writer(); }
@@ -68,6 +76,7 @@ private:
   ByteStream input_;
   Wrap32 isn_;
   uint64_t initial_RTO_ms_;
+  size_t super_segment_size_; // 超级分段的最大负载，为0时不合并
 
   uint16_t window_size_ { 1 };
   bool zero_window_ {}; // 表示发送方拥塞窗口大小是不是为0，如果为0的话就不加倍超时重传时间
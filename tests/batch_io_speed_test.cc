@@ -0,0 +1,206 @@
+#include "buffer_pool.hh"
+#include "exception.hh"
+#include "io_uring.hh"
+#include "socket.hh"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t DATAGRAM_SIZE = 1400;
+constexpr size_t BATCH_SIZE = 32;
+
+enum class Mode : uint8_t
+{
+  Single,  //!< one system call per datagram
+  IoUring, //!< FileDescriptor::write_batch and read_batch
+  Mmsg,    //!< DatagramSocket::send_batch and recv_batch
+};
+
+string_view name( const Mode mode )
+{
+  switch ( mode ) {
+    case Mode::Single:
+      return "one syscall per datagram";
+    case Mode::IoUring:
+      return "batched (io_uring)";
+    case Mode::Mmsg:
+      return "batched (sendmmsg/recvmmsg)";
+  }
+  return {};
+}
+
+//! One end of an AF_UNIX datagram socketpair
+class LocalDatagramEnd : public DatagramSocket
+{
+public:
+  explicit LocalDatagramEnd( FileDescriptor&& fd ) : DatagramSocket( std::move( fd ), AF_UNIX, SOCK_DGRAM ) {}
+};
+
+//! Sends batches of datagrams over an AF_UNIX datagram socketpair and reads them back
+double speed_test( const Mode mode )
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  LocalDatagramEnd sender { FileDescriptor { fds[0] } };
+  LocalDatagramEnd receiver { FileDescriptor { fds[1] } };
+
+  const string payload( DATAGRAM_SIZE, 'x' );
+  vector<vector<Ref<string>>> outgoing( BATCH_SIZE );
+  for ( auto& datagram : outgoing ) {
+    datagram.push_back( Ref<string>::borrow( payload ) );
+  }
+  vector<vector<Ref<string>>> incoming;
+  DatagramSocket::Batch outgoing_batch { BATCH_SIZE };
+  DatagramSocket::Batch incoming_batch { BATCH_SIZE };
+
+  size_t datagrams = 0;
+  const auto start_time = steady_clock::now();
+  const auto stop_time = start_time + milliseconds { 250 };
+  auto now = start_time;
+  while ( now < stop_time ) {
+    for ( unsigned i = 0; i < 16; i++ ) {
+      switch ( mode ) {
+        case Mode::Single:
+          for ( const auto& datagram : outgoing ) {
+            sender.write( datagram );
+          }
+          break;
+        case Mode::IoUring:
+          sender.write_batch( outgoing );
+          break;
+        case Mode::Mmsg:
+          outgoing_batch.clear();
+          for ( const auto& datagram : outgoing ) {
+            outgoing_batch.push_back( datagram );
+          }
+          if ( sender.send_batch( outgoing_batch ) != BATCH_SIZE ) {
+            throw runtime_error( "sendmmsg sent a partial batch" );
+          }
+          break;
+      }
+
+      size_t received = 0;
+      while ( received < BATCH_SIZE ) {
+        if ( mode == Mode::Mmsg ) {
+          const size_t count = receiver.recv_batch( incoming_batch );
+          for ( size_t j = 0; j < count; j++ ) {
+            if ( incoming_batch.payload( j ).size() != DATAGRAM_SIZE ) {
+              throw runtime_error( "datagram was truncated" );
+            }
+          }
+          received += count;
+          continue;
+        }
+
+        incoming.resize( mode == Mode::IoUring ? BATCH_SIZE - received : 1 );
+        for ( auto& buffers : incoming ) {
+          buffers.clear();
+          buffers.push_back( BufferPool::take() );
+        }
+        if ( mode == Mode::IoUring ) {
+          received += receiver.read_batch( incoming );
+        } else {
+          receiver.read( incoming.front() );
+          ++received;
+        }
+        if ( incoming.empty() or incoming.front().front()->size() != DATAGRAM_SIZE ) {
+          throw runtime_error( "datagram was lost or truncated" );
+        }
+      }
+    }
+    datagrams += 16 * BATCH_SIZE;
+    now = steady_clock::now();
+  }
+
+  const double seconds = duration<double>( now - start_time ).count();
+  const double datagrams_per_second = static_cast<double>( datagrams ) / seconds;
+  cout << "AF_UNIX socketpair, " << name( mode ) << ": " << fixed
+       << setprecision( 0 ) << setw( 8 ) << datagrams_per_second << " datagrams/s.\n";
+
+  return datagrams_per_second;
+}
+
+//! Fills a non-blocking socketpair with write_batch, which should report the datagrams it wrote, not throw
+void full_socket_test()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  FileDescriptor sender { fds[0] };
+  FileDescriptor receiver { fds[1] };
+  sender.set_blocking( false );
+  receiver.set_blocking( false );
+
+  const string payload( DATAGRAM_SIZE, 'x' );
+  const vector<vector<Ref<string>>> outgoing( BATCH_SIZE, { Ref<string>::borrow( payload ) } );
+  size_t bytes_written = 0;
+  while ( true ) {
+    const size_t bytes = sender.write_batch( outgoing );
+    bytes_written += bytes;
+    if ( bytes < BATCH_SIZE * DATAGRAM_SIZE ) {
+      break;
+    }
+  }
+  if ( bytes_written % DATAGRAM_SIZE != 0 ) {
+    throw runtime_error( "write_batch on a full socket reported part of a datagram" );
+  }
+
+  size_t datagrams_read = 0;
+  string datagram;
+  while ( true ) {
+    receiver.read( datagram );
+    if ( datagram.empty() ) {
+      break;
+    }
+    if ( datagram.size() != DATAGRAM_SIZE ) {
+      throw runtime_error( "datagram was truncated" );
+    }
+    ++datagrams_read;
+  }
+  if ( datagrams_read * DATAGRAM_SIZE != bytes_written ) {
+    throw runtime_error( "write_batch on a full socket reported " + to_string( bytes_written / DATAGRAM_SIZE )
+                         + " datagrams written, but " + to_string( datagrams_read ) + " arrived" );
+  }
+}
+
+void program_body()
+{
+  if ( not IoUring::supported() ) {
+    cout << "io_uring is not available; batched I/O falls back to one system call per datagram.\n";
+  }
+
+  full_socket_test();
+
+  speed_test( Mode::Single );
+  for ( const Mode mode : { Mode::IoUring, Mode::Mmsg } ) {
+    if ( speed_test( mode ) < 10000 ) {
+      throw runtime_error( "batched I/O did not meet minimum speed of 10000 datagrams/s" );
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+#include "checksum.hh"
+#include "random.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// The original byte-at-a-time algorithm (with a 64-bit sum, so large inputs can't overflow it)
+class ReferenceChecksum
+{
+  uint64_t sum_;
+  bool parity_ {};
+
+public:
+  explicit ReferenceChecksum( const uint32_t sum ) : sum_( sum ) {}
+
+  void add( const string_view data )
+  {
+    for ( const uint8_t i : data ) {
+      uint16_t val = i;
+      if ( not parity_ ) {
+        val <<= 8;
+      }
+      sum_ += val;
+      parity_ = !parity_;
+    }
+  }
+
+  uint16_t value() const
+  {
+    uint64_t ret = sum_;
+    while ( ret > 0xffff ) {
+      ret = ( ret >> 16 ) + static_cast<uint16_t>( ret );
+    }
+    return ~ret;
+  }
+};
+
+const char* kernel_name( const InternetChecksum::Kernel kernel )
+{
+  switch ( kernel ) {
+    case InternetChecksum::Kernel::Scalar:
+      return "Scalar";
+    case InternetChecksum::Kernel::SSE2:
+      return "SSE2";
+    case InternetChecksum::Kernel::AVX2:
+      return "AVX2";
+  }
+  return "unknown";
+}
+
+// Checksums `buffers` (preceded by the pseudo-header sum `initial`) with the active kernel and the reference, and
+// again while copying them out
+void check( const uint32_t initial, const vector<string_view>& buffers )
+{
+  InternetChecksum fast { initial };
+  InternetChecksum copying { initial };
+  ReferenceChecksum reference { initial };
+  string copy;
+  string expected_copy;
+  fast.add( buffers );
+  for ( const auto buffer : buffers ) {
+    reference.add( buffer );
+    copying.add_and_append( buffer, copy );
+    expected_copy.append( buffer );
+  }
+
+  if ( fast.value() != reference.value() or copying.value() != reference.value() or copy != expected_copy ) {
+    ostringstream ss;
+    ss << "The " << kernel_name( InternetChecksum::kernel() ) << " checksum kernel computed " << fast.value()
+       << " (or " << copying.value() << " while copying" << ( copy == expected_copy ? "" : ", wrongly" )
+       << ") but the reference computed " << reference.value() << ", for an initial sum of " << initial
+       << " and buffers of lengths:";
+    for ( const auto buffer : buffers ) {
+      ss << " " << buffer.size();
+    }
+    throw runtime_error( ss.str() );
+  }
+}
+
+void fuzz( default_random_engine& rd )
+{
+  uniform_int_distribution<uint32_t> initial_sum { 0, UINT32_MAX };
+  uniform_int_distribution<size_t> buffer_count { 1, 8 };
+  uniform_int_distribution<size_t> short_length { 0, 300 };
+  uniform_int_distribution<size_t> misalignment { 0, 63 };
+  uniform_int_distribution<int> byte { 0, 255 };
+  bernoulli_distribution long_buffer { 0.02 };
+  bernoulli_distribution all_ones { 0.1 };
+
+  // each buffer is a substring at a random offset, so its start has any alignment
+  string storage;
+  for ( unsigned int i = 0; i < 4000; i++ ) {
+    const size_t count = buffer_count( rd );
+    vector<pair<size_t, size_t>> spans;
+    storage.clear();
+    for ( size_t j = 0; j < count; j++ ) {
+      const size_t length = long_buffer( rd ) ? short_length( rd ) * 200 : short_length( rd );
+      storage.append( misalignment( rd ), '\0' );
+      spans.emplace_back( storage.size(), length );
+      if ( all_ones( rd ) ) {
+        storage.append( length, '\xff' ); // (the largest words, to catch any overflowing lane)
+      } else {
+        for ( size_t k = 0; k < length; k++ ) {
+          storage.push_back( static_cast<char>( byte( rd ) ) );
+        }
+      }
+    }
+
+    vector<string_view> buffers;
+    for ( const auto& [offset, length] : spans ) {
+      buffers.emplace_back( string_view { storage }.substr( offset, length ) );
+    }
+    check( initial_sum( rd ), buffers );
+  }
+
+  // a buffer long enough for the vector kernels to fold their lanes part-way through
+  const string big( 3'000'001, '\xff' );
+  check( UINT32_MAX, { big } );
+  check( 0, { string_view { big }.substr( 1 ), string_view { big }.substr( 3 ) } );
+}
+
+int main()
+{
+  try {
+    auto rd = get_random_engine();
+    for ( const auto kernel :
+          { InternetChecksum::Kernel::Scalar, InternetChecksum::Kernel::SSE2, InternetChecksum::Kernel::AVX2 } ) {
+      if ( InternetChecksum::supported( kernel ) ) {
+        InternetChecksum::use_kernel( kernel );
+        fuzz( rd );
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
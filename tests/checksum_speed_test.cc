@@ -0,0 +1,126 @@
+#include "checksum.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+const char* kernel_name( const InternetChecksum::Kernel kernel )
+{
+  switch ( kernel ) {
+    case InternetChecksum::Kernel::Scalar:
+      return "scalar";
+    case InternetChecksum::Kernel::SSE2:
+      return "SSE2";
+    case InternetChecksum::Kernel::AVX2:
+      return "AVX2";
+  }
+  return "unknown";
+}
+
+//! Checksums a `size`-byte buffer (starting one byte past an aligned address) over and over; returns GB/s
+double speed_test( const size_t size )
+{
+  const string storage( size + 1, 'x' );
+  const string_view data = string_view { storage }.substr( 1 );
+  const size_t iterations = 2'000'000'000 / ( size + 64 );
+
+  uint16_t combined = 0;
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    InternetChecksum check { static_cast<uint32_t>( i ) };
+    check.add( data );
+    combined ^= check.value();
+  }
+  const double seconds = duration<double>( steady_clock::now() - start_time ).count();
+
+  if ( combined == 0x1234 ) {
+    cout << "(unlikely)\n"; // (uses the result, so the loop can't be optimized out)
+  }
+  return static_cast<double>( iterations * size ) / seconds / 1e9;
+}
+
+//! Copies a `size`-byte buffer into a fresh string and checksums it, in two passes or in one; returns GB/s
+double copy_speed_test( const size_t size, const bool fused )
+{
+  const string storage( size + 1, 'x' );
+  const string_view data = string_view { storage }.substr( 1 );
+  const size_t iterations = 1'000'000'000 / ( size + 64 );
+
+  uint16_t combined = 0;
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    InternetChecksum check { static_cast<uint32_t>( i ) };
+    string copy;
+    if ( fused ) {
+      check.add_and_append( data, copy );
+    } else {
+      copy.append( data );
+      check.add( string_view { copy } );
+    }
+    combined ^= check.value() ^ static_cast<uint16_t>( copy.back() );
+  }
+  const double seconds = duration<double>( steady_clock::now() - start_time ).count();
+
+  if ( combined == 0x1234 ) {
+    cout << "(unlikely)\n";
+  }
+  return static_cast<double>( iterations * size ) / seconds / 1e9;
+}
+
+void program_body()
+{
+  const auto best_kernel = InternetChecksum::kernel();
+  double best_rate = 0;
+
+  for ( const auto kernel :
+        { InternetChecksum::Kernel::Scalar, InternetChecksum::Kernel::SSE2, InternetChecksum::Kernel::AVX2 } ) {
+    if ( not InternetChecksum::supported( kernel ) ) {
+      continue;
+    }
+    InternetChecksum::use_kernel( kernel );
+    cout << setw( 7 ) << left << kernel_name( kernel ) << right << fixed << setprecision( 2 );
+    for ( const size_t size : { 20, 1500, 65536 } ) {
+      const double rate = speed_test( size );
+      cout << "  " << setw( 5 ) << size << " bytes: " << setw( 6 ) << rate << " GB/s";
+      if ( kernel == best_kernel and size == 1500 ) {
+        best_rate = rate;
+      }
+    }
+    cout << ( kernel == best_kernel ? "  (default)\n" : "\n" );
+  }
+  InternetChecksum::use_kernel( best_kernel );
+
+  for ( const size_t size : { 536, 1460 } ) {
+    const double separate = copy_speed_test( size, false );
+    const double fused = copy_speed_test( size, true );
+    cout << "copy + checksum, " << setw( 4 ) << size << " bytes: " << setw( 6 ) << separate
+         << " GB/s in two passes, " << setw( 6 ) << fused << " GB/s in one\n";
+  }
+
+  if ( best_rate < 1 ) {
+    throw runtime_error( "checksum did not meet minimum speed of 1 GB/s (1500-byte buffers)" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+#include "eventloop.hh"
+#include "exception.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+const char* backend_name( const EventLoop::Backend backend )
+{
+  switch ( backend ) {
+    case EventLoop::Backend::Poll:
+      return "poll";
+    case EventLoop::Backend::Epoll:
+      return "epoll";
+    case EventLoop::Backend::IoUring:
+      return "io_uring";
+  }
+  return "unknown";
+}
+
+void expect( const bool condition, const string& what )
+{
+  if ( not condition ) {
+    throw runtime_error( "EventLoop: " + what );
+  }
+}
+
+//! Call wait_next_event until `done` or the loop exits, failing if that takes longer than `limit`
+template<typename Predicate>
+EventLoop::Result run_until( EventLoop& loop, const Predicate& done, const milliseconds limit = seconds { 2 } )
+{
+  const auto give_up = EventLoop::Clock::now() + limit;
+  while ( not done() ) {
+    expect( EventLoop::Clock::now() < give_up, "gave up waiting" );
+    if ( loop.wait_next_event( 10 ) == EventLoop::Result::Exit ) {
+      return EventLoop::Result::Exit;
+    }
+  }
+  return EventLoop::Result::Success;
+}
+
+// Timers scheduled in any order fire in deadline order, none before its deadline
+void timer_order( const EventLoop::Backend backend, const EventLoop::Scheduling scheduling )
+{
+  EventLoop loop { backend };
+  loop.set_scheduling( scheduling );
+  const string what
+    = string { backend_name( backend ) } + ( scheduling == EventLoop::Scheduling::Fair ? " (fair)" : "" );
+
+  const auto start = EventLoop::Clock::now();
+  vector<size_t> fired;
+  for ( const size_t i : { 5, 1, 4, 0, 3, 2 } ) {
+    const auto deadline = start + milliseconds { 3 * i };
+    loop.add_timer( "timer " + to_string( i ), deadline, [&fired, i, deadline, &what] {
+      expect( EventLoop::Clock::now() >= deadline, what + ": timer fired early" );
+      fired.push_back( i );
+    } );
+  }
+
+  // (a timer keeps the loop from exiting until it has fired; one-shot timers that fired don't)
+  expect( run_until( loop, [] { return false; } ) == EventLoop::Result::Exit, what + ": loop did not exit" );
+  expect( fired == vector<size_t> { 0, 1, 2, 3, 4, 5 }, what + ": timers fired out of order" );
+}
+
+// Rescheduling moves a timer's only expiration; cancelling a timer stops it; periodic timers repeat
+void timer_changes( const EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  const string what = backend_name( backend );
+  const size_t category = loop.add_category( "timers" );
+  const auto start = EventLoop::Clock::now();
+
+  size_t moved_fired = 0;
+  EventLoop::Clock::time_point moved_deadline = start + milliseconds { 1 };
+  const auto moved = loop.add_timer( category, moved_deadline, [&] {
+    expect( EventLoop::Clock::now() >= moved_deadline, what + ": rescheduled timer fired at its old deadline" );
+    ++moved_fired;
+  } );
+  moved_deadline = start + milliseconds { 20 };
+  loop.reschedule_timer( moved, moved_deadline );
+
+  auto cancelled = loop.add_timer( category, start + milliseconds { 5 }, [&] {
+    throw runtime_error( "EventLoop: " + what + ": cancelled timer fired" );
+  } );
+  cancelled.cancel();
+
+  size_t ticks = 0;
+  auto periodic = loop.add_timer( category, start + milliseconds { 2 }, [&] { ++ticks; }, milliseconds { 2 } );
+
+  run_until( loop, [&] { return moved_fired > 0; } );
+  expect( ticks >= 5, what + ": periodic timer did not keep firing" );
+  periodic.cancel();
+  expect( loop.wait_next_event( -1 ) == EventLoop::Result::Exit, what + ": loop did not exit without timers" );
+  expect( moved_fired == 1, what + ": rescheduled timer fired more than once" );
+
+  // rescheduling a one-shot timer that has fired arms it again
+  moved_deadline = EventLoop::Clock::now() + milliseconds { 1 };
+  loop.reschedule_timer( moved, moved_deadline );
+  expect( run_until( loop, [] { return false; } ) == EventLoop::Result::Exit and moved_fired == 2,
+          what + ": fired timer not re-armed by reschedule_timer" );
+}
+
+// With fair scheduling, a category that always has work runs its budget's worth of callbacks per call to
+// wait_next_event, and the other categories, fds and timers still get their turn in the same call
+void busy_category( const EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_scheduling( EventLoop::Scheduling::Fair );
+  const string what = backend_name( backend );
+
+  const size_t busy = loop.add_category( "busy" );
+  loop.set_category_budget( busy, 4 );
+  size_t busy_done = 0;
+  loop.add_rule( busy, [&] { ++busy_done; }, [] { return true; } );
+
+  size_t other_left = 10;
+  loop.add_rule( "other", [&] { --other_left; }, [&] { return other_left > 0; } );
+
+  FileDescriptor event { CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+  size_t events = 0;
+  loop.add_rule( "eventfd", event, Direction::In, [&] {
+    string counter( sizeof( uint64_t ), 0 );
+    event.read( counter );
+    ++events;
+  } );
+  event.write( string { "\x01\0\0\0\0\0\0\0", sizeof( uint64_t ) } );
+
+  size_t timer_fired = 0;
+  loop.add_timer( "timer", EventLoop::Clock::now(), [&] { ++timer_fired; } );
+
+  expect( loop.wait_next_event( 0 ) == EventLoop::Result::Success, what + ": no rule executed" );
+  expect( busy_done == 4, what + ": busy category ran past its budget" );
+  expect( other_left == 0, what + ": busy category starved another" );
+  expect( events == 1, what + ": busy category starved an fd" );
+  expect( timer_fired == 1, what + ": busy category starved a timer" );
+
+  for ( unsigned i = 0; i < 2; i++ ) {
+    loop.wait_next_event( 0 );
+  }
+  const auto stats = loop.category_stats( busy );
+  expect( busy_done == 12 and stats.callbacks == 12 and stats.budget_exhausted == 3,
+          what + ": busy category's budget not enforced on every call" );
+}
+
+// Within one category, a rule that used up the budget goes behind the others, so it can't starve them
+void busy_rule()
+{
+  EventLoop loop;
+  loop.set_scheduling( EventLoop::Scheduling::Fair );
+  const size_t shared = loop.add_category( "shared" );
+  loop.set_category_budget( shared, 4 );
+
+  size_t busy_done = 0;
+  loop.add_rule( shared, [&] { ++busy_done; }, [] { return true; } );
+  size_t other_done = 0;
+  loop.add_rule( shared, [&] { ++other_done; }, [&] { return other_done < 10; } );
+
+  // the rules take turns using the whole budget
+  for ( unsigned i = 0; i < 2; i++ ) {
+    loop.wait_next_event( 0 );
+  }
+  expect( busy_done == 4 and other_done == 4, "busy rule kept the other rule in its category waiting" );
+  for ( unsigned i = 0; i < 4; i++ ) {
+    loop.wait_next_event( 0 );
+  }
+  expect( other_done == 10 and busy_done == 14, "rules in a category did not share its budget" );
+}
+
+// A profiling loop records each callback's duration in its category's histogram; other loops only count
+void profiling()
+{
+  for ( const bool profile : { false, true } ) {
+    EventLoop loop;
+    loop.set_profiling( profile );
+    size_t left = 20;
+    const size_t category = loop.add_category( "work" );
+    loop.add_rule(
+      category,
+      [&] {
+        const auto until = EventLoop::Clock::now() + microseconds { 50 };
+        while ( EventLoop::Clock::now() < until ) {}
+        --left;
+      },
+      [&] { return left > 0; } );
+    run_until( loop, [&] { return left == 0; } );
+
+    const auto stats = loop.category_stats( category );
+    expect( stats.callbacks == 20 and stats.time >= microseconds { 20 * 50 }, "callbacks not counted" );
+    if ( not profile ) {
+      expect( stats.latency.count() == 0 and stats.max_time == EventLoop::Clock::duration {},
+              "loop profiled with profiling off" );
+      continue;
+    }
+    expect( stats.latency.count() == 20 and stats.max_time >= microseconds { 50 }
+              and stats.latency.percentile( 0.5 ) >= 50'000,
+            "callback durations not recorded" );
+
+    ostringstream profile_text;
+    loop.print_profile( profile_text );
+    expect( profile_text.str().find( "work" ) != string::npos, "profile does not list the category" );
+    loop.set_profiling( false ); // (so its destructor doesn't print the profile)
+  }
+}
+
+void program_body()
+{
+  vector<EventLoop::Backend> backends { EventLoop::Backend::Poll, EventLoop::Backend::Epoll };
+  if ( IoUring::supported() ) {
+    backends.push_back( EventLoop::Backend::IoUring );
+  }
+
+  for ( const auto backend : backends ) {
+    timer_order( backend, EventLoop::Scheduling::OneRule );
+    timer_order( backend, EventLoop::Scheduling::Fair );
+    timer_changes( backend );
+    busy_category( backend );
+  }
+  busy_rule();
+  profiling();
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
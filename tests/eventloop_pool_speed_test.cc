@@ -0,0 +1,293 @@
+#include "eventloop.hh"
+#include "eventloop_pool.hh"
+#include "exception.hh"
+#include "helpers.hh"
+#include "lossy_fd_adapter.hh"
+#include "socket.hh"
+#include "tcp_minnow_socket_impl.hh"
+#include "tcp_over_ip.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t TOTAL_BYTES = 16 * 1024 * 1024; // spread over all the connections
+
+//! Carries IPv4 datagrams over one end of a connected UDP socket pair (or fails to, once told to)
+class UDPPairAdapter : public TCPOverIPv4Adapter
+{
+  UDPSocket _socket;
+  shared_ptr<atomic<bool>> _fail_writes;
+
+public:
+  explicit UDPPairAdapter( UDPSocket&& socket, shared_ptr<atomic<bool>> fail_writes = {} )
+    : _socket( move( socket ) ), _fail_writes( move( fail_writes ) )
+  {}
+
+  optional<TCPMessage> read()
+  {
+    vector<string> buffers( 1 );
+    _socket.read( buffers );
+    InternetDatagram datagram;
+    if ( not parse( datagram, move( buffers ) ) ) {
+      return {};
+    }
+    return unwrap_tcp_in_ip( move( datagram ) );
+  }
+
+  void write( const TCPMessage& msg )
+  {
+    if ( _fail_writes and _fail_writes->load() ) {
+      throw runtime_error( "UDPPairAdapter: write failed" );
+    }
+    _socket.write( serialize( wrap_tcp_in_ip( msg ) ) );
+  }
+  FileDescriptor& fd() { return _socket; }
+};
+
+using PairSocket = TCPMinnowSocket<LossyFdAdapter<UDPPairAdapter>>;
+
+//! Discards the sockets' DEBUG chatter
+class QuietStderr
+{
+  streambuf* _saved;
+
+public:
+  QuietStderr() : _saved( cerr.rdbuf( nullptr ) ) {}
+  ~QuietStderr()
+  {
+    cerr.rdbuf( _saved );
+    cerr.clear();
+  }
+  QuietStderr( const QuietStderr& other ) = delete;
+  QuietStderr& operator=( const QuietStderr& other ) = delete;
+  QuietStderr( QuietStderr&& other ) = delete;
+  QuietStderr& operator=( QuietStderr&& other ) = delete;
+};
+
+bool raise_fd_limit( const size_t fd_count )
+{
+  rlimit limit {};
+  CheckSystemCall( "getrlimit", getrlimit( RLIMIT_NOFILE, &limit ) );
+  const rlim_t wanted = fd_count + 64;
+  if ( limit.rlim_cur < wanted ) {
+    limit.rlim_cur = min( wanted, limit.rlim_max );
+    CheckSystemCall( "setrlimit", setrlimit( RLIMIT_NOFILE, &limit ) );
+  }
+  return limit.rlim_cur >= wanted;
+}
+
+uint64_t context_switches()
+{
+  rusage usage {};
+  CheckSystemCall( "getrusage", getrusage( RUSAGE_SELF, &usage ) );
+  return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+//! Sends TOTAL_BYTES / `connection_count` bytes over each of `connection_count` connections (each between two
+//! TCPMinnowSockets), all driven by one owner thread, and reports the aggregate throughput and the
+//! process's context switches. The TCPPeers run on a thread each, or on `pool`.
+//! Connects a client socket to a server socket (the `index`th pair, for its port), each on a thread of its own
+//! or on `pool`; the client's adapter throws on write once `client_fails` is set
+pair<unique_ptr<PairSocket>, unique_ptr<PairSocket>> connect_pair( const size_t index,
+                                                                   EventLoopPool* pool,
+                                                                   const shared_ptr<atomic<bool>>& client_fails
+                                                                   = {} )
+{
+  UDPSocket client_side;
+  UDPSocket server_side;
+  client_side.bind( Address { "127.0.0.1", 0 } );
+  server_side.bind( Address { "127.0.0.1", 0 } );
+  client_side.connect( server_side.local_address() );
+  server_side.connect( client_side.local_address() );
+
+  auto make = [&]( UDPSocket&& socket, const shared_ptr<atomic<bool>>& fail_writes ) {
+    LossyFdAdapter<UDPPairAdapter> adapter { UDPPairAdapter { move( socket ), fail_writes } };
+    return pool ? make_unique<PairSocket>( move( adapter ), *pool ) : make_unique<PairSocket>( move( adapter ) );
+  };
+  auto client = make( move( client_side ), client_fails );
+  auto server = make( move( server_side ), {} );
+
+  FdAdapterConfig client_config;
+  FdAdapterConfig server_config;
+  client_config.source = Address { "10.0.0.1", static_cast<uint16_t>( 1024 + index ) };
+  client_config.destination = Address { "10.0.0.2", 80 };
+  server_config.source = client_config.destination;
+
+  TCPConfig tcp_config;
+  tcp_config.rt_timeout = 100; // (so that the closing peers don't linger for long)
+  thread server_thread( [&] { server->listen_and_accept( tcp_config, server_config ); } );
+  client->connect( tcp_config, client_config );
+  server_thread.join();
+  return { move( client ), move( server ) };
+}
+
+double speed_test( const size_t connection_count, EventLoopPool* pool )
+{
+  vector<unique_ptr<PairSocket>> clients;
+  vector<unique_ptr<PairSocket>> servers;
+  for ( size_t i = 0; i < connection_count; i++ ) {
+    auto [client, server] = connect_pair( i, pool );
+    clients.push_back( move( client ) );
+    servers.push_back( move( server ) );
+  }
+
+  // one owner thread writes every client's bytes and reads every server's
+  const size_t bytes_per_connection = TOTAL_BYTES / connection_count;
+  const string data( bytes_per_connection, 'x' );
+  vector<size_t> sent( connection_count );
+  size_t open_streams = 2 * connection_count;
+  EventLoop owner { EventLoop::Backend::Epoll };
+  const size_t write_category = owner.add_category( "write to client" );
+  const size_t server_category = owner.add_category( "read from server" );
+  const size_t client_category = owner.add_category( "read from client" );
+  for ( size_t i = 0; i < connection_count; i++ ) {
+    PairSocket& client = *clients[i];
+    PairSocket& server = *servers[i];
+    owner.add_rule(
+      write_category,
+      client,
+      Direction::Out,
+      [&, i] {
+        sent[i] += client.write( string_view { data }.substr( sent[i] ) );
+        if ( sent[i] == data.size() ) {
+          client.shutdown( SHUT_WR );
+        }
+      },
+      [&, i] { return sent[i] < data.size(); } );
+    owner.add_rule(
+      server_category,
+      server,
+      Direction::In,
+      [&] {
+        string buffer;
+        server.read( buffer );
+        if ( server.eof() ) {
+          server.shutdown( SHUT_WR );
+          --open_streams;
+        }
+      },
+      [&] { return not server.eof(); } );
+    owner.add_rule(
+      client_category,
+      client,
+      Direction::In,
+      [&] {
+        string buffer;
+        client.read( buffer );
+        if ( client.eof() ) {
+          --open_streams;
+        }
+      },
+      [&] { return not client.eof(); } );
+  }
+
+  const uint64_t switches_before = context_switches();
+  const auto start_time = steady_clock::now();
+  while ( open_streams > 0 ) {
+    if ( owner.wait_next_event( 1000 ) == EventLoop::Result::Timeout ) {
+      throw runtime_error( "transfer stalled with " + to_string( open_streams ) + " streams open" );
+    }
+  }
+  const auto elapsed = steady_clock::now() - start_time;
+  const uint64_t switches = context_switches() - switches_before;
+
+  for ( size_t i = 0; i < connection_count; i++ ) {
+    clients[i]->wait_until_closed();
+    servers[i]->wait_until_closed();
+  }
+
+  const double megabytes_per_second
+    = static_cast<double>( bytes_per_connection * connection_count ) / 1e6 / duration<double>( elapsed ).count();
+  cout << setw( 5 ) << connection_count << " connections, "
+       << ( pool ? "pool of " + to_string( pool->size() ) + " thread(s) " : "thread per TCPPeer  " ) << ": "
+       << fixed << setprecision( 1 ) << setw( 6 ) << megabytes_per_second << " MB/s, " << setw( 7 ) << switches
+       << " context switches.\n";
+
+  return megabytes_per_second;
+}
+
+//! Reads from `socket` until `until` says to stop, or throws after a few seconds
+void read_until( PairSocket& socket, string& received, const function<bool()>& until )
+{
+  const auto deadline = steady_clock::now() + seconds( 5 );
+  while ( not until() ) {
+    if ( steady_clock::now() > deadline ) {
+      throw runtime_error( "connection stalled after another connection on its shard failed" );
+    }
+    string buffer;
+    socket.read( buffer );
+    received += buffer;
+    this_thread::sleep_for( milliseconds( 1 ) );
+  }
+}
+
+//! A connection whose adapter throws on the pool fails alone: the other connections on its shard carry on, and
+//! every socket can still be destroyed
+void failure_test()
+{
+  EventLoopPool pool { 1 };
+  const auto fails = make_shared<atomic<bool>>( false );
+  auto [failing_client, failing_server] = connect_pair( 0, &pool, fails );
+  auto [client, server] = connect_pair( 1, &pool );
+
+  fails->store( true );
+  failing_client->write( "doomed" );
+  string discarded;
+  read_until( *failing_client, discarded, [&] { return failing_client->eof(); } );
+
+  client->write( "still here" );
+  string received;
+  read_until( *server, received, [&] { return received == "still here"; } );
+}
+
+void program_body()
+{
+  const QuietStderr quiet;
+  failure_test();
+
+  EventLoopPool pool;
+  for ( const size_t connection_count : { 1, 100, 1000 } ) {
+    if ( not raise_fd_limit( 8 * connection_count ) ) {
+      cout << "Skipping " << connection_count << " connections: RLIMIT_NOFILE is too low.\n";
+      continue;
+    }
+
+    speed_test( connection_count, nullptr );
+    const double pool_speed = speed_test( connection_count, &pool );
+    if ( pool_speed < 1.0 ) {
+      throw runtime_error( "EventLoopPool did not meet minimum speed of 1 MB/s" );
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,305 @@
+#include "eventloop.hh"
+#include "exception.hh"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <pthread.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+//! Try to make room for `fd_count` eventfds (plus a few others); returns false if the limit is too low
+bool raise_fd_limit( const size_t fd_count )
+{
+  rlimit limit {};
+  CheckSystemCall( "getrlimit", getrlimit( RLIMIT_NOFILE, &limit ) );
+  const rlim_t wanted = fd_count + 64;
+  if ( limit.rlim_cur >= wanted ) {
+    return true;
+  }
+  limit.rlim_cur = min( wanted, limit.rlim_max );
+  CheckSystemCall( "setrlimit", setrlimit( RLIMIT_NOFILE, &limit ) );
+  return limit.rlim_cur >= wanted;
+}
+
+const char* backend_name( const EventLoop::Backend backend )
+{
+  switch ( backend ) {
+    case EventLoop::Backend::Poll:
+      return "poll";
+    case EventLoop::Backend::Epoll:
+      return "epoll";
+    case EventLoop::Backend::IoUring:
+      return "io_uring";
+  }
+  return "unknown";
+}
+
+//! Registers `fd_count` eventfds, then repeatedly signals one of them and waits for the EventLoop to service it
+double speed_test( const EventLoop::Backend backend, const size_t fd_count, const size_t random_seed )
+{
+  vector<FileDescriptor> fds;
+  fds.reserve( fd_count );
+  for ( size_t i = 0; i < fd_count; i++ ) {
+    fds.emplace_back( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) );
+  }
+
+  EventLoop loop { backend };
+  const size_t category = loop.add_category( "eventfd" );
+  size_t serviced = 0;
+  for ( auto& fd : fds ) {
+    loop.add_rule( category, fd, Direction::In, [&] {
+      string counter( sizeof( uint64_t ), 0 );
+      fd.read( counter );
+      ++serviced;
+    } );
+  }
+
+  default_random_engine rd { random_seed };
+  uniform_int_distribution<size_t> pick { 0, fd_count - 1 };
+  const string one { "\x01\0\0\0\0\0\0\0", sizeof( uint64_t ) };
+
+  // warm up (the epoll and io_uring backends arm every rule on their first wait)
+  fds.at( pick( rd ) ).write( one );
+  loop.wait_next_event( -1 );
+
+  size_t wakeups = 0;
+  const auto start_time = steady_clock::now();
+  const auto stop_time = start_time + milliseconds { 250 };
+  auto now = start_time;
+  while ( now < stop_time ) {
+    for ( unsigned i = 0; i < 64; i++ ) {
+      fds.at( pick( rd ) ).write( one );
+      if ( loop.wait_next_event( -1 ) != EventLoop::Result::Success ) {
+        throw runtime_error( "EventLoop did not service the signaled eventfd" );
+      }
+    }
+    wakeups += 64;
+    now = steady_clock::now();
+  }
+
+  if ( serviced != wakeups + 1 ) {
+    throw runtime_error( "EventLoop serviced " + to_string( serviced ) + " rules for " + to_string( wakeups + 1 )
+                         + " signals" );
+  }
+
+  const double wakeups_per_second = static_cast<double>( wakeups ) / duration<double>( now - start_time ).count();
+  cout << "EventLoop (" << setw( 8 ) << backend_name( backend ) << ") with " << setw( 5 ) << fd_count
+       << " fds: " << fixed << setprecision( 0 ) << setw( 8 ) << wakeups_per_second << " wakeups/s.\n";
+
+  return wakeups_per_second;
+}
+
+//! Repeatedly reschedules a one-shot timer on an otherwise idle EventLoop and measures how late it fires
+void timer_test( const EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  const auto delay = milliseconds { 2 };
+  auto deadline = EventLoop::Clock::now() + delay;
+  size_t fired = 0;
+  duration<double, micro> total_lateness {};
+  optional<EventLoop::TimerHandle> timer;
+  timer = loop.add_timer( "one-shot", deadline, [&] {
+    const auto now = EventLoop::Clock::now();
+    if ( now < deadline ) {
+      throw runtime_error( "timer fired early" );
+    }
+    total_lateness += now - deadline;
+    ++fired;
+    deadline = now + delay;
+    loop.reschedule_timer( *timer, deadline );
+  } );
+
+  size_t wakeups = 0;
+  while ( fired < 50 ) {
+    if ( loop.wait_next_event( -1 ) == EventLoop::Result::Exit ) {
+      throw runtime_error( "EventLoop exited with a timer still armed" );
+    }
+    ++wakeups;
+  }
+  timer->cancel();
+  if ( loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {
+    throw runtime_error( "EventLoop did not exit after its only timer was cancelled" );
+  }
+
+  cout << "EventLoop (" << backend_name( backend ) << ") " << fired
+       << " timer expirations in " << wakeups << " wakeups, mean lateness " << fixed << setprecision( 0 )
+       << total_lateness.count() / static_cast<double>( fired ) << " us.\n";
+}
+
+//! A non-blocking timerfd that expires every `period`, starting one period from now
+FileDescriptor make_timerfd( const nanoseconds period, steady_clock::time_point& start_time )
+{
+  FileDescriptor fd { CheckSystemCall( "timerfd_create", timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK ) ) };
+  start_time = steady_clock::now() + period;
+  const auto first = start_time.time_since_epoch();
+  const itimerspec schedule { { 0, period.count() },
+                              { duration_cast<seconds>( first ).count(), ( first % seconds { 1 } ).count() } };
+  CheckSystemCall( "timerfd_settime", timerfd_settime( fd.fd_num(), TFD_TIMER_ABSTIME, &schedule, nullptr ) );
+  return fd;
+}
+
+//! Reads a timerfd's expiration count
+uint64_t read_expirations( FileDescriptor& fd )
+{
+  string counter( sizeof( uint64_t ), 0 );
+  fd.read( counter );
+  uint64_t count {};
+  memcpy( &count, counter.data(), sizeof( count ) );
+  return count;
+}
+
+//! Measures how long a timerfd (expiring every 1 ms) waits to be serviced while a non-fd rule works through
+//! a backlog: a second timerfd tops the backlog up to 100 work items of ~10 us each every 1.7 ms
+double fairness_test( const EventLoop::Scheduling scheduling )
+{
+  EventLoop loop;
+  loop.set_scheduling( scheduling );
+
+  const auto period = microseconds { 1000 };
+  steady_clock::time_point start_time;
+  FileDescriptor ticker = make_timerfd( period, start_time );
+  uint64_t expirations = 0;
+  size_t ticks = 0;
+  duration<double, micro> total_latency {};
+  duration<double, micro> max_latency {};
+  loop.add_rule( "ticker", ticker, Direction::In, [&] {
+    expirations += read_expirations( ticker );
+    const duration<double, micro> latency = steady_clock::now() - ( start_time + period * ( expirations - 1 ) );
+    total_latency += latency;
+    max_latency = max( max_latency, latency );
+    ++ticks;
+  } );
+
+  steady_clock::time_point unused;
+  FileDescriptor producer = make_timerfd( microseconds { 1700 }, unused );
+  size_t backlog = 0;
+  loop.add_rule( "producer", producer, Direction::In, [&] {
+    read_expirations( producer );
+    backlog = 100; // (the one-rule loop refuses to run one rule more than 128 times in a row)
+  } );
+
+  const size_t work = loop.add_category( "work" );
+  loop.add_rule(
+    work,
+    [&] {
+      const auto until = steady_clock::now() + microseconds { 10 };
+      while ( steady_clock::now() < until ) {}
+      --backlog;
+    },
+    [&] { return backlog > 0; } );
+
+  const auto stop_time = steady_clock::now() + milliseconds { 250 };
+  while ( steady_clock::now() < stop_time ) {
+    loop.wait_next_event( 10 );
+  }
+
+  const auto stats = loop.category_stats( work );
+  if ( ticks == 0 or stats.callbacks == 0 ) {
+    throw runtime_error( "EventLoop serviced " + to_string( ticks ) + " timerfd ticks and "
+                         + to_string( stats.callbacks ) + " work callbacks" );
+  }
+  if ( scheduling == EventLoop::Scheduling::Fair and stats.budget_exhausted == 0 ) {
+    throw runtime_error( "fair EventLoop never held the work category to its budget" );
+  }
+  const double mean_latency = total_latency.count() / static_cast<double>( max( ticks, size_t { 1 } ) );
+  cout << "EventLoop (" << ( scheduling == EventLoop::Scheduling::Fair ? "fair" : "one rule" ) << ") fd latency "
+       << "under non-fd load: mean " << fixed << setprecision( 0 ) << setw( 4 ) << mean_latency << " us, max "
+       << setw( 4 ) << max_latency.count() << " us (" << stats.callbacks << " work callbacks in "
+       << duration_cast<milliseconds>( stats.time ).count() << " ms, budget exhausted " << stats.budget_exhausted
+       << " times).\n";
+
+  return mean_latency;
+}
+
+//! Checks that the profile-dump signal wakes an EventLoop that is waiting forever on an idle fd
+void signal_test( const EventLoop::Backend backend )
+{
+  FileDescriptor idle { CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+  EventLoop loop { backend };
+  loop.add_rule( "idle", idle, Direction::In, [] { throw runtime_error( "idle eventfd became readable" ); } );
+
+  // (keeps signalling, in case one lands before the loop starts waiting)
+  atomic<bool> woken {};
+  const pthread_t waiter = pthread_self();
+  const jthread signaller { [&woken, waiter] {
+    while ( not woken ) {
+      this_thread::sleep_for( milliseconds { 50 } );
+      pthread_kill( waiter, SIGUSR1 );
+    }
+  } };
+  const auto result = loop.wait_next_event( -1 );
+  woken = true;
+  if ( result != EventLoop::Result::Timeout ) {
+    throw runtime_error( "EventLoop woken by a signal did not report a timeout" );
+  }
+}
+
+void program_body()
+{
+  const double one_rule_latency = fairness_test( EventLoop::Scheduling::OneRule );
+  const double fair_latency = fairness_test( EventLoop::Scheduling::Fair );
+  if ( fair_latency >= one_rule_latency ) {
+    throw runtime_error( "fair scheduling did not service the fd sooner than running one rule at a time" );
+  }
+
+  timer_test( EventLoop::Backend::Poll );
+  timer_test( EventLoop::Backend::Epoll );
+  if ( IoUring::supported() ) {
+    timer_test( EventLoop::Backend::IoUring );
+  }
+
+  for ( const size_t fd_count : { 10, 1000, 10000 } ) {
+    if ( not raise_fd_limit( fd_count ) ) {
+      cout << "Skipping " << fd_count << " fds: RLIMIT_NOFILE is too low.\n";
+      continue;
+    }
+
+    speed_test( EventLoop::Backend::Poll, fd_count, 1234 );
+    if ( IoUring::supported() ) {
+      speed_test( EventLoop::Backend::IoUring, fd_count, 1234 );
+    }
+    const double epoll_speed = speed_test( EventLoop::Backend::Epoll, fd_count, 1234 );
+    if ( epoll_speed < 10000 ) {
+      throw runtime_error( "epoll EventLoop did not meet minimum speed of 10000 wakeups/s" );
+    }
+  }
+
+  // last, since every EventLoop made after enable_profiling prints its profile when destroyed
+  EventLoop::enable_profiling( SIGUSR1 );
+  signal_test( EventLoop::Backend::Poll );
+  signal_test( EventLoop::Backend::Epoll );
+  if ( IoUring::supported() ) {
+    signal_test( EventLoop::Backend::IoUring );
+  }
+  cout << "EventLoop woken by the profile-dump signal on every backend.\n";
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+#include "address.hh"
+#include "exception.hh"
+#include "packet_ring.hh"
+#include "packet_ring_adapter.hh"
+#include "tcp_config.hh"
+#include "tcp_minnow_socket.hh"
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <net/if.h>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t TRANSFER_SIZE = 4'000'000;
+
+//! Lets the test look at the ring under the socket (once the TCPPeer's thread is done with it)
+class RingSocket : public TCPOverEthernetMinnowSocket
+{
+public:
+  using TCPOverEthernetMinnowSocket::TCPOverEthernetMinnowSocket;
+  const PacketRing& ring() const { return _datagram_adapter.ring(); }
+};
+
+char byte_at( const size_t i )
+{
+  return static_cast<char>( i % 251 );
+}
+
+//! Connects a TCPMinnowSocket on `client_device` to one listening on `server_device` (the two ends of a veth
+//! pair), both running TCP over a PacketRing, and sends TRANSFER_SIZE bytes across; the client's transmit ring
+//! has the room set in `client_options`. Returns the number of frames the client had to hold back.
+uint64_t transfer( const string& client_device,
+                   const string& server_device,
+                   const PacketRingOptions& client_options,
+                   const string_view description )
+{
+  const Address client_ip { "10.144.0.9" };
+  const Address server_ip { "10.144.0.1" };
+
+  // (the server's ring is set up first, so it has the client's first frames waiting when it starts listening)
+  RingSocket server { TCPOverIPv4OverPacketRingAdapter(
+    server_device, { 0x02, 0, 0, 0, 0x01, 0x44 }, server_ip, client_ip ) };
+  RingSocket client { TCPOverIPv4OverPacketRingAdapter(
+    client_device, { 0x02, 0, 0, 0, 0x01, 0x45 }, client_ip, server_ip, client_options ) };
+
+  TCPConfig tcp_config;
+  tcp_config.rt_timeout = 100; // (so the side that closes first lingers for only a second)
+
+  size_t bytes_received = 0;
+  steady_clock::time_point end_time;
+  thread server_thread( [&] {
+    FdAdapterConfig listen_config;
+    listen_config.source = Address { server_ip.ip(), 9090 };
+    server.listen_and_accept( tcp_config, listen_config );
+
+    string buffer;
+    while ( not server.eof() ) {
+      server.read( buffer );
+      for ( const char c : buffer ) {
+        if ( c != byte_at( bytes_received++ ) ) {
+          throw runtime_error( "data was corrupted" );
+        }
+      }
+    }
+    end_time = steady_clock::now();
+    server.wait_until_closed();
+  } );
+
+  FdAdapterConfig connect_config;
+  connect_config.source = Address { client_ip.ip(), 41000 };
+  connect_config.destination = Address { server_ip.ip(), 9090 };
+  const auto start_time = steady_clock::now();
+  client.connect( tcp_config, connect_config );
+
+  string data( TRANSFER_SIZE, 0 );
+  for ( size_t i = 0; i < data.size(); i++ ) {
+    data[i] = byte_at( i );
+  }
+  string_view remaining = data;
+  while ( not remaining.empty() ) {
+    remaining.remove_prefix( client.write( remaining ) );
+  }
+  client.shutdown( SHUT_WR );
+
+  server_thread.join();
+  client.wait_until_closed();
+  if ( bytes_received != TRANSFER_SIZE ) {
+    throw runtime_error( "received " + to_string( bytes_received ) + " of " + to_string( TRANSFER_SIZE )
+                         + " bytes" );
+  }
+
+  const double seconds = duration<double>( end_time - start_time ).count();
+  const auto& stats = client.ring().stats();
+  cout << setw( 32 ) << left << description << right << fixed << setprecision( 2 )
+       << static_cast<double>( TRANSFER_SIZE ) / 1e6 / seconds << " MB/s (" << stats.frames_sent
+       << " frames in " << stats.flushes << " flushes, " << stats.frames_delayed << " held back).\n";
+  return stats.frames_delayed;
+}
+
+void program_body( const string& client_device, const string& server_device )
+{
+  if ( ::if_nametoindex( client_device.c_str() ) == 0 or ::if_nametoindex( server_device.c_str() ) == 0 ) {
+    cout << "Skipping: no " << client_device << "/" << server_device << " veth pair (make one with `ip link add "
+         << client_device << " type veth peer name " << server_device << "`, and set both up).\n";
+    return;
+  }
+  try {
+    const PacketRing probe { client_device };
+  } catch ( const unix_error& e ) {
+    if ( e.code().value() != EPERM ) {
+      throw;
+    }
+    cout << "Skipping: packet sockets need CAP_NET_RAW.\n";
+    return;
+  }
+
+  transfer( client_device, server_device, {}, "default rings:" );
+
+  PacketRingOptions small;
+  small.block_size = 4096;
+  small.tx_blocks = 1; // (two frames)
+  if ( transfer( client_device, server_device, small, "two-frame transmit ring:" ) == 0 ) {
+    throw runtime_error( "a full transmit ring never held back a frame" );
+  }
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+    const auto args = span( argv, argc );
+    program_body( argc > 2 ? args[1] : "veth144", argc > 2 ? args[2] : "veth145" );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
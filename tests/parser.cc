@@ -0,0 +1,149 @@
+#include "buffer_pool.hh"
+#include "helpers.hh"
+#include "ipv4_datagram.hh"
+#include "parser.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+void expect( const bool condition, const string& what )
+{
+  if ( not condition ) {
+    throw runtime_error( "Parser: " + what );
+  }
+}
+
+//! `wire` cut into buffers of `split` bytes, with an empty buffer after each (which the Parser must skip)
+vector<string> split_into( const string_view wire, const size_t split )
+{
+  vector<string> buffers;
+  for ( size_t offset = 0; offset < wire.size(); offset += split ) {
+    buffers.emplace_back( wire.substr( offset, split ) );
+    buffers.emplace_back();
+  }
+  return buffers;
+}
+
+//! The same, in pooled buffers
+vector<Ref<string>> pooled( const string_view wire, const size_t split )
+{
+  vector<Ref<string>> buffers;
+  for ( string& piece : split_into( wire, split ) ) {
+    buffers.push_back( BufferPool::take() );
+    buffers.back()->assign( piece );
+  }
+  return buffers;
+}
+
+// Integers come out the same whether they lie in one buffer or straddle several; reading past the end is an error
+void integers()
+{
+  const string wire { "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f", 15 };
+  for ( size_t split = 1; split <= wire.size(); split++ ) {
+    const string what = "split every " + to_string( split ) + " bytes";
+    Parser p { split_into( wire, split ) };
+    expect( p.bytes_remaining() == wire.size(), what + ": wrong size" );
+
+    uint8_t a {};
+    uint16_t b {};
+    uint32_t c {};
+    uint64_t d {};
+    p.integer( a );
+    p.integer( b );
+    p.integer( c );
+    p.integer( d );
+    expect( not p.has_error() and p.bytes_remaining() == 0, what + ": integers not all read" );
+    expect( a == 0x01 and b == 0x0203 and c == 0x04050607 and d == 0x08090a0b0c0d0e0f,
+            what + ": wrong integer value" );
+
+    p.integer( a );
+    expect( p.has_error(), what + ": read past the end" );
+  }
+}
+
+// Truncating keeps that many bytes counting from the parser's position, wherever the position and the buffer
+// boundaries fall
+void truncation()
+{
+  string wire;
+  for ( size_t i = 0; i < 40; i++ ) {
+    wire.push_back( static_cast<char>( 'a' + i % 26 ) );
+  }
+
+  for ( size_t split = 1; split <= wire.size(); split++ ) {
+    for ( size_t consumed = 0; consumed <= wire.size(); consumed++ ) {
+      const size_t left = wire.size() - consumed;
+      for ( const size_t keep : { size_t { 0 }, size_t { 1 }, size_t { 7 }, left - 1, left, left + 5 } ) {
+        if ( keep > left + 5 ) {
+          continue; // (left - 1 with nothing left)
+        }
+        const string what = "split every " + to_string( split ) + " bytes, " + to_string( consumed )
+                            + " consumed, truncated to " + to_string( keep );
+        const string expected = wire.substr( consumed, keep );
+
+        Parser p { pooled( wire, split ) };
+        p.remove_prefix( consumed );
+        p.truncate( keep );
+        expect( p.bytes_remaining() == expected.size(), what + ": wrong size" );
+        expect( concat( p.buffer() ) == expected, what + ": wrong bytes kept" );
+
+        string rest;
+        p.concatenate_all_remaining( rest );
+        expect( rest == expected and p.bytes_remaining() == 0, what + ": wrong bytes taken" );
+      }
+    }
+  }
+}
+
+// A datagram followed by padding (as in a minimum-size Ethernet frame) parses to exactly its own payload,
+// however it is split; a datagram cut short of its total length doesn't parse
+void padded_datagram()
+{
+  const string payload = "payload split across buffers";
+  InternetDatagram dgram;
+  dgram.header.src = 0x0a000001;
+  dgram.header.dst = 0x0a000002;
+  dgram.header.len = IPv4Header::LENGTH + payload.size();
+  dgram.header.compute_checksum();
+  dgram.payload.emplace_back( string { payload } );
+  const string wire = concat( serialize( dgram ) );
+  const string padded = wire + string( 18, '\0' );
+
+  for ( size_t split = 1; split <= padded.size(); split++ ) {
+    const string what = "split every " + to_string( split ) + " bytes";
+
+    InternetDatagram parsed;
+    expect( parse( parsed, pooled( padded, split ) ), what + ": padded datagram did not parse" );
+    expect( concat( parsed.payload ) == payload, what + ": padding kept, or payload cut short" );
+
+    InternetDatagram short_dgram;
+    expect( not parse( short_dgram, pooled( string_view { wire }.substr( 0, wire.size() - 1 ), split ) ),
+            what + ": datagram shorter than its header says parsed" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    integers();
+    truncation();
+    padded_datagram();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+#include "buffer_pool.hh"
+#include "helpers.hh"
+#include "ipv4_datagram.hh"
+#include "tcp_segment.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+//! The wire form of an IPv4 datagram carrying a TCP segment with `payload_size` bytes of payload
+string make_datagram( const size_t payload_size )
+{
+  TCPSegment seg;
+  seg.udinfo = { .src_port = 1234, .dst_port = 80, .cksum = 0 };
+  seg.message.sender->seqno = Wrap32 { 0x12345678 };
+  seg.message.sender->payload = string( payload_size, 'x' );
+  seg.message.receiver->ackno = Wrap32 { 0x9abcdef0 };
+  seg.message.receiver->window_size = 65535;
+
+  InternetDatagram dgram;
+  dgram.header.src = 0x0a000001;
+  dgram.header.dst = 0x0a000002;
+  dgram.header.proto = IPv4Header::PROTO_TCP;
+  dgram.header.len = IPv4Header::LENGTH + TCPSegment::HEADER_LENGTH + payload_size;
+  seg.compute_checksum( dgram.header.pseudo_checksum() );
+  dgram.payload = serialize( seg );
+  dgram.header.compute_checksum();
+
+  return concat( serialize( dgram ) );
+}
+
+//! Copies `wire` into pooled buffers (so the copies don't allocate): one buffer, or split every `split` bytes
+vector<Ref<string>> buffers_for( const string_view wire, const size_t split )
+{
+  vector<Ref<string>> buffers;
+  for ( size_t offset = 0; offset < wire.size(); offset += split ) {
+    buffers.push_back( BufferPool::take() );
+    buffers.back()->assign( wire.substr( offset, split ) );
+  }
+  return buffers;
+}
+
+//! Parses the datagram's IPv4 header, then its TCP segment, over and over
+void speed_test( const size_t payload_size, const size_t split, const string_view description )
+{
+  const string wire = make_datagram( payload_size );
+  constexpr size_t iterations = 500'000;
+
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    InternetDatagram dgram;
+    if ( not parse( dgram, buffers_for( wire, split ) ) ) {
+      throw runtime_error( "IPv4 header did not parse" );
+    }
+    TCPSegment seg;
+    if ( not parse( seg, move( dgram.payload ), dgram.header.pseudo_checksum() )
+         or seg.message.sender->payload.size() != payload_size or seg.udinfo.dst_port != 80 ) {
+      throw runtime_error( "TCP segment did not parse" );
+    }
+  }
+  const double seconds = duration<double>( steady_clock::now() - start_time ).count();
+
+  const double rate = static_cast<double>( iterations ) / seconds;
+  cout << setw( 44 ) << left << description << right << fixed << setprecision( 2 ) << rate / 1e6
+       << " M datagrams/s.\n";
+
+  if ( rate < 100'000 ) {
+    throw runtime_error( "parsing did not meet minimum speed of 0.1 M datagrams/s" );
+  }
+}
+
+void program_body()
+{
+  speed_test( 0, SIZE_MAX, "IPv4 + TCP headers, contiguous:" );
+  speed_test( 0, 7, "IPv4 + TCP headers, split every 7 bytes:" );
+  speed_test( 1400, SIZE_MAX, "IPv4 + TCP + 1400 bytes, contiguous:" );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+#include "random.hh"
+#include "tcp_receive_coalescer.hh"
+#include "tcp_receiver.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+TCPMessage data_segment( const Wrap32 seqno,
+                         string payload,
+                         const optional<Wrap32> ackno,
+                         const uint16_t window = 1000 )
+{
+  TCPMessage msg;
+  msg.sender = TCPSenderMessage { .seqno = seqno, .payload = move( payload ) };
+  msg.receiver = TCPReceiverMessage { .ackno = ackno, .window_size = window };
+  return msg;
+}
+
+void expect( const bool condition, const string& what )
+{
+  if ( not condition ) {
+    throw runtime_error( "receive coalescing: " + what );
+  }
+}
+
+// Segments that don't continue the held one are handed on as they were
+void merge_rules()
+{
+  const Wrap32 isn { 1000 };
+  const Wrap32 ackno { 77 };
+  TCPReceiveCoalescer coalescer { 3000 };
+
+  TCPMessage syn = data_segment( isn, "", ackno );
+  syn.sender->SYN = true;
+  expect( not coalescer.push( move( syn ) ).has_value(), "nothing to hand on yet" );
+  auto out = coalescer.push( data_segment( isn + 1, string( 1000, 'a' ), ackno ) );
+  expect( out.has_value() and out->sender->SYN, "SYN merged" );
+
+  expect( not coalescer.push( data_segment( isn + 1001, string( 1000, 'b' ), ackno, 900 ) ).has_value(),
+          "in-order segment not merged" );
+  out = coalescer.push( data_segment( isn + 2001, string( 1000, 'c' ), ackno + 5 ) );
+  expect( out.has_value() and out->sender->payload == string( 1000, 'a' ) + string( 1000, 'b' ),
+          "segments with another ackno merged, or in-order segments not" );
+  expect( out->receiver->window_size == 900, "merged segment lacks the newer window" );
+
+  out = coalescer.push( data_segment( isn + 4001, string( 1000, 'd' ), ackno + 5 ) );
+  expect( out.has_value() and out->sender->payload == string( 1000, 'c' ), "segment after a gap merged" );
+
+  TCPMessage fin = data_segment( isn + 5001, string( 1000, 'e' ), ackno + 5 );
+  fin.sender->FIN = true;
+  expect( not coalescer.push( move( fin ) ).has_value(), "segment with FIN not merged" );
+  out = coalescer.push( data_segment( isn + 6002, string( 1000, 'f' ), ackno + 5 ) );
+  expect( out.has_value() and out->sender->FIN and out->sender->payload.size() == 2000, "merged past FIN" );
+
+  out = coalescer.push( data_segment( isn + 7002, string( 1000, 'g' ), ackno + 5 ) );
+  out = coalescer.push( data_segment( isn + 8002, string( 1000, 'h' ), ackno + 5 ) );
+  out = coalescer.push( data_segment( isn + 9002, string( 1000, 'i' ), ackno + 5 ) );
+  expect( out.has_value() and out->sender->payload.size() == 3000, "merged past the maximum payload size" );
+
+  out = coalescer.flush();
+  expect( out.has_value() and out->sender->payload == string( 1000, 'i' ), "flush didn't hand on the segment" );
+  expect( not coalescer.flush().has_value(), "flushed twice" );
+  expect( coalescer.stats().segments_in == 10 and coalescer.stats().segments_out == 6, "miscounted" );
+}
+
+// A stream cut into segments (some out of order or repeated) and read in batches arrives the same way
+// whether merged or not
+void random_streams()
+{
+  auto rd = get_random_engine();
+  for ( unsigned int round = 0; round < 1000; round++ ) {
+    const Wrap32 isn { static_cast<uint32_t>( rd() ) };
+    string stream( uniform_int_distribution<size_t> { 0, 20000 }( rd ), 0 );
+    ranges::generate( stream, [&] { return static_cast<char>( rd() ); } );
+
+    vector<TCPMessage> segments;
+    TCPMessage syn = data_segment( isn, "", Wrap32 { 0 } );
+    syn.sender->SYN = true;
+    segments.push_back( move( syn ) );
+    for ( size_t i = 0; i < stream.size(); ) {
+      const size_t size = min( stream.size() - i, uniform_int_distribution<size_t> { 1, 1000 }( rd ) );
+      segments.push_back( data_segment( isn + 1 + static_cast<uint32_t>( i ), stream.substr( i, size ), {} ) );
+      i += size;
+    }
+    segments.back().sender->FIN = true;
+    for ( size_t i = 1; i + 1 < segments.size(); i++ ) {
+      if ( rd() % 10 == 0 ) {
+        swap( segments[i], segments[i + 1] );
+      } else if ( rd() % 10 == 0 ) {
+        segments.insert( segments.begin() + static_cast<ptrdiff_t>( i ), TCPMessage { segments[i] } );
+      }
+    }
+
+    TCPReceiver receiver { Reassembler { ByteStream { 65536 } } };
+    TCPReceiveCoalescer coalescer;
+    for ( size_t i = 0; i < segments.size(); i++ ) {
+      if ( auto ready = coalescer.push( move( segments[i] ) ) ) {
+        receiver.receive( move( ready->sender ) );
+      }
+      if ( rd() % 8 == 0 ) {
+        if ( auto ready = coalescer.flush() ) { // (the end of a batch of reads)
+          receiver.receive( move( ready->sender ) );
+        }
+      }
+    }
+    if ( auto ready = coalescer.flush() ) {
+      receiver.receive( move( ready->sender ) );
+    }
+
+    string received;
+    while ( receiver.reader().bytes_buffered() > 0 ) {
+      received += receiver.reader().peek();
+      receiver.reader().pop( receiver.reader().peek().size() );
+    }
+    expect( receiver.reader().is_finished() and received == stream, "stream arrived differently" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    merge_rules();
+    random_streams();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
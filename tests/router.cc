@@ -169,7 +169,7 @@ private:
   unordered_map<string, Host> _hosts {};
 
 public:
-  Network()
+  explicit Network( const bool forwarding )
     : default_id( _router.add_interface( make_shared<NetworkInterface>( "default",
                                                                         upstream,
                                                                         random_router_ethernet_address(),
@@ -232,6 +232,7 @@ public:
     _router.add_route( ip( "143.195.128.0" ), 18, host( "hs_router" ).address(), hs4_id );
     _router.add_route( ip( "143.195.192.0" ), 19, host( "hs_router" ).address(), hs4_id );
     _router.add_route( ip( "128.30.76.255" ), 16, Address { "128.30.0.1" }, mit5_id );
+    _router.set_forwarding( forwarding );
   }
 
   void simulate()
@@ -261,14 +262,15 @@ public:
   }
 };
 
-void network_simulator()
+void network_simulator( const bool forwarding )
 {
   const string green = "\033[32;1m";
   const string normal = "\033[m";
 
-  cerr << green << "Constructing network." << normal << "\n";
+  cerr << green << "Constructing network" << ( forwarding ? " (forwarding serialized datagrams)." : "." ) << normal
+       << "\n";
 
-  Network network;
+  Network network { forwarding };
 
   cout << green << "\n\nTesting traffic between two ordinary hosts (applesauce to cherrypie)..." << normal
        << "\n\n";
@@ -348,6 +350,7 @@ void network_simulator()
   cout << green << "\n\nSuccess! Testing network with no default route..." << normal << "\n\n";
   {
     Router router {};
+    router.set_forwarding( forwarding );
     auto addr0 = random_router_ethernet_address();
     auto addr1 = random_router_ethernet_address();
     auto addr2 = random_router_ethernet_address();
@@ -401,13 +404,48 @@ void network_simulator()
     }
   }
 
+  cout << green << "\n\nSuccess! Testing datagrams whose total length doesn't fit..." << normal << "\n\n";
+  {
+    Router router {};
+    router.set_forwarding( forwarding );
+    auto addr0 = random_router_ethernet_address();
+    auto addr1 = random_router_ethernet_address();
+    auto frames0 = make_shared<FramesOut>();
+    auto frames1 = make_shared<FramesOut>();
+    auto eth0 = make_shared<NetworkInterface>( "eth0", frames0, addr0, Address { "10.0.0.1" } );
+    auto eth1 = make_shared<NetworkInterface>( "eth1", frames1, addr1, Address { "192.168.0.1" } );
+    const auto eth0_id = router.add_interface( eth0 );
+    const auto eth1_id = router.add_interface( eth1 );
+    router.add_route( ip( "10.0.0.0" ), 8, {}, eth0_id );
+
+    // (each with a correct header checksum, but a total length shorter than the header or longer than the frame)
+    for ( const uint16_t len : { 0, 1, 19, 1000 } ) {
+      InternetDatagram dgram { { .len = len,
+                                 .ttl = 64,
+                                 .src = Address { "192.168.0.2" }.ipv4_numeric(),
+                                 .dst = Address { "10.0.0.5" }.ipv4_numeric() } };
+      dgram.payload.emplace_back( string( 8, 'x' ) );
+      dgram.header.compute_checksum();
+      EthernetFrame frame { .header = { addr1, random_host_ethernet_address(), EthernetHeader::TYPE_IPv4 } };
+      frame.payload.emplace_back( concat( serialize( dgram ) ) ); // (the header in one buffer, as forwarded)
+
+      router.interface( eth1_id )->recv_frame( move( frame ) );
+      router.route();
+
+      if ( ( !frames0->frames.empty() ) or ( !frames1->frames.empty() ) ) {
+        throw runtime_error( "router forwarded a datagram with total length " + to_string( len ) );
+      }
+    }
+  }
+
   cout << "\n\n\033[32;1mCongratulations! All datagrams were routed successfully.\033[m\n";
 }
 
 int main()
 {
   try {
-    network_simulator();
+    network_simulator( false );
+    network_simulator( true );
   } catch ( const exception& e ) {
     cerr << "\n\n\n";
     cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
@@ -0,0 +1,161 @@
+#include "arp_message.hh"
+#include "helpers.hh"
+#include "router.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+//! An output port that keeps only the last frame it was given
+class LastFramePort : public NetworkInterface::OutputPort
+{
+public:
+  size_t frames_transmitted {};
+  EthernetFrame last_frame {};
+
+  void transmit( const NetworkInterface&, const EthernetFrame& frame ) override
+  {
+    ++frames_transmitted;
+    last_frame = clone( frame );
+  }
+};
+
+double report( const string_view description, const size_t packets, const steady_clock::time_point start_time )
+{
+  const double seconds = duration<double>( steady_clock::now() - start_time ).count();
+  const double rate = static_cast<double>( packets ) / seconds;
+  cout << setw( 44 ) << left << description << right << fixed << setprecision( 2 ) << rate / 1e6
+       << " M packets/s.\n";
+  return rate;
+}
+
+//! Decrements a header's TTL and fixes its checksum, either by re-summing the header or incrementally
+void header_update_test()
+{
+  IPv4Header header;
+  header.src = 0x0a000001;
+  header.dst = 0x0a010063;
+  header.len = 84;
+  header.compute_checksum();
+  const IPv4Header original = header;
+  constexpr size_t iterations = 2'000'000;
+
+  auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    header.ttl = original.ttl;
+    header.cksum = original.cksum;
+    --header.ttl;
+    header.compute_checksum();
+  }
+  report( "TTL decrement, checksum recomputed:", iterations, start_time );
+  const uint16_t recomputed = header.cksum;
+
+  start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    header.ttl = original.ttl;
+    header.cksum = original.cksum;
+    header.decrement_ttl();
+  }
+  report( "TTL decrement, checksum updated (RFC 1624):", iterations, start_time );
+
+  if ( header.cksum != recomputed ) {
+    throw runtime_error( "incrementally updated checksum differs from recomputed checksum" );
+  }
+}
+
+//! Forwards datagrams through a Router from one interface to another (whose next hop is already resolved),
+//! either parsing each one or leaving it serialized (and changing its TTL where it lies)
+void forwarding_test( const bool serialized )
+{
+  const auto in_port = make_shared<LastFramePort>();
+  const auto out_port = make_shared<LastFramePort>();
+  const EthernetAddress router_ethernet_address { 0x02, 0, 0, 0, 0, 0x01 };
+  const EthernetAddress next_hop_ethernet_address { 0x02, 0, 0, 0, 0, 0x02 };
+  const Address next_hop { "10.1.0.2" };
+
+  Router router;
+  const EthernetAddress in_ethernet_address { 0x02, 0, 0, 0, 0, 0x03 };
+  router.add_interface(
+    make_shared<NetworkInterface>( "in", in_port, in_ethernet_address, Address { "10.0.0.1" } ) );
+  router.add_interface(
+    make_shared<NetworkInterface>( "out", out_port, router_ethernet_address, Address { "10.1.0.1" } ) );
+  router.add_route( next_hop.ipv4_numeric() & 0xffff0000, 16, next_hop, 1 );
+  router.interface( 0 )->set_forwarding( serialized );
+
+  // teach the outgoing interface the next hop's Ethernet address
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REPLY;
+  arp.sender_ethernet_address = next_hop_ethernet_address;
+  arp.sender_ip_address = next_hop.ipv4_numeric();
+  arp.target_ethernet_address = router_ethernet_address;
+  arp.target_ip_address = Address { "10.1.0.1" }.ipv4_numeric();
+  EthernetFrame arp_frame;
+  arp_frame.header = { router_ethernet_address, next_hop_ethernet_address, EthernetHeader::TYPE_ARP };
+  arp_frame.payload = serialize( arp );
+  router.interface( 1 )->recv_frame( move( arp_frame ) );
+
+  InternetDatagram dgram;
+  dgram.header.src = Address { "10.0.0.2" }.ipv4_numeric();
+  dgram.header.dst = Address { "10.1.0.99" }.ipv4_numeric();
+  dgram.payload.emplace_back( string( 64, 'x' ) );
+  dgram.header.len = IPv4Header::LENGTH + 64;
+  dgram.header.compute_checksum();
+
+  EthernetFrame frame;
+  frame.header = { in_ethernet_address, EthernetAddress { 0x02, 0, 0, 0, 0, 0x04 }, EthernetHeader::TYPE_IPv4 };
+  frame.payload.emplace_back( concat( serialize( dgram ) ) );
+
+  constexpr size_t iterations = 20'000;
+  constexpr size_t batch = 32;
+  const auto& in_interface = router.interface( 0 );
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    for ( size_t j = 0; j < batch; j++ ) {
+      in_interface->recv_frame( clone( frame ) );
+    }
+    router.route();
+  }
+  const double rate = report( serialized ? "Router forwarding, left serialized:" : "Router forwarding, parsed:",
+                              iterations * batch,
+                              start_time );
+
+  InternetDatagram forwarded;
+  if ( out_port->frames_transmitted != iterations * batch or not parse( forwarded, out_port->last_frame.payload )
+       or forwarded.header.ttl != dgram.header.ttl - 1 or concat( forwarded.payload ) != concat( dgram.payload ) ) {
+    throw runtime_error( "router did not forward every datagram with a valid checksum and decremented TTL" );
+  }
+  if ( rate < 100'000 ) {
+    throw runtime_error( "router did not meet minimum speed of 0.1 M packets/s" );
+  }
+}
+
+void program_body()
+{
+  header_update_test();
+  forwarding_test( false );
+  forwarding_test( true );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -708,6 +708,53 @@ int main()
       test.execute( ExpectSeqno { isn + bigstring.size() + 2 } );
       test.execute( ExpectSeqnosInFlight { 0 } );
     }
+
+    {
+      TCPConfig cfg;
+      const Wrap32 isn( rd() );
+      const size_t rto = uniform_int_distribution<uint16_t> { 30, 10000 }( rd );
+      cfg.isn = isn;
+      cfg.rt_timeout = rto;
+      cfg.super_segment_size = 4 * TCPConfig::MAX_PAYLOAD_SIZE;
+
+      const string nicechars = "abcdefghijklmnopqrstuvwxyz";
+      string bigstring;
+      for ( unsigned int i = 0; i < 9 * TCPConfig::MAX_PAYLOAD_SIZE + 500; i++ ) {
+        bigstring.push_back( nicechars.at( rd() % nicechars.size() ) );
+      }
+
+      TCPSenderTestHarness test { "Super-segments join full segments, but retransmit one segment", cfg };
+      test.execute( Push {} );
+      test.execute(
+        ExpectMessage {}.with_no_flags().with_syn( true ).with_payload_size( 0 ).with_segment_size( 0 ) );
+      test.execute( AckReceived { Wrap32 { isn + 1 } }.with_win( 60000 ) );
+      test.execute( Push { string( bigstring ) }.with_close() );
+      for ( size_t i = 0; i < 8 * TCPConfig::MAX_PAYLOAD_SIZE; i += 4 * TCPConfig::MAX_PAYLOAD_SIZE ) {
+        test.execute( ExpectMessage {}
+                        .with_no_flags()
+                        .with_segment_size( TCPConfig::MAX_PAYLOAD_SIZE )
+                        .with_data( bigstring.substr( i, 4 * TCPConfig::MAX_PAYLOAD_SIZE ) )
+                        .with_seqno( isn + 1 + i ) );
+      }
+      test.execute( ExpectMessage {}
+                      .with_segment_size( TCPConfig::MAX_PAYLOAD_SIZE )
+                      .with_data( bigstring.substr( 8 * TCPConfig::MAX_PAYLOAD_SIZE ) )
+                      .with_seqno( isn + 1 + 8 * TCPConfig::MAX_PAYLOAD_SIZE )
+                      .with_fin( true ) );
+      test.execute( ExpectNoSegment {} );
+      test.execute( ExpectSeqnosInFlight { bigstring.size() + 1 } );
+      test.execute( Tick { rto } );
+      test.execute( ExpectMessage {}
+                      .with_no_flags()
+                      .with_segment_size( 0 )
+                      .with_data( bigstring.substr( 0, TCPConfig::MAX_PAYLOAD_SIZE ) )
+                      .with_seqno( isn + 1 ) );
+      test.execute( AckReceived { isn + 1 + TCPConfig::MAX_PAYLOAD_SIZE }.with_win( 60000 ) );
+      test.execute( ExpectSeqnosInFlight { bigstring.size() + 1 - TCPConfig::MAX_PAYLOAD_SIZE } );
+      test.execute( AckReceived { isn + bigstring.size() + 2 }.with_win( 60000 ) );
+      test.execute( ExpectSeqnosInFlight { 0 } );
+      test.execute( ExpectNoSegment {} );
+    }
   } catch ( const exception& e ) {
     cerr << e.what() << "\n";
     return 1;
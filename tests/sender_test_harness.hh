@@ -1,5 +1,6 @@
 #pragma once
 
+#include "checksum.hh"
 #include "common.hh"
 #include "helpers.hh"
 #include "tcp_config.hh"
@@ -55,7 +56,10 @@ public:
   TCPSenderTestHarness( std::string name, TCPConfig config )
     : TestHarness( move( name ),
                    "initial_RTO_ms=" + to_string( config.rt_timeout ) + " and ISN=" + to_string( config.isn ),
-                   { TCPSender { ByteStream { config.send_capacity }, config.isn, config.rt_timeout } } )
+                   { TCPSender { ByteStream { config.send_capacity },
+                                 config.isn,
+                                 config.rt_timeout,
+                                 config.super_segment_size } } )
   {}
 
   template<std::derived_from<TestStep<TCPSender>> T>
@@ -283,8 +287,9 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
   std::optional<Wrap32> seqno {};
   std::optional<std::string> data {};
   std::optional<size_t> payload_size {};
+  std::optional<size_t> segment_size {}; // (0: not a super-segment)
 
-  bool empty() const { return not( syn or fin or rst or seqno or data or payload_size ); }
+  bool empty() const { return not( syn or fin or rst or seqno or data or payload_size or segment_size ); }
 
   ExpectMessage& with_syn( bool syn_ )
   {
@@ -324,6 +329,12 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
     return *this;
   }
 
+  ExpectMessage& with_segment_size( size_t segment_size_ )
+  {
+    segment_size = segment_size_;
+    return *this;
+  }
+
   ExpectMessage& with_data( std::string data_ )
   {
     data = std::move( data_ );
@@ -355,6 +366,9 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
       }
     }
 
+    if ( segment_size.has_value() ) {
+      o << " segment_size=" << segment_size.value();
+    }
     if ( fin.has_value() ) {
       o << ( fin.value() ? " +FIN" : " -FIN" );
     }
@@ -377,7 +391,13 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
 
     const TCPSenderMessage seg = ss.expect_message();
 
-    if ( seg.payload.size() > TCPConfig::MAX_PAYLOAD_SIZE ) {
+    if ( seg.segment_size.has_value() ) {
+      if ( seg.segment_size.value() > TCPConfig::MAX_PAYLOAD_SIZE or seg.SYN ) {
+        throw ExpectationViolation( "sent a super-segment of " + std::to_string( seg.segment_size.value() )
+                                    + "-byte segments, which are longer than the maximum ("
+                                    + std::to_string( TCPConfig::MAX_PAYLOAD_SIZE ) + "), or with SYN" );
+      }
+    } else if ( seg.payload.size() > TCPConfig::MAX_PAYLOAD_SIZE ) {
       throw ExpectationViolation( "sent a message with a " + std::to_string( seg.payload.size() )
                                   + "-byte payload, which is longer than the maximum ("
                                   + std::to_string( TCPConfig::MAX_PAYLOAD_SIZE ) + ")" );
@@ -397,9 +417,20 @@ struct ExpectMessage : public Expectation<SenderAndOutput>
     if ( payload_size.has_value() and seg.payload.size() != payload_size.value() ) {
       throw MessageExpectationViolation( seg, "payload size", payload_size.value(), seg.payload.size() );
     }
+    const size_t seg_segment_size = seg.segment_size.value_or( 0 );
+    if ( segment_size.has_value() and seg_segment_size != segment_size.value() ) {
+      throw MessageExpectationViolation( seg, "segment size", segment_size.value(), seg_segment_size );
+    }
     if ( data.has_value() and data.value() != static_cast<std::string>( seg.payload ) ) {
       throw MessageExpectationViolation( seg, "payload", data.value(), static_cast<std::string>( seg.payload ) );
     }
+    if ( seg.payload_sum.has_value() ) {
+      InternetChecksum check;
+      check.add( std::string_view { seg.payload } );
+      if ( check.partial() != seg.payload_sum.value() ) {
+        throw MessageExpectationViolation( seg, "payload sum", check.partial(), seg.payload_sum.value() );
+      }
+    }
   }
 
   constexpr std::string obj() const override { return "TCPSender"; }
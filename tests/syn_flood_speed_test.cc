@@ -0,0 +1,296 @@
+#include "exception.hh"
+#include "helpers.hh"
+#include "tcp_minnow_listener.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_peer.hh"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <poll.h>
+#include <random>
+#include <stop_token>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr uint16_t LISTEN_PORT = 80;
+constexpr uint16_t LEGIT_PORT = 5000;
+const Address listen_address { "10.0.0.1", LISTEN_PORT };
+const Address legit_address { "10.0.0.2", LEGIT_PORT };
+
+size_t resident_bytes()
+{
+  ifstream statm { "/proc/self/statm" };
+  size_t total_pages {};
+  size_t resident_pages {};
+  statm >> total_pages >> resident_pages;
+  return resident_pages * static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+}
+
+template<typename Predicate>
+bool wait_for( const Predicate& pred, const milliseconds timeout )
+{
+  const auto deadline = steady_clock::now() + timeout;
+  while ( not pred() ) {
+    if ( steady_clock::now() > deadline ) {
+      return false;
+    }
+    this_thread::sleep_for( milliseconds { 1 } );
+  }
+  return true;
+}
+
+//! Floods a listener with spoofed SYNs, then times one legitimate handshake and accept()
+struct FloodResult
+{
+  size_t resident_growth {};
+  uint64_t tracked_connections {};
+  optional<double> accept_latency_ms {};
+  TCPMinnowListener::Stats stats {};
+};
+
+FloodResult flood( const TCPListenerConfig& listen_cfg, const size_t syn_count, const size_t seed )
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  FileDescriptor attacker { fds[0] };
+
+  FdAdapterConfig adapter_cfg;
+  adapter_cfg.source = listen_address;
+  TCPMinnowListener listener { FileDescriptor { fds[1] } };
+  listener.listen( {}, adapter_cfg, listen_cfg );
+
+  // everything that writes to `attacker` or touches `legit` holds this mutex
+  mutex client_mutex;
+  TCPPeer legit { TCPConfig {} };
+  TCPOverIPv4Adapter legit_adapter;
+  legit_adapter.config_mut().source = legit_address;
+  legit_adapter.config_mut().destination = listen_address;
+  const auto legit_transmit
+    = [&]( const TCPMessage& msg ) { attacker.write( serialize( legit_adapter.wrap_tcp_in_ip( msg ) ) ); };
+
+  // drain the listener's replies (otherwise it would block on a full socket), and feed the legitimate peer
+  atomic_bool stop_reader { false };
+  thread reader { [&] {
+    while ( not stop_reader ) {
+      pollfd pfd { attacker.fd_num(), POLLIN, 0 };
+      if ( poll( &pfd, 1, 10 ) <= 0 ) {
+        continue;
+      }
+      vector<string> buffers( 1 );
+      attacker.read( buffers );
+      InternetDatagram dgram;
+      TCPSegment seg;
+      if ( not parse( dgram, move( buffers ) )
+           or not parse( seg, move( dgram.payload ), dgram.header.pseudo_checksum() ) ) {
+        continue;
+      }
+      if ( seg.udinfo.dst_port == LEGIT_PORT ) {
+        const lock_guard lock { client_mutex };
+        legit.receive( move( seg.message ), legit_transmit );
+      }
+    }
+  } };
+
+  default_random_engine rd { seed };
+  uniform_int_distribution<uint32_t> ip_dist { 0xac100000, 0xac1fffff }; // 172.16.0.0/12
+  uniform_int_distribution<uint16_t> port_dist { 1024, UINT16_MAX };
+
+  const size_t resident_before = resident_bytes();
+  for ( size_t i = 0; i < syn_count; i++ ) {
+    TCPOverIPv4Adapter spoofed;
+    spoofed.config_mut().source = Address { Address::from_ipv4_numeric( ip_dist( rd ) ).ip(), port_dist( rd ) };
+    spoofed.config_mut().destination = listen_address;
+    const TCPMessage syn { TCPSenderMessage { .seqno = Wrap32 { static_cast<uint32_t>( rd() ) }, .SYN = true },
+                           TCPReceiverMessage { .window_size = UINT16_MAX } };
+    const lock_guard lock { client_mutex };
+    attacker.write( serialize( spoofed.wrap_tcp_in_ip( syn ) ) );
+  }
+
+  if ( not wait_for( [&] { return listener.stats().syns_received >= syn_count; }, seconds { 5 } ) ) {
+    throw runtime_error( "listener did not process the SYN flood in time" );
+  }
+
+  FloodResult result;
+  result.resident_growth = resident_bytes() - min( resident_before, resident_bytes() );
+  result.tracked_connections = listener.stats().active_connections;
+
+  const auto start_time = steady_clock::now();
+  {
+    const lock_guard lock { client_mutex };
+    legit.push( legit_transmit );
+  }
+  if ( wait_for( [&] { return listener.stats().established > 0; }, seconds { 2 } ) ) {
+    TCPMinnowConnection conn = listener.accept();
+    result.accept_latency_ms = duration<double, milli>( steady_clock::now() - start_time ).count();
+    if ( conn.peer_address().to_string() != legit_address.to_string() ) {
+      throw runtime_error( "accepted connection from unexpected peer " + conn.peer_address().to_string() );
+    }
+  }
+
+  result.stats = listener.stats();
+  stop_reader = true;
+  reader.join();
+  return result;
+}
+
+FloodResult speed_test( const string& scenario, const TCPListenerConfig& listen_cfg, const size_t syn_count )
+{
+  const FloodResult result = flood( listen_cfg, syn_count, 1234 );
+
+  cout << "SYN flood of " << syn_count << " (" << scenario << "): " << result.tracked_connections
+       << " connections tracked, RSS +" << fixed << setprecision( 1 )
+       << static_cast<double>( result.resident_growth ) / 1e6 << " MB, " << result.stats.syns_dropped
+       << " SYNs dropped, " << result.stats.cookies_sent << " cookies sent, ";
+  if ( result.accept_latency_ms.has_value() ) {
+    cout << "legitimate connection accepted in " << setprecision( 2 ) << *result.accept_latency_ms << " ms.\n";
+  } else {
+    cout << "legitimate connection NOT accepted.\n";
+  }
+  return result;
+}
+
+//! Completes many handshakes that the owner never accepts, then resets them all
+void accept_flood_test( const TCPListenerConfig::SynCookies syn_cookies )
+{
+  constexpr size_t client_count = 40;
+  constexpr uint16_t first_port = 6000;
+
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  FileDescriptor clients_fd { fds[0] };
+
+  FdAdapterConfig adapter_cfg;
+  adapter_cfg.source = listen_address;
+  TCPListenerConfig listen_cfg;
+  listen_cfg.accept_backlog = 4;
+  listen_cfg.syn_cookies = syn_cookies;
+  TCPMinnowListener listener { FileDescriptor { fds[1] } };
+  listener.listen( {}, adapter_cfg, listen_cfg );
+
+  // everything that writes to `clients_fd` or touches a client holds this mutex
+  mutex client_mutex;
+  vector<TCPPeer> clients( client_count, TCPPeer { TCPConfig {} } );
+  const auto transmit_from = [&]( const size_t index ) {
+    return [&, index]( const TCPMessage& msg ) {
+      TCPOverIPv4Adapter adapter;
+      adapter.config_mut().source = Address { legit_address.ip(), static_cast<uint16_t>( first_port + index ) };
+      adapter.config_mut().destination = listen_address;
+      clients_fd.write( serialize( adapter.wrap_tcp_in_ip( msg ) ) );
+    };
+  };
+
+  // (a jthread, so that it is stopped and joined however this function exits)
+  const jthread reader { [&]( const stop_token& stop ) {
+    while ( not stop.stop_requested() ) {
+      pollfd pfd { clients_fd.fd_num(), POLLIN, 0 };
+      if ( poll( &pfd, 1, 10 ) <= 0 ) {
+        continue;
+      }
+      vector<string> buffers( 1 );
+      clients_fd.read( buffers );
+      InternetDatagram dgram;
+      TCPSegment seg;
+      if ( not parse( dgram, move( buffers ) )
+           or not parse( seg, move( dgram.payload ), dgram.header.pseudo_checksum() ) ) {
+        continue;
+      }
+      const size_t index = seg.udinfo.dst_port - first_port;
+      if ( index < client_count ) {
+        const lock_guard lock { client_mutex };
+        clients[index].receive( move( seg.message ), transmit_from( index ) );
+      }
+    }
+  } };
+
+  for ( size_t i = 0; i < client_count; i++ ) {
+    const lock_guard lock { client_mutex };
+    clients[i].push( transmit_from( i ) );
+  }
+
+  // the accept queue and the connections waiting for room in it fill up; later handshakes stay incomplete
+  if ( not wait_for( [&] { return listener.stats().acks_dropped > 0; }, seconds { 5 } ) ) {
+    throw runtime_error( "listener completed every handshake though nobody called accept()" );
+  }
+  this_thread::sleep_for( milliseconds { 100 } );
+  const TCPMinnowListener::Stats flooded = listener.stats();
+  if ( flooded.established > 2 * listen_cfg.accept_backlog ) {
+    throw runtime_error( "listener let " + to_string( flooded.established ) + " connections wait for accept()" );
+  }
+
+  // every connection, accepted or not, must be forgotten once its peer resets it
+  for ( size_t i = 0; i < client_count; i++ ) {
+    const lock_guard lock { client_mutex };
+    const Wrap32 seqno = clients[i].sender().make_empty_message().seqno;
+    transmit_from( i )( { TCPSenderMessage { .seqno = seqno, .RST = true }, clients[i].receiver().send() } );
+  }
+  if ( not wait_for( [&] { return listener.stats().active_connections == 0; }, seconds { 5 } ) ) {
+    throw runtime_error( "listener kept " + to_string( listener.stats().active_connections )
+                         + " connections after their peers reset them" );
+  }
+
+  const TCPMinnowListener::Stats reset = listener.stats();
+  cout << "Accept flood of " << client_count << " ("
+       << ( syn_cookies == TCPListenerConfig::SynCookies::Off ? "no cookies" : "SYN cookies" )
+       << "): " << flooded.established << " handshakes completed, " << reset.acks_dropped << " ACKs dropped, "
+       << reset.unaccepted_expired << " unaccepted connections reset.\n";
+}
+
+void program_body()
+{
+  constexpr size_t syn_count = 5000;
+
+  TCPListenerConfig cookies;
+  cookies.syn_cookies = TCPListenerConfig::SynCookies::WhenFull;
+  const FloodResult with_cookies = speed_test( "SYN cookies when backlog full", cookies, syn_count );
+  if ( not with_cookies.accept_latency_ms.has_value() or with_cookies.stats.cookies_accepted != 1 ) {
+    throw runtime_error( "legitimate connection was not accepted through a SYN cookie" );
+  }
+  if ( with_cookies.tracked_connections > TCPListenerConfig::DEFAULT_SYN_BACKLOG ) {
+    throw runtime_error( "listener kept per-SYN state despite SYN cookies" );
+  }
+
+  TCPListenerConfig parsed_in_parallel = cookies;
+  parsed_in_parallel.parse_threads = 2;
+  const FloodResult with_parsers = speed_test( "SYN cookies, 2 parse threads", parsed_in_parallel, syn_count );
+  if ( not with_parsers.accept_latency_ms.has_value() or with_parsers.stats.cookies_accepted != 1 ) {
+    throw runtime_error( "legitimate connection was not accepted with parse threads" );
+  }
+
+  speed_test( "no cookies, default backlog", {}, syn_count );
+
+  TCPListenerConfig big_backlog;
+  big_backlog.syn_backlog = syn_count + 1;
+  speed_test( "no cookies, unbounded backlog", big_backlog, syn_count );
+
+  accept_flood_test( TCPListenerConfig::SynCookies::Off );
+  accept_flood_test( TCPListenerConfig::SynCookies::Always );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+#include "exception.hh"
+#include "helpers.hh"
+#include "tcp_minnow_listener.hh"
+#include "tcp_over_ip.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr uint16_t LISTEN_PORT = 80;
+const Address listen_address { "10.0.0.1", LISTEN_PORT };
+const string client_ip = "10.0.0.2";
+
+void expect( const bool condition, const string& what )
+{
+  if ( not condition ) {
+    throw runtime_error( "TCP listener: " + what );
+  }
+}
+
+template<typename Predicate>
+bool wait_for( const Predicate& pred, const milliseconds timeout = seconds { 2 } )
+{
+  const auto deadline = steady_clock::now() + timeout;
+  while ( not pred() ) {
+    if ( steady_clock::now() > deadline ) {
+      return false;
+    }
+    this_thread::sleep_for( milliseconds { 1 } );
+  }
+  return true;
+}
+
+//! A TCPMinnowListener on one end of a datagram socket pair; the test plays every client on the other end
+class Harness
+{
+  FileDescriptor _clients;
+  TCPMinnowListener _listener;
+
+  explicit Harness( array<FileDescriptor, 2>&& fds ) : _clients( move( fds[0] ) ), _listener( move( fds[1] ) ) {}
+
+  static array<FileDescriptor, 2> _socket_pair()
+  {
+    array<int, 2> fds {};
+    CheckSystemCall( "socketpair", socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+    return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+  }
+
+public:
+  explicit Harness( const TCPListenerConfig& listen_cfg ) : Harness( _socket_pair() )
+  {
+    FdAdapterConfig adapter_cfg;
+    adapter_cfg.source = listen_address;
+    _listener.listen( {}, adapter_cfg, listen_cfg );
+  }
+
+  TCPMinnowListener& listener() { return _listener; }
+
+  //! Send `msg` to the listener from the client on `port`
+  void send( const uint16_t port, const TCPMessage& msg )
+  {
+    TCPOverIPv4Adapter adapter;
+    adapter.config_mut().source = Address { client_ip, port };
+    adapter.config_mut().destination = listen_address;
+    _clients.write( serialize( adapter.wrap_tcp_in_ip( msg ) ) );
+  }
+
+  //! The next segment the listener sends to the client on `port` (others are skipped), if one comes in time
+  optional<TCPMessage> receive( const uint16_t port, const milliseconds timeout = milliseconds { 500 } )
+  {
+    const auto deadline = steady_clock::now() + timeout;
+    while ( steady_clock::now() < deadline ) {
+      pollfd pfd { _clients.fd_num(), POLLIN, 0 };
+      if ( poll( &pfd, 1, 10 ) <= 0 ) {
+        continue;
+      }
+      vector<string> buffers( 1 );
+      _clients.read( buffers );
+      InternetDatagram dgram;
+      TCPSegment seg;
+      if ( parse( dgram, move( buffers ) ) and parse( seg, move( dgram.payload ), dgram.header.pseudo_checksum() )
+           and seg.udinfo.dst_port == port ) {
+        return move( seg.message );
+      }
+    }
+    return {};
+  }
+
+  //! Send a SYN from `port` and return the listener's SYN/ACK, if it answers
+  optional<TCPMessage> syn( const uint16_t port, const Wrap32 isn )
+  {
+    send( port,
+          { TCPSenderMessage { .seqno = isn, .SYN = true }, TCPReceiverMessage { .window_size = UINT16_MAX } } );
+    optional<TCPMessage> reply = receive( port );
+    if ( reply.has_value() ) {
+      expect( reply->sender->SYN and reply->receiver->ackno == isn + 1, "reply to a SYN is not a SYN/ACK" );
+    }
+    return reply;
+  }
+
+  //! Send the ACK that completes a handshake, acknowledging `server_isn`
+  void ack( const uint16_t port, const Wrap32 isn, const Wrap32 server_isn )
+  {
+    send( port,
+          { TCPSenderMessage { .seqno = isn + 1 },
+            TCPReceiverMessage { .ackno = server_isn + 1, .window_size = UINT16_MAX } } );
+  }
+
+  //! Send a RST from `port`
+  void reset( const uint16_t port, const Wrap32 isn )
+  {
+    send( port, { TCPSenderMessage { .seqno = isn + 1, .RST = true }, TCPReceiverMessage {} } );
+  }
+};
+
+// Completed handshakes wait in the accept queue, in order, and beyond accept_backlog their final ACK is ignored
+void accept_queue()
+{
+  TCPListenerConfig listen_cfg;
+  listen_cfg.accept_backlog = 1;
+  Harness h { listen_cfg };
+
+  const Wrap32 isn { 1000 };
+  vector<Wrap32> server_isns;
+  for ( uint16_t port = 5001; port <= 5003; port++ ) {
+    const optional<TCPMessage> syn_ack = h.syn( port, isn );
+    expect( syn_ack.has_value(), "no SYN/ACK for the client on port " + to_string( port ) );
+    server_isns.push_back( syn_ack->sender->seqno );
+  }
+  expect( server_isns[0] != server_isns[1] and server_isns[1] != server_isns[2], "connections share an ISN" );
+
+  // one connection fits in the accept queue, one waits for room in it, and the third handshake stays incomplete
+  for ( uint16_t i = 0; i < 3; i++ ) {
+    h.ack( static_cast<uint16_t>( 5001 + i ), isn, server_isns[i] );
+  }
+  expect( wait_for( [&] { return h.listener().stats().acks_dropped == 1; } ), "third handshake completed" );
+  expect( h.listener().stats().established == 2, "handshakes not completed" );
+  expect( not h.syn( 5004, isn ).has_value() and h.listener().stats().syns_dropped == 1,
+          "SYN answered while the accept queue is full" );
+
+  TCPMinnowConnection first = h.listener().accept();
+  expect( first.peer_address().port() == 5001, "accept() returned connections out of order" );
+  TCPMinnowConnection second = h.listener().accept();
+  expect( second.peer_address().port() == 5002, "waiting connection not moved to the accept queue" );
+
+  // accepted connections carry data to their own client
+  first.write( "hello" );
+  const optional<TCPMessage> data = h.receive( 5001 );
+  expect( data.has_value() and data->sender->payload == "hello", "accepted connection did not send its data" );
+
+  // once there is room again, a retransmitted ACK completes the third handshake
+  h.ack( 5003, isn, server_isns[2] );
+  expect( wait_for( [&] { return h.listener().stats().established == 3; } ), "handshake refused with room" );
+  expect( h.listener().accept().peer_address().port() == 5003, "wrong connection accepted" );
+}
+
+// With cookies off, SYNs beyond syn_backlog are dropped without an answer
+void syn_backlog()
+{
+  TCPListenerConfig listen_cfg;
+  listen_cfg.syn_backlog = 2;
+  Harness h { listen_cfg };
+
+  const Wrap32 isn { 2000 };
+  expect( h.syn( 5001, isn ).has_value() and h.syn( 5002, isn ).has_value(), "SYN within the backlog ignored" );
+  expect( not h.syn( 5003, isn ).has_value(), "SYN beyond the backlog answered" );
+
+  const TCPMinnowListener::Stats stats = h.listener().stats();
+  expect( stats.syns_received == 3 and stats.syns_dropped == 1, "SYN beyond the backlog not counted as dropped" );
+  expect( stats.active_connections == 2 and stats.cookies_sent == 0, "dropped SYN created state" );
+
+  // a reset half-open connection frees its place in the SYN queue
+  h.reset( 5001, isn );
+  expect( wait_for( [&] { return h.listener().stats().half_open_expired == 1; } ), "reset half-open kept" );
+  expect( h.syn( 5004, isn ).has_value(), "SYN refused after a half-open connection went away" );
+}
+
+// An ACK creates a connection only if it echoes the cookie issued to its own four-tuple
+void syn_cookies()
+{
+  TCPListenerConfig listen_cfg;
+  listen_cfg.syn_cookies = TCPListenerConfig::SynCookies::Always;
+  Harness h { listen_cfg };
+
+  const Wrap32 isn { 3000 };
+  const optional<TCPMessage> syn_ack = h.syn( 5001, isn );
+  expect( syn_ack.has_value(), "no SYN/ACK carrying a cookie" );
+  const Wrap32 cookie = syn_ack->sender->seqno;
+  expect( h.listener().stats().cookies_sent == 1 and h.listener().stats().active_connections == 0,
+          "cookie SYN/ACK left state behind" );
+
+  h.ack( 5001, isn, cookie + 1 ); // wrong cookie
+  h.ack( 5001, isn + 1, cookie ); // right cookie, but not for this ISN
+  h.ack( 5002, isn, cookie );     // right cookie, other port
+  h.ack( 5001, isn, cookie );
+  // (the listener handles datagrams in order, so the rejections are done once the valid ACK is)
+  expect( wait_for( [&] { return h.listener().stats().cookies_accepted > 0; } ), "valid cookie rejected" );
+  const TCPMinnowListener::Stats stats = h.listener().stats();
+  expect( stats.cookies_accepted == 1 and stats.active_connections == 1, "invalid cookie accepted" );
+
+  expect( wait_for( [&] { return h.listener().stats().established == 1; } ), "cookie handshake not completed" );
+  TCPMinnowConnection conn = h.listener().accept();
+  expect( conn.peer_address().port() == 5001, "cookie connection has the wrong peer" );
+  conn.write( "cookie" );
+  const optional<TCPMessage> data = h.receive( 5001 );
+  expect( data.has_value() and data->sender->seqno == cookie + 1 and data->sender->payload == "cookie",
+          "cookie connection does not continue the cookie's sequence numbers" );
+}
+
+// Established connections that were never accepted are forgotten when their peer resets them
+void unaccepted_expiry()
+{
+  TCPListenerConfig listen_cfg;
+  listen_cfg.accept_backlog = 1;
+  Harness h { listen_cfg };
+
+  // the first connection goes to the accept queue, and the second waits for room in it
+  const Wrap32 isn { 4000 };
+  const optional<TCPMessage> first = h.syn( 5001, isn );
+  const optional<TCPMessage> second = h.syn( 5002, isn );
+  expect( first.has_value() and second.has_value(), "SYN ignored" );
+  h.ack( 5001, isn, first->sender->seqno );
+  h.ack( 5002, isn, second->sender->seqno );
+  expect( wait_for( [&] { return h.listener().stats().established == 2; } ), "handshakes not completed" );
+
+  h.reset( 5002, isn );
+  expect( wait_for( [&] { return h.listener().stats().active_connections == 1; } ), "reset connection kept" );
+  expect( h.listener().stats().unaccepted_expired == 1, "reset connection not counted as expired" );
+
+  // the connection in the accept queue is unaffected, and the expired one is never handed out
+  expect( h.listener().accept().peer_address().port() == 5001, "wrong connection accepted" );
+  const optional<TCPMessage> third = h.syn( 5003, isn );
+  expect( third.has_value(), "SYN refused after the accept queue emptied" );
+  h.ack( 5003, isn, third->sender->seqno );
+  expect( wait_for( [&] { return h.listener().stats().established == 3; } ), "handshake after expiry refused" );
+  expect( h.listener().accept().peer_address().port() == 5003, "expired connection accepted" );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    accept_queue();
+    syn_backlog();
+    syn_cookies();
+    unaccepted_expiry();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+#include "random.hh"
+#include "timer_wheel.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Wheel = TimerWheel<size_t>;
+
+constexpr uint64_t LEVEL_SPAN = Wheel::SLOTS; // width of a level-1 slot
+constexpr uint64_t WHEEL_SPAN = uint64_t { 1 } << ( Wheel::SLOT_BITS * Wheel::LEVELS ); // width of the whole wheel
+
+void expect( const bool condition, const string& what )
+{
+  if ( not condition ) {
+    throw runtime_error( "timer wheel: " + what );
+  }
+}
+
+//! Advance `wheel` to `now`, returning the (deadline, value) pairs that expired, in order
+vector<pair<uint64_t, size_t>> advance( Wheel& wheel, const uint64_t now )
+{
+  vector<pair<uint64_t, size_t>> expired;
+  wheel.advance( now, [&]( const uint64_t deadline, const size_t value ) {
+    expect( deadline <= now, "timer for " + to_string( deadline ) + " expired at " + to_string( now ) );
+    expired.emplace_back( deadline, value );
+  } );
+  return expired;
+}
+
+//! A timer expires when the clock reaches its deadline, and not a millisecond before
+void expect_expires_at( const uint64_t start, const uint64_t deadline )
+{
+  const string what = "timer for " + to_string( deadline ) + " scheduled at " + to_string( start );
+
+  Wheel wheel { start };
+  wheel.schedule( deadline, 7 );
+  const optional<uint64_t> next = wheel.next_event();
+  expect( next.has_value() and *next > start and *next <= deadline, what + ": bad next_event()" );
+
+  expect( advance( wheel, deadline - 1 ).empty(), what + ": expired early" );
+  expect( wheel.size() == 1 and wheel.next_event().value_or( UINT64_MAX ) <= deadline,
+          what + ": lost before its deadline" );
+  const auto expired = advance( wheel, deadline );
+  expect( expired.size() == 1 and expired[0] == pair { deadline, size_t { 7 } }, what + ": did not expire" );
+  expect( wheel.empty() and not wheel.next_event().has_value(), what + ": still pending after expiring" );
+}
+
+// Deadlines on and next to the slot boundaries of every level, and in the overflow list
+void slot_boundaries()
+{
+  for ( const uint64_t start : { uint64_t { 0 }, uint64_t { 1 }, LEVEL_SPAN - 1, uint64_t { 12345 } } ) {
+    for ( uint64_t span = LEVEL_SPAN; span <= 4 * WHEEL_SPAN; span *= LEVEL_SPAN ) {
+      const uint64_t boundary = ( start / span + 1 ) * span;
+      for ( const uint64_t deadline : { boundary - 1, boundary, boundary + 1 } ) {
+        if ( deadline > start ) {
+          expect_expires_at( start, deadline );
+        }
+      }
+    }
+    expect_expires_at( start, start + 1 );
+    expect_expires_at( start, start + WHEEL_SPAN - 1 );
+    expect_expires_at( start, start + WHEEL_SPAN );
+    expect_expires_at( start, start + 3 * WHEEL_SPAN + 17 );
+  }
+
+  // a deadline that has already passed expires on the next advance, even one that doesn't move the clock
+  Wheel wheel { 1000 };
+  wheel.schedule( 999, 1 );
+  wheel.schedule( 1000, 2 );
+  expect( wheel.next_event() == 1000, "past deadline not due now" );
+  expect( advance( wheel, 1000 ) == vector<pair<uint64_t, size_t>> { { 999, 1 }, { 1000, 2 } },
+          "past deadlines did not expire right away" );
+}
+
+// Timers spread over every level and the overflow list expire exactly once, in deadline order, however the
+// clock is advanced; timers scheduled from on_expire are honored too
+void cascading()
+{
+  auto rng = get_random_engine();
+  for ( unsigned round = 0; round < 20; round++ ) {
+    const uint64_t start = uniform_int_distribution<uint64_t> { 0, 2 * WHEEL_SPAN }( rng );
+    Wheel wheel { start };
+    multimap<uint64_t, size_t> pending; // deadline -> value
+
+    // deadlines at every scale, from the next millisecond to well past the top level
+    const auto random_delay = [&] {
+      const unsigned bits = uniform_int_distribution<unsigned> { 0, Wheel::SLOT_BITS * Wheel::LEVELS + 3 }( rng );
+      return uniform_int_distribution<uint64_t> { 1, uint64_t { 1 } << bits }( rng );
+    };
+
+    size_t next_value = 0;
+    for ( ; next_value < 2000; next_value++ ) {
+      const uint64_t deadline = start + random_delay();
+      wheel.schedule( deadline, next_value );
+      pending.emplace( deadline, next_value );
+    }
+
+    uint64_t now = start;
+    uint64_t last_expired = 0;
+    while ( not pending.empty() ) {
+      const uint64_t earliest = pending.begin()->first;
+      const optional<uint64_t> next = wheel.next_event();
+      expect( next.has_value() and *next > now and *next <= earliest, "next_event() is not a lower bound" );
+
+      // sometimes land exactly on the earliest deadline, sometimes jump far past it
+      const bool jump = uniform_int_distribution<unsigned> { 0, 9 }( rng ) == 0;
+      const uint64_t target = jump ? earliest + random_delay() : earliest;
+
+      wheel.advance( target, [&]( const uint64_t deadline, const size_t value ) {
+        expect( deadline <= target and deadline >= last_expired, "timers expired out of order" );
+        last_expired = deadline;
+        const auto [first, last] = pending.equal_range( deadline );
+        const auto it = find_if( first, last, [&]( const auto& timer ) { return timer.second == value; } );
+        expect( it != last, "timer expired twice, or with the wrong deadline" );
+        pending.erase( it );
+
+        // sometimes reschedule from the callback, into the future or (rarely) the past
+        if ( value % 4 == 0 ) {
+          const uint64_t later = value % 64 == 0 ? deadline : deadline + random_delay();
+          wheel.schedule( later, next_value );
+          pending.emplace( later, next_value++ );
+        }
+      } );
+      now = target;
+
+      expect( pending.empty() or pending.begin()->first > now, "timer not expired by its deadline" );
+      expect( wheel.size() == pending.size(), "size() disagrees with the timers pending" );
+    }
+    expect( wheel.empty() and not wheel.next_event().has_value(), "wheel not empty once every timer expired" );
+  }
+}
+
+// Timers in the overflow list come back into the wheel when the clock reaches their epoch
+void overflow()
+{
+  Wheel wheel;
+  wheel.schedule( 5 * WHEEL_SPAN + 3, 5 );
+  wheel.schedule( WHEEL_SPAN + 3, 1 );
+  wheel.schedule( 2 * WHEEL_SPAN - 1, 2 );
+  wheel.schedule( 10, 0 );
+
+  expect( advance( wheel, WHEEL_SPAN ) == vector<pair<uint64_t, size_t>> { { 10, 0 } }, "wrong timers expired" );
+  expect( wheel.next_event().value_or( UINT64_MAX ) <= WHEEL_SPAN + 3, "overflowed timer not back in the wheel" );
+  expect( advance( wheel, WHEEL_SPAN + 2 ).empty(), "overflowed timer expired early" );
+  expect( advance( wheel, 3 * WHEEL_SPAN )
+            == vector<pair<uint64_t, size_t>> { { WHEEL_SPAN + 3, 1 }, { 2 * WHEEL_SPAN - 1, 2 } },
+          "overflowed timers did not expire in order" );
+  expect( wheel.size() == 1 and wheel.next_event().value_or( UINT64_MAX ) <= 5 * WHEEL_SPAN + 3, "far timer lost" );
+  expect( advance( wheel, 5 * WHEEL_SPAN + 2 ).empty(), "far timer expired early" );
+  expect( advance( wheel, 5 * WHEEL_SPAN + 3 ) == vector<pair<uint64_t, size_t>> { { 5 * WHEEL_SPAN + 3, 5 } },
+          "far timer did not expire at its deadline" );
+}
+
+// Timers can't be cancelled, so an owner that reschedules records its current deadline and skips the stale
+// expirations (as TCPMinnowListener does); each expiration must report the deadline it was scheduled with
+void stale_entries()
+{
+  Wheel wheel;
+  map<size_t, uint64_t> wanted; // owner -> deadline it currently cares about
+  const auto reschedule = [&]( const size_t owner, const uint64_t deadline ) {
+    wanted[owner] = deadline;
+    wheel.schedule( deadline, owner );
+  };
+
+  reschedule( 1, 500 );
+  reschedule( 1, 100 ); // earlier: the entry for 500 goes stale
+  reschedule( 2, 200 );
+  reschedule( 2, 5000 ); // later: the entry for 200 goes stale
+  reschedule( 3, 300 );
+  wanted.erase( 3 ); // gave up: the entry for 300 goes stale
+  expect( wheel.size() == 5, "size() does not count stale entries" );
+
+  vector<pair<uint64_t, size_t>> acted_on;
+  size_t skipped = 0;
+  wheel.advance( 10000, [&]( const uint64_t deadline, const size_t owner ) {
+    const auto it = wanted.find( owner );
+    if ( it == wanted.end() or it->second != deadline ) {
+      skipped++;
+      return;
+    }
+    wanted.erase( it );
+    acted_on.emplace_back( deadline, owner );
+  } );
+
+  expect( skipped == 3, "stale entries not all delivered with their own deadlines" );
+  expect( acted_on == vector<pair<uint64_t, size_t>> { { 100, 1 }, { 5000, 2 } }, "wrong expirations acted on" );
+  expect( wheel.empty(), "stale entries still pending" );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    slot_boundaries();
+    cascading();
+    overflow();
+    stale_entries();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+
+  return EXIT_SUCCESS;
+}
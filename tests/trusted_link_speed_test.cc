@@ -0,0 +1,85 @@
+#include "checksum.hh"
+#include "helpers.hh"
+#include "tcp_over_ip.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t PAYLOAD_SIZE = 1000;
+
+//! Wraps segments in one adapter and unwraps them in its peer (as the two ends of a link would), with TCP
+//! checksums or without (FdAdapterConfig::checksum_trusted); returns MB/s of payload
+double speed_test( const bool checksum_trusted, const string_view description )
+{
+  TCPOverIPv4Adapter sender;
+  TCPOverIPv4Adapter receiver;
+  sender.config_mut().source = Address { "10.0.0.1", 1024 };
+  sender.config_mut().destination = Address { "10.0.0.2", 80 };
+  receiver.config_mut().source = sender.config().destination;
+  receiver.config_mut().destination = sender.config().source;
+  sender.config_mut().checksum_trusted = checksum_trusted;
+  receiver.config_mut().checksum_trusted = checksum_trusted;
+
+  TCPMessage msg;
+  msg.sender->seqno = Wrap32 { 1 };
+  msg.sender->payload = string( PAYLOAD_SIZE, 'x' );
+  msg.receiver->ackno = Wrap32 { 1 };
+  msg.receiver->window_size = 65535;
+
+  constexpr size_t iterations = 300'000;
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    InternetDatagram dgram;
+    if ( not parse( dgram, vector { concat( serialize( sender.wrap_tcp_in_ip( msg ) ) ) } ) ) { // (as if sent)
+      throw runtime_error( "IPv4 datagram did not parse" );
+    }
+    const auto received = receiver.unwrap_tcp_in_ip( move( dgram ) );
+    if ( not received or received->sender->payload.size() != PAYLOAD_SIZE ) {
+      throw runtime_error( "TCP segment did not arrive" );
+    }
+  }
+  const double seconds = duration<double>( steady_clock::now() - start_time ).count();
+
+  const double megabytes_per_second = static_cast<double>( iterations * PAYLOAD_SIZE ) / 1e6 / seconds;
+  cout << setw( 36 ) << left << description << right << fixed << setprecision( 2 )
+       << static_cast<double>( iterations ) / seconds / 1e6 << " M segments/s (" << setprecision( 0 )
+       << megabytes_per_second << " MB/s).\n";
+  return megabytes_per_second;
+}
+
+void program_body()
+{
+  const auto best_kernel = InternetChecksum::kernel();
+  InternetChecksum::use_kernel( InternetChecksum::Kernel::Scalar );
+  speed_test( false, "TCP checksums (scalar kernel):" );
+  InternetChecksum::use_kernel( best_kernel );
+  speed_test( false, "TCP checksums (default kernel):" );
+  if ( speed_test( true, "checksum-trusted link:" ) < 10 ) {
+    throw runtime_error( "checksum-trusted link did not meet minimum speed of 10 MB/s" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
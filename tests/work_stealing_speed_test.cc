@@ -0,0 +1,122 @@
+#include "work_stealing_executor.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+void spin_for( const steady_clock::duration duration )
+{
+  const auto deadline = steady_clock::now() + duration;
+  while ( steady_clock::now() < deadline ) {}
+}
+
+//! Submits `per_key` numbered tasks for each of `keys` keys, interleaved, and checks that every key's tasks
+//! ran in order
+void ordering_test( const size_t threads, const size_t keys, const size_t per_key )
+{
+  vector<vector<size_t>> seen( keys );
+  const auto start_time = steady_clock::now();
+  uint64_t steals {};
+  {
+    WorkStealingExecutor executor { threads };
+    for ( size_t i = 0; i < per_key; i++ ) {
+      for ( size_t key = 0; key < keys; key++ ) {
+        executor.submit( key, [&seen, key, i] { seen[key].push_back( i ); } );
+      }
+    }
+    steals = executor.steals();
+  } // (waits for the tasks)
+  const auto elapsed = steady_clock::now() - start_time;
+
+  for ( const auto& numbers : seen ) {
+    if ( numbers.size() != per_key ) {
+      throw runtime_error( "lost a task" );
+    }
+    for ( size_t i = 0; i < per_key; i++ ) {
+      if ( numbers[i] != i ) {
+        throw runtime_error( "tasks with the same key ran out of order" );
+      }
+    }
+  }
+
+  const double tasks = static_cast<double>( keys * per_key );
+  cout << "Ordering, " << threads << " thread(s): " << fixed << setprecision( 2 )
+       << tasks / duration<double>( elapsed ).count() / 1e6 << " M tasks/s, " << steals << " steals.\n";
+}
+
+//! One key gets a long queue of 1 ms tasks, and many other keys get one short task each right after; reports
+//! how long the short tasks had to wait
+void stall_test( const size_t threads )
+{
+  constexpr size_t heavy_tasks = 200;
+  constexpr size_t light_keys = 1000;
+  constexpr uint64_t heavy_key = light_keys;
+
+  atomic<size_t> light_done {};
+  atomic<int64_t> light_finished_ns {};
+  atomic<int64_t> heavy_finished_ns {};
+  const auto start_time = steady_clock::now();
+  const auto since_start = [&] { return duration_cast<nanoseconds>( steady_clock::now() - start_time ).count(); };
+  {
+    WorkStealingExecutor executor { threads };
+    for ( size_t i = 0; i < heavy_tasks; i++ ) {
+      executor.submit( heavy_key, [&, i] {
+        spin_for( milliseconds { 1 } );
+        if ( i + 1 == heavy_tasks ) {
+          heavy_finished_ns = since_start();
+        }
+      } );
+    }
+    for ( size_t key = 0; key < light_keys; key++ ) {
+      executor.submit( key, [&] {
+        spin_for( microseconds { 10 } );
+        if ( ++light_done == light_keys ) {
+          light_finished_ns = since_start();
+        }
+      } );
+    }
+  }
+
+  const double light_ms = static_cast<double>( light_finished_ns ) / 1e6;
+  const double heavy_ms = static_cast<double>( heavy_finished_ns ) / 1e6;
+  cout << "Heavy key, " << threads << " thread(s): light keys done after " << fixed << setprecision( 1 )
+       << light_ms << " ms, heavy key after " << heavy_ms << " ms.\n";
+
+  if ( light_ms >= heavy_ms ) {
+    throw runtime_error( "the heavy key stalled the others" );
+  }
+}
+
+void program_body()
+{
+  for ( const size_t threads : { 1, 2, 4 } ) {
+    ordering_test( threads, 64, 10000 );
+  }
+  for ( const size_t threads : { 1, 2, 4 } ) {
+    stall_test( threads );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+#include "buffer_pool.hh"
+
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Pool
+{
+  vector<string> buffers {};
+  vector<string> small_buffers {};
+  BufferPool::Stats stats {};
+
+  Pool()
+  {
+    buffers.reserve( BufferPool::kMaxPooled );
+    small_buffers.reserve( BufferPool::kMaxPooledSmall );
+  }
+  ~Pool();
+
+  Pool( const Pool& other ) = delete;
+  Pool& operator=( const Pool& other ) = delete;
+  Pool( Pool&& other ) = delete;
+  Pool& operator=( Pool&& other ) = delete;
+};
+
+// (a buffer can outlive its thread's pool, e.g. in another thread_local object; it is then just freed)
+thread_local bool pool_destroyed = false;
+thread_local Pool pool;
+
+Pool::~Pool()
+{
+  pool_destroyed = true;
+}
+
+// A buffer with room for `size` bytes, from `buffers` if possible
+Ref<string> take_from( vector<string>& buffers, const size_t size, Ref<string>::Recycler give_back )
+{
+  string buffer;
+  if ( buffers.empty() ) {
+    buffer.reserve( size );
+    ++pool.stats.allocated;
+  } else {
+    buffer = move( buffers.back() );
+    buffers.pop_back();
+    ++pool.stats.reused;
+  }
+  return Ref<string>::recycled( move( buffer ), give_back );
+}
+
+} // namespace
+
+Ref<string> BufferPool::take()
+{
+  return take_from( pool.buffers, kBufferSize, give_back );
+}
+
+Ref<string> BufferPool::take_small()
+{
+  return take_from( pool.small_buffers, kSmallBufferSize, give_back );
+}
+
+vector<Ref<string>> BufferPool::take_for_headers( const initializer_list<size_t> header_lengths )
+{
+  vector<Ref<string>> buffers;
+  buffers.reserve( header_lengths.size() + 1 );
+  for ( const size_t length : header_lengths ) {
+    buffers.push_back( take_small() );
+    buffers.back()->resize( length );
+  }
+  buffers.push_back( take() );
+  return buffers;
+}
+
+void BufferPool::give_back( string& buffer ) noexcept
+{
+  if ( pool_destroyed ) {
+    return;
+  }
+
+  // keep buffers that are still one of the two sizes (a moved-from or swapped-out string has no room left), each
+  // in its own pool
+  const size_t capacity = buffer.capacity();
+  const bool large = capacity >= kBufferSize and capacity <= 2 * kBufferSize;
+  const bool small = capacity >= kSmallBufferSize and capacity <= 2 * kSmallBufferSize;
+  auto& buffers = large ? pool.buffers : pool.small_buffers;
+  if ( not( large or small ) or buffers.size() >= ( large ? kMaxPooled : kMaxPooledSmall ) ) {
+    ++pool.stats.discarded;
+    return;
+  }
+
+  buffer.clear();
+  buffers.push_back( move( buffer ) ); // (can't throw: the vector's capacity was reserved)
+}
+
+BufferPool::Stats BufferPool::stats()
+{
+  Stats stats = pool.stats;
+  stats.pooled = pool.buffers.size() + pool.small_buffers.size();
+  return stats;
+}
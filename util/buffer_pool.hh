@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ref.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+//! \brief A per-thread pool of packet buffers, so reading a datagram doesn't have to allocate
+//! \details take() hands out a buffer as an owned Ref<std::string>: an empty string with room for a whole
+//! datagram. The buffer can be filled by FileDescriptor::read, moved into a Parser (and on into a parsed
+//! frame's or datagram's payload) and moved around like any other owned Ref. When the Ref that owns it is
+//! destroyed, the string (with its allocation) goes back to the pool of the thread that destroyed it, instead
+//! of being freed. Each thread keeps at most kMaxPooled buffers. take_small() does the same with smaller
+//! buffers, for headers: a header that waits in a queue shouldn't pin a whole datagram's worth of memory.
+class BufferPool
+{
+public:
+  static constexpr size_t kBufferSize = 16384; //!< Room in each buffer (as much as FileDescriptor::read reads)
+  static constexpr size_t kMaxPooled = 1024;   //!< Buffers each thread keeps for reuse
+  static constexpr size_t kSmallBufferSize = 512; //!< Room in each small buffer (headers, and a small payload)
+  static constexpr size_t kMaxPooledSmall = 4096; //!< Small buffers each thread keeps for reuse
+
+  //! An empty buffer with room for kBufferSize bytes, from this thread's pool if possible
+  static Ref<std::string> take();
+
+  //! An empty buffer with room for kSmallBufferSize bytes (e.g. to serialize headers into), from this thread's
+  //! pool if possible
+  static Ref<std::string> take_small();
+
+  //! Buffers for reading one datagram with FileDescriptor::read( buffers ): one sized to each header (small
+  //! ones), so that parsing consumes them whole, plus an empty one for the payload
+  static std::vector<Ref<std::string>> take_for_headers( std::initializer_list<size_t> header_lengths );
+
+  struct Stats
+  {
+    uint64_t allocated; //!< Buffers allocated because the pool was empty
+    uint64_t reused;    //!< Buffers taken from the pool
+    uint64_t discarded; //!< Buffers freed because the pool was full (or they had grown too large)
+    size_t pooled;      //!< Buffers in the pool now (of either size)
+  };
+
+  //! This thread's counters
+  static Stats stats();
+
+private:
+  static void give_back( std::string& buffer ) noexcept;
+};
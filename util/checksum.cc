@@ -0,0 +1,264 @@
+#include "checksum.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+#if defined( __x86_64__ )
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Each kernel returns the sum of the buffer's 16-bit words, as loaded in the machine's own byte order (and with
+// an odd last byte padded by a zero byte after it). The sum isn't folded: only its value modulo 0xffff, and
+// whether it is zero, matter to the one's-complement arithmetic. With `Copy`, a kernel also stores each word it
+// loads to `dest`, so copying the buffer costs no second pass over it.
+
+namespace {
+
+// (always inlined, so the vector kernels can finish with it without a call)
+template<bool Copy>
+[[gnu::always_inline]] inline uint64_t sum_scalar_inline( const uint8_t* data,
+                                                          size_t len,
+                                                          [[maybe_unused]] uint8_t* dest )
+{
+  uint64_t sum = 0;
+  for ( ; len >= 8; data += 8, len -= 8 ) {
+    uint64_t word {};
+    memcpy( &word, data, sizeof( word ) );
+    sum += ( word >> 32 ) + static_cast<uint32_t>( word ); // (a 32-bit word is congruent to its two halves' sum)
+    if constexpr ( Copy ) {
+      memcpy( dest, &word, sizeof( word ) );
+      dest += 8;
+    }
+  }
+  if ( len >= 4 ) {
+    uint32_t word {};
+    memcpy( &word, data, sizeof( word ) );
+    sum += word;
+    data += 4;
+    len -= 4;
+    if constexpr ( Copy ) {
+      memcpy( dest, &word, sizeof( word ) );
+      dest += 4;
+    }
+  }
+  if ( len >= 2 ) {
+    uint16_t word {};
+    memcpy( &word, data, sizeof( word ) );
+    sum += word;
+    data += 2;
+    len -= 2;
+    if constexpr ( Copy ) {
+      memcpy( dest, &word, sizeof( word ) );
+      dest += 2;
+    }
+  }
+  if ( len ) {
+    sum += endian::native == endian::little ? *data : *data << 8;
+    if constexpr ( Copy ) {
+      *dest = *data;
+    }
+  }
+  return sum;
+}
+
+template<bool Copy>
+uint64_t sum_scalar( const uint8_t* data, size_t len, uint8_t* dest )
+{
+  return sum_scalar_inline<Copy>( data, len, dest );
+}
+
+#if defined( __x86_64__ )
+
+// The vector kernels widen each 16-bit word into a 32-bit lane, where it adds at most 0xffff. After this many
+// steps (of two adds per lane) the lanes are added into the 64-bit sum, well before one could overflow.
+constexpr size_t kStepsPerFold = 16384;
+
+// (always inlined, so the AVX2 kernel can finish with it without a call, and without mixing in legacy SSE code)
+template<bool Copy>
+[[gnu::always_inline]] inline uint64_t sum_sse2_inline( const uint8_t* data,
+                                                        size_t len,
+                                                        [[maybe_unused]] uint8_t* dest )
+{
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t sum = 0;
+  while ( len >= 16 ) {
+    const size_t steps = min( len / 16, kStepsPerFold );
+    __m128i lanes = zero;
+    for ( size_t i = 0; i < steps; i++, data += 16 ) {
+      const __m128i words = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data ) );
+      lanes = _mm_add_epi32( lanes, _mm_unpacklo_epi16( words, zero ) );
+      lanes = _mm_add_epi32( lanes, _mm_unpackhi_epi16( words, zero ) );
+      if constexpr ( Copy ) {
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( dest ), words );
+        dest += 16;
+      }
+    }
+    len -= steps * 16;
+
+    alignas( 16 ) uint32_t lane_sums[4];
+    _mm_store_si128( reinterpret_cast<__m128i*>( lane_sums ), lanes );
+    for ( const uint32_t lane_sum : lane_sums ) {
+      sum += lane_sum;
+    }
+  }
+  return sum + sum_scalar_inline<Copy>( data, len, dest );
+}
+
+template<bool Copy>
+uint64_t sum_sse2( const uint8_t* data, size_t len, uint8_t* dest )
+{
+  return sum_sse2_inline<Copy>( data, len, dest );
+}
+
+template<bool Copy>
+__attribute__( ( target( "avx2" ) ) ) uint64_t sum_avx2( const uint8_t* data,
+                                                        size_t len,
+                                                        [[maybe_unused]] uint8_t* dest )
+{
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t sum = 0;
+  while ( len >= 64 ) {
+    const size_t steps = min( len / 64, kStepsPerFold / 2 );
+    __m256i lanes_a = zero;
+    __m256i lanes_b = zero;
+    for ( size_t i = 0; i < steps; i++, data += 64 ) {
+      const __m256i words_a = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( data ) );
+      const __m256i words_b = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( data + 32 ) );
+      lanes_a = _mm256_add_epi32( lanes_a, _mm256_unpacklo_epi16( words_a, zero ) );
+      lanes_b = _mm256_add_epi32( lanes_b, _mm256_unpackhi_epi16( words_a, zero ) );
+      lanes_a = _mm256_add_epi32( lanes_a, _mm256_unpacklo_epi16( words_b, zero ) );
+      lanes_b = _mm256_add_epi32( lanes_b, _mm256_unpackhi_epi16( words_b, zero ) );
+      if constexpr ( Copy ) {
+        _mm256_storeu_si256( reinterpret_cast<__m256i*>( dest ), words_a );
+        _mm256_storeu_si256( reinterpret_cast<__m256i*>( dest + 32 ), words_b );
+        dest += 64;
+      }
+    }
+    len -= steps * 64;
+
+    alignas( 32 ) uint32_t lane_sums[16];
+    _mm256_store_si256( reinterpret_cast<__m256i*>( lane_sums ), lanes_a );
+    _mm256_store_si256( reinterpret_cast<__m256i*>( lane_sums + 8 ), lanes_b );
+    for ( const uint32_t lane_sum : lane_sums ) {
+      sum += lane_sum;
+    }
+  }
+  return sum + sum_sse2_inline<Copy>( data, len, dest );
+}
+
+#endif
+
+// (`dest` is ignored by the kernels that don't copy)
+using SumFunction = uint64_t ( * )( const uint8_t*, size_t, uint8_t* );
+
+template<bool Copy>
+SumFunction sum_function( const InternetChecksum::Kernel kernel )
+{
+  switch ( kernel ) {
+#if defined( __x86_64__ )
+    case InternetChecksum::Kernel::SSE2:
+      return sum_sse2<Copy>;
+    case InternetChecksum::Kernel::AVX2:
+      return sum_avx2<Copy>;
+#endif
+    default:
+      return sum_scalar<Copy>;
+  }
+}
+
+// (constant-initialized, so add() works even before the best kernel has been selected below)
+InternetChecksum::Kernel active_kernel = InternetChecksum::Kernel::Scalar;
+SumFunction active_sum = sum_scalar<false>;
+SumFunction active_sum_copy = sum_scalar<true>;
+
+[[maybe_unused]] const bool best_kernel_selected = [] {
+  for ( const auto kernel : { InternetChecksum::Kernel::AVX2, InternetChecksum::Kernel::SSE2 } ) {
+    if ( InternetChecksum::supported( kernel ) ) {
+      InternetChecksum::use_kernel( kernel );
+      break;
+    }
+  }
+  return true;
+}();
+
+// Buffers shorter than this (e.g. a lone header) are summed without the indirect call
+constexpr size_t kShortBuffer = 64;
+
+} // namespace
+
+void InternetChecksum::add( const string_view data )
+{
+  if ( data.empty() ) {
+    return;
+  }
+
+  const auto* bytes = reinterpret_cast<const uint8_t*>( data.data() );
+  accumulate( data.size() < kShortBuffer ? sum_scalar<false>( bytes, data.size(), nullptr )
+                                         : active_sum( bytes, data.size(), nullptr ),
+              data.size() );
+}
+
+void InternetChecksum::add_and_append( const string_view data, string& out )
+{
+  if ( data.empty() ) {
+    return;
+  }
+
+  const size_t offset = out.size();
+  out.resize( offset + data.size() );
+  const auto* bytes = reinterpret_cast<const uint8_t*>( data.data() );
+  auto* dest = reinterpret_cast<uint8_t*>( out.data() + offset );
+  accumulate( data.size() < kShortBuffer ? sum_scalar<true>( bytes, data.size(), dest )
+                                         : active_sum_copy( bytes, data.size(), dest ),
+              data.size() );
+}
+
+void InternetChecksum::accumulate( uint64_t sum, const size_t size )
+{
+  while ( sum > 0xffff ) {
+    sum = ( sum >> 16 ) + static_cast<uint16_t>( sum );
+  }
+
+  // Swapping a folded sum's bytes swaps the bytes of every word summed. The checksum's words are big-endian,
+  // and a buffer that starts at an odd offset (after an odd amount of data) has its words shifted by a byte.
+  const bool swap = ( endian::native == endian::little ) != parity_;
+  sum_ += swap ? static_cast<uint16_t>( ( sum << 8 ) | ( sum >> 8 ) ) : sum;
+  parity_ = parity_ != ( size % 2 == 1 );
+}
+
+InternetChecksum::Kernel InternetChecksum::kernel()
+{
+  return active_kernel;
+}
+
+bool InternetChecksum::supported( const Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Scalar:
+      return true;
+#if defined( __x86_64__ )
+    case Kernel::SSE2:
+      return true; // (part of x86-64)
+    case Kernel::AVX2:
+      __builtin_cpu_init(); // (needed when called before main(), as when the best kernel is selected)
+      return __builtin_cpu_supports( "avx2" );
+#endif
+    default:
+      return false;
+  }
+}
+
+void InternetChecksum::use_kernel( const Kernel kernel )
+{
+  if ( not supported( kernel ) ) {
+    throw runtime_error( "InternetChecksum: kernel not supported by this CPU" );
+  }
+  active_kernel = kernel;
+  active_sum = sum_function<false>( kernel );
+  active_sum_copy = sum_function<true>( kernel );
+}
@@ -2,31 +2,39 @@
 
 #include <cstdint>
 #include <ranges>
+#include <string>
+#include <string_view>
 
 //! The internet checksum algorithm
+//! \details add() sums the data a machine word (or vector register) at a time, using the widest kernel the CPU
+//! supports, and tracks whether the data so far had an odd length, so the data can arrive split anywhere.
 class InternetChecksum
 {
 private:
-  uint32_t sum_;
+  uint64_t sum_;
   bool parity_ {};
 
+  void accumulate( uint64_t sum, size_t size ); // folds in a kernel's (unfolded) sum of `size` bytes
+
 public:
-  explicit InternetChecksum( const uint32_t sum = 0 ) : sum_( sum ) {}
-  void add( std::string_view data )
+  //! The loops that can sum a buffer's 16-bit words (chosen at startup by what the CPU supports)
+  enum class Kernel : uint8_t
   {
-    for ( const uint8_t i : data ) {
-      uint16_t val = i;
-      if ( not parity_ ) {
-        val <<= 8;
-      }
-      sum_ += val;
-      parity_ = !parity_;
-    }
-  }
+    Scalar, //!< 64 bits at a time
+    SSE2,   //!< 128 bits at a time (x86-64 only)
+    AVX2,   //!< 256 bits at a time (x86-64 only)
+  };
+
+  explicit InternetChecksum( const uint32_t sum = 0 ) : sum_( sum ) {}
+  void add( std::string_view data );
+
+  //! Adds `data` while appending it to `out`, reading it only once (so a payload can be checksummed as it is
+  //! assembled, instead of being summed again afterwards)
+  void add_and_append( std::string_view data, std::string& out );
 
   uint16_t value() const
   {
-    uint32_t ret = sum_;
+    uint64_t ret = sum_;
 
     while ( ret > 0xffff ) {
       ret = ( ret >> 16 ) + static_cast<uint16_t>( ret );
@@ -35,10 +43,22 @@ public:
     return ~ret;
   }
 
+  //! The folded sum itself, i.e. the complement of value() (a partial checksum, to add to a later one)
+  uint16_t partial() const { return ~value(); }
+
   void add( std::ranges::range auto&& data )
   {
     for ( const auto& x : data ) {
       add( std::string_view { x } );
     }
   }
+
+  //! The kernel add() uses
+  static Kernel kernel();
+
+  //! Whether this CPU can run `kernel`
+  static bool supported( Kernel kernel );
+
+  //! Makes add() use `kernel` from now on (for tests and benchmarks; not thread-safe)
+  static void use_kernel( Kernel kernel );
 };
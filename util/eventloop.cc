@@ -1,27 +1,237 @@
 #include "eventloop.hh"
 #include "exception.hh"
+#include "work_stealing_executor.hh"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 
 using namespace std;
 
+namespace {
+atomic<bool> profile_new_loops {};            // NOLINT(*-avoid-non-const-global-variables)
+atomic<uint64_t> profile_dump_requests {};    // NOLINT(*-avoid-non-const-global-variables)
+static_assert( atomic<uint64_t>::is_always_lock_free, "the signal handler needs a lock-free counter" );
+
+const string one_event { "\x01\0\0\0\0\0\0\0", sizeof( uint64_t ) }; // NOLINT(*-throwing-static-initialization)
+
+void request_profile_dump( int /* signum */ )
+{
+  profile_dump_requests.fetch_add( 1, memory_order_relaxed );
+}
+
+//! Like CheckSystemCall, but a wait interrupted by a signal (such as a profile dump request) counts as a timeout
+int CheckWait( const string_view attempt, const int return_value )
+{
+  if ( return_value < 0 and errno == EINTR ) {
+    return 0;
+  }
+  return CheckSystemCall( attempt, return_value );
+}
+} // namespace
+
 unsigned int EventLoop::FDRule::service_count() const
 {
   return direction == Direction::In ? fd.read_count() : fd.write_count();
 }
 
+EventLoop::EventLoop( const Backend backend )
+  : _backend( backend )
+  , _profiling( profile_new_loops.load() )
+  , _profile_dumps_seen( profile_dump_requests.load() )
+{
+  _rule_categories.reserve( 64 );
+  if ( _backend == Backend::Epoll ) {
+    _epoll_fd.emplace( CheckSystemCall( "epoll_create1", ::epoll_create1( EPOLL_CLOEXEC ) ) );
+  } else if ( _backend == Backend::IoUring ) {
+    if ( IoUring::supported() ) {
+      _ring = make_unique<IoUring>( 256 );
+    } else {
+      _backend = Backend::Poll;
+    }
+  }
+}
+
+EventLoop::~EventLoop()
+{
+  if ( _profiling ) {
+    print_profile( cerr );
+  }
+
+  // coroutines still waiting for something will never get it
+  for ( void* const task : _tasks ) {
+    Task::Handle::from_address( task ).destroy();
+  }
+}
+
 size_t EventLoop::add_category( const string& name )
 {
   if ( _rule_categories.size() >= _rule_categories.capacity() ) {
     throw runtime_error( "maximum categories reached" );
   }
 
-  _rule_categories.push_back( { name } );
+  _rule_categories.emplace_back( name, _default_budget );
   return _rule_categories.size() - 1;
 }
 
+void EventLoop::set_default_budget( const unsigned max_callbacks )
+{
+  if ( max_callbacks == 0 ) {
+    throw out_of_range( "category budget must be at least one callback" );
+  }
+  _default_budget = max_callbacks;
+  for ( auto& category : _rule_categories ) {
+    category.budget = max_callbacks;
+  }
+}
+
+size_t EventLoop::category_named( const string& name )
+{
+  for ( size_t i = 0; i < _rule_categories.size(); i++ ) {
+    if ( _rule_categories[i].name == name ) {
+      return i;
+    }
+  }
+  return add_category( name );
+}
+
+void EventLoop::set_category_budget( const size_t category_id, const unsigned max_callbacks )
+{
+  if ( max_callbacks == 0 ) {
+    throw out_of_range( "category budget must be at least one callback" );
+  }
+  _rule_categories.at( category_id ).budget = max_callbacks;
+}
+
+EventLoop::CategoryStats EventLoop::category_stats( const size_t category_id ) const
+{
+  const RuleCategory& category = _rule_categories.at( category_id );
+  return { category.name,           category.callbacks, category.time,
+           category.budget_exhausted, category.max_time,  category.latency };
+}
+
+void EventLoop::enable_profiling( const int dump_signal )
+{
+  struct sigaction action {};
+  action.sa_handler = request_profile_dump;
+  action.sa_flags = SA_RESTART;
+  CheckSystemCall( "sigemptyset", sigemptyset( &action.sa_mask ) );
+  CheckSystemCall( "sigaction", sigaction( dump_signal, &action, nullptr ) );
+  profile_new_loops = true;
+}
+
+void EventLoop::print_profile( ostream& out ) const
+{
+  if ( _waits == 0 and _rule_categories.empty() ) {
+    return; // (moved from)
+  }
+
+  const auto us = []( const auto nanoseconds ) { return static_cast<double>( nanoseconds ) / 1000.0; };
+
+  // build the whole report first, so that loops on different threads don't interleave their lines
+  ostringstream report;
+  report << fixed << setprecision( 1 ) << "EventLoop profile: " << _waits << " waits, "
+         << chrono::duration<double, milli>( _wait_time ).count() << " ms waiting\n";
+  report << "  " << left << setw( 44 ) << "category" << right << setw( 10 ) << "callbacks" << setw( 11 )
+         << "total ms" << setw( 10 ) << "mean us" << setw( 10 ) << "p50 us" << setw( 10 ) << "p99 us"
+         << setw( 11 ) << "max us" << "\n";
+  for ( const auto& category : _rule_categories ) {
+    if ( category.callbacks == 0 ) {
+      continue;
+    }
+    const chrono::duration<double, milli> total = category.time;
+    const chrono::duration<double, micro> max_time = category.max_time;
+    report << "  " << left << setw( 44 ) << category.name << right << setw( 10 ) << category.callbacks
+           << setw( 11 ) << total.count() << setw( 10 )
+           << total.count() * 1000.0 / static_cast<double>( category.callbacks ) << setw( 10 )
+           << us( category.latency.percentile( 0.5 ) ) << setw( 10 ) << us( category.latency.percentile( 0.99 ) )
+           << setw( 11 ) << max_time.count() << "\n";
+  }
+  out << report.str() << flush;
+}
+
+void EventLoop::set_executor( WorkStealingExecutor& executor )
+{
+  _executor = &executor;
+  if ( _offloaded ) {
+    return;
+  }
+
+  _offloaded = make_shared<OffloadQueue>(
+    FileDescriptor { CheckSystemCall( "eventfd", ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) } );
+  add_rule(
+    "offloaded work",
+    _offloaded->wakeup,
+    Direction::In,
+    [this] { _run_completions(); },
+    [this] { return _offloads_outstanding > 0; } );
+}
+
+void EventLoop::offload( const uint64_t key, CallbackT work, CallbackT then )
+{
+  if ( not _executor ) {
+    work();
+    then();
+    return;
+  }
+
+  ++_offloads_outstanding;
+  _executor->submit( key, [queue = _offloaded, work = move( work ), then = move( then )]() mutable {
+    CallbackT completion;
+    try {
+      work();
+      completion = move( then );
+    } catch ( ... ) {
+      completion = [error = current_exception()] { rethrow_exception( error ); };
+    }
+
+    bool was_empty {};
+    {
+      const lock_guard lock { queue->mutex };
+      was_empty = queue->done.empty();
+      queue->done.push_back( move( completion ) );
+    }
+
+    // the loop takes every completion on each wakeup, so only the first one needs to signal it
+    if ( was_empty ) {
+      queue->wakeup.write( one_event );
+    }
+  } );
+}
+
+void EventLoop::_run_completions()
+{
+  string counter( sizeof( uint64_t ), 0 );
+  _offloaded->wakeup.read( counter );
+  {
+    const lock_guard lock { _offloaded->mutex };
+    move( _offloaded->done.begin(), _offloaded->done.end(), back_inserter( _completions ) );
+    _offloaded->done.clear();
+  }
+
+  while ( not _completions.empty() ) {
+    const CallbackT completion = move( _completions.front() );
+    _completions.pop_front();
+    --_offloads_outstanding;
+    try {
+      completion();
+    } catch ( ... ) {
+      if ( not _completions.empty() ) {
+        _offloaded->wakeup.write( one_event ); // (run the rest on the next call)
+      }
+      throw;
+    }
+  }
+}
+
 EventLoop::BasicRule::BasicRule( size_t s_category_id, InterestT s_interest, CallbackT s_callback )
   : category_id( s_category_id ), interest( move( s_interest ) ), callback( move( s_callback ) )
 {}
@@ -38,6 +248,10 @@ EventLoop::FDRule::FDRule( BasicRule&& base,
   , error( move( s_error ) )
 {}
 
+EventLoop::TimerRule::TimerRule( BasicRule&& base, Clock::time_point s_deadline, Clock::duration s_period )
+  : BasicRule( move( base ) ), deadline( s_deadline ), period( s_period )
+{}
+
 EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
                                            FileDescriptor& fd,
                                            Direction direction,
@@ -50,10 +264,17 @@ EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
     throw out_of_range( "bad category_id" );
   }
 
-  _fd_rules.emplace_back( make_shared<FDRule>(
-    BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel, error ) );
+  auto rule = make_shared<FDRule>(
+    BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel, error );
+
+  if ( _backend != Backend::Poll ) {
+    rule->cancel_queue = _cancelled;
+    _register( rule );
+  } else {
+    _fd_rules.push_back( rule );
+  }
 
-  return RuleHandle { _fd_rules.back() };
+  return RuleHandle { rule };
 }
 
 EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
@@ -69,50 +290,419 @@ EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
   return RuleHandle { _non_fd_rules.back() };
 }
 
+EventLoop::RuleHandle EventLoop::add_flush_rule( const size_t category_id, FileDescriptor& fd )
+{
+  auto queued = make_shared<FileDescriptor>( fd.duplicate() );
+  return add_rule(
+    category_id,
+    fd,
+    Direction::Out,
+    [queued] { queued->flush_writes(); },
+    [queued] { return queued->queued_writes() > 0; } );
+}
+
+EventLoop::TimerHandle EventLoop::add_timer( const size_t category_id,
+                                             const Clock::time_point deadline,
+                                             const CallbackT& callback,
+                                             const Clock::duration period )
+{
+  if ( category_id >= _rule_categories.size() ) {
+    throw out_of_range( "bad category_id" );
+  }
+  if ( period < Clock::duration::zero() ) {
+    throw out_of_range( "negative timer period" );
+  }
+
+  auto rule = make_shared<TimerRule>( BasicRule { category_id, [] { return true; }, callback }, deadline, period );
+  rule->cancel_queue = _cancelled_timers;
+  _timer_rules.insert( rule );
+  _timers.push( { deadline, rule->generation, rule } );
+
+  return TimerHandle { rule };
+}
+
+void EventLoop::reschedule_timer( const TimerHandle& timer, const Clock::time_point deadline )
+{
+  const shared_ptr<TimerRule> rule = timer.timer_weak_ptr_.lock();
+  if ( not rule or rule->cancel_requested ) {
+    return;
+  }
+
+  rule->deadline = deadline;
+  rule->armed = true;
+  _timers.push( { deadline, ++rule->generation, rule } );
+}
+
 void EventLoop::RuleHandle::cancel()
 {
   const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
-  if ( rule_shared_ptr ) {
+  if ( rule_shared_ptr and not rule_shared_ptr->cancel_requested ) {
     rule_shared_ptr->cancel_requested = true;
+    if ( const auto cancel_queue = rule_shared_ptr->cancel_queue.lock() ) {
+      cancel_queue->push_back( rule_shared_ptr );
+    }
+  }
+}
+
+void EventLoop::spawn( Task&& task )
+{
+  const Task::Handle handle = task.release();
+  if ( not handle ) {
+    return;
+  }
+
+  handle.promise().loop = this;
+  _tasks.insert( handle.address() );
+  handle.resume();
+  _reap_tasks();
+}
+
+void EventLoop::Sleep::await_suspend( const coroutine_handle<> coroutine ) const
+{
+  loop.resume_at( Clock::now() + duration, coroutine );
+}
+
+void EventLoop::resume_when_ready( FileDescriptor& fd,
+                                   const Direction direction,
+                                   const coroutine_handle<> coroutine )
+{
+  auto& category = direction == Direction::In ? _readable_category : _writable_category;
+  if ( not category ) {
+    category = add_category( direction == Direction::In ? "resume coroutine (readable)"
+                                                        : "resume coroutine (writable)" );
+  }
+
+  // a one-shot rule: whatever happens to the fd first (ready, hangup or error) resumes the coroutine, which
+  // then finds out by reading or writing
+  struct Waiter
+  {
+    coroutine_handle<> coroutine;
+    optional<RuleHandle> rule {};
+  };
+  auto waiter = make_shared<Waiter>( coroutine );
+  const auto resume = [waiter] {
+    if ( waiter->coroutine ) {
+      waiter->rule->cancel();
+      exchange( waiter->coroutine, {} ).resume();
+    }
+  };
+  waiter->rule = add_rule(
+    *category, fd, direction, resume, [waiter] { return static_cast<bool>( waiter->coroutine ); }, resume, resume );
+}
+
+void EventLoop::resume_at( const Clock::time_point deadline, const coroutine_handle<> coroutine )
+{
+  if ( not _sleep_category ) {
+    _sleep_category = add_category( "resume coroutine (timer)" );
   }
+
+  auto timer = make_shared<optional<TimerHandle>>();
+  *timer = add_timer( *_sleep_category, deadline, [timer, coroutine] {
+    timer->value().cancel();
+    coroutine.resume();
+  } );
+}
+
+void EventLoop::_task_finished( const Task::Handle task ) noexcept
+{
+  _finished_tasks.push_back( task );
+}
+
+//! Destroy the spawned tasks that have finished, and rethrow the first exception one of them threw
+void EventLoop::_reap_tasks()
+{
+  exception_ptr error;
+  for ( const auto task : _finished_tasks ) {
+    if ( not error ) {
+      error = task.promise().exception;
+    }
+    _tasks.erase( task.address() );
+    task.destroy();
+  }
+  _finished_tasks.clear();
+
+  if ( error ) {
+    rethrow_exception( error );
+  }
+}
+
+EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
+{
+  const Result result = _wait_next_event( timeout_ms );
+  if ( not _finished_tasks.empty() ) {
+    _reap_tasks();
+  }
+  return result;
 }
 
 // NOLINTBEGIN(*-cognitive-complexity)
 // NOLINTBEGIN(*-signed-bitwise)
-EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
+EventLoop::Result EventLoop::_wait_next_event( const int timeout_ms )
 {
+  if ( _profiling and _profile_dumps_seen != profile_dump_requests.load( memory_order_relaxed ) ) {
+    _profile_dumps_seen = profile_dump_requests.load( memory_order_relaxed );
+    print_profile( cerr );
+  }
+
+  if ( _scheduling == Scheduling::Fair ) {
+    return _wait_fair( timeout_ms );
+  }
+
   // first, handle the non-file-descriptor-related rules
-  {
-    for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
-      auto& this_rule = **it;
-      bool rule_fired = false;
+  if ( _service_non_fd_rules() ) {
+    return Result::Success; /* only serve one rule on each iteration */
+  }
 
-      if ( this_rule.cancel_requested ) {
-        it = _non_fd_rules.erase( it );
-        continue;
-      }
+  // then any timer that has expired
+  if ( _service_due_timer() ) {
+    return Result::Success;
+  }
+
+  // now the file-descriptor-related rules, waiting no later than the next timer's deadline
+  const Result result = _wait_fds( _timeout_until_next_timer( timeout_ms ) );
+  if ( result == Result::Timeout and _service_due_timer() ) {
+    return Result::Success;
+  }
 
-      uint8_t iterations = 0;
-      while ( this_rule.interest() ) {
-        if ( iterations++ >= 128 ) {
-          throw runtime_error( "EventLoop: busy wait detected: rule \""
-                               + _rule_categories.at( this_rule.category_id ).name + "\" is still interested after "
-                               + to_string( iterations ) + " iterations" );
-        }
+  return result;
+}
 
-        rule_fired = true;
-        this_rule.callback();
-      }
+//! Wait for (and service) the fd rules with the chosen backend
+EventLoop::Result EventLoop::_wait_fds( const int timeout_ms )
+{
+  Result result {};
+  switch ( _backend ) {
+    case Backend::Epoll:
+      result = _wait_epoll( timeout_ms );
+      break;
+    case Backend::IoUring:
+      result = _wait_io_uring( timeout_ms );
+      break;
+    default:
+      result = _wait_poll( timeout_ms );
+  }
 
-      if ( rule_fired ) {
-        return Result::Success; /* only serve one rule on each iteration */
+  if ( result == Result::Exit and _next_timer() ) {
+    // no file descriptors to wait for, but a timer is still armed
+    const auto wait_start = Clock::now();
+    CheckWait( "poll", ::poll( nullptr, 0, timeout_ms ) );
+    _count_wait( wait_start );
+    result = Result::Timeout;
+  }
+
+  return result;
+}
+
+//! wait_next_event with Scheduling::Fair
+EventLoop::Result EventLoop::_wait_fair( const int timeout_ms )
+{
+  for ( auto& category : _rule_categories ) {
+    category.used = 0;
+  }
+
+  bool executed = _service_non_fd_rules_fair();
+  while ( _service_due_timer() ) {
+    executed = true;
+  }
+
+  // if anything ran, just collect the fds that are already ready (the non-fd rules may have more to do)
+  Result result = _wait_fds( executed ? 0 : _timeout_until_next_timer( timeout_ms ) );
+  while ( result == Result::Timeout and _service_due_timer() ) {
+    result = Result::Success;
+  }
+
+  return executed ? Result::Success : result;
+}
+
+//! (Fair) Can a callback of this category run in the current call to wait_next_event?
+bool EventLoop::_take_budget( const size_t category_id )
+{
+  if ( _scheduling != Scheduling::Fair ) {
+    return true;
+  }
+
+  RuleCategory& category = _rule_categories.at( category_id );
+  if ( category.used >= category.budget ) {
+    if ( category.used++ == category.budget ) {
+      ++category.budget_exhausted; // count each call to wait_next_event once
+    }
+    return false;
+  }
+
+  ++category.used;
+  return true;
+}
+
+//! Execute a rule's callback, and account for it in the rule's category
+void EventLoop::_execute( const BasicRule& rule )
+{
+  const auto start = Clock::now();
+  rule.callback();
+  const auto elapsed = Clock::now() - start;
+  RuleCategory& category = _rule_categories.at( rule.category_id );
+  ++category.callbacks;
+  category.time += elapsed;
+  if ( _profiling ) {
+    category.max_time = max( category.max_time, elapsed );
+    category.latency.record( chrono::duration_cast<chrono::nanoseconds>( elapsed ).count() );
+  }
+}
+
+void EventLoop::_count_wait( const Clock::time_point start )
+{
+  ++_waits;
+  _wait_time += Clock::now() - start;
+}
+
+//! The earliest armed timer, or nullptr if there is none (discards queue entries that are out of date)
+const EventLoop::TimerEntry* EventLoop::_next_timer()
+{
+  vector<shared_ptr<BasicRule>> cancelled;
+  swap( cancelled, *_cancelled_timers );
+  for ( const auto& rule : cancelled ) {
+    _timer_rules.erase( static_pointer_cast<TimerRule>( rule ) );
+  }
+
+  while ( not _timers.empty() ) {
+    const TimerEntry& entry = _timers.top();
+    if ( entry.rule->armed and not entry.rule->cancel_requested and entry.generation == entry.rule->generation ) {
+      return &entry;
+    }
+    _timers.pop();
+  }
+  return nullptr;
+}
+
+bool EventLoop::_service_due_timer()
+{
+  const TimerEntry* entry = _next_timer();
+  if ( not entry or entry->deadline > Clock::now() or not _take_budget( entry->rule->category_id ) ) {
+    return false;
+  }
+
+  const shared_ptr<TimerRule> rule = entry->rule;
+  _timers.pop();
+  if ( rule->period > Clock::duration::zero() ) {
+    // a periodic timer that fell more than a period behind skips the expirations it missed
+    rule->deadline = max( rule->deadline + rule->period, Clock::now() );
+    _timers.push( { rule->deadline, rule->generation, rule } );
+  } else {
+    rule->armed = false;
+  }
+
+  _execute( *rule );
+  return true; /* only serve one rule on each iteration */
+}
+
+//! Shorten `timeout_ms` (negative means forever) so the wait ends by the next timer's deadline
+int EventLoop::_timeout_until_next_timer( const int timeout_ms )
+{
+  const TimerEntry* entry = _next_timer();
+  if ( not entry ) {
+    return timeout_ms;
+  }
+
+  // round up, so the timer has expired by the time the wait ends
+  const auto remaining = chrono::ceil<chrono::milliseconds>( entry->deadline - Clock::now() ).count();
+  const int timer_ms = static_cast<int>( clamp<int64_t>( remaining, 0, INT32_MAX ) );
+  return timeout_ms < 0 ? timer_ms : min( timeout_ms, timer_ms );
+}
+
+bool EventLoop::_service_non_fd_rules()
+{
+  for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
+    auto& this_rule = **it;
+    bool rule_fired = false;
+
+    if ( this_rule.cancel_requested ) {
+      it = _non_fd_rules.erase( it );
+      continue;
+    }
+
+    uint8_t iterations = 0;
+    while ( this_rule.interest() ) {
+      if ( iterations++ >= 128 ) {
+        throw runtime_error( "EventLoop: busy wait detected: rule \""
+                             + _rule_categories.at( this_rule.category_id ).name + "\" is still interested after "
+                             + to_string( iterations ) + " iterations" );
       }
 
-      ++it;
+      rule_fired = true;
+      _execute( this_rule );
+    }
+
+    if ( rule_fired ) {
+      return true;
     }
+
+    ++it;
   }
 
-  // now the file-descriptor-related rules. poll any "interested" file descriptors
+  return false;
+}
+
+//! (Fair) Run each interested non-fd rule until it loses interest or its category's budget is used up
+//! \details A rule that ran moves to the back of the list, so the rules behind it go first next time
+//! (which matters once budgets run out).
+bool EventLoop::_service_non_fd_rules_fair()
+{
+  bool any_fired = false;
+  size_t remaining = _non_fd_rules.size();
+  for ( auto it = _non_fd_rules.begin(); remaining > 0 and it != _non_fd_rules.end(); remaining-- ) {
+    const shared_ptr<BasicRule> this_rule = *it;
+
+    if ( this_rule->cancel_requested ) {
+      it = _non_fd_rules.erase( it );
+      continue;
+    }
+
+    bool rule_fired = false;
+    while ( not this_rule->cancel_requested and this_rule->interest() and _take_budget( this_rule->category_id ) ) {
+      rule_fired = true;
+      _execute( *this_rule );
+    }
+
+    const auto next = std::next( it );
+    if ( rule_fired ) {
+      _non_fd_rules.splice( _non_fd_rules.end(), _non_fd_rules, it );
+      any_fired = true;
+    }
+    it = next;
+  }
+
+  return any_fired;
+}
+
+void EventLoop::_report_fd_error( const FDRule& rule ) const
+{
+  /* see if fd is a socket */
+  int socket_error = 0;
+  socklen_t optlen = sizeof( socket_error );
+  const int ret = getsockopt( rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
+  if ( ret == -1 and errno == ENOTSOCK ) {
+    cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( rule.category_id ).name
+         << "\"\n";
+  } else if ( ret == -1 ) {
+    throw unix_error( "getsockopt" );
+  } else if ( optlen != sizeof( socket_error ) ) {
+    throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
+  } else if ( socket_error ) {
+    cerr << "error on polled socket for rule \"" << _rule_categories.at( rule.category_id ).name
+         << "\": " << strerror( socket_error ) << "\n";
+  }
+}
+
+void EventLoop::_check_busy_wait( const FDRule& rule, const unsigned int count_before ) const
+{
+  if ( count_before == rule.service_count() and ( not rule.fd.closed() ) and rule.interest() ) {
+    throw runtime_error( "EventLoop: busy wait detected: rule \"" + _rule_categories.at( rule.category_id ).name
+                         + "\" did not read/write fd and is still interested" );
+  }
+}
+
+EventLoop::Result EventLoop::_wait_poll( const int timeout_ms )
+{
+  // poll any "interested" file descriptors
   vector<pollfd> pollfds {};
   pollfds.reserve( _fd_rules.size() );
   bool something_to_poll = false;
@@ -159,33 +749,29 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
   }
 
   // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
-  if ( 0 == CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) ) ) {
+  const auto wait_start = Clock::now();
+  const int ready_count = CheckWait( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) );
+  _count_wait( wait_start );
+  if ( ready_count == 0 ) {
     return Result::Timeout;
   }
 
-  // go through the poll results
-  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) ); it != _fd_rules.end(); ++idx ) {
+  // go through the poll results (rules added by a callback are at the end, and weren't polled)
+  vector<list<shared_ptr<FDRule>>::iterator> executed;
+  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) );
+        it != _fd_rules.end() and idx < pollfds.size();
+        ++idx ) {
     const auto& this_pollfd = pollfds.at( idx );
     auto& this_rule = **it;
 
+    if ( this_rule.cancel_requested ) {
+      ++it; // (cancelled by an earlier callback in this call; erased next time)
+      continue;
+    }
+
     const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
     if ( poll_error ) {
-      /* see if fd is a socket */
-      int socket_error = 0;
-      socklen_t optlen = sizeof( socket_error );
-      const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
-      if ( ret == -1 and errno == ENOTSOCK ) {
-        cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\"\n";
-      } else if ( ret == -1 ) {
-        throw unix_error( "getsockopt" );
-      } else if ( optlen != sizeof( socket_error ) ) {
-        throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
-      } else if ( socket_error ) {
-        cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\": " << strerror( socket_error ) << "\n";
-      }
-
+      _report_fd_error( this_rule );
       this_rule.error();
       this_rule.cancel();
       it = _fd_rules.erase( it );
@@ -204,24 +790,375 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
       continue;
     }
 
-    if ( poll_ready ) {
+    if ( poll_ready and _take_budget( this_rule.category_id ) ) {
       // we only want to call callback if revents includes the event we asked for
       const auto count_before = this_rule.service_count();
-      this_rule.callback();
+      _execute( this_rule );
+      _check_busy_wait( this_rule, count_before );
 
-      if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
-        throw runtime_error( "EventLoop: busy wait detected: rule \""
-                             + _rule_categories.at( this_rule.category_id ).name
-                             + "\" did not read/write fd and is still interested" );
+      if ( _scheduling == Scheduling::OneRule ) {
+        return Result::Success; /* only serve one rule on each iteration */
       }
+      executed.push_back( it );
+    }
+
+    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+  }
+
+  // (Fair) the rules that ran go to the back, behind those that were left for later
+  for ( const auto& it : executed ) {
+    _fd_rules.splice( _fd_rules.end(), _fd_rules, it );
+  }
+
+  return Result::Success;
+}
+
+//! \details Same rule semantics as the poll backend, but each fd stays registered with epoll between
+//! calls. A rule is "armed" (its direction is part of the fd's registration) while its interest() is
+//! true; once its fd is reported ready and interest() has turned false, it is disarmed and goes back
+//! to being re-checked on every call.
+EventLoop::Result EventLoop::_wait_epoll( const int timeout_ms )
+{
+  // quit if there is nothing left to wait for
+  if ( not _arm_interested_rules() ) {
+    return Result::Exit;
+  }
+
+  array<epoll_event, 64> events {};
+  const auto wait_start = Clock::now();
+  const int event_count = CheckWait(
+    "epoll_wait",
+    ::epoll_wait( _epoll_fd->fd_num(), events.data(), static_cast<int>( events.size() ), timeout_ms ) );
+  _count_wait( wait_start );
+  if ( event_count == 0 ) {
+    _sweep_registrations();
+    return Result::Timeout;
+  }
 
+  for ( int i = 0; i < event_count; i++ ) {
+    const bool executed = _service_ready_fd( events.at( i ).data.fd, events.at( i ).events );
+    if ( executed and _scheduling == Scheduling::OneRule ) {
       return Result::Success; /* only serve one rule on each iteration */
     }
+  }
 
-    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+  return Result::Success;
+}
+
+//! \details Each fd with armed rules has one outstanding one-shot IORING_OP_POLL_ADD. When it
+//! completes, the fd is re-armed on the next call, and the new poll is submitted by the same
+//! io_uring_enter that waits for the next completion. (A poll on an fd that is still ready completes
+//! right away, so the readiness semantics are the same as the level-triggered epoll backend.)
+EventLoop::Result EventLoop::_wait_io_uring( const int timeout_ms )
+{
+  // re-arm the fds whose polls completed during the previous call
+  vector<int> rearm;
+  swap( rearm, _rearm );
+  for ( const int fd_num : rearm ) {
+    const auto registration = _registrations.find( fd_num );
+    if ( registration != _registrations.end() ) {
+      _update_registration( fd_num, registration->second );
+    }
+  }
+
+  // quit if there is nothing left to wait for
+  if ( not _arm_interested_rules() ) {
+    return Result::Exit;
+  }
+
+  // completions of removed (or superseded) polls don't count as events, so keep waiting past them
+  const auto deadline = chrono::steady_clock::now() + chrono::milliseconds { max( timeout_ms, 0 ) };
+  vector<pair<int, uint32_t>> ready;
+  while ( ready.empty() ) {
+    int remaining_ms = -1;
+    if ( timeout_ms >= 0 ) {
+      const auto remaining = chrono::ceil<chrono::milliseconds>( deadline - chrono::steady_clock::now() );
+      remaining_ms = static_cast<int>( max( remaining.count(), int64_t { 0 } ) );
+    }
+
+    const auto wait_start = Clock::now();
+    const bool completed = _ring->submit_and_wait( 1, remaining_ms );
+    _count_wait( wait_start );
+    if ( not completed ) {
+      _sweep_registrations();
+      return Result::Timeout;
+    }
+
+    _ring->reap( [&]( const uint64_t user_data, const int32_t result ) {
+      const int fd_num = static_cast<int>( user_data & UINT32_MAX );
+      const auto registration = _registrations.find( fd_num );
+      if ( user_data == 0 or registration == _registrations.end() or registration->second.poll_id != user_data ) {
+        return;
+      }
+
+      // the one-shot poll is gone; the fd gets a new one on the next call if any rule is still armed
+      registration->second.poll_id = 0;
+      registration->second.events = 0;
+      _rearm.push_back( fd_num );
+      ready.emplace_back( fd_num, result < 0 ? EPOLLERR : static_cast<uint32_t>( result ) );
+    } );
+  }
+
+  for ( const auto& [fd_num, events] : ready ) {
+    if ( _service_ready_fd( fd_num, events ) and _scheduling == Scheduling::OneRule ) {
+      return Result::Success; /* only serve one rule on each iteration */
+    }
   }
 
   return Result::Success;
 }
+
+//! Forget externally cancelled rules and arm the disarmed rules that have become interested
+//! \returns true if any rule is armed
+bool EventLoop::_arm_interested_rules()
+{
+  // forget rules that were cancelled externally (without calling their cancellation callbacks)
+  vector<shared_ptr<BasicRule>> cancelled;
+  swap( cancelled, *_cancelled );
+  for ( const auto& rule : cancelled ) {
+    _deregister( static_cast<FDRule&>( *rule ) );
+  }
+
+  // arm the rules that have become interested
+  vector<shared_ptr<FDRule>> disarmed;
+  swap( disarmed, _disarmed );
+  for ( const auto& rule : disarmed ) {
+    if ( not rule->registered or rule->armed or _retire_if_defunct( rule ) ) {
+      continue;
+    }
+
+    if ( rule->interest() ) {
+      _set_armed( rule, true );
+    } else {
+      _disarmed.push_back( rule );
+    }
+  }
+
+  return _armed_count > 0;
+}
+
+//! Handle readiness `events` (an epoll/poll event mask) reported for `fd_num`
+//! \returns true if a rule's callback was executed (with Scheduling::Fair, every ready rule's callback is)
+bool EventLoop::_service_ready_fd( const int fd_num, const uint32_t events )
+{
+  bool executed = false;
+  const auto registration = _registrations.find( fd_num );
+  if ( registration == _registrations.end() ) {
+    return executed;
+  }
+
+  const vector<shared_ptr<FDRule>> rules = registration->second.rules;
+  for ( const auto& rule : rules ) {
+    if ( not rule->registered or rule->cancel_requested ) {
+      continue;
+    }
+
+    if ( events & EPOLLERR ) {
+      _report_fd_error( *rule );
+      rule->error();
+      rule->cancel();
+      _deregister( *rule );
+      continue;
+    }
+
+    const bool ready = rule->armed and ( events & ( rule->direction == Direction::In ? EPOLLIN : EPOLLOUT ) );
+    const bool hup = events & EPOLLHUP;
+    if ( hup and ( ( rule->armed and not ready ) or rule->direction == Direction::Out ) ) {
+      // same reasoning as the poll backend: this fd is defunct for this rule
+      rule->cancel();
+      _deregister( *rule );
+      continue;
+    }
+
+    if ( not ready ) {
+      continue;
+    }
+
+    // interest() was true when the rule was armed; it may not be anymore
+    if ( not rule->interest() ) {
+      _set_armed( rule, false );
+      continue;
+    }
+
+    if ( not _take_budget( rule->category_id ) ) {
+      continue; // (the fd will be reported ready again)
+    }
+
+    const auto count_before = rule->service_count();
+    _execute( *rule );
+    _check_busy_wait( *rule, count_before );
+    if ( rule->registered ) {
+      _retire_if_defunct( rule );
+    }
+
+    executed = true;
+    if ( _scheduling == Scheduling::OneRule ) {
+      break;
+    }
+  }
+
+  return executed;
+}
 // NOLINTEND(*-signed-bitwise)
 // NOLINTEND(*-cognitive-complexity)
+
+void EventLoop::_register( const shared_ptr<FDRule>& rule )
+{
+  const int fd_num = rule->fd.fd_num();
+  auto registration = _registrations.find( fd_num );
+
+  // the fd number may have been closed and reused while the old rules were still registered
+  if ( registration != _registrations.end() and registration->second.rules.front()->fd.closed() ) {
+    const vector<shared_ptr<FDRule>> stale = registration->second.rules;
+    for ( const auto& stale_rule : stale ) {
+      stale_rule->cancel();
+      _deregister( *stale_rule );
+    }
+    registration = _registrations.find( fd_num );
+  }
+
+  if ( registration == _registrations.end() ) {
+    if ( _epoll_fd.has_value() ) {
+      epoll_event event {};
+      event.data.fd = fd_num;
+      CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_ADD, fd_num, &event ) );
+    }
+    registration = _registrations.emplace( fd_num, Registration {} ).first;
+  }
+
+  registration->second.rules.push_back( rule );
+  rule->registered = true;
+  _disarmed.push_back( rule ); // its interest() will be checked on the next wait
+}
+
+void EventLoop::_deregister( FDRule& rule )
+{
+  if ( not rule.registered ) {
+    return;
+  }
+
+  rule.registered = false;
+  if ( rule.armed ) {
+    rule.armed = false;
+    --_armed_count;
+  }
+
+  const int fd_num = rule.fd.fd_num();
+  const auto registration = _registrations.find( fd_num );
+  if ( registration == _registrations.end() ) {
+    return;
+  }
+
+  auto& rules = registration->second.rules;
+  erase_if( rules, [&]( const shared_ptr<FDRule>& x ) { return x.get() == &rule; } );
+  if ( not rules.empty() ) {
+    _update_registration( fd_num, registration->second );
+    return;
+  }
+
+  if ( _ring ) {
+    _update_poll( fd_num, registration->second, 0 );
+  } else if ( not rule.fd.closed() ) {
+    // (a closed fd has already left the epoll set)
+    ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_DEL, fd_num, nullptr );
+  }
+  _registrations.erase( registration );
+}
+
+void EventLoop::_set_armed( const shared_ptr<FDRule>& rule, const bool armed )
+{
+  if ( rule->armed == armed ) {
+    return;
+  }
+
+  rule->armed = armed;
+  if ( armed ) {
+    ++_armed_count;
+  } else {
+    --_armed_count;
+    _disarmed.push_back( rule );
+  }
+
+  _update_registration( rule->fd.fd_num(), _registrations.at( rule->fd.fd_num() ) );
+}
+
+//! Tell epoll (or io_uring) about a change in the union of the armed rules' directions (if there is one)
+void EventLoop::_update_registration( const int fd_num, Registration& registration )
+{
+  uint32_t events = 0;
+  for ( const auto& rule : registration.rules ) {
+    if ( rule->armed ) {
+      events |= rule->direction == Direction::In ? EPOLLIN : EPOLLOUT;
+    }
+  }
+
+  if ( _ring ) {
+    _update_poll( fd_num, registration, events );
+    return;
+  }
+
+  if ( events == registration.events or registration.rules.front()->fd.closed() ) {
+    return;
+  }
+
+  epoll_event event {};
+  event.events = events;
+  event.data.fd = fd_num;
+  CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_MOD, fd_num, &event ) );
+  registration.events = events;
+}
+
+//! (io_uring) Replace the fd's outstanding poll (if any) with one for `events` (if any)
+void EventLoop::_update_poll( const int fd_num, Registration& registration, const uint32_t events )
+{
+  if ( events == registration.events and ( events == 0 or registration.poll_id != 0 ) ) {
+    return;
+  }
+
+  // each change costs up to two submissions; hand the queue to the kernel before it fills up
+  if ( _ring->space_left() < 2 ) {
+    _ring->submit_and_wait( 0 );
+  }
+
+  if ( registration.poll_id != 0 ) {
+    _ring->prepare_poll_remove( registration.poll_id, 0 );
+    registration.poll_id = 0;
+  }
+
+  registration.events = events;
+  if ( events != 0 and not registration.rules.empty() and not registration.rules.front()->fd.closed() ) {
+    if ( ++_poll_generation == 0 ) {
+      _poll_generation = 1; // (a user_data of 0 marks completions to ignore)
+    }
+    registration.poll_id = ( static_cast<uint64_t>( _poll_generation ) << 32 ) | static_cast<uint32_t>( fd_num );
+    _ring->prepare_poll_add( fd_num, events, registration.poll_id );
+  }
+}
+
+//! Cancel a rule whose fd has reached EOF (for reading) or been closed, like the poll backend does
+bool EventLoop::_retire_if_defunct( const shared_ptr<FDRule>& rule )
+{
+  if ( ( rule->direction == Direction::In and rule->fd.eof() ) or rule->fd.closed() ) {
+    rule->cancel();
+    _deregister( *rule );
+    return true;
+  }
+  return false;
+}
+
+//! Check every registered rule for cancellation, EOF or closure (only done when a wait times out)
+void EventLoop::_sweep_registrations()
+{
+  vector<shared_ptr<FDRule>> rules;
+  for ( const auto& [fd_num, registration] : _registrations ) {
+    rules.insert( rules.end(), registration.rules.begin(), registration.rules.end() );
+  }
+
+  for ( const auto& rule : rules ) {
+    if ( rule->cancel_requested ) {
+      _deregister( *rule );
+    } else if ( rule->registered ) {
+      _retire_if_defunct( rule );
+    }
+  }
+}
@@ -1,11 +1,26 @@
 #pragma once
 
+#include <chrono>
+#include <coroutine>
+#include <deque>
 #include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
 #include <poll.h>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "file_descriptor.hh"
+#include "io_uring.hh"
+#include "latency_histogram.hh"
+#include "task.hh"
+
+class WorkStealingExecutor;
 
 //! Waits for events on file descriptors and executes corresponding callbacks.
 class EventLoop
@@ -18,6 +33,45 @@ public:
     Out // Callback will be triggered when Rule::fd is writable.
   };
 
+  //! How the EventLoop waits for file descriptors, chosen at construction
+  enum class Backend : uint8_t
+  {
+    Poll, //!< Rebuild a pollfd array from every rule on each wait (cheap for a handful of fds)
+    Epoll, //!< Keep fds registered with a (level-triggered) epoll instance; a wakeup costs O(ready fds)
+    IoUring //!< Like Epoll, but with one-shot io_uring polls that are re-armed in the same system call
+            //!< as the wait (falls back to Poll if io_uring is unavailable)
+  };
+
+  //! Clock used for timer deadlines
+  using Clock = std::chrono::steady_clock;
+
+  //! How many ready rules one call to wait_next_event executes
+  enum class Scheduling : uint8_t
+  {
+    OneRule, //!< Execute the first ready rule found (the default)
+    Fair     //!< Execute every ready rule, within each category's budget, rotating which rules go first
+  };
+
+  //! Counters kept for each rule category
+  struct CategoryStats
+  {
+    std::string name;
+    uint64_t callbacks;        //!< Callbacks executed
+    Clock::duration time;      //!< Time spent executing those callbacks
+    uint64_t budget_exhausted; //!< (Fair) Calls to wait_next_event that left some of the category's work for later
+    Clock::duration max_time;  //!< (profiling) Longest callback
+    LatencyHistogram latency;  //!< (profiling) Callback durations, in nanoseconds
+  };
+
+  //! Returned by each call to EventLoop::wait_next_event.
+  enum class Result : uint8_t
+  {
+    Success, //!< At least one Rule was triggered.
+    Timeout, //!< No rules were triggered before timeout.
+    Exit     //!< All rules have been canceled or were uninterested; make no further calls to
+             //!< EventLoop::wait_next_event.
+  };
+
 private:
   using CallbackT = std::function<void( void )>;
   using InterestT = std::function<bool( void )>;
@@ -25,6 +79,15 @@ private:
   struct RuleCategory
   {
     std::string name;
+    unsigned budget { DEFAULT_BUDGET }; //!< (Fair) Most callbacks executed per call to wait_next_event
+    unsigned used {};                   //!< (Fair) Callbacks executed so far in this call to wait_next_event
+    uint64_t callbacks {};
+    Clock::duration time {};
+    uint64_t budget_exhausted {};
+    Clock::duration max_time {};
+    LatencyHistogram latency {};
+
+    RuleCategory( std::string s_name, unsigned s_budget ) : name( std::move( s_name ) ), budget( s_budget ) {}
   };
 
   struct BasicRule
@@ -34,6 +97,10 @@ private:
     CallbackT callback;
     bool cancel_requested {};
 
+    //! Timers, and fd rules with the epoll and io_uring backends, report their cancellation here so the
+    //! loop can forget them
+    std::weak_ptr<std::vector<std::shared_ptr<BasicRule>>> cancel_queue {};
+
     BasicRule( size_t s_category_id, InterestT s_interest, CallbackT s_callback );
   };
 
@@ -43,6 +110,8 @@ private:
     Direction direction; //!< Direction::In for reading from fd, Direction::Out for writing to fd.
     CallbackT cancel;    //!< A callback that is called when the rule is cancelled (e.g. on EOF or hangup)
     CallbackT error;     //!< A callback that is called when the fd has an error before cancellation
+    bool armed {};       //!< (epoll, io_uring) Is the rule's direction part of the fd's registration?
+    bool registered {};  //!< (epoll, io_uring) Is the rule still part of its fd's Registration?
 
     FDRule( BasicRule&& base, FileDescriptor&& s_fd, Direction s_direction, CallbackT s_cancel, CallbackT s_error );
 
@@ -51,24 +120,209 @@ private:
     unsigned int service_count() const;
   };
 
+  struct TimerRule : public BasicRule
+  {
+    Clock::time_point deadline; //!< When the timer next expires
+    Clock::duration period;     //!< Interval between expirations of a periodic timer (zero for a one-shot timer)
+    uint64_t generation {};     //!< Bumped whenever the timer is rescheduled, to invalidate older queue entries
+    bool armed { true };        //!< Is the timer waiting to expire? (a one-shot timer is disarmed once it fires)
+
+    TimerRule( BasicRule&& base, Clock::time_point s_deadline, Clock::duration s_period );
+  };
+
+  //! A timer's place in the timer queue (entries for cancelled or rescheduled timers are skipped when reached)
+  struct TimerEntry
+  {
+    Clock::time_point deadline;
+    uint64_t generation;
+    std::shared_ptr<TimerRule> rule;
+
+    bool operator>( const TimerEntry& other ) const { return deadline > other.deadline; }
+  };
+
+  //! (epoll, io_uring) All rules for one fd number, which epoll can only register once
+  struct Registration
+  {
+    std::vector<std::shared_ptr<FDRule>> rules {};
+    uint32_t events {};  //!< Events currently registered with epoll (union over armed rules)
+    uint64_t poll_id {}; //!< (io_uring) user_data of the outstanding one-shot poll, or 0 if there is none
+  };
+
   std::vector<RuleCategory> _rule_categories {};
-  std::list<std::shared_ptr<FDRule>> _fd_rules {};
+  std::list<std::shared_ptr<FDRule>> _fd_rules {}; // (poll backend)
   std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
+  std::unordered_set<std::shared_ptr<TimerRule>> _timer_rules {}; //!< Every timer that hasn't been cancelled
+  std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<>> _timers {};
+  std::shared_ptr<std::vector<std::shared_ptr<BasicRule>>> _cancelled_timers {
+    std::make_shared<std::vector<std::shared_ptr<BasicRule>>>() };
 
-public:
-  EventLoop() { _rule_categories.reserve( 64 ); }
+  Backend _backend;
+  Scheduling _scheduling { Scheduling::OneRule };
+  unsigned _default_budget { DEFAULT_BUDGET };
+  bool _profiling;
+  uint64_t _profile_dumps_seen {}; //!< Dump requests (see enable_profiling) already answered
+  uint64_t _waits {};              //!< Calls to poll, epoll_wait or io_uring_enter
+  Clock::duration _wait_time {};   //!< Time spent in those calls
+  std::optional<FileDescriptor> _epoll_fd {};
+  std::unique_ptr<IoUring> _ring {};
+  uint32_t _poll_generation {};   //!< (io_uring) distinguishes successive polls of the same fd number
+  std::vector<int> _rearm {};     //!< (io_uring) fds whose one-shot poll has completed
+  std::unordered_map<int, Registration> _registrations {};
+  std::vector<std::shared_ptr<FDRule>> _disarmed {}; //!< Rules whose interest() has to be re-checked each wait
+  size_t _armed_count {};
+  std::shared_ptr<std::vector<std::shared_ptr<BasicRule>>> _cancelled {
+    std::make_shared<std::vector<std::shared_ptr<BasicRule>>>() };
 
-  //! Returned by each call to EventLoop::wait_next_event.
-  enum class Result : uint8_t
+  //! Finished offloaded work, handed from the executor's threads to the loop's (shared, so that work
+  //! finishing after the loop is gone has somewhere to go)
+  struct OffloadQueue
   {
-    Success, //!< At least one Rule was triggered.
-    Timeout, //!< No rules were triggered before timeout.
-    Exit     //!< All rules have been canceled or were uninterested; make no further calls to
-             //!< EventLoop::wait_next_event.
+    FileDescriptor wakeup;           //!< eventfd that tells the loop's thread there are completions
+    std::mutex mutex {};             //!< Protects done
+    std::vector<CallbackT> done {};  //!< Completions not yet handed to the loop
+
+    explicit OffloadQueue( FileDescriptor&& s_wakeup ) : wakeup( std::move( s_wakeup ) ) {}
   };
 
+  WorkStealingExecutor* _executor {};
+  std::shared_ptr<OffloadQueue> _offloaded {};
+  std::deque<CallbackT> _completions {}; //!< Completions handed to the loop but not yet run
+  size_t _offloads_outstanding {};       //!< Offloaded work whose completion hasn't run yet
+
+  void _run_completions();
+
+  std::unordered_set<void*> _tasks {}; //!< Frame addresses of the spawned tasks that haven't finished
+  std::vector<Task::Handle> _finished_tasks {};
+  std::optional<size_t> _readable_category {};
+  std::optional<size_t> _writable_category {};
+  std::optional<size_t> _sleep_category {};
+
+  friend struct Task::FinalAwaiter;
+  void _task_finished( Task::Handle task ) noexcept;
+  void _reap_tasks();
+  Result _wait_next_event( int timeout_ms );
+
+  bool _service_non_fd_rules();
+  bool _service_non_fd_rules_fair();
+  bool _take_budget( size_t category_id );
+  void _execute( const BasicRule& rule );
+  Result _wait_fds( int timeout_ms );
+  void _count_wait( Clock::time_point start );
+  Result _wait_fair( int timeout_ms );
+  const TimerEntry* _next_timer();
+  bool _service_due_timer();
+  int _timeout_until_next_timer( int timeout_ms );
+  void _report_fd_error( const FDRule& rule ) const;
+  void _check_busy_wait( const FDRule& rule, unsigned int count_before ) const;
+  Result _wait_poll( int timeout_ms );
+  Result _wait_epoll( int timeout_ms );
+  Result _wait_io_uring( int timeout_ms );
+  bool _arm_interested_rules();
+  bool _service_ready_fd( int fd_num, uint32_t events );
+
+  void _register( const std::shared_ptr<FDRule>& rule );
+  void _deregister( FDRule& rule );
+  void _set_armed( const std::shared_ptr<FDRule>& rule, bool armed );
+  void _update_registration( int fd_num, Registration& registration );
+  void _update_poll( int fd_num, Registration& registration, uint32_t events );
+  bool _retire_if_defunct( const std::shared_ptr<FDRule>& rule );
+  void _sweep_registrations();
+
+public:
+  //! (Fair) Default number of callbacks per category per call to wait_next_event
+  static constexpr unsigned DEFAULT_BUDGET = 16;
+
+  explicit EventLoop( Backend backend = Backend::Poll );
+
+  //! Prints the loop's profile to stderr if profiling is on
+  ~EventLoop();
+
+  //! \name
+  //! Some rules (e.g. those of set_executor, add_flush_rule and spawn) refer to the loop itself, so it can be
+  //! neither copied nor moved
+  //!@{
+  EventLoop( const EventLoop& other ) = delete;
+  EventLoop& operator=( const EventLoop& other ) = delete;
+  EventLoop( EventLoop&& other ) = delete;
+  EventLoop& operator=( EventLoop&& other ) = delete;
+  //!@}
+
   size_t add_category( const std::string& name );
 
+  //! The first category called `name`, which is added if there is none (for rules that many connections
+  //! sharing one loop add over and over)
+  size_t category_named( const std::string& name );
+
+  //! Choose how many ready rules each call to wait_next_event executes
+  void set_scheduling( Scheduling scheduling ) { _scheduling = scheduling; }
+  Scheduling scheduling() const { return _scheduling; }
+
+  //! (Fair) Limit the callbacks executed for a category in each call to wait_next_event (at least one)
+  void set_category_budget( size_t category_id, unsigned max_callbacks );
+
+  //! (Fair) Set the budget of every category, including those added later
+  void set_default_budget( unsigned max_callbacks );
+
+  size_t category_count() const { return _rule_categories.size(); }
+  CategoryStats category_stats( size_t category_id ) const;
+
+  //! \brief Profile every EventLoop constructed from now on, and make `dump_signal` (e.g. SIGUSR1) print
+  //! their profiles to stderr
+  //! \details Each loop prints its profile the next time it wakes up after the signal arrives, and again
+  //! when it is destroyed. Installs a signal handler (with SA_RESTART) for `dump_signal`.
+  static void enable_profiling( int dump_signal );
+
+  //! Turn this loop's profiling on or off
+  //! \details Profiling adds a latency histogram and the maximum to each category's callback counters.
+  void set_profiling( bool profiling ) { _profiling = profiling; }
+  bool profiling() const { return _profiling; }
+
+  //! Time spent waiting in poll, epoll_wait or io_uring_enter
+  Clock::duration wait_time() const { return _wait_time; }
+
+  //! Print the wait time and, for each category that ran, its callback counters and latency percentiles
+  void print_profile( std::ostream& out ) const;
+
+  //! \brief Run offloaded work (see offload) on `executor`'s threads instead of this loop's
+  //! \details The executor must outlive the loop; it can serve many loops. Adds an "offloaded work" rule
+  //! that runs the completions on the loop's thread.
+  void set_executor( WorkStealingExecutor& executor );
+
+  //! \brief Run `work` on the executor, and then `then` on the loop's thread (from wait_next_event)
+  //! \details Work offloaded with the same `key` (e.g. a connection's FourTuple hash) runs one piece at a
+  //! time, in order, and so do the `then`s, while other keys' work runs in parallel. `work` must not touch
+  //! anything the loop's callbacks use; `then` may. If `work` throws, wait_next_event rethrows the exception
+  //! in place of `then`. Without an executor, `work` and `then` both run before offload returns.
+  void offload( uint64_t key, CallbackT work, CallbackT then );
+
+  //! Offloaded work whose `then` hasn't run yet (while there is some, the loop won't return Result::Exit)
+  size_t offloads_outstanding() const { return _offloads_outstanding; }
+
+  //! \brief Start `task`, which runs until it first suspends before spawn returns; the loop owns it from then on
+  //! \details An exception that escapes a spawned Task is rethrown by spawn or wait_next_event, whichever
+  //! was running when the Task ended. Tasks that never finish are destroyed with the loop. (The loop
+  //! must not be moved once it has tasks.)
+  void spawn( Task&& task );
+
+  //! Awaitable that suspends a Task for a while: `co_await loop.sleep( 10ms )`
+  struct Sleep
+  {
+    EventLoop& loop;
+    Clock::duration duration;
+
+    bool await_ready() const noexcept { return duration <= Clock::duration::zero(); }
+    void await_suspend( std::coroutine_handle<> coroutine ) const;
+    void await_resume() const noexcept {}
+  };
+  Sleep sleep( Clock::duration duration ) { return { *this, duration }; }
+
+  //! Resume `coroutine` once `fd` is ready for `direction`, has hung up, or has an error (see
+  //! FileDescriptor::async_read and async_write)
+  void resume_when_ready( FileDescriptor& fd, Direction direction, std::coroutine_handle<> coroutine );
+
+  //! Resume `coroutine` once the clock reaches `deadline`
+  void resume_at( Clock::time_point deadline, std::coroutine_handle<> coroutine );
+
   class RuleHandle
   {
     std::weak_ptr<BasicRule> rule_weak_ptr_;
@@ -81,6 +335,17 @@ public:
     void cancel();
   };
 
+  //! A RuleHandle for a timer, which can also be rescheduled
+  class TimerHandle : public RuleHandle
+  {
+    std::weak_ptr<TimerRule> timer_weak_ptr_;
+
+    friend class EventLoop;
+
+  public:
+    explicit TimerHandle( const std::shared_ptr<TimerRule>& x ) : RuleHandle( x ), timer_weak_ptr_( x ) {}
+  };
+
   RuleHandle add_rule(
     size_t category_id,
     FileDescriptor& fd,
@@ -93,15 +358,50 @@ public:
   RuleHandle
   add_rule( size_t category_id, const CallbackT& callback, const InterestT& interest = [] { return true; } );
 
-  //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+  //! Flushes `fd`'s write queue (see FileDescriptor::queue_write) whenever it has queued writes and is writable
+  RuleHandle add_flush_rule( size_t category_id, FileDescriptor& fd );
+
+  //! Calls `callback` once the clock reaches `deadline`, and then every `period` (if it is nonzero) after that
+  TimerHandle add_timer( size_t category_id,
+                         Clock::time_point deadline,
+                         const CallbackT& callback,
+                         Clock::duration period = Clock::duration::zero() );
+
+  //! Move the timer's next expiration to `deadline` (this re-arms a one-shot timer that has already fired)
+  void reschedule_timer( const TimerHandle& timer, Clock::time_point deadline );
+
+  //! Calls [poll(2)](\ref man2::poll), [epoll_wait(2)](\ref man2::epoll_wait) or
+  //! [io_uring_enter(2)](\ref man2::io_uring_enter) and then executes the callback of one ready rule.
+  //! \details With the epoll and io_uring backends, a rule whose interest() is true stays registered with epoll and
+  //! its interest() is only re-checked once its fd becomes ready; a rule whose interest() is false is
+  //! re-checked on every call. An fd closed outside of its rules' callbacks is noticed the next time
+  //! the wait times out (or when the rule is cancelled).
+  //!
+  //! If a timer expires first, the wait ends early and the timer's callback is executed instead. Armed
+  //! timers keep the EventLoop from returning Result::Exit.
+  //!
+  //! With Scheduling::Fair, one call executes every ready rule and expired timer instead, but no more
+  //! than its category's budget of callbacks per category. A non-fd rule that is still interested
+  //! after its budget is used up waits for the next call (rather than being reported as a busy wait),
+  //! and moves behind the other non-fd rules; fds are polled without waiting whenever a non-fd rule ran,
+  //! so a busy non-fd rule can't starve them.
   Result wait_next_event( int timeout_ms );
 
+  Backend backend() const { return _backend; }
+
   // convenience function to add category and rule at the same time
   template<typename... Targs>
   auto add_rule( const std::string& name, Targs&&... Fargs )
   {
     return add_rule( add_category( name ), std::forward<Targs>( Fargs )... );
   }
+
+  // convenience function to add category and timer at the same time
+  template<typename... Targs>
+  auto add_timer( const std::string& name, Targs&&... Fargs )
+  {
+    return add_timer( add_category( name ), std::forward<Targs>( Fargs )... );
+  }
 };
 
 using Direction = EventLoop::Direction;
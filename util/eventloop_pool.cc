@@ -0,0 +1,114 @@
+#include "eventloop_pool.hh"
+
+#include "exception.hh"
+
+#include <iostream>
+#include <string>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+namespace {
+const string one_event { "\x01\0\0\0\0\0\0\0", sizeof( uint64_t ) }; // NOLINT(*-throwing-static-initialization)
+}
+
+EventLoopPool::Shard::Shard( const EventLoop::Backend backend, FileDescriptor&& s_wakeup )
+  : loop( backend ), wakeup( move( s_wakeup ) )
+{
+  // a shard's loop is shared by many connections: service everything that is ready on each wakeup, with
+  // budgets sized for many rules per category
+  loop.set_scheduling( EventLoop::Scheduling::Fair );
+  loop.set_default_budget( SHARD_BUDGET );
+}
+
+EventLoopPool::EventLoopPool( const size_t threads, const EventLoop::Backend backend )
+{
+  if ( threads == 0 ) {
+    throw runtime_error( "EventLoopPool needs at least one thread" );
+  }
+
+  _shards.reserve( threads );
+  for ( size_t i = 0; i < threads; i++ ) {
+    FileDescriptor wakeup { CheckSystemCall( "eventfd", ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+    _shards.push_back( make_unique<Shard>( backend, move( wakeup ) ) );
+  }
+
+  for ( auto& shard : _shards ) {
+    shard->thread = thread( &EventLoopPool::_run, this, ref( *shard ) );
+  }
+}
+
+EventLoopPool::~EventLoopPool()
+{
+  try {
+    _stopping.store( true );
+    for ( auto& shard : _shards ) {
+      shard->wakeup.write( one_event );
+    }
+    for ( auto& shard : _shards ) {
+      if ( shard->thread.joinable() ) {
+        shard->thread.join();
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception destructing EventLoopPool: " << e.what() << "\n";
+  }
+}
+
+size_t EventLoopPool::default_threads()
+{
+  return max( 1U, thread::hardware_concurrency() );
+}
+
+void EventLoopPool::post( const size_t shard_index, Task&& task )
+{
+  Shard& shard = *_shards.at( shard_index );
+  bool was_empty {};
+  {
+    const lock_guard lock { shard.mutex };
+    was_empty = shard.inbox.empty();
+    shard.inbox.push_back( move( task ) );
+  }
+
+  // the shard drains its whole inbox on each wakeup, so only the first task needs to signal it
+  if ( was_empty ) {
+    shard.wakeup.write( one_event );
+  }
+}
+
+void EventLoopPool::_run( Shard& shard )
+{
+  try {
+    vector<Task> tasks;
+    shard.loop.add_rule( "EventLoopPool tasks", shard.wakeup, Direction::In, [&] {
+      string counter( sizeof( uint64_t ), 0 );
+      shard.wakeup.read( counter );
+      {
+        const lock_guard lock { shard.mutex };
+        swap( tasks, shard.inbox );
+      }
+      // one task's failure is its own: the tasks after it (often for other connections) still run
+      for ( auto& task : tasks ) {
+        try {
+          task( shard.loop );
+        } catch ( const exception& e ) {
+          cerr << "Exception in EventLoopPool task: " << e.what() << "\n";
+        }
+      }
+      tasks.clear();
+    } );
+
+    // likewise a rule's callback: its exception is reported, and the shard goes on serving the other rules
+    // (rules that can fail, like a TCPMinnowSocket's, catch their own exceptions and cancel themselves)
+    while ( not _stopping ) {
+      try {
+        shard.loop.wait_next_event( -1 );
+      } catch ( const exception& e ) {
+        cerr << "Exception in EventLoopPool rule: " << e.what() << "\n";
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception in EventLoopPool thread: " << e.what() << "\n";
+  }
+  shard.stopped.store( true );
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! \brief A fixed set of threads ("shards"), each running its own EventLoop
+//! \details Work reaches a shard's EventLoop only through post(), which runs a task on the shard's
+//! thread; rules added by a task belong to that shard from then on. Callers that keep per-connection
+//! state pick a shard with shard_for( hash ) so that everything about one connection (identified,
+//! e.g., by its FourTuple) happens on one thread, in order, without locks.
+class EventLoopPool
+{
+public:
+  using Task = std::function<void( EventLoop& )>;
+
+  //! Callbacks per category per wakeup on a shard (its loops use Scheduling::Fair)
+  static constexpr unsigned SHARD_BUDGET = 256;
+
+  //! Start `threads` shards (by default, one per core), each with an EventLoop using `backend`
+  explicit EventLoopPool( size_t threads = default_threads(),
+                          EventLoop::Backend backend = EventLoop::Backend::Epoll );
+
+  //! Stop and join the shard threads (rules still registered are abandoned)
+  ~EventLoopPool();
+
+  //! One thread per core, as reported by the standard library (at least one)
+  static size_t default_threads();
+
+  size_t size() const { return _shards.size(); }
+
+  //! The shard that owns work identified by `hash`
+  size_t shard_for( uint64_t hash ) const { return hash % _shards.size(); }
+
+  //! Run `task` on the shard's thread, after every task posted to that shard before it
+  //! \details An exception thrown by the task is reported on stderr, and doesn't stop the shard.
+  void post( size_t shard, Task&& task );
+
+  //! Has the shard's thread stopped (so tasks posted to it will never run)?
+  bool stopped( size_t shard ) const { return _shards.at( shard )->stopped.load(); }
+
+  //! \name
+  //! The shard threads refer to this object, so it can't be copied or moved
+  //!@{
+  EventLoopPool( const EventLoopPool& other ) = delete;
+  EventLoopPool& operator=( const EventLoopPool& other ) = delete;
+  EventLoopPool( EventLoopPool&& other ) = delete;
+  EventLoopPool& operator=( EventLoopPool&& other ) = delete;
+  //!@}
+
+private:
+  struct Shard
+  {
+    EventLoop loop;
+    FileDescriptor wakeup;          //!< eventfd that tells the shard's thread it has tasks
+    std::mutex mutex {};            //!< Protects inbox
+    std::vector<Task> inbox {};     //!< Tasks posted but not yet run
+    std::atomic_bool stopped {};    //!< Set once the thread has left its loop
+    std::thread thread {};
+
+    Shard( EventLoop::Backend backend, FileDescriptor&& s_wakeup );
+  };
+
+  std::vector<std::unique_ptr<Shard>> _shards {};
+  std::atomic_bool _stopping { false };
+
+  void _run( Shard& shard );
+};
@@ -1,6 +1,8 @@
 #include "file_descriptor.hh"
 
+#include "eventloop.hh"
 #include "exception.hh"
+#include "io_uring.hh"
 
 #include <fcntl.h>
 #include <iostream>
@@ -77,6 +79,44 @@ FileDescriptor FileDescriptor::duplicate() const
   return FileDescriptor { internal_fd_ };
 }
 
+void FileDescriptor::Readiness::await_suspend( const Task::Handle coroutine ) const
+{
+  EventLoop* const loop = coroutine.promise().loop;
+  if ( not loop ) {
+    throw runtime_error( "FileDescriptor: async I/O in a Task that is not running on an EventLoop" );
+  }
+  loop->resume_when_ready( fd, writable ? Direction::Out : Direction::In, coroutine );
+}
+
+Task FileDescriptor::async_read( string& buffer )
+{
+  const size_t capacity = buffer.empty() ? kReadBufferSize : buffer.size();
+  bool ready = internal_fd_->non_blocking_; // (a non-blocking fd can just be tried; a blocking one mustn't block)
+  while ( true ) {
+    if ( not ready ) {
+      co_await Readiness { *this, false };
+    }
+    buffer.resize( capacity );
+    read( buffer );
+    if ( not buffer.empty() or eof() or not internal_fd_->non_blocking_ ) {
+      co_return;
+    }
+    ready = false;
+  }
+}
+
+Task FileDescriptor::async_write( string_view buffer )
+{
+  bool ready = internal_fd_->non_blocking_;
+  while ( not buffer.empty() ) {
+    if ( not ready ) {
+      co_await Readiness { *this, true };
+    }
+    buffer.remove_prefix( write( buffer ) );
+    ready = false;
+  }
+}
+
 // buffer is the string to be read into
 void FileDescriptor::read( string& buffer )
 {
@@ -106,21 +146,53 @@ void FileDescriptor::read( string& buffer )
   buffer.resize( bytes_read );
 }
 
-void FileDescriptor::read( vector<string>& buffers )
+namespace {
+
+// Shrink `buffers` (each of which was filled in turn) to the `bytes_read` bytes that were read into them
+template<typename Buffer>
+void trim_to_read( vector<Buffer>& buffers, size_t bytes_read )
+{
+  for ( auto& x : buffers ) {
+    string& buf = x;
+    if ( bytes_read >= buf.size() ) {
+      bytes_read -= buf.size();
+    } else {
+      buf.resize( bytes_read );
+      bytes_read = 0;
+    }
+  }
+}
+
+// Copy any borrowed buffers in a queued write, which has to outlive the caller's objects
+void keep_buffers( vector<Ref<string>>& buffers )
+{
+  for ( auto& buffer : buffers ) {
+    if ( buffer.is_borrowed() ) {
+      buffer = Ref<string> { string { buffer.get() } };
+    }
+  }
+}
+
+} // namespace
+
+template<typename Buffer>
+void FileDescriptor::readv_into( vector<Buffer>& buffers )
 {
   if ( buffers.empty() ) {
     return;
   }
 
-  buffers.back().clear();
-  buffers.back().resize( kReadBufferSize );
+  string& last = buffers.back();
+  last.clear();
+  last.resize( kReadBufferSize );
 
   vector<iovec> iovecs;
   iovecs.reserve( buffers.size() );
   size_t total_size = 0;
-  for ( const auto& x : buffers ) {
-    iovecs.push_back( { const_cast<char*>( x.data() ), x.size() } ); // NOLINT(*-const-cast)
-    total_size += x.size();
+  for ( auto& x : buffers ) {
+    string& buf = x;
+    iovecs.push_back( { buf.data(), buf.size() } );
+    total_size += buf.size();
   }
 
   const ssize_t bytes_read = ::readv( fd_num(), iovecs.data(), static_cast<int>( iovecs.size() ) );
@@ -138,15 +210,17 @@ void FileDescriptor::read( vector<string>& buffers )
     throw runtime_error( "read() read more than requested" );
   }
 
-  size_t remaining_size = bytes_read;
-  for ( auto& buf : buffers ) {
-    if ( remaining_size >= buf.size() ) {
-      remaining_size -= buf.size();
-    } else {
-      buf.resize( remaining_size );
-      remaining_size = 0;
-    }
-  }
+  trim_to_read( buffers, bytes_read );
+}
+
+void FileDescriptor::read( vector<string>& buffers )
+{
+  readv_into( buffers );
+}
+
+void FileDescriptor::read( vector<Ref<string>>& buffers )
+{
+  readv_into( buffers );
 }
 
 size_t FileDescriptor::write( string_view buffer )
@@ -178,7 +252,8 @@ size_t FileDescriptor::write( const vector<string_view>& buffers )
     = CheckSystemCall( "writev", ::writev( fd_num(), iovecs.data(), static_cast<int>( iovecs.size() ) ) );
   register_write();
 
-  if ( bytes_written == 0 and total_size != 0 ) {
+  // (a non-blocking fd that isn't writable right now returns 0)
+  if ( bytes_written == 0 and total_size != 0 and not internal_fd_->non_blocking_ ) {
     throw runtime_error( "write returned 0 given non-empty input buffer" );
   }
 
@@ -189,6 +264,145 @@ size_t FileDescriptor::write( const vector<string_view>& buffers )
   return bytes_written;
 }
 
+//! \details The write goes straight to the fd (so buffers the fd takes whole are never copied), and only what
+//! it doesn't take joins the queue; a write that fails throws before anything is queued.
+bool FileDescriptor::queue_write( vector<Ref<string>>&& buffers )
+{
+  FDWrapper& wrapper = *internal_fd_;
+  if ( not wrapper.write_queue_.empty() ) {
+    return defer_write( move( buffers ) ); // (it has to wait its turn)
+  }
+
+  size_t size = 0;
+  for ( const auto& buffer : buffers ) {
+    size += buffer->size();
+  }
+  const size_t bytes_written = write( buffers );
+  if ( bytes_written == size ) {
+    return true;
+  }
+
+  keep_buffers( buffers );
+  wrapper.write_queue_skip_ = bytes_written;
+  wrapper.write_queue_bytes_ = size - bytes_written;
+  wrapper.write_queue_.push_back( move( buffers ) );
+  return true;
+}
+
+bool FileDescriptor::defer_write( vector<Ref<string>>&& buffers )
+{
+  FDWrapper& wrapper = *internal_fd_;
+  if ( wrapper.write_queue_bytes_ >= wrapper.write_queue_limit_ ) {
+    return false;
+  }
+
+  keep_buffers( buffers ); // (before it joins the queue, which may outlive the buffers it borrows from)
+  for ( const auto& buffer : buffers ) {
+    wrapper.write_queue_bytes_ += buffer->size();
+  }
+  wrapper.write_queue_.push_back( move( buffers ) );
+  return true;
+}
+
+void FileDescriptor::FDWrapper::drop_queued_writes( const size_t count )
+{
+  write_queue_bytes_ += write_queue_skip_; // (the first write's part that was made, counted whole below)
+  write_queue_skip_ = 0;
+  for ( size_t i = 0; i < count; i++ ) {
+    for ( const auto& buffer : write_queue_.front() ) {
+      write_queue_bytes_ -= buffer->size();
+    }
+    write_queue_.pop_front();
+  }
+}
+
+//! \details Each queued write gets a write of its own, so datagrams keep their boundaries. Whole writes go
+//! several at a time (with write_batch, in one io_uring submission) when there is more than one. A stream fd
+//! may take part of a write, and the rest waits for the next flush. A write that fails (e.g. with EPIPE) is
+//! dropped before the exception goes on, so the next flush doesn't fail on it again; when it was part of a
+//! batch, the whole queue goes, as there is no telling which writes of the batch were made.
+size_t FileDescriptor::flush_writes()
+{
+  FDWrapper& wrapper = *internal_fd_;
+  size_t total_written = 0;
+  vector<string_view> views;
+  vector<vector<Ref<string>>> batch;
+  while ( not wrapper.write_queue_.empty() ) {
+    if ( wrapper.write_queue_skip_ == 0 and wrapper.write_queue_.size() > 1 and IoUring::for_this_thread() ) {
+      batch.clear();
+      size_t batch_bytes = 0;
+      for ( const auto& buffers : wrapper.write_queue_ ) {
+        auto& datagram = batch.emplace_back();
+        for ( const auto& buffer : buffers ) {
+          datagram.push_back( buffer.borrow() );
+          batch_bytes += buffer->size();
+        }
+      }
+
+      size_t bytes_written = 0;
+      try {
+        bytes_written = write_batch( batch );
+      } catch ( ... ) {
+        wrapper.drop_queued_writes( wrapper.write_queue_.size() );
+        throw;
+      }
+      total_written += bytes_written;
+      wrapper.write_queue_bytes_ -= bytes_written;
+
+      // drop the writes that went whole, and note how much of the next one went
+      size_t left = bytes_written;
+      for ( const auto& datagram : batch ) {
+        size_t size = 0;
+        for ( const auto& buffer : datagram ) {
+          size += buffer->size();
+        }
+        if ( left < size ) {
+          wrapper.write_queue_skip_ = left;
+          break;
+        }
+        left -= size;
+        wrapper.write_queue_.pop_front();
+      }
+      if ( bytes_written < batch_bytes ) {
+        break;
+      }
+      continue;
+    }
+
+    views.clear();
+    size_t skip = wrapper.write_queue_skip_;
+    size_t remaining = 0;
+    for ( const auto& buffer : wrapper.write_queue_.front() ) {
+      const string_view view { buffer.get() };
+      if ( skip >= view.size() ) {
+        skip -= view.size();
+        continue;
+      }
+      views.push_back( view.substr( skip ) );
+      remaining += views.back().size();
+      skip = 0;
+    }
+
+    size_t bytes_written = 0;
+    try {
+      bytes_written = write( views );
+    } catch ( ... ) {
+      wrapper.drop_queued_writes( 1 );
+      throw;
+    }
+    total_written += bytes_written;
+    wrapper.write_queue_bytes_ -= bytes_written;
+    if ( bytes_written < remaining ) {
+      wrapper.write_queue_skip_ += bytes_written;
+      break;
+    }
+
+    wrapper.write_queue_.pop_front();
+    wrapper.write_queue_skip_ = 0;
+  }
+  return total_written;
+}
+
 void FileDescriptor::set_blocking( bool blocking )
 {
   int flags = CheckSystemCall( "fcntl", fcntl( fd_num(), F_GETFL ) ); // NOLINT(*-vararg)
@@ -202,3 +416,139 @@ void FileDescriptor::set_blocking( bool blocking )
 
   internal_fd_->non_blocking_ = not blocking;
 }
+
+//! \details The first datagram is read with a plain readv() (so a blocking fd still blocks until one
+//! arrives); the rest are queued together as non-waiting reads, so a batch never waits for more
+//! datagrams than are already available. The rounds of reads grow (4, 8, 16, ...), so a fd with only a
+//! few datagrams waiting doesn't cost a whole batch of reads that come back empty.
+size_t FileDescriptor::read_batch( vector<vector<Ref<string>>>& datagrams )
+{
+  if ( datagrams.empty() ) {
+    return 0;
+  }
+
+  readv_into( datagrams.front() );
+  if ( datagrams.front().empty() or eof() ) {
+    datagrams.clear();
+    return 0;
+  }
+
+  IoUring* ring = IoUring::for_this_thread();
+  size_t count = 1;
+  size_t round = 4;
+  vector<vector<iovec>> iovecs;
+  while ( count < datagrams.size() ) {
+    if ( not ring ) {
+      // no io_uring: keep reading while datagrams are available (a blocking fd gets a batch of one)
+      if ( not internal_fd_->non_blocking_ ) {
+        break;
+      }
+      readv_into( datagrams.at( count ) );
+      if ( datagrams.at( count ).empty() ) {
+        break;
+      }
+      ++count;
+      continue;
+    }
+
+    const size_t first = count;
+    const size_t batch = min( { datagrams.size() - first, round, static_cast<size_t>( ring->space_left() ) } );
+    round *= 2;
+    iovecs.resize( batch );
+    for ( size_t i = 0; i < batch; i++ ) {
+      auto& buffers = datagrams[first + i];
+      buffers.back().get_mut().resize( kReadBufferSize );
+      iovecs[i].clear();
+      for ( auto& buffer : buffers ) {
+        iovecs[i].push_back( { buffer.get_mut().data(), buffer->size() } );
+      }
+      ring->prepare_readv( fd_num(), iovecs[i].data(), static_cast<unsigned>( iovecs[i].size() ), first + i, true );
+    }
+    while ( not ring->submit_and_wait( batch ) ) {} // (a signal arrived first; the rest are still coming)
+
+    vector<int32_t> results( batch );
+    ring->reap( [&]( const uint64_t index, const int32_t result ) { results.at( index - first ) = result; } );
+
+    // keep the datagrams that were read, in order
+    for ( size_t i = 0; i < batch; i++ ) {
+      if ( results[i] > 0 ) {
+        register_read();
+        trim_to_read( datagrams[first + i], results[i] );
+        swap( datagrams[count++], datagrams[first + i] );
+      } else if ( results[i] == 0 ) {
+        set_eof();
+      } else if ( results[i] != -EAGAIN ) {
+        throw unix_error( "io_uring readv", -results[i] );
+      }
+    }
+
+    if ( count < first + batch ) {
+      break; // the fd ran dry
+    }
+  }
+
+  datagrams.resize( count );
+  return count;
+}
+
+//! \details The writes are linked, so the kernel makes them in order and stops at the first one the fd doesn't
+//! take whole (e.g. a non-blocking fd that fills up): the bytes written always cover the first datagrams, then
+//! possibly part of one more (on a stream fd).
+size_t FileDescriptor::write_batch( const vector<vector<Ref<string>>>& datagrams )
+{
+  vector<vector<iovec>> iovecs( datagrams.size() );
+  vector<size_t> sizes( datagrams.size() );
+  for ( size_t i = 0; i < datagrams.size(); i++ ) {
+    for ( const auto& buffer : datagrams[i] ) {
+      iovecs[i].push_back( { const_cast<char*>( buffer->data() ), buffer->size() } ); // NOLINT(*-const-cast)
+      sizes[i] += buffer->size();
+    }
+  }
+
+  IoUring* ring = IoUring::for_this_thread();
+  if ( not ring or datagrams.size() < 2 ) {
+    size_t total = 0;
+    for ( size_t i = 0; i < datagrams.size(); i++ ) {
+      const size_t bytes_written = write( datagrams[i] );
+      total += bytes_written;
+      if ( bytes_written < sizes[i] ) {
+        break; // (a non-blocking fd is full)
+      }
+    }
+    return total;
+  }
+
+  size_t total = 0;
+  for ( size_t first = 0; first < datagrams.size(); ) {
+    const size_t batch = min( datagrams.size() - first, static_cast<size_t>( ring->space_left() ) );
+    for ( size_t i = first; i < first + batch; i++ ) {
+      const bool link = i + 1 < first + batch;
+      const auto count = static_cast<unsigned>( iovecs[i].size() );
+      ring->prepare_writev( fd_num(), iovecs[i].data(), count, i, internal_fd_->non_blocking_, link );
+    }
+    while ( not ring->submit_and_wait( batch ) ) {} // (a signal arrived first; the rest are still coming)
+
+    vector<int32_t> results( batch );
+    ring->reap( [&]( const uint64_t index, const int32_t result ) { results.at( index - first ) = result; } );
+
+    register_write();
+    for ( size_t i = 0; i < batch; i++ ) {
+      if ( results[i] == -ECANCELED or ( internal_fd_->non_blocking_ and results[i] == -EAGAIN ) ) {
+        return total; // (the fd is full, and the writes after it were cancelled)
+      }
+      if ( results[i] < 0 ) {
+        throw unix_error( "io_uring writev", -results[i] );
+      }
+      if ( results[i] == 0 and sizes[first + i] != 0 ) {
+        throw runtime_error( "write returned 0 given non-empty input buffer" );
+      }
+      total += results[i];
+      if ( static_cast<size_t>( results[i] ) < sizes[first + i] ) {
+        return total; // (a stream fd took part of this one)
+      }
+    }
+    first += batch;
+  }
+
+  return total;
+}
@@ -1,13 +1,20 @@
 #pragma once
 
 #include "ref.hh"
+#include "task.hh"
 #include <cstddef>
+#include <deque>
 #include <memory>
+#include <string>
+#include <string_view>
 #include <vector>
 
 // A reference-counted handle to a file descriptor
 class FileDescriptor
 {
+  // default bound on the bytes in an fd's write queue (see queue_write)
+  static constexpr size_t kWriteQueueLimit = 4 << 20;
+
   // FDWrapper: A handle on a kernel file descriptor.
   // FileDescriptor objects contain a std::shared_ptr to a FDWrapper.
   class FDWrapper
@@ -20,12 +27,19 @@ class FileDescriptor
     unsigned read_count_ = 0;   // The number of times FDWrapper::fd_ has been read
     unsigned write_count_ = 0;  // The numberof times FDWrapper::fd_ has been written
 
+    std::deque<std::vector<Ref<std::string>>> write_queue_ {}; // Writes waiting for the fd (see queue_write)
+    size_t write_queue_skip_ = 0;                               // Bytes of the first queued write already written
+    size_t write_queue_bytes_ = 0;                              // Bytes still to write, in all queued writes
+    size_t write_queue_limit_ = kWriteQueueLimit;               // Queued bytes past which writes are refused
+
     // Construct from a file descriptor number returned by the kernel
     explicit FDWrapper( int fd );
     // Closes the file descriptor upon destruction
     ~FDWrapper();
     // Calls [close(2)](\ref man2::close) on FDWrapper::fd_
     void close();
+    // Drops the first `count` queued writes (and whatever is left of the first)
+    void drop_queued_writes( size_t count );
 
     template<typename T>
     T CheckSystemCall( std::string_view s_attempt, T return_value ) const;
@@ -43,6 +57,22 @@ class FileDescriptor
   // private constructor used to duplicate the FileDescriptor (increase the reference count)
   explicit FileDescriptor( std::shared_ptr<FDWrapper> other_shared_ptr );
 
+  // Awaitable that suspends a Task until its EventLoop finds the fd readable (or writable), hung up, or in error
+  struct Readiness
+  {
+    FileDescriptor& fd;
+    bool writable;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend( Task::Handle coroutine ) const;
+    void await_resume() const noexcept {}
+  };
+
+  // Shared by the read( vector ) overloads and read_batch: one readv() into `buffers` (the last one grown to
+  // kReadBufferSize), each of which is then shrunk to what was read
+  template<typename Buffer>
+  void readv_into( std::vector<Buffer>& buffers );
+
 protected:
   // size of buffer to allocate for read()
   static constexpr size_t kReadBufferSize = 16384;
@@ -64,13 +94,48 @@ public:
   // Read into `buffer`
   void read( std::string& buffer );
   void read( std::vector<std::string>& buffers );
+  void read( std::vector<Ref<std::string>>& buffers ); // (owned Refs, e.g. from BufferPool::take())
 
   // Attempt to write a buffer
-  // returns number of bytes written
+  // returns number of bytes written (zero if the fd is non-blocking and not writable)
   size_t write( std::string_view buffer );
   size_t write( const std::vector<std::string_view>& buffers );
   size_t write( const std::vector<Ref<std::string>>& buffers );
 
+  // Coroutine versions of read() and write(), for a Task running on an EventLoop. A non-blocking fd is
+  // tried right away, and the Task only suspends (letting the thread run other Tasks) if it would block.
+  // async_read reads into `buffer` the way read() does, once there is something to read; the buffer comes back
+  // empty only at EOF. async_write writes all of `buffer`, suspending as often as needed.
+  Task async_read( std::string& buffer );
+  Task async_write( std::string_view buffer );
+
+  // Optional outbound queue, so a writer to a non-blocking fd neither blocks nor loses data when the fd is full.
+  // queue_write() writes `buffers` right away (as one write, so a datagram stays one datagram) if nothing is
+  // queued ahead of it, and keeps whatever the fd didn't take (copying any borrowed buffers it keeps).
+  // defer_write() only queues `buffers`, so that the next flush can write it along with the rest.
+  // Both refuse a write (and return false) once the queue holds its limit of bytes: a datagram can then be
+  // dropped, as a full device queue would drop it, while a stream has to wait for the queue to drain.
+  // flush_writes() writes as much of the queue as the fd takes, in order (whole writes several at a time, with
+  // write_batch), and returns the number of bytes written; EventLoop::add_flush_rule calls it whenever the fd is
+  // writable. A write that fails is dropped from the queue, and its exception passed on.
+  // Don't mix queue_write() with the other writes on the same fd, or they may overtake each other.
+  bool queue_write( std::vector<Ref<std::string>>&& buffers );
+  bool defer_write( std::vector<Ref<std::string>>&& buffers );
+  size_t flush_writes();
+  void set_write_queue_limit( size_t bytes ) { internal_fd_->write_queue_limit_ = bytes; }
+  size_t queued_writes() const { return internal_fd_->write_queue_.size(); }
+  size_t queued_bytes() const { return internal_fd_->write_queue_bytes_; }
+
+  // Read up to `datagrams.size()` datagrams (e.g. from a TUN device), each into its own set of buffers the way
+  // read( buffers ) would, and drop the unused sets. Reads them with a few io_uring submissions when available.
+  // Only the first read may block. Returns the number of datagrams read.
+  size_t read_batch( std::vector<std::vector<Ref<std::string>>>& datagrams );
+
+  // Write each element of `datagrams` the way write( buffers ) would, one datagram per element, in order. Uses
+  // one io_uring submission for the whole batch when available. Stops at the first element the fd doesn't take
+  // whole (e.g. a full non-blocking fd), and returns the total number of bytes written.
+  size_t write_batch( const std::vector<std::vector<Ref<std::string>>>& datagrams );
+
   // Close the underlying file descriptor
   void close() { internal_fd_->close(); }
 
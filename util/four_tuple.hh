@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//! The addresses and ports that identify one TCP connection, seen from the local end
+struct FourTuple
+{
+  uint32_t local_ip {};    //!< Local IPv4 address (host byte order)
+  uint32_t remote_ip {};   //!< Remote IPv4 address (host byte order)
+  uint16_t local_port {};  //!< Local TCP port
+  uint16_t remote_port {}; //!< Remote TCP port
+
+  bool operator==( const FourTuple& other ) const = default;
+
+  //! Well-mixed hash of all four fields (usable for hash tables and for picking a shard)
+  uint64_t hash() const
+  {
+    uint64_t x = ( static_cast<uint64_t>( local_ip ) << 32 ) | remote_ip;
+    x ^= ( static_cast<uint64_t>( local_port ) << 16 | remote_port ) * 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+
+  //! Hasher for std::unordered_map
+  struct Hash
+  {
+    size_t operator()( const FourTuple& t ) const { return t.hash(); }
+  };
+};
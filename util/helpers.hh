@@ -1,5 +1,6 @@
 #pragma once
 
+#include "buffer_pool.hh"
 #include "ethernet_frame.hh"
 #include "ipv4_datagram.hh"
 #include "parser.hh"
@@ -11,12 +12,13 @@
 #include <vector>
 #include <algorithm>
 
-// Helper to serialize any object (without constructing a Serializer of the caller's own)
+// Helper to serialize any object (without constructing a Serializer of the caller's own). The headers (and a
+// small payload) go into one small buffer from the BufferPool (see BufferPool::take_small).
 // example: ```ethernet_frame.payload = serialize( internet_datagram );```
 template<class T>
 std::vector<Ref<std::string>> serialize( const T& obj )
 {
-  Serializer s;
+  Serializer s { BufferPool::take_small() };
   obj.serialize( s );
   return s.finish();
 }
@@ -0,0 +1,212 @@
+#include "io_uring.hh"
+
+#include "exception.hh"
+
+#include <atomic>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+IoUring::IoUring( const unsigned entries ) : IoUring( entries, io_uring_params {} ) {}
+
+IoUring::IoUring( const unsigned entries, io_uring_params params )
+  : _ring_fd(
+    CheckSystemCall( "io_uring_setup", static_cast<int>( ::syscall( __NR_io_uring_setup, entries, &params ) ) ) )
+{
+  // one mapping for both rings (5.4), and timeouts passed to io_uring_enter (5.11)
+  if ( not( params.features & IORING_FEAT_SINGLE_MMAP ) or not( params.features & IORING_FEAT_EXT_ARG ) ) {
+    throw runtime_error( "io_uring: kernel is missing required features" );
+  }
+
+  _rings_size = max( params.sq_off.array + params.sq_entries * sizeof( unsigned ),
+                     params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe ) );
+  _rings = ::mmap( nullptr,
+                   _rings_size,
+                   PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE,
+                   _ring_fd.fd_num(),
+                   IORING_OFF_SQ_RING );
+  if ( _rings == MAP_FAILED ) {
+    throw unix_error( "mmap" );
+  }
+
+  _sqes_size = params.sq_entries * sizeof( io_uring_sqe );
+  void* sqes = ::mmap(
+    nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd.fd_num(), IORING_OFF_SQES );
+  if ( sqes == MAP_FAILED ) {
+    ::munmap( _rings, _rings_size );
+    throw unix_error( "mmap" );
+  }
+  _sqes = static_cast<io_uring_sqe*>( sqes );
+
+  char* base = static_cast<char*>( _rings );
+  // NOLINTBEGIN(*-reinterpret-cast)
+  _sq_head = reinterpret_cast<unsigned*>( base + params.sq_off.head );
+  _sq_tail = reinterpret_cast<unsigned*>( base + params.sq_off.tail );
+  _sq_mask = reinterpret_cast<unsigned*>( base + params.sq_off.ring_mask );
+  _sq_array = reinterpret_cast<unsigned*>( base + params.sq_off.array );
+  _cq_head = reinterpret_cast<unsigned*>( base + params.cq_off.head );
+  _cq_tail = reinterpret_cast<unsigned*>( base + params.cq_off.tail );
+  _cq_mask = reinterpret_cast<unsigned*>( base + params.cq_off.ring_mask );
+  _cqes = reinterpret_cast<io_uring_cqe*>( base + params.cq_off.cqes );
+  // NOLINTEND(*-reinterpret-cast)
+  _sq_entries = params.sq_entries;
+}
+
+IoUring::~IoUring()
+{
+  ::munmap( _sqes, _sqes_size );
+  ::munmap( _rings, _rings_size );
+}
+
+bool IoUring::supported()
+{
+  static const bool is_supported = [] {
+    try {
+      const IoUring probe { 2 };
+      return true;
+    } catch ( const exception& ) {
+      return false;
+    }
+  }();
+  return is_supported;
+}
+
+IoUring* IoUring::for_this_thread()
+{
+  if ( not supported() ) {
+    return nullptr;
+  }
+  thread_local IoUring ring { 64 };
+  return &ring;
+}
+
+unsigned IoUring::_load_acquire( const unsigned* p )
+{
+  return atomic_ref<const unsigned>( *p ).load( memory_order_acquire );
+}
+
+void IoUring::_store_release( unsigned* p, const unsigned value )
+{
+  atomic_ref<unsigned>( *p ).store( value, memory_order_release );
+}
+
+unsigned IoUring::space_left() const
+{
+  return _sq_entries - ( *_sq_tail - _load_acquire( _sq_head ) );
+}
+
+void IoUring::_push( const io_uring_sqe& sqe )
+{
+  if ( space_left() == 0 ) {
+    throw runtime_error( "io_uring submission queue is full" );
+  }
+
+  const unsigned tail = *_sq_tail;
+  const unsigned index = tail & *_sq_mask;
+  _sqes[index] = sqe;
+  _sq_array[index] = index;
+  _store_release( _sq_tail, tail + 1 );
+  ++_to_submit;
+}
+
+void IoUring::prepare_readv( const int fd,
+                             const iovec* iovecs,
+                             const unsigned count,
+                             const uint64_t user_data,
+                             const bool nowait )
+{
+  io_uring_sqe sqe {};
+  sqe.opcode = IORING_OP_READV;
+  sqe.fd = fd;
+  sqe.off = -1;
+  sqe.addr = reinterpret_cast<uint64_t>( iovecs ); // NOLINT(*-reinterpret-cast)
+  sqe.len = count;
+  sqe.rw_flags = nowait ? RWF_NOWAIT : 0;
+  sqe.user_data = user_data;
+  _push( sqe );
+}
+
+void IoUring::prepare_writev( const int fd,
+                              const iovec* iovecs,
+                              const unsigned count,
+                              const uint64_t user_data,
+                              const bool nowait,
+                              const bool link )
+{
+  io_uring_sqe sqe {};
+  sqe.opcode = IORING_OP_WRITEV;
+  sqe.flags = link ? IOSQE_IO_LINK : 0;
+  sqe.fd = fd;
+  sqe.off = -1;
+  sqe.addr = reinterpret_cast<uint64_t>( iovecs ); // NOLINT(*-reinterpret-cast)
+  sqe.len = count;
+  sqe.rw_flags = nowait ? RWF_NOWAIT : 0;
+  sqe.user_data = user_data;
+  _push( sqe );
+}
+
+void IoUring::prepare_poll_add( const int fd, const uint32_t poll_mask, const uint64_t user_data )
+{
+  io_uring_sqe sqe {};
+  sqe.opcode = IORING_OP_POLL_ADD;
+  sqe.fd = fd;
+  sqe.poll32_events = poll_mask;
+  sqe.user_data = user_data;
+  _push( sqe );
+}
+
+void IoUring::prepare_poll_remove( const uint64_t target_user_data, const uint64_t user_data )
+{
+  io_uring_sqe sqe {};
+  sqe.opcode = IORING_OP_POLL_REMOVE;
+  sqe.fd = -1;
+  sqe.addr = target_user_data;
+  sqe.user_data = user_data;
+  _push( sqe );
+}
+
+//! \details Submission and waiting happen in the same io_uring_enter call. If the kernel returns
+//! before `wait_count` completions are ready (the timeout passed, or a signal arrived), this
+//! reports a timeout, as EventLoop's other backends do.
+bool IoUring::submit_and_wait( const unsigned wait_count, const int timeout_ms )
+{
+  __kernel_timespec timeout {};
+  io_uring_getevents_arg arg {};
+  unsigned flags = wait_count > 0 ? IORING_ENTER_GETEVENTS : 0;
+  if ( wait_count > 0 and timeout_ms >= 0 ) {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = static_cast<long long>( timeout_ms % 1000 ) * 1'000'000;
+    arg.ts = reinterpret_cast<uint64_t>( &timeout ); // NOLINT(*-reinterpret-cast)
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+
+  while ( true ) {
+    const long ret = ::syscall( __NR_io_uring_enter,
+                                _ring_fd.fd_num(),
+                                _to_submit,
+                                wait_count,
+                                flags,
+                                ( flags & IORING_ENTER_EXT_ARG ) ? &arg : nullptr,
+                                ( flags & IORING_ENTER_EXT_ARG ) ? sizeof( arg ) : 0 );
+    if ( ret < 0 ) {
+      if ( errno == EINTR or errno == ETIME ) {
+        return false;
+      }
+      throw unix_error( "io_uring_enter" );
+    }
+
+    // (a signal that arrives after some submissions cuts the wait short without an error)
+    _to_submit -= static_cast<unsigned>( ret );
+    if ( _load_acquire( _cq_tail ) - *_cq_head < wait_count ) {
+      return false;
+    }
+    if ( _to_submit == 0 ) {
+      return true;
+    }
+  }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "file_descriptor.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+//! \brief A minimal [io_uring](\ref man7::io_uring) submission/completion queue pair
+//! \details Talks to the kernel with the raw io_uring_setup/io_uring_enter system calls (no liburing).
+//! Operations are prepared into the submission queue and handed to the kernel in one batch by
+//! submit_and_wait(); their results are collected with reap().
+class IoUring
+{
+public:
+  //! Set up a ring with room for `entries` submissions (throws if the kernel refuses)
+  explicit IoUring( unsigned entries );
+  ~IoUring();
+
+  //! Can this process use io_uring? (The answer is probed once and cached.)
+  static bool supported();
+
+  //! A ring shared by everything on the calling thread, or nullptr if io_uring is not supported
+  static IoUring* for_this_thread();
+
+  //! \name Prepare operations (they are not visible to the kernel until submit_and_wait())
+  //! A `nowait` read or write completes with -EAGAIN instead of waiting for the fd, even on a blocking fd (the
+  //! kernel waits on a socket's behalf regardless of O_NONBLOCK). A `link`ed write runs before the next operation
+  //! prepared, which completes with -ECANCELED unless the write was whole.
+  //!@{
+  void prepare_readv( int fd, const iovec* iovecs, unsigned count, uint64_t user_data, bool nowait = false );
+  void prepare_writev(
+    int fd, const iovec* iovecs, unsigned count, uint64_t user_data, bool nowait = false, bool link = false );
+  void prepare_poll_add( int fd, uint32_t poll_mask, uint64_t user_data );
+  void prepare_poll_remove( uint64_t target_user_data, uint64_t user_data );
+  //!@}
+
+  //! Room left in the submission queue
+  unsigned space_left() const;
+
+  //! Submit everything prepared so far, then wait for at least `wait_count` completions
+  //! \returns false if `timeout_ms` (negative means forever) passed first, or a signal arrived
+  bool submit_and_wait( unsigned wait_count, int timeout_ms = -1 );
+
+  //! Call `on_completion( user_data, result )` for each available completion; returns how many there were
+  template<typename Callback>
+  unsigned reap( Callback&& on_completion )
+  {
+    unsigned count = 0;
+    unsigned head = *_cq_head;
+    while ( head != _load_acquire( _cq_tail ) ) {
+      const io_uring_cqe& cqe = _cqes[head & *_cq_mask];
+      on_completion( cqe.user_data, cqe.res );
+      ++head;
+      ++count;
+      _store_release( _cq_head, head );
+    }
+    return count;
+  }
+
+  //! \name
+  //! The ring is mapped into this object's memory, so it can't be copied or moved
+  //!@{
+  IoUring( const IoUring& other ) = delete;
+  IoUring& operator=( const IoUring& other ) = delete;
+  IoUring( IoUring&& other ) = delete;
+  IoUring& operator=( IoUring&& other ) = delete;
+  //!@}
+
+private:
+  FileDescriptor _ring_fd;
+
+  void* _rings {};     //!< Shared mapping of the submission and completion rings
+  size_t _rings_size {};
+  io_uring_sqe* _sqes {}; //!< Mapping of the submission queue entries
+  size_t _sqes_size {};
+
+  unsigned* _sq_head {};
+  unsigned* _sq_tail {};
+  unsigned* _sq_mask {};
+  unsigned* _sq_array {};
+  unsigned _sq_entries {};
+
+  unsigned* _cq_head {};
+  unsigned* _cq_tail {};
+  unsigned* _cq_mask {};
+  io_uring_cqe* _cqes {};
+
+  unsigned _to_submit {}; //!< Entries prepared since the last submission
+
+  IoUring( unsigned entries, io_uring_params params );
+  void _push( const io_uring_sqe& sqe );
+
+  static unsigned _load_acquire( const unsigned* p );
+  static void _store_release( unsigned* p, unsigned value );
+};
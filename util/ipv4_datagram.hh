@@ -16,6 +16,9 @@ struct IPv4Datagram
   void parse( Parser& parser )
   {
     header.parse( parser );
+    if ( parser.bytes_remaining() < header.payload_length() ) {
+      parser.set_error(); // (shorter than its header says)
+    }
     parser.truncate( header.payload_length() );
     parser.all_remaining( payload );
   }
@@ -1,7 +1,9 @@
 #include "ipv4_header.hh"
+#include "buffer_pool.hh"
 #include "checksum.hh"
 
 #include <arpa/inet.h>
+#include <cstring>
 #include <sstream>
 
 using namespace std;
@@ -33,7 +35,7 @@ void IPv4Header::parse( Parser& parser )
     parser.set_error();
   }
 
-  if ( hlen < 5 ) {
+  if ( hlen < 5 or len < static_cast<uint16_t>( hlen ) * 4 ) {
     parser.set_error();
   }
 
@@ -105,7 +107,7 @@ uint32_t IPv4Header::pseudo_checksum() const
 void IPv4Header::compute_checksum()
 {
   cksum = 0;
-  Serializer s;
+  Serializer s { BufferPool::take_small() };
   serialize( s );
 
   // calculate checksum -- taken over header only
@@ -114,6 +116,57 @@ void IPv4Header::compute_checksum()
   cksum = check.value();
 }
 
+namespace {
+
+// HC' = ~( ~HC + ~m + m' ), in one's-complement arithmetic (RFC 1624, eqn. 3)
+uint16_t updated_checksum( const uint16_t cksum, const uint16_t old_word, const uint16_t new_word )
+{
+  uint32_t sum = static_cast<uint16_t>( ~cksum );
+  sum += static_cast<uint16_t>( ~old_word );
+  sum += new_word;
+  while ( sum > 0xffff ) {
+    sum = ( sum >> 16 ) + static_cast<uint16_t>( sum );
+  }
+  return ~sum;
+}
+
+} // namespace
+
+void IPv4Header::update_checksum( const uint16_t old_word, const uint16_t new_word )
+{
+  cksum = updated_checksum( cksum, old_word, new_word );
+}
+
+void IPv4Header::decrement_ttl()
+{
+  // ttl shares its 16-bit word with proto
+  const uint16_t old_word = static_cast<uint16_t>( ttl << 8 | proto );
+  --ttl;
+  update_checksum( old_word, static_cast<uint16_t>( ttl << 8 | proto ) );
+}
+
+bool IPv4HeaderView::valid() const
+{
+  if ( buffer_.size() < IPv4Header::LENGTH or ver() != 4 or hlen() < 5
+       or buffer_.size() < static_cast<size_t>( hlen() ) * 4 or len() < static_cast<size_t>( hlen() ) * 4 ) {
+    return false;
+  }
+
+  InternetChecksum check;
+  check.add( buffer_.substr( 0, static_cast<size_t>( hlen() ) * 4 ) );
+  return check.value() == 0;
+}
+
+void MutableIPv4HeaderView::decrement_ttl()
+{
+  // ttl shares its 16-bit word with proto, and the checksum is the next word
+  const uint16_t old_word = integer<uint16_t>( 8 );
+  const auto new_word = static_cast<uint16_t>( old_word - 0x100 );
+  const uint16_t new_cksum = big_endian( updated_checksum( cksum(), old_word, new_word ) );
+  mutable_buffer_[8] = static_cast<char>( new_word >> 8 );
+  memcpy( mutable_buffer_.data() + 10, &new_cksum, sizeof( new_cksum ) );
+}
+
 string IPv4Header::to_string() const
 {
   stringstream ss {};
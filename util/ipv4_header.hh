@@ -4,7 +4,10 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <span>
 #include <string>
+#include <string_view>
 
 // IPv4 Internet datagram header (note: IP options are not supported)
 struct IPv4Header
@@ -57,9 +60,65 @@ struct IPv4Header
   // Set checksum to correct value
   void compute_checksum();
 
+  // Adjust checksum for one 16-bit header word changing from old_word to new_word, without re-summing the
+  // header (RFC 1624, eqn. 3)
+  void update_checksum( uint16_t old_word, uint16_t new_word );
+
+  // Decrement ttl, adjusting checksum to match
+  void decrement_ttl();
+
   // Return a string containing a header in human-readable format
   std::string to_string() const;
 
   void parse( Parser& parser );
   void serialize( Serializer& serializer ) const;
 };
+
+// A serialized IPv4 header, read a field at a time where it lies (for code that needs only a few fields, e.g. a
+// router, which needs only dst and ttl, and can then pass the datagram on without re-serializing it). The buffer
+// must outlive the view.
+class IPv4HeaderView
+{
+public:
+  explicit IPv4HeaderView( std::string_view buffer ) : buffer_( buffer ) {}
+
+  // Does the buffer start with a whole header, of version 4, with a total length that covers the header, and
+  // with a correct checksum?
+  bool valid() const;
+
+  uint8_t ver() const { return byte( 0 ) >> 4; }
+  uint8_t hlen() const { return byte( 0 ) & 0x0f; }
+  uint16_t len() const { return integer<uint16_t>( 2 ); }
+  uint8_t ttl() const { return byte( 8 ); }
+  uint8_t proto() const { return byte( 9 ); }
+  uint16_t cksum() const { return integer<uint16_t>( 10 ); }
+  uint32_t src() const { return integer<uint32_t>( 12 ); }
+  uint32_t dst() const { return integer<uint32_t>( 16 ); }
+
+protected:
+  uint8_t byte( const size_t offset ) const { return static_cast<uint8_t>( buffer_[offset] ); }
+
+  template<std::unsigned_integral T>
+  T integer( const size_t offset ) const
+  {
+    T raw;
+    std::memcpy( &raw, buffer_.data() + offset, sizeof( T ) );
+    return big_endian( raw );
+  }
+
+private:
+  std::string_view buffer_;
+};
+
+// An IPv4HeaderView that can also change the header where it lies
+class MutableIPv4HeaderView : public IPv4HeaderView
+{
+public:
+  explicit MutableIPv4HeaderView( std::string& buffer ) : IPv4HeaderView( buffer ), mutable_buffer_( buffer ) {}
+
+  // Decrement ttl, adjusting checksum to match
+  void decrement_ttl();
+
+private:
+  std::span<char> mutable_buffer_;
+};
@@ -0,0 +1,63 @@
+#include "latency_histogram.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+using namespace std;
+
+size_t LatencyHistogram::_index( const uint64_t value )
+{
+  if ( value < SUB_BUCKETS ) {
+    return value;
+  }
+
+  const unsigned magnitude = bit_width( value ) - 1; // position of the highest set bit
+  if ( magnitude >= MAX_MAGNITUDE ) {
+    return BUCKETS - 1;
+  }
+
+  const size_t sub_bucket = ( value >> ( magnitude - SUB_BUCKET_BITS ) ) & ( SUB_BUCKETS - 1 );
+  return ( magnitude - SUB_BUCKET_BITS + 1 ) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t LatencyHistogram::_upper_bound( const size_t index )
+{
+  if ( index < SUB_BUCKETS ) {
+    return index;
+  }
+
+  const unsigned shift = index / SUB_BUCKETS - 1;
+  const uint64_t sub_bucket = index % SUB_BUCKETS;
+  return ( ( SUB_BUCKETS + sub_bucket + 1 ) << shift ) - 1;
+}
+
+void LatencyHistogram::record( const uint64_t value )
+{
+  if ( _buckets.empty() ) {
+    _buckets.resize( BUCKETS );
+  }
+
+  ++_buckets[_index( value )];
+  ++_count;
+  _max = std::max( _max, value );
+  _total += value;
+}
+
+uint64_t LatencyHistogram::percentile( const double quantile ) const
+{
+  if ( _count == 0 ) {
+    return 0;
+  }
+
+  const double scaled = ceil( clamp( quantile, 0.0, 1.0 ) * static_cast<double>( _count ) );
+  const uint64_t rank = std::max( uint64_t { 1 }, static_cast<uint64_t>( scaled ) );
+  uint64_t seen = 0;
+  for ( size_t i = 0; i < _buckets.size(); i++ ) {
+    seen += _buckets[i];
+    if ( seen >= rank ) {
+      return std::min( _upper_bound( i ), _max );
+    }
+  }
+  return _max;
+}
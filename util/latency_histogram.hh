@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//! \brief A log-linear histogram of non-negative values (e.g. durations in nanoseconds), in the style of
+//! HdrHistogram
+//! \details Values below 2^SUB_BUCKET_BITS are counted exactly. Above that, each power of two is split into
+//! 2^SUB_BUCKET_BITS equal buckets, so a bucket's width is at most 1/32 of its values (about 3% relative
+//! error) whatever their magnitude. Values of 2^MAX_MAGNITUDE or more share the last bucket. The buckets
+//! are only allocated once a value is recorded.
+class LatencyHistogram
+{
+public:
+  static constexpr unsigned SUB_BUCKET_BITS = 5;
+  static constexpr unsigned MAX_MAGNITUDE = 40; //!< (in nanoseconds, about 18 minutes)
+
+  void record( uint64_t value );
+
+  uint64_t count() const { return _count; }
+  uint64_t max() const { return _max; }
+  uint64_t total() const { return _total; }
+
+  //! An upper bound on the smallest value that `quantile` (0 to 1) of the recorded values are at or below
+  //! \details This is the end of that value's bucket, but never more than the largest value recorded.
+  uint64_t percentile( double quantile ) const;
+
+private:
+  static constexpr size_t SUB_BUCKETS = size_t { 1 } << SUB_BUCKET_BITS;
+  static constexpr size_t BUCKETS = ( MAX_MAGNITUDE - SUB_BUCKET_BITS + 1 ) * SUB_BUCKETS;
+
+  std::vector<uint64_t> _buckets {};
+  uint64_t _count {};
+  uint64_t _max {};
+  uint64_t _total {};
+
+  static size_t _index( uint64_t value );
+  static uint64_t _upper_bound( size_t index ); //!< Largest value that falls in the bucket
+};
@@ -5,9 +5,11 @@
 #include "tcp_config.hh"
 #include "tcp_segment.hh"
 
+#include <cstddef>
 #include <optional>
 #include <random>
 #include <utility>
+#include <vector>
 
 //! An adapter class that adds random dropping behavior to an FD adapter
 template<typename AdapterT>
@@ -49,6 +51,24 @@ public:
     return ret;
   }
 
+  //! \brief Read several datagrams at once from the underlying AdapterT instance (if it can), potentially
+  //! dropping each segment read
+  //! \returns the number of datagrams the underlying AdapterT read
+  size_t read_batch( const size_t max_datagrams, std::vector<TCPMessage>& segments )
+    requires requires( AdapterT a, std::vector<TCPMessage> s ) { a.read_batch( size_t {}, s ); }
+  {
+    const size_t first = segments.size();
+    const size_t count = _adapter.read_batch( max_datagrams, segments );
+    size_t kept = first;
+    for ( size_t i = first; i < segments.size(); i++ ) {
+      if ( not _should_drop( false ) ) {
+        segments[kept++] = std::move( segments[i] );
+      }
+    }
+    segments.resize( kept );
+    return count;
+  }
+
   //! \brief Write to the underlying AdapterT instance, potentially dropping the datagram to be written
   //! \param[in] seg is the packet to either write or drop
   void write( const TCPMessage& seg )
@@ -59,6 +79,17 @@ public:
     return _adapter.write( seg );
   }
 
+  //! \brief Queue a write in the underlying AdapterT instance (if it can), potentially dropping the datagram
+  //! \param[in] seg is the packet to either queue or drop
+  void defer_write( const TCPMessage& seg )
+    requires requires( AdapterT a, TCPMessage s ) { a.defer_write( s ); }
+  {
+    if ( _should_drop( true ) ) {
+      return;
+    }
+    _adapter.defer_write( seg );
+  }
+
   //! \name
   //! Passthrough functions to the underlying AdapterT instance
 
@@ -66,4 +97,19 @@ public:
   const FdAdapterConfig& config() const { return _adapter.config(); } //!< FdAdapterBase::config passthrough
   FdAdapterConfig& config_mut() { return _adapter.config_mut(); }     //!< FdAdapterBase::config_mut passthrough
   void tick( const size_t ms_since_last_tick ) { _adapter.tick( ms_since_last_tick ); }
+  void flush_writes() //!< flush_writes passthrough (for an AdapterT that queues writes)
+    requires requires( AdapterT a ) { a.flush_writes(); }
+  {
+    _adapter.flush_writes();
+  }
+  bool writes_ready() const //!< writes_ready passthrough (for an AdapterT that queues writes)
+    requires requires( const AdapterT a ) { a.writes_ready(); }
+  {
+    return _adapter.writes_ready();
+  }
+  bool writes_queued() const //!< writes_queued passthrough (for an AdapterT that queues writes)
+    requires requires( const AdapterT a ) { a.writes_queued(); }
+  {
+    return _adapter.writes_queued();
+  }
 };
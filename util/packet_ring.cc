@@ -0,0 +1,224 @@
+#include "packet_ring.hh"
+
+#include "checksum.hh"
+#include "exception.hh"
+#include "helpers.hh"
+#include "ipv4_header.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+namespace {
+
+template<typename T>
+void set_packet_option( const int fd, const int option, const T& value )
+{
+  CheckSystemCall( "setsockopt", ::setsockopt( fd, SOL_PACKET, option, &value, sizeof( value ) ) );
+}
+
+// Where the frame data goes in a transmit slot (without PACKET_TX_HAS_OFF, right after the header)
+constexpr size_t TX_DATA_OFFSET = TPACKET_ALIGN( sizeof( tpacket3_hdr ) );
+
+constexpr uint8_t PROTO_UDP = 17;
+
+// Complete the TCP or UDP checksum of an IPv4 datagram whose checksum field holds just the pseudo-header's
+// (folded, uncomplemented) sum, which is how the kernel leaves it for a device with checksum offload
+void complete_checksum( string& dgram )
+{
+  const auto byte_at = [&]( const size_t offset ) { return static_cast<uint8_t>( dgram.at( offset ) ); };
+  if ( dgram.size() < IPv4Header::LENGTH or byte_at( 0 ) >> 4 != 4 ) {
+    return;
+  }
+  const size_t header_length = 4 * ( byte_at( 0 ) & 0xfU );
+  const size_t total_length = min<size_t>( dgram.size(), byte_at( 2 ) << 8 | byte_at( 3 ) ); // (less any padding)
+  const uint8_t proto = byte_at( 9 );
+  const size_t checksum_offset = header_length + ( proto == IPv4Header::PROTO_TCP ? 16 : 6 );
+  if ( ( proto != IPv4Header::PROTO_TCP and proto != PROTO_UDP ) or checksum_offset + 2 > total_length ) {
+    return;
+  }
+
+  InternetChecksum checksum;
+  checksum.add( string_view { dgram }.substr( header_length, total_length - header_length ) );
+  const uint16_t value = checksum.value();
+  dgram[checksum_offset] = static_cast<char>( value >> 8 );
+  dgram[checksum_offset + 1] = static_cast<char>( value & 0xffU );
+}
+
+} // namespace
+
+//! \param[in] device is the name of the network device to bind to, e.g. one end of a veth pair made with
+//!
+//!     ip link add veth0 type veth peer name veth1
+//!
+//! \param[in] options says how large the rings are
+PacketRing::PacketRing( const string& device, const PacketRingOptions& options )
+  : PacketSocket( SOCK_RAW, 0 ), _options( options ) // (protocol 0: receive nothing until bound)
+{
+  set_packet_option( fd_num(), PACKET_VERSION, int { TPACKET_V3 } );
+  set_packet_option( fd_num(), PACKET_IGNORE_OUTGOING, int { 1 } ); // (don't receive what this end sends)
+
+  const uint32_t frames_per_block = options.block_size / options.frame_size;
+  tpacket_req3 rx {};
+  rx.tp_block_size = options.block_size;
+  rx.tp_block_nr = options.rx_blocks;
+  rx.tp_frame_size = options.frame_size;
+  rx.tp_frame_nr = frames_per_block * options.rx_blocks;
+  rx.tp_retire_blk_tov = options.block_timeout_ms;
+  set_packet_option( fd_num(), PACKET_RX_RING, rx );
+
+  // (the kernel sends from the transmit ring frame by frame, so it takes no block timeout)
+  tpacket_req3 tx {};
+  tx.tp_block_size = options.block_size;
+  tx.tp_block_nr = options.tx_blocks;
+  tx.tp_frame_size = options.frame_size;
+  tx.tp_frame_nr = frames_per_block * options.tx_blocks;
+  set_packet_option( fd_num(), PACKET_TX_RING, tx );
+  _tx_frames = tx.tp_frame_nr;
+
+  sockaddr_ll address {};
+  address.sll_family = AF_PACKET;
+  address.sll_protocol = htons( ETH_P_ALL );
+  address.sll_ifindex = static_cast<int>( ::if_nametoindex( device.c_str() ) );
+  if ( address.sll_ifindex == 0 ) {
+    throw unix_error( "if_nametoindex" );
+  }
+  const auto* raw_address = reinterpret_cast<const sockaddr*>( &address ); // NOLINT(*-reinterpret-cast)
+  bind( Address { raw_address, sizeof( address ) } );
+
+  _map_size = size_t { options.block_size } * ( options.rx_blocks + options.tx_blocks );
+  void* map = ::mmap( nullptr, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_num(), 0 );
+  if ( map == MAP_FAILED ) {
+    throw unix_error( "mmap" );
+  }
+  _map = static_cast<char*>( map );
+  _tx_ring = _map + size_t { options.block_size } * options.rx_blocks;
+}
+
+PacketRing::~PacketRing()
+{
+  ::munmap( _map, _map_size );
+}
+
+tpacket_block_desc* PacketRing::_rx_block_ready() const
+{
+  auto* block = reinterpret_cast<tpacket_block_desc*>( _rx_block_data( _rx_next ) ); // NOLINT(*-reinterpret-cast)
+  const uint32_t status = atomic_ref<uint32_t>( block->hdr.bh1.block_status ).load( memory_order_acquire );
+  return ( status & TP_STATUS_USER ) ? block : nullptr;
+}
+
+void PacketRing::_rx_block_release()
+{
+  auto* block = reinterpret_cast<tpacket_block_desc*>( _rx_block_data( _rx_next ) ); // NOLINT(*-reinterpret-cast)
+  atomic_ref<uint32_t>( block->hdr.bh1.block_status ).store( TP_STATUS_KERNEL, memory_order_release );
+  _rx_next = ( _rx_next + 1 ) % _options.rx_blocks;
+}
+
+bool PacketRing::_parse_frame( const string_view frame, const bool checksum_partial, EthernetFrame& out )
+{
+  if ( frame.size() < EthernetHeader::LENGTH ) {
+    return false;
+  }
+  auto buffers = BufferPool::take_for_headers( { EthernetHeader::LENGTH } );
+  buffers[0].get_mut().assign( frame.substr( 0, EthernetHeader::LENGTH ) );
+  buffers[1].get_mut().assign( frame.substr( EthernetHeader::LENGTH ) );
+  const auto type // (the header's last two bytes)
+    = static_cast<uint16_t>( static_cast<uint8_t>( frame[12] ) << 8 | static_cast<uint8_t>( frame[13] ) );
+  if ( checksum_partial and type == EthernetHeader::TYPE_IPv4 ) {
+    complete_checksum( buffers[1].get_mut() );
+  }
+  return parse( out, move( buffers ) );
+}
+
+tpacket3_hdr* PacketRing::_tx_slot() const
+{
+  // the slots fill each block from its start (with no room left over, if frame_size divides block_size)
+  const uint32_t frames_per_block = _options.block_size / _options.frame_size;
+  char* slot = _tx_ring + size_t { _tx_next / frames_per_block } * _options.block_size
+               + size_t { _tx_next % frames_per_block } * _options.frame_size;
+  return reinterpret_cast<tpacket3_hdr*>( slot ); // NOLINT(*-reinterpret-cast)
+}
+
+bool PacketRing::has_room() const
+{
+  return atomic_ref<uint32_t>( _tx_slot()->tp_status ).load( memory_order_acquire ) == TP_STATUS_AVAILABLE;
+}
+
+bool PacketRing::send( const vector<Ref<string>>& frame )
+{
+  if ( not has_room() ) {
+    return false; // (the kernel hasn't sent this slot's last frame yet)
+  }
+
+  auto* header = _tx_slot();
+  char* slot = reinterpret_cast<char*>( header ); // NOLINT(*-reinterpret-cast)
+
+  size_t length = 0;
+  for ( const auto& buffer : frame ) {
+    if ( length + buffer->size() > _options.frame_size - TX_DATA_OFFSET ) {
+      throw runtime_error( "PacketRing: frame too large for the transmit ring" );
+    }
+    buffer->copy( slot + TX_DATA_OFFSET + length, buffer->size() );
+    length += buffer->size();
+  }
+  header->tp_len = static_cast<uint32_t>( length );
+  header->tp_snaplen = static_cast<uint32_t>( length );
+  header->tp_next_offset = 0;
+  atomic_ref<uint32_t>( header->tp_status ).store( TP_STATUS_SEND_REQUEST, memory_order_release );
+
+  _tx_next = ( _tx_next + 1 ) % _tx_frames;
+  ++_stats.frames_sent;
+  ++_tx_queued;
+  return true;
+}
+
+void PacketRing::queue_frame( vector<Ref<string>>&& frame )
+{
+  if ( _backlog.empty() and send( frame ) ) {
+    return;
+  }
+
+  // (the frame may borrow from its sender's buffers, which won't outlive this call)
+  for ( auto& buffer : frame ) {
+    if ( buffer.is_borrowed() ) {
+      buffer = Ref<string> { string { buffer.get() } };
+    }
+  }
+  _backlog.push_back( move( frame ) );
+  ++_stats.frames_delayed;
+}
+
+void PacketRing::flush()
+{
+  while ( not _backlog.empty() and send( _backlog.front() ) ) {
+    _backlog.pop_front();
+  }
+
+  if ( _tx_queued == 0 ) {
+    return;
+  }
+  if ( ::sendto( fd_num(), nullptr, 0, MSG_DONTWAIT, nullptr, 0 ) < 0 ) {
+    if ( errno != EAGAIN and errno != ENOBUFS ) {
+      throw unix_error( "sendto" );
+    }
+    return; // (the frames stay marked for sending, and go with the next flush)
+  }
+  _tx_queued = 0;
+  ++_stats.flushes;
+  register_write();
+}
+
+uint64_t PacketRing::drops()
+{
+  tpacket_stats_v3 stats {};
+  socklen_t length = sizeof( stats );
+  CheckSystemCall( "getsockopt", ::getsockopt( fd_num(), SOL_PACKET, PACKET_STATISTICS, &stats, &length ) );
+  return stats.tp_drops;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "ethernet_frame.hh"
+#include "ref.hh"
+#include "socket.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <linux/if_packet.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//! How a PacketRing's rings are laid out
+struct PacketRingOptions
+{
+  uint32_t block_size = 1 << 18; //!< Bytes per block (a multiple of the page size)
+  uint32_t rx_blocks = 64;       //!< Blocks in the receive ring
+  uint32_t tx_blocks = 16;       //!< Blocks in the transmit ring
+  uint32_t frame_size = 2048;    //!< Room for each frame in the transmit ring (with its tpacket3_hdr)
+  uint32_t block_timeout_ms = 1; //!< How long the kernel may hold on to a partly filled receive block
+};
+
+//! \brief A [packet socket](\ref man7::packet) bound to one network device (e.g. one end of a veth pair),
+//! that exchanges Ethernet frames with the kernel through memory-mapped TPACKET_V3 rings
+//! \details The kernel packs received frames into the blocks of the receive ring and hands each block over
+//! whole (once it is full, or block_timeout_ms after its first frame), so receive() goes through a batch of
+//! frames with no system call. send() copies a frame into the next free slot of the transmit ring, and
+//! flush() has the kernel send every frame queued so far with one system call. queue_frame() also keeps the
+//! frames that find the ring full, for flush() to move into it once the kernel has freed some slots. Wait for
+//! frames by polling the socket for readability (e.g. with an EventLoop rule). The socket polls writable
+//! whether or not the transmit ring has room, and the kernel gives no notice when it frees a slot, so a rule
+//! that flushes the backlog should also ask has_room(). Needs CAP_NET_RAW.
+class PacketRing : public PacketSocket
+{
+public:
+  //! Set up both rings and bind to `device` (throws if the kernel refuses)
+  explicit PacketRing( const std::string& device, const PacketRingOptions& options = {} );
+  ~PacketRing();
+
+  //! Call `on_frame( frame )` (a std::string_view into the ring, valid only during the call) for each frame in
+  //! the blocks the kernel has handed over, then hand the blocks back; returns the number of frames
+  template<typename Callback>
+  size_t receive( Callback&& on_frame )
+  {
+    return _receive( [&]( const std::string_view frame, uint32_t /* status */ ) { on_frame( frame ); } );
+  }
+
+  //! Parse each frame that receive() finds, and call `on_frame( EthernetFrame&& )` with it (frames that
+  //! don't parse are skipped)
+  //! \details The header and payload are copied out of the ring into BufferPool buffers (as the ring's memory
+  //! has to go back to the kernel), so taking a frame costs one copy but no allocation and no system call.
+  //! A frame that this machine's kernel sent with checksum offload (e.g. over a veth pair) holds only the
+  //! pseudo-header's sum in its TCP or UDP checksum; the copy gets the full checksum, as a real device's would.
+  template<typename Callback>
+  size_t receive_frames( Callback&& on_frame )
+  {
+    return _receive( [&]( const std::string_view frame, const uint32_t status ) {
+      EthernetFrame parsed;
+      if ( _parse_frame( frame, status & TP_STATUS_CSUMNOTREADY, parsed ) ) {
+        on_frame( std::move( parsed ) );
+      }
+    } );
+  }
+
+  //! Queue a frame (the concatenation of `frame`) in the transmit ring
+  //! \returns false if the ring is full (flush(), and try again once the kernel has sent some)
+  bool send( const std::vector<Ref<std::string>>& frame );
+
+  //! Queue a frame (the concatenation of `frame`) in the transmit ring, or if the ring is full (or frames are
+  //! already waiting), in a backlog behind it
+  void queue_frame( std::vector<Ref<std::string>>&& frame );
+
+  //! Move as much of the backlog into the transmit ring as fits, and have the kernel send the frames queued there
+  //! (without waiting for it to finish)
+  void flush();
+
+  //! Frames waiting in the backlog for room in the transmit ring
+  size_t queued_frames() const { return _backlog.size(); }
+
+  //! Is the next slot of the transmit ring free (has the kernel sent the frame that was in it)?
+  bool has_room() const;
+
+  struct Stats
+  {
+    uint64_t frames_received {}; //!< Frames found in the receive ring
+    uint64_t blocks_received {}; //!< Receive blocks the kernel handed over
+    uint64_t frames_sent {};     //!< Frames queued in the transmit ring
+    uint64_t flushes {};         //!< System calls made to send them
+    uint64_t frames_delayed {};  //!< Frames that waited in the backlog for room in the transmit ring
+  };
+
+  const Stats& stats() const { return _stats; }
+
+  //! Frames the kernel dropped because the receive ring was full, since the last call
+  uint64_t drops();
+
+  //! \name
+  //! The rings are mapped into this object's memory, so it can't be copied or moved
+  //!@{
+  PacketRing( const PacketRing& other ) = delete;
+  PacketRing& operator=( const PacketRing& other ) = delete;
+  PacketRing( PacketRing&& other ) = delete;
+  PacketRing& operator=( PacketRing&& other ) = delete;
+  //!@}
+
+private:
+  PacketRingOptions _options;
+  char* _map {}; //!< Shared mapping of the receive ring, followed by the transmit ring
+  size_t _map_size {};
+  char* _tx_ring {};
+  uint32_t _tx_frames {};
+
+  uint32_t _rx_next {};   //!< The next receive block to be handed over
+  uint32_t _tx_next {};   //!< The next transmit slot to fill
+  uint32_t _tx_queued {}; //!< Frames in the transmit ring that the kernel hasn't been asked to send yet
+
+  std::deque<std::vector<Ref<std::string>>> _backlog {}; //!< Frames waiting for room in the transmit ring
+  Stats _stats {};
+
+  char* _rx_block_data( uint32_t index ) const { return _map + size_t { index } * _options.block_size; }
+  tpacket3_hdr* _tx_slot() const; //!< The next slot to fill
+  tpacket_block_desc* _rx_block_ready() const;
+  void _rx_block_release();
+
+  //! receive(), also passing each frame's tp_status
+  template<typename Callback>
+  size_t _receive( Callback&& on_frame )
+  {
+    register_read(); // (looking in the ring is this socket's read)
+    size_t count = 0;
+    while ( auto* block = _rx_block_ready() ) {
+      const auto& header = block->hdr.bh1;
+      const char* frame = _rx_block_data( _rx_next ) + header.offset_to_first_pkt;
+      for ( uint32_t i = 0; i < header.num_pkts; i++ ) {
+        const auto* packet = reinterpret_cast<const tpacket3_hdr*>( frame ); // NOLINT(*-reinterpret-cast)
+        on_frame( std::string_view { frame + packet->tp_mac, packet->tp_snaplen }, packet->tp_status );
+        frame += packet->tp_next_offset;
+      }
+      count += header.num_pkts;
+      ++_stats.blocks_received;
+      _rx_block_release();
+    }
+    _stats.frames_received += count;
+    return count;
+  }
+
+  static bool _parse_frame( std::string_view frame, bool checksum_partial, EthernetFrame& out );
+};
@@ -0,0 +1,67 @@
+#include "packet_ring_adapter.hh"
+
+#include "helpers.hh"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+using namespace std;
+
+void PacketRingPort::transmit( const NetworkInterface& sender [[maybe_unused]], const EthernetFrame& frame )
+{
+  _ring.queue_frame( serialize( frame ) );
+}
+
+TCPOverIPv4OverPacketRingAdapter::Link::Link( const string& device,
+                                              const PacketRingOptions& options,
+                                              const EthernetAddress& ethernet_address,
+                                              const Address& ip_address )
+  : ring( device, options )
+  , interface( device, make_shared<PacketRingPort>( ring ), ethernet_address, ip_address )
+{}
+
+TCPOverIPv4OverPacketRingAdapter::TCPOverIPv4OverPacketRingAdapter( const string& device,
+                                                                    const EthernetAddress& ethernet_address,
+                                                                    const Address& ip_address,
+                                                                    const Address& next_hop,
+                                                                    const PacketRingOptions& options )
+  : _link( make_unique<Link>( device, options, ethernet_address, ip_address ) ), _next_hop( next_hop )
+{}
+
+optional<TCPMessage> TCPOverIPv4OverPacketRingAdapter::read()
+{
+  if ( _link->unread.empty() ) {
+    vector<TCPMessage> segments;
+    read_batch( 0, segments );
+    move( segments.begin(), segments.end(), back_inserter( _link->unread ) );
+  }
+  if ( _link->unread.empty() ) {
+    return {};
+  }
+
+  TCPMessage seg = move( _link->unread.front() );
+  _link->unread.pop_front();
+  return seg;
+}
+
+size_t TCPOverIPv4OverPacketRingAdapter::read_batch( const size_t max_datagrams [[maybe_unused]],
+                                                     vector<TCPMessage>& segments )
+{
+  NetworkInterface& interface = _link->interface;
+  const size_t frames = _link->ring.receive_frames(
+    [&]( EthernetFrame&& frame ) { interface.recv_frame( move( frame ) ); } );
+
+  while ( not interface.datagrams_received().empty() ) {
+    if ( auto seg = unwrap_tcp_in_ip( move( interface.datagrams_received().front() ) ) ) {
+      segments.push_back( move( seg.value() ) );
+    }
+    interface.datagrams_received().pop();
+  }
+  return frames;
+}
+
+void TCPOverIPv4OverPacketRingAdapter::defer_write( const TCPMessage& seg )
+{
+  _link->interface.send_datagram( wrap_tcp_in_ip( seg ), _next_hop );
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "network_interface.hh"
+#include "packet_ring.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_segment.hh"
+#include "tuntap_adapter.hh"
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+//! A NetworkInterface's link to the outside through a PacketRing's transmit ring
+//! \details Frames that find the ring full wait in its backlog (see PacketRing::queue_frame), so whoever runs
+//! the ring must flush() it after each event, and again when the ring has room for them.
+class PacketRingPort : public NetworkInterface::OutputPort
+{
+  PacketRing& _ring;
+
+public:
+  explicit PacketRingPort( PacketRing& ring ) : _ring( ring ) {}
+
+  void transmit( const NetworkInterface& sender, const EthernetFrame& frame ) override;
+};
+
+//! \brief A FD adapter for IPv4 datagrams carried in Ethernet frames through a PacketRing on a network device
+//! (e.g. one end of a veth pair), as an alternative to a TUN device
+//! \details A NetworkInterface resolves the next hop with ARP, and puts each datagram in a frame. The ring
+//! hands over received frames a block at a time, so read_batch() takes all that have arrived. Outgoing frames
+//! go into the transmit ring right away; write() then has the kernel send them, while defer_write() leaves that
+//! to the next flush_writes() (which TCPMinnowSocket calls after each event). Frames the ring has no room for
+//! wait in its backlog until it has (see writes_ready() and writes_queued()).
+class TCPOverIPv4OverPacketRingAdapter : public TCPOverIPv4Adapter
+{
+private:
+  //! The ring and what refers to it (it can't be moved, so the adapter holds it by pointer)
+  struct Link
+  {
+    PacketRing ring;
+    NetworkInterface interface;
+    std::deque<TCPMessage> unread {}; //!< Segments received by read() but not yet returned
+
+    Link( const std::string& device,
+          const PacketRingOptions& options,
+          const EthernetAddress& ethernet_address,
+          const Address& ip_address );
+  };
+
+  std::unique_ptr<Link> _link;
+  Address _next_hop;
+
+public:
+  //! Bind a PacketRing to `device`, and run a NetworkInterface with `ethernet_address` and `ip_address` on it
+  //! that sends every datagram to `next_hop`
+  TCPOverIPv4OverPacketRingAdapter( const std::string& device,
+                                    const EthernetAddress& ethernet_address,
+                                    const Address& ip_address,
+                                    const Address& next_hop,
+                                    const PacketRingOptions& options = {} );
+
+  //! Attempts to read and parse an IPv4 datagram containing a TCP segment related to the current connection
+  std::optional<TCPMessage> read();
+
+  //! Hands every frame that has arrived to the NetworkInterface (`max_datagrams` is not a limit, as the ring
+  //! hands over whole blocks), and appends the TCP segments related to the current connection to `segments`;
+  //! returns the number of frames received
+  size_t read_batch( size_t max_datagrams, std::vector<TCPMessage>& segments );
+
+  //! Creates an IPv4 datagram from a TCP segment and has the kernel send it (or waits for ARP)
+  void write( const TCPMessage& seg )
+  {
+    defer_write( seg );
+    flush_writes();
+  }
+
+  //! Like write(), but only queues the frame in the transmit ring: the next flush_writes() sends everything
+  //! queued by then, with one system call
+  void defer_write( const TCPMessage& seg );
+
+  //! Has the kernel send the frames queued by write(), as far as the transmit ring has room for them
+  void flush_writes() { _link->ring.flush(); }
+
+  //! Are frames waiting for room in the transmit ring, and is there room for one now?
+  bool writes_ready() const { return _link->ring.queued_frames() > 0 and _link->ring.has_room(); }
+
+  //! Are frames waiting for room in the transmit ring? (the kernel doesn't say when it frees a slot)
+  bool writes_queued() const { return _link->ring.queued_frames() > 0; }
+
+  //! Lets the NetworkInterface retry ARP requests and expire what it has learned
+  void tick( size_t ms_since_last_tick ) { _link->interface.tick( ms_since_last_tick ); }
+
+  //! Access the underlying PacketRing
+  const PacketRing& ring() const { return _link->ring; }
+
+  //! Access underlying file descriptor
+  FileDescriptor& fd() { return _link->ring; }
+};
+
+static_assert( TCPDatagramBatchAdapter<TCPOverIPv4OverPacketRingAdapter> );
+static_assert( TCPDatagramQueueingAdapter<TCPOverIPv4OverPacketRingAdapter> );
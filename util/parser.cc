@@ -5,24 +5,24 @@
 
 using namespace std;
 
-string_view Parser::BufferList::peek() const
+void Parser::BufferList::set_front()
 {
-  if ( buffer_.empty() ) {
-    throw runtime_error( "peek on empty BufferList" );
-  }
-  return string_view { buffer_.front().get() }.substr( skip_ );
+  front_ = first_ < buffer_.size() ? string_view { buffer_[first_].get() }.substr( skip_ ) : string_view {};
 }
 
-void Parser::BufferList::remove_prefix( uint64_t len )
+void Parser::BufferList::remove_prefix_across_buffers( uint64_t len )
 {
-  while ( len and not buffer_.empty() ) {
-    const uint64_t to_pop_now = min( len, peek().size() );
+  while ( len and first_ < buffer_.size() ) {
+    const uint64_t to_pop_now = min( len, front_.size() );
     skip_ += to_pop_now;
     len -= to_pop_now;
     size_ -= to_pop_now;
-    if ( skip_ == buffer_.front()->size() ) {
-      buffer_.pop_front();
+    front_.remove_prefix( to_pop_now );
+    if ( front_.empty() ) {
+      buffer_[first_] = Ref<std::string> {}; // (lets go of the buffer now, e.g. back to its BufferPool)
+      ++first_;
       skip_ = 0;
+      set_front();
     }
   }
 }
@@ -33,38 +33,34 @@ void Parser::BufferList::truncate( size_t len )
     return;
   }
 
-  if ( len == 0 ) {
-    buffer_.clear();
-    size_ = 0;
-    return;
-  }
-
+  // keep `len` bytes, counting from the front (after the skipped bytes)
   size_t size_so_far = 0;
-  auto it = buffer_.begin();
-  while ( it != buffer_.end() ) {
-    if ( size_so_far + it->get().size() < len ) {
-      size_so_far += it->get().size();
+  size_t skip = skip_;
+  auto it = buffer_.begin() + static_cast<ptrdiff_t>( first_ );
+  while ( it != buffer_.end() and size_so_far < len ) {
+    const size_t available = it->get().size() - skip;
+    if ( size_so_far + available <= len ) {
+      size_so_far += available;
+      skip = 0;
       ++it;
       continue;
     }
 
-    if ( size_so_far + it->get().size() == len ) {
-      ++it;
-      break;
-    }
-
-    assert( !it->get().empty() );
     assert( len > size_so_far );
-    assert( len - size_so_far < it->get().size() );
-    it->get_mut().resize( len - size_so_far );
-    break;
+    it->get_mut().resize( skip + len - size_so_far );
+    size_so_far = len;
+    ++it;
   }
 
-  while ( it != buffer_.end() ) {
-    it = buffer_.erase( it );
+  buffer_.erase( it, buffer_.end() );
+  if ( len == 0 ) {
+    buffer_.clear();
+    first_ = 0;
+    skip_ = 0;
   }
 
   size_ = len;
+  set_front();
 }
 
 void Parser::BufferList::dump_all( vector<Ref<std::string>>& out )
@@ -73,15 +69,20 @@ void Parser::BufferList::dump_all( vector<Ref<std::string>>& out )
   if ( empty() ) {
     return;
   }
+  out.reserve( buffer_segment_count() );
   if ( skip_ ) {
-    out.emplace_back( buffer_.front()->substr( skip_ ) );
+    out.emplace_back( buffer_[first_]->substr( skip_ ) );
   } else {
-    out.push_back( move( buffer_.front() ) );
+    out.push_back( move( buffer_[first_] ) );
   }
-  buffer_.pop_front();
-  for ( auto&& x : buffer_ ) {
-    out.emplace_back( move( x ) );
+  for ( size_t i = first_ + 1; i < buffer_.size(); i++ ) {
+    out.push_back( move( buffer_[i] ) );
   }
+  buffer_.clear();
+  first_ = 0;
+  skip_ = 0;
+  size_ = 0;
+  set_front();
 }
 
 vector<string_view> Parser::BufferList::buffer() const
@@ -92,8 +93,8 @@ vector<string_view> Parser::BufferList::buffer() const
   vector<string_view> ret;
   ret.reserve( buffer_segment_count() );
   auto tmp_skip = skip_;
-  for ( const auto& x : buffer_ ) {
-    ret.push_back( string_view { x.get() }.substr( tmp_skip ) );
+  for ( size_t i = first_; i < buffer_.size(); i++ ) {
+    ret.push_back( string_view { buffer_[i].get() }.substr( tmp_skip ) );
     tmp_skip = 0;
   }
   return ret;
@@ -130,17 +131,42 @@ void Parser::concatenate_all_remaining( std::string& out )
   }
 }
 
+Serializer::Serializer( Ref<string> buffer, const size_t copy_limit )
+  : buffer_( move( buffer ) ), copy_limit_( copy_limit )
+{
+  output_.reserve( 4 );
+  buffer_->clear();
+}
+
 void Serializer::flush()
 {
-  if ( not buffer_.empty() ) {
-    output_.emplace_back( move( buffer_ ) );
-    buffer_.clear();
+  if ( not buffer_->empty() ) {
+    output_.push_back( move( buffer_ ) );
+    buffer_ = Ref<string> {};
+  }
+}
+
+//! Appends a small payload to the current buffer (instead of adding it to the output as a buffer of its own)
+bool Serializer::copy_in( const string_view buf )
+{
+  if ( buf.size() > copy_limit_ ) {
+    return false;
+  }
+  buffer_->append( buf );
+  return true;
+}
+
+void Serializer::buffer( const string& buf )
+{
+  if ( not buf.empty() and not copy_in( buf ) ) {
+    flush();
+    output_.emplace_back( string { buf } );
   }
 }
 
-void Serializer::buffer( string buf )
+void Serializer::buffer( string&& buf )
 {
-  if ( not buf.empty() ) {
+  if ( not buf.empty() and not copy_in( buf ) ) {
     flush();
     output_.emplace_back( move( buf ) );
   }
@@ -148,7 +174,7 @@ void Serializer::buffer( string buf )
 
 void Serializer::buffer( Ref<string> buf )
 {
-  if ( not buf.get().empty() ) {
+  if ( not buf.get().empty() and not copy_in( buf.get() ) ) {
     flush();
     output_.emplace_back( move( buf ) );
   }
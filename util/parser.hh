@@ -2,9 +2,11 @@
 
 #include "ref.hh"
 
+#include <array>
+#include <bit>
 #include <concepts>
 #include <cstdint>
-#include <deque>
+#include <cstring>
 #include <ranges>
 #include <span>
 #include <stdexcept>
@@ -12,34 +14,80 @@
 #include <string_view>
 #include <vector>
 
+//! Converts an unsigned integer between host and big-endian (network) byte order, in either direction
+template<std::unsigned_integral T>
+constexpr T big_endian( const T value )
+{
+  if constexpr ( sizeof( T ) == 1 or std::endian::native == std::endian::big ) {
+    return value;
+  } else if constexpr ( sizeof( T ) == 2 ) {
+    return __builtin_bswap16( value );
+  } else if constexpr ( sizeof( T ) == 4 ) {
+    return __builtin_bswap32( value );
+  } else {
+    static_assert( sizeof( T ) == 8 );
+    return __builtin_bswap64( value );
+  }
+}
+
 class Parser
 {
   class BufferList
   {
     uint64_t size_ {};
-    std::deque<Ref<std::string>> buffer_ {};
-    uint64_t skip_ {};
+    std::vector<Ref<std::string>> buffer_ {};
+    size_t first_ {};           // buffer_[first_] is the front; the ones before it have been consumed
+    uint64_t skip_ {};          // bytes consumed from the front buffer
+    std::string_view front_ {}; // what's left of the front buffer
+
+    void set_front();
+    void remove_prefix_across_buffers( uint64_t len );
 
   public:
     explicit BufferList( std::ranges::range auto&& buffers )
       requires std::is_convertible_v<decltype( std::move( *buffers.begin() ) ), Ref<std::string>>
     {
+      if constexpr ( std::ranges::sized_range<decltype( buffers )> ) {
+        buffer_.reserve( std::ranges::size( buffers ) );
+      }
       for ( auto&& x : buffers ) {
         buffer_.emplace_back( std::move( x ) );
         if ( buffer_.back().is_borrowed() ) {
           throw std::runtime_error( "cannot parse borrowed string" );
         }
+        if ( buffer_.back()->empty() ) {
+          buffer_.pop_back(); // (so the front buffer is never empty while there is anything left)
+          continue;
+        }
         size_ += buffer_.back()->size();
       }
+      set_front();
     }
 
     uint64_t size() const { return size_; }
     uint64_t serialized_length() const { return size(); }
     bool empty() const { return size_ == 0; }
-    size_t buffer_segment_count() const { return buffer_.size(); }
+    size_t buffer_segment_count() const { return buffer_.size() - first_; }
+
+    std::string_view peek() const
+    {
+      if ( front_.empty() ) {
+        throw std::runtime_error( "peek on empty BufferList" );
+      }
+      return front_;
+    }
+
+    void remove_prefix( const uint64_t len )
+    {
+      if ( len < front_.size() ) {
+        front_.remove_prefix( len );
+        skip_ += len;
+        size_ -= len;
+        return;
+      }
+      remove_prefix_across_buffers( len );
+    }
 
-    std::string_view peek() const;
-    void remove_prefix( uint64_t len );
     void truncate( size_t len );
     void dump_all( std::vector<Ref<std::string>>& out );
     std::vector<std::string_view> buffer() const;
@@ -60,6 +108,7 @@ public:
 
   bool has_error() const { return error_; }
   void set_error() { error_ = true; }
+  uint64_t bytes_remaining() const { return input_.size(); }
   void remove_prefix( size_t n ) { input_.remove_prefix( n ); }
   void truncate( size_t len ) { input_.truncate( len ); }
 
@@ -77,11 +126,22 @@ public:
       return;
     }
 
+    const std::string_view front = input_.peek();
     if constexpr ( sizeof( T ) == 1 ) {
-      out = static_cast<uint8_t>( input_.peek().front() );
+      out = static_cast<uint8_t>( front.front() );
       input_.remove_prefix( 1 );
       return;
     } else {
+      // fast path: the whole integer is in the front buffer
+      if ( front.size() >= sizeof( T ) ) {
+        T raw;
+        std::memcpy( &raw, front.data(), sizeof( T ) );
+        out = big_endian( raw );
+        input_.remove_prefix( sizeof( T ) );
+        return;
+      }
+
+      // the integer straddles buffers: one byte at a time
       out = static_cast<T>( 0 );
       for ( size_t i = 0; i < sizeof( T ); i++ ) {
         out <<= 8;
@@ -95,23 +155,32 @@ public:
 class Serializer
 {
   std::vector<Ref<std::string>> output_ {};
-  std::string buffer_ {};
+  Ref<std::string> buffer_ {}; // where integers (and small payloads) go, until the next output_ buffer
+  size_t copy_limit_ {};
 
   void flush();
+  bool copy_in( std::string_view buf );
 
 public:
+  //! Payloads of up to this many bytes are copied into the caller's buffer (see below)
+  static constexpr size_t kSmallPayload = 256;
+
+  Serializer() { output_.reserve( 4 ); }
+
+  //! Serialize into `buffer` (e.g. one from BufferPool::take_small(), so that serializing doesn't allocate):
+  //! integers are appended to it, and so is any payload buffer of up to `copy_limit` bytes, so a frame with
+  //! a small payload comes out as the one contiguous buffer. (Larger payloads are borrowed, as usual.)
+  explicit Serializer( Ref<std::string> buffer, size_t copy_limit = kSmallPayload );
+
   template<std::unsigned_integral T>
   void integer( const T val )
   {
-    constexpr uint64_t len = sizeof( T );
-
-    for ( uint64_t i = 0; i < len; ++i ) {
-      const uint8_t byte_val = val >> ( ( len - i - 1 ) * 8 );
-      buffer_.push_back( byte_val );
-    }
+    const auto bytes = std::bit_cast<std::array<char, sizeof( T )>>( big_endian( val ) );
+    buffer_->append( bytes.data(), bytes.size() );
   }
 
-  void buffer( std::string buf );
+  void buffer( const std::string& buf ); // (copied, unless copied in)
+  void buffer( std::string&& buf );
   void buffer( Ref<std::string> buf );
   void buffer( const std::vector<Ref<std::string>>& bufs );
   std::vector<Ref<std::string>> finish();
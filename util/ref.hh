@@ -2,11 +2,14 @@
 
 #include <optional>
 #include <stdexcept>
+#include <utility>
 
 /*
  * A Ref<T> represents a "borrowed"-or-"owned" reference to an object of type T.
  * Whether "borrowed" or "owned", the Ref exposes a constant reference to the inner T.
  * If "owned", the inner T can also be accessed by non-const reference (and mutated).
+ * An owned Ref can also be "recycled": instead of destroying the inner T along with the Ref,
+ * it hands it to a recycler function (e.g. to return a buffer to a pool; see BufferPool).
  */
 template<typename T>
 class Ref
@@ -24,11 +27,33 @@ public:
   // construct from rvalue reference -> owned reference (moved from original)
   Ref( T&& obj ) : obj_( std::move( obj ) ) {} // NOLINT(*-explicit-*)
 
-  // move constructor: move from original (owned or borrowed)
-  Ref( Ref&& other ) noexcept = default;
+  // owned reference (moved from original) whose object goes to `recycler` when the Ref is destroyed
+  using Recycler = void ( * )( T& obj ) noexcept;
+  static Ref recycled( T&& obj, Recycler recycler )
+  {
+    Ref ret { std::move( obj ) };
+    ret.recycler_ = recycler;
+    return ret;
+  }
 
-  // move-assignment: move from original (owned or borrowed)
-  Ref& operator=( Ref&& other ) noexcept = default;
+  // move constructor: move from original (owned, recycled or borrowed)
+  Ref( Ref&& other ) noexcept
+    : borrowed_obj_( other.borrowed_obj_ )
+    , obj_( std::move( other.obj_ ) )
+    , recycler_( std::exchange( other.recycler_, nullptr ) )
+  {}
+
+  // move-assignment: move from original (owned, recycled or borrowed)
+  Ref& operator=( Ref&& other ) noexcept
+  {
+    if ( this != &other ) {
+      recycle();
+      borrowed_obj_ = other.borrowed_obj_;
+      obj_ = std::move( other.obj_ );
+      recycler_ = std::exchange( other.recycler_, nullptr );
+    }
+    return *this;
+  }
 
   // borrow from const reference: borrowed reference (points to original)
   static Ref borrow( const T& obj )
@@ -65,7 +90,7 @@ public:
   Ref& operator=( const Ref& other ) = delete;
 #endif
 
-  ~Ref() = default;
+  ~Ref() { recycle(); }
 
   bool is_owned() const { return obj_.has_value(); }
   bool is_borrowed() const { return not is_owned(); }
@@ -98,6 +123,7 @@ public:
   T release()
   {
     if ( obj_.has_value() ) {
+      recycler_ = nullptr; // (the caller keeps it)
       return std::move( *obj_ );
     }
 
@@ -111,6 +137,14 @@ public:
 private:
   const T* borrowed_obj_ {};
   std::optional<T> obj_ {};
+  Recycler recycler_ {};
+
+  void recycle() noexcept
+  {
+    if ( recycler_ and obj_.has_value() ) {
+      std::exchange( recycler_, nullptr )( *obj_ );
+    }
+  }
 
   struct uninitialized_t
   {};
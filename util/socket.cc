@@ -147,6 +147,137 @@ void DatagramSocket::send( const string_view payload )
   register_write();
 }
 
+DatagramSocket::Batch::Batch( const size_t capacity ) : _headers( capacity ), _addresses( capacity )
+{
+  if ( capacity == 0 ) {
+    throw runtime_error( "DatagramSocket::Batch needs room for at least one datagram" );
+  }
+  _iovecs.reserve( capacity );
+  _first_iovec.reserve( capacity );
+}
+
+void DatagramSocket::Batch::clear()
+{
+  _size = 0;
+  _iovecs.clear();
+  _first_iovec.clear();
+}
+
+void DatagramSocket::Batch::push_back( const Address& destination, const string_view payload )
+{
+  _push_back( &destination );
+  _iovecs.push_back( { const_cast<char*>( payload.data() ), payload.size() } ); // NOLINT(*-const-cast)
+}
+
+void DatagramSocket::Batch::push_back( const string_view payload )
+{
+  _push_back( nullptr );
+  _iovecs.push_back( { const_cast<char*>( payload.data() ), payload.size() } ); // NOLINT(*-const-cast)
+}
+
+void DatagramSocket::Batch::push_back( const vector<Ref<string>>& buffers )
+{
+  _push_back( nullptr );
+  for ( const auto& buffer : buffers ) {
+    _iovecs.push_back( { const_cast<char*>( buffer->data() ), buffer->size() } ); // NOLINT(*-const-cast)
+  }
+}
+
+//! Start a datagram (its iovecs follow, and are hooked up to its header by send_batch)
+void DatagramSocket::Batch::_push_back( const Address* destination )
+{
+  if ( _size >= capacity() ) {
+    throw runtime_error( "DatagramSocket::Batch is full" );
+  }
+  if ( _size == 0 ) {
+    _iovecs.clear();
+    _first_iovec.clear();
+  }
+
+  msghdr& header = _headers[_size].msg_hdr;
+  header = {};
+  if ( destination ) {
+    header.msg_name = const_cast<sockaddr*>( destination->raw() ); // NOLINT(*-const-cast)
+    header.msg_namelen = destination->size();
+  }
+  _first_iovec.push_back( _iovecs.size() );
+  ++_size;
+}
+
+string_view DatagramSocket::Batch::payload( const size_t i ) const
+{
+  if ( i >= _size ) {
+    throw out_of_range( "DatagramSocket::Batch::payload" );
+  }
+  return { _buffers[i].data(), _headers[i].msg_len };
+}
+
+Address DatagramSocket::Batch::source( const size_t i ) const
+{
+  if ( i >= _size ) {
+    throw out_of_range( "DatagramSocket::Batch::source" );
+  }
+  return { _addresses[i], _headers[i].msg_hdr.msg_namelen };
+}
+
+size_t DatagramSocket::recv_batch( Batch& batch )
+{
+  const size_t capacity = batch.capacity();
+  if ( batch._buffers.empty() ) {
+    batch._buffers.resize( capacity, string( kReadBufferSize, 0 ) );
+  }
+
+  batch.clear();
+  batch._iovecs.resize( capacity );
+  for ( size_t i = 0; i < capacity; i++ ) {
+    batch._iovecs[i] = { batch._buffers[i].data(), kReadBufferSize };
+    msghdr& header = batch._headers[i].msg_hdr;
+    header = {};
+    header.msg_name = static_cast<sockaddr*>( batch._addresses[i] );
+    header.msg_namelen = sizeof( batch._addresses[i].storage );
+    header.msg_iov = &batch._iovecs[i];
+    header.msg_iovlen = 1;
+  }
+
+  const int count = CheckSystemCall( "recvmmsg",
+                                     ::recvmmsg( fd_num(),
+                                                 batch._headers.data(),
+                                                 static_cast<unsigned>( capacity ),
+                                                 MSG_WAITFORONE | MSG_TRUNC,
+                                                 nullptr ) );
+  for ( int i = 0; i < count; i++ ) {
+    if ( batch._headers[i].msg_hdr.msg_flags & MSG_TRUNC ) {
+      throw runtime_error( "recvmmsg (oversized datagram)" );
+    }
+    register_read();
+  }
+
+  batch._size = count;
+  return count;
+}
+
+size_t DatagramSocket::send_batch( Batch& batch )
+{
+  if ( batch.size() == 0 ) {
+    return 0;
+  }
+
+  // (the iovecs may have moved while the batch was filled)
+  for ( size_t i = 0; i < batch.size(); i++ ) {
+    const size_t first = batch._first_iovec[i];
+    const size_t end = i + 1 < batch.size() ? batch._first_iovec[i + 1] : batch._iovecs.size();
+    batch._headers[i].msg_hdr.msg_iov = batch._iovecs.data() + first;
+    batch._headers[i].msg_hdr.msg_iovlen = end - first;
+  }
+
+  const int count = CheckSystemCall(
+    "sendmmsg", ::sendmmsg( fd_num(), batch._headers.data(), static_cast<unsigned>( batch.size() ), 0 ) );
+  for ( int i = 0; i < count; i++ ) {
+    register_write();
+  }
+  return count;
+}
+
 // mark the socket as listening for incoming connections
 //! \param[in] backlog is the number of waiting connections to queue (see [listen(2)](\ref man2::listen))
 void TCPSocket::listen( const int backlog )
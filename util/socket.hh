@@ -2,9 +2,13 @@
 
 #include "address.hh"
 #include "file_descriptor.hh"
+#include "ref.hh"
 
 #include <functional>
+#include <string>
+#include <string_view>
 #include <sys/socket.h>
+#include <vector>
 
 //! \brief Base class for network sockets (TCP, UDP, etc.)
 //! \details Socket is generally used via a subclass. See TCPSocket and UDPSocket for usage examples.
@@ -69,6 +73,55 @@ public:
   //! Send datagram to the socket's connected address (must call connect() first)
   void send( std::string_view payload );
 
+  //! \brief Storage for recv_batch and send_batch, allocated once and reused from batch to batch
+  //! \details Holds a message header and an address for each datagram, the datagrams' iovecs, and (once
+  //! used for receiving) a payload buffer for each datagram.
+  class Batch
+  {
+  public:
+    explicit Batch( size_t capacity );
+
+    size_t capacity() const { return _headers.size(); }
+    size_t size() const { return _size; }
+    void clear();
+
+    //! \name
+    //! (send_batch) Add a datagram, for `destination` or for the socket's connected address. The payload
+    //! isn't copied, and must stay valid until it has been sent.
+    //!@{
+    void push_back( const Address& destination, std::string_view payload );
+    void push_back( std::string_view payload );
+    void push_back( const std::vector<Ref<std::string>>& buffers );
+    //!@}
+
+    //! (recv_batch) The payload of the `i`th datagram received (valid until the next recv_batch)
+    std::string_view payload( size_t i ) const;
+
+    //! (recv_batch) The sender of the `i`th datagram received
+    Address source( size_t i ) const;
+
+  private:
+    friend class DatagramSocket;
+
+    std::vector<mmsghdr> _headers;
+    std::vector<Address::Raw> _addresses;
+    std::vector<iovec> _iovecs {};
+    std::vector<size_t> _first_iovec {};  //!< (send_batch) Where each datagram's iovecs start in _iovecs
+    std::vector<std::string> _buffers {}; //!< Allocated by the first recv_batch
+    size_t _size {};
+
+    void _push_back( const Address* destination );
+  };
+
+  //! \brief Receive up to `batch.capacity()` datagrams with one [recvmmsg(2)](\ref man2::recvmmsg)
+  //! \details Waits (on a blocking socket) only for the first datagram. Returns the number received.
+  size_t recv_batch( Batch& batch );
+
+  //! \brief Send the datagrams in `batch` with one [sendmmsg(2)](\ref man2::sendmmsg)
+  //! \details Returns the number sent, which is smaller than `batch.size()` if a non-blocking socket
+  //! ran out of buffer space.
+  size_t send_batch( Batch& batch );
+
 protected:
   DatagramSocket( int domain, int type, int protocol = 0 ) : Socket( domain, type, protocol ) {}
 
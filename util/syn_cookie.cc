@@ -0,0 +1,100 @@
+#include "syn_cookie.hh"
+
+#include <bit>
+#include <random>
+
+using namespace std;
+
+namespace {
+class Wrap32Raw : public Wrap32
+{
+public:
+  uint32_t raw_value() const { return raw_value_; }
+};
+
+// SipHash-2-4 (Aumasson and Bernstein) over a fixed number of 64-bit words
+template<size_t N>
+uint64_t siphash( const array<uint64_t, 2>& key, const array<uint64_t, N>& words )
+{
+  uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+
+  const auto round = [&] {
+    v0 += v1;
+    v1 = rotl( v1, 13 );
+    v1 ^= v0;
+    v0 = rotl( v0, 32 );
+    v2 += v3;
+    v3 = rotl( v3, 16 );
+    v3 ^= v2;
+    v0 += v3;
+    v3 = rotl( v3, 21 );
+    v3 ^= v0;
+    v2 += v1;
+    v1 = rotl( v1, 17 );
+    v1 ^= v2;
+    v2 = rotl( v2, 32 );
+  };
+
+  const auto compress = [&]( const uint64_t m ) {
+    v3 ^= m;
+    round();
+    round();
+    v0 ^= m;
+  };
+
+  for ( const uint64_t m : words ) {
+    compress( m );
+  }
+  compress( static_cast<uint64_t>( N * sizeof( uint64_t ) ) << 56 );
+
+  v2 ^= 0xff;
+  round();
+  round();
+  round();
+  round();
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+} // namespace
+
+SynCookieGenerator::SynCookieGenerator()
+{
+  random_device rd;
+  for ( auto& k : _key ) {
+    k = ( static_cast<uint64_t>( rd() ) << 32 ) | rd();
+  }
+}
+
+uint32_t SynCookieGenerator::_mac( const FourTuple& tuple, const Wrap32 client_isn, const uint32_t slot ) const
+{
+  const array<uint64_t, 3> words {
+    ( static_cast<uint64_t>( tuple.local_ip ) << 32 ) | tuple.remote_ip,
+    ( static_cast<uint64_t>( tuple.local_port ) << 16 ) | tuple.remote_port,
+    ( static_cast<uint64_t>( Wrap32Raw { client_isn }.raw_value() ) << 32 ) | slot };
+  return static_cast<uint32_t>( siphash( _key, words ) ) & ( ( 1U << MAC_BITS ) - 1 );
+}
+
+Wrap32 SynCookieGenerator::make( const FourTuple& tuple, const Wrap32 client_isn, const uint64_t now_ms ) const
+{
+  const uint32_t slot = static_cast<uint32_t>( now_ms / SLOT_MS ) & ( ( 1U << SLOT_BITS ) - 1 );
+  return Wrap32 { ( slot << MAC_BITS ) | _mac( tuple, client_isn, slot ) };
+}
+
+bool SynCookieGenerator::check( const FourTuple& tuple,
+                                const Wrap32 client_isn,
+                                const Wrap32 cookie,
+                                const uint64_t now_ms ) const
+{
+  constexpr uint32_t slot_mask = ( 1U << SLOT_BITS ) - 1;
+  const uint32_t raw = Wrap32Raw { cookie }.raw_value();
+  const uint32_t slot = raw >> MAC_BITS;
+  const uint32_t age = ( static_cast<uint32_t>( now_ms / SLOT_MS ) - slot ) & slot_mask;
+
+  if ( age > 1 ) {
+    return false;
+  }
+
+  return ( raw & ( ( 1U << MAC_BITS ) - 1 ) ) == _mac( tuple, client_isn, slot );
+}
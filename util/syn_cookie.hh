@@ -0,0 +1,36 @@
+#pragma once
+
+#include "four_tuple.hh"
+#include "wrapping_integers.hh"
+
+#include <array>
+#include <cstdint>
+
+//! \brief Stateless SYN cookies for TCPMinnowListener
+//! \details A cookie is an initial sequence number chosen so that the final ACK of the
+//! handshake proves the peer received our SYN/ACK. The top SLOT_BITS bits hold a coarse
+//! timestamp (the time slot the cookie was issued in); the remaining bits hold a keyed
+//! MAC over the four-tuple, the peer's ISN and that time slot. The listener therefore
+//! needs no per-connection state until the ACK validates.
+class SynCookieGenerator
+{
+public:
+  static constexpr uint64_t SLOT_MS = 64'000; //!< Length of one cookie time slot, in milliseconds
+  static constexpr unsigned SLOT_BITS = 5;    //!< Bits of the cookie that hold the time slot
+  static constexpr unsigned MAC_BITS = 32 - SLOT_BITS;
+
+  //! Construct with a fresh random secret
+  SynCookieGenerator();
+
+  //! The ISN to put in a SYN/ACK answering `client_isn` on connection `tuple`
+  Wrap32 make( const FourTuple& tuple, Wrap32 client_isn, uint64_t now_ms ) const;
+
+  //! Does `cookie` (the ACK's ackno minus one) belong to `tuple` and `client_isn`
+  //! (the ACK's seqno minus one), issued in the current or the previous time slot?
+  bool check( const FourTuple& tuple, Wrap32 client_isn, Wrap32 cookie, uint64_t now_ms ) const;
+
+private:
+  std::array<uint64_t, 2> _key {};
+
+  uint32_t _mac( const FourTuple& tuple, Wrap32 client_isn, uint32_t slot ) const;
+};
@@ -0,0 +1,33 @@
+#include "task.hh"
+
+#include "eventloop.hh"
+
+using namespace std;
+
+coroutine_handle<> Task::FinalAwaiter::await_suspend( const Handle finished ) const noexcept
+{
+  const promise_type& promise = finished.promise();
+  if ( promise.continuation ) {
+    return promise.continuation; // (the awaiting Task picks up the exception, if any)
+  }
+
+  // a spawned Task: the loop destroys it (and reports its exception) once control is back with the loop
+  if ( promise.loop ) {
+    promise.loop->_task_finished( finished );
+  }
+  return noop_coroutine();
+}
+
+coroutine_handle<> Task::await_suspend( const Handle awaiting ) noexcept
+{
+  _handle.promise().loop = awaiting.promise().loop;
+  _handle.promise().continuation = awaiting;
+  return _handle;
+}
+
+void Task::await_resume() const
+{
+  if ( _handle and _handle.promise().exception ) {
+    rethrow_exception( _handle.promise().exception );
+  }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+class EventLoop;
+
+//! \brief A coroutine that runs on an EventLoop (write `Task f() { ... co_await ...; }`)
+//! \details A Task starts suspended. EventLoop::spawn() starts it and owns it until it finishes; or another
+//! Task can `co_await` it, which runs it to completion (on the same EventLoop) before going on, and rethrows
+//! its exception if it threw one. Inside a Task, `co_await fd.async_read( buffer )`,
+//! `co_await fd.async_write( data )` and `co_await loop.sleep( duration )` suspend the coroutine until the
+//! EventLoop has something for it, so one thread can run many of them.
+class Task
+{
+public:
+  struct promise_type;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  //! Resumes whoever awaited the Task (or tells the EventLoop that a spawned Task is done)
+  struct FinalAwaiter
+  {
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend( Handle finished ) const noexcept;
+    void await_resume() const noexcept {}
+  };
+
+  struct promise_type
+  {
+    EventLoop* loop {};                      //!< The loop the coroutine runs on (set when started)
+    std::coroutine_handle<> continuation {}; //!< The coroutine awaiting this one, if any
+    std::exception_ptr exception {};
+
+    Task get_return_object() { return Task { Handle::from_promise( *this ) }; }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() { exception = std::current_exception(); }
+  };
+
+  //! \name
+  //! Awaiting a Task runs it, on the awaiting coroutine's EventLoop, until it finishes
+  //!@{
+  bool await_ready() const noexcept { return not _handle or _handle.done(); }
+  std::coroutine_handle<> await_suspend( Handle awaiting ) noexcept;
+  void await_resume() const;
+  //!@}
+
+  //! Give up ownership of the coroutine (see EventLoop::spawn)
+  Handle release() { return std::exchange( _handle, {} ); }
+
+  ~Task()
+  {
+    if ( _handle ) {
+      _handle.destroy();
+    }
+  }
+
+  //! \name
+  //! A Task owns its coroutine, so it can be moved but not copied
+  //!@{
+  Task( Task&& other ) noexcept : _handle( other.release() ) {}
+  Task& operator=( Task&& other ) noexcept
+  {
+    if ( this != &other ) {
+      if ( _handle ) {
+        _handle.destroy();
+      }
+      _handle = other.release();
+    }
+    return *this;
+  }
+  Task( const Task& other ) = delete;
+  Task& operator=( const Task& other ) = delete;
+  //!@}
+
+private:
+  explicit Task( Handle handle ) : _handle( handle ) {}
+
+  Handle _handle;
+};
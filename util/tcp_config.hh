@@ -12,6 +12,7 @@ class TCPConfig
 public:
   static constexpr size_t DEFAULT_CAPACITY = 64000; //!< Default capacity
   static constexpr size_t MAX_PAYLOAD_SIZE = 1000;  //!< Conservative max payload size for real Internet
+  static constexpr size_t MAX_SUPER_SEGMENT_SIZE = 64 * MAX_PAYLOAD_SIZE; //!< (fits in one IPv4 datagram)
   static constexpr uint16_t TIMEOUT_DFLT = 1000;    //!< Default re-transmit timeout is 1 second
   static constexpr unsigned MAX_RETX_ATTEMPTS = 8;  //!< Maximum re-transmit attempts before giving up
 
@@ -19,6 +20,11 @@ public:
   size_t recv_capacity = DEFAULT_CAPACITY; //!< Receive capacity, in bytes
   size_t send_capacity = DEFAULT_CAPACITY; //!< Sender capacity, in bytes
   Wrap32 isn { 137 };                      //!< Default initial sequence number
+
+  //! If nonzero, the sender joins consecutive full-size segments into super-segments of up to this many payload
+  //! bytes, for a link that cuts them apart again (segmentation offload, as through a TunFD opened with
+  //! TunTapOptions::gso). Retransmissions are still single segments.
+  size_t super_segment_size = 0;
 };
 
 //! Config for classes derived from FdAdapter
@@ -30,4 +36,29 @@ public:
 
   uint16_t loss_rate_dn = 0; //!< Downlink loss rate (for LossyFdAdapter)
   uint16_t loss_rate_up = 0; //!< Uplink loss rate (for LossyFdAdapter)
+
+  //! The link can't corrupt segments (e.g. both ends are minnow stacks on this machine), so TCP checksums are
+  //! neither computed nor verified. Both ends must agree. (See TCPOverIPv4Adapter.)
+  bool checksum_trusted = false;
+};
+
+//! Config for TCPMinnowListener
+class TCPListenerConfig
+{
+public:
+  static constexpr size_t DEFAULT_SYN_BACKLOG = 128;   //!< Default limit on half-open connections
+  static constexpr size_t DEFAULT_ACCEPT_BACKLOG = 16; //!< Default limit on connections waiting for accept()
+
+  //! When to answer a SYN with a stateless SYN cookie instead of a half-open connection
+  enum class SynCookies : uint8_t
+  {
+    Off,      //!< Never; SYNs beyond the SYN backlog are dropped
+    WhenFull, //!< Only once the SYN backlog is full
+    Always    //!< For every SYN; the listener keeps no half-open state at all
+  };
+
+  size_t syn_backlog = DEFAULT_SYN_BACKLOG;       //!< Max connections that have sent SYN but not completed handshake
+  size_t accept_backlog = DEFAULT_ACCEPT_BACKLOG; //!< Max established connections not yet accepted by the owner
+  SynCookies syn_cookies = SynCookies::Off;       //!< Stateless SYN/ACK policy
+  size_t parse_threads = 0;                       //!< Threads that parse and checksum datagrams (0: listener's own)
 };
@@ -0,0 +1,621 @@
+#include "tcp_minnow_listener.hh"
+
+#include "buffer_pool.hh"
+#include "helpers.hh"
+#include "ipv4_datagram.hh"
+#include "tcp_minnow_socket_impl.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_peer.hh"
+#include "tcp_segment.hh"
+
+#include <iostream>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+constexpr int TCP_TICK_MS = 10; //!< How often the listener thread checks for expired timers and shutdown
+
+Address make_address( const uint32_t ip, const uint16_t port )
+{
+  return Address { Address::from_ipv4_numeric( ip ).ip(), port };
+}
+
+//! A datagram on its way from the device to its connection
+struct Arrival
+{
+  vector<Ref<string>> buffers;
+  bool verify_checksum {}; //!< Verify the TCP checksum (unless FdAdapterConfig::checksum_trusted)?
+  IPv4Header header {};
+  TCPSegment segment {};
+  bool valid {}; //!< Did the datagram and its TCP segment parse, with correct checksums?
+};
+
+//! Parse the datagram and its TCP segment (this touches no listener state, so it can run on any thread)
+void parse_arrival( Arrival& arrival )
+{
+  InternetDatagram dgram;
+  if ( not parse( dgram, move( arrival.buffers ) ) or dgram.header.proto != IPv4Header::PROTO_TCP ) {
+    return;
+  }
+  arrival.header = dgram.header;
+  arrival.valid = arrival.verify_checksum
+                    ? parse( arrival.segment, move( dgram.payload ), dgram.header.pseudo_checksum() )
+                    : parse( arrival.segment, move( dgram.payload ) );
+}
+
+uint8_t byte_at( const vector<Ref<string>>& buffers, size_t offset )
+{
+  for ( const auto& buffer : buffers ) {
+    if ( offset < buffer->size() ) {
+      return buffer->at( offset );
+    }
+    offset -= buffer->size();
+  }
+  return 0;
+}
+
+//! Hash of the four-tuple of a datagram that hasn't been parsed yet, read straight from the raw headers
+//! (a malformed datagram gets some arbitrary key, and is then rejected by parse_arrival)
+uint64_t flow_key( const vector<Ref<string>>& buffers )
+{
+  const auto u16_at = [&]( const size_t offset ) {
+    return static_cast<uint16_t>( byte_at( buffers, offset ) << 8 | byte_at( buffers, offset + 1 ) );
+  };
+  const auto u32_at = [&]( const size_t offset ) {
+    return static_cast<uint32_t>( u16_at( offset ) ) << 16 | u16_at( offset + 2 );
+  };
+
+  const size_t tcp_offset = 4 * ( byte_at( buffers, 0 ) & 0xfU ); // IHL
+  return FourTuple { .local_ip = u32_at( 16 ),
+                     .remote_ip = u32_at( 12 ),
+                     .local_port = u16_at( tcp_offset + 2 ),
+                     .remote_port = u16_at( tcp_offset ) }
+    .hash();
+}
+} // namespace
+
+//! State the listener thread keeps for each connection
+struct TCPMinnowListener::Connection
+{
+  enum class State : uint8_t
+  {
+    SynReceived, // handshake in progress; counts against the SYN backlog
+    Established, // handshake done; waiting for room in the accept queue
+    Promoted     // handed to the accept queue with its own socket pair
+  };
+
+  Connection( const FourTuple& s_tuple,
+              const TCPConfig& cfg,
+              FileDescriptor&& s_datagrams,
+              uint64_t now,
+              bool checksum_trusted )
+    : tuple( s_tuple ), peer( cfg ), datagrams( move( s_datagrams ) ), last_tick_ms( now )
+  {
+    adapter.config_mut().source = make_address( tuple.local_ip, tuple.local_port );
+    adapter.config_mut().destination = make_address( tuple.remote_ip, tuple.remote_port );
+    adapter.config_mut().checksum_trusted = checksum_trusted;
+  }
+
+  FourTuple tuple;
+  TCPPeer peer;
+  FileDescriptor datagrams;          //!< Shared handle on the listener's datagram device
+  TCPOverIPv4Adapter adapter {};     //!< Wraps outgoing segments with this connection's addresses
+  State state { State::SynReceived };
+
+  uint64_t last_tick_ms;           //!< Time up to which the TCPPeer has been ticked
+  optional<uint64_t> wakeup_ms {}; //!< Deadline of this connection's live entry in the timer wheel
+
+  optional<LocalStreamSocket> thread_data {}; //!< Listener's end of the socket pair (once promoted)
+  vector<EventLoop::RuleHandle> rules {};
+  promise<void> finished_promise {};
+  shared_future<void> finished { finished_promise.get_future().share() };
+
+  bool inbound_shutdown {};  //!< Has the listener shut down the incoming data to the owner?
+  bool outbound_shutdown {}; //!< Has the owner shut down the outbound data to the TCP connection?
+  bool retired {};           //!< Has the listener forgotten this connection?
+};
+
+TCPMinnowConnection::TCPMinnowConnection( FileDescriptor&& owner_side,
+                                          Address peer_address,
+                                          shared_future<void> finished )
+  : LocalStreamSocket( move( owner_side ) ), _peer_address( move( peer_address ) ), _finished( move( finished ) )
+{}
+
+void TCPMinnowConnection::wait_until_closed()
+{
+  shutdown( SHUT_RDWR );
+  cerr << "DEBUG: minnow waiting for clean shutdown... ";
+  _finished.wait();
+  cerr << "done.\n";
+}
+
+TCPMinnowListener::TCPMinnowListener( FileDescriptor&& datagram_fd ) : _datagrams( move( datagram_fd ) ) {}
+
+void TCPMinnowListener::listen( const TCPConfig& c_tcp,
+                                const FdAdapterConfig& c_ad,
+                                const TCPListenerConfig& c_listen )
+{
+  if ( _listener_thread.joinable() ) {
+    throw runtime_error( "listen() called on a TCPMinnowListener that is already listening" );
+  }
+
+  _tcp_config = c_tcp;
+  _adapter_config = c_ad;
+  _listen_config = c_listen;
+  _timers = TimerWheel<weak_ptr<Connection>> { timestamp_ms() };
+
+  if ( _listen_config.parse_threads > 0 ) {
+    _parsers = make_unique<WorkStealingExecutor>( _listen_config.parse_threads );
+    _eventloop.set_executor( *_parsers );
+  }
+
+  _push_category = _eventloop.add_category( "push bytes to TCPPeer" );
+  _deliver_category = _eventloop.add_category( "read bytes from inbound stream" );
+  _eventloop.add_rule( "receive TCP segment from the network", _datagrams, Direction::In, [&] {
+    _receive_datagram();
+  } );
+  _datagrams.set_blocking( false ); // (segments that don't fit wait in its write queue)
+  _eventloop.add_flush_rule( _eventloop.add_category( "flush queued TCP segments" ), _datagrams );
+
+  cerr << "DEBUG: minnow listening for incoming connections on port " << _adapter_config.source.port() << "...\n";
+  _listener_thread = thread( &TCPMinnowListener::_listener_main, this );
+}
+
+TCPMinnowConnection TCPMinnowListener::accept()
+{
+  unique_lock lock { _accept_mutex };
+  _accept_ready.wait( lock, [&] { return not _accept_queue.empty() or _stopped; } );
+  if ( _accept_queue.empty() ) {
+    throw runtime_error( "accept() on a TCPMinnowListener that has stopped" );
+  }
+
+  PendingConnection next = move( _accept_queue.front() );
+  _accept_queue.pop_front();
+  return { move( next.owner_side ), move( next.peer_address ), move( next.finished ) };
+}
+
+TCPMinnowListener::Stats TCPMinnowListener::stats() const
+{
+  const lock_guard lock { _accept_mutex };
+  return _stats;
+}
+
+TCPMinnowListener::~TCPMinnowListener()
+{
+  try {
+    if ( _listener_thread.joinable() ) {
+      _abort.store( true );
+      _listener_thread.join();
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception destructing TCPMinnowListener: " << e.what() << "\n";
+  }
+}
+
+bool TCPMinnowListener::_should_drop( const bool uplink )
+{
+  const uint16_t loss = uplink ? _adapter_config.loss_rate_up : _adapter_config.loss_rate_dn;
+  return loss != 0 && static_cast<uint16_t>( _rand() ) < loss;
+}
+
+void TCPMinnowListener::_send( Connection& conn, const TCPMessage& msg )
+{
+  if ( not _should_drop( true ) ) {
+    // (a segment that finds the queue full is dropped, as a full device would drop it; TCP sends it again)
+    conn.datagrams.queue_write( serialize( conn.adapter.wrap_tcp_in_ip( msg ) ) );
+  }
+}
+
+void TCPMinnowListener::_listener_main()
+{
+  try {
+    while ( not _abort ) {
+      if ( _eventloop.wait_next_event( TCP_TICK_MS ) == EventLoop::Result::Exit ) {
+        break;
+      }
+
+      _expire_timers();
+      _promote_established();
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception in TCPMinnowListener thread: " << e.what() << "\n";
+  }
+
+  {
+    const lock_guard lock { _accept_mutex };
+    _stopped = true;
+  }
+  _accept_ready.notify_all();
+}
+
+//! \details Reads one datagram, parses it, and hands its TCP segment to the connection with the matching
+//! four-tuple. A SYN for an unknown four-tuple creates a new half-open connection, as long as
+//! neither the SYN queue nor the accept queue is full, or is answered with a SYN cookie if the
+//! listener's SynCookies policy says so. An ACK for an unknown four-tuple creates a connection
+//! if it echoes a valid cookie; anything else for an unknown four-tuple is ignored. While too many
+//! established connections are waiting for accept(), an ACK that would complete a handshake is ignored
+//! too; the half-open connection retransmits its SYN/ACK, and the peer's next ACK may find room.
+void TCPMinnowListener::_receive_datagram()
+{
+  auto buffers = BufferPool::take_for_headers( { IPv4Header::LENGTH, TCPSegment::HEADER_LENGTH } );
+  _datagrams.read( buffers );
+
+  if ( buffers.empty() or _should_drop( false ) ) {
+    return;
+  }
+
+  // parsing (on the executor, if there is one) keeps each four-tuple's datagrams in order
+  const uint64_t key = flow_key( buffers );
+  auto arrival = make_shared<Arrival>(
+    Arrival { .buffers = move( buffers ), .verify_checksum = not _adapter_config.checksum_trusted } );
+  _eventloop.offload(
+    key,
+    [arrival] { parse_arrival( *arrival ); },
+    [this, arrival] {
+      if ( arrival->valid ) {
+        _deliver_segment( arrival->header, move( arrival->segment ) );
+      }
+    } );
+}
+
+//! Hand a parsed segment to its connection (see _receive_datagram)
+void TCPMinnowListener::_deliver_segment( const IPv4Header& header, TCPSegment&& seg )
+{
+  // is the IPv4 datagram for us? (listening on address "0" accepts any local address)
+  const uint32_t listen_ip = _adapter_config.source.ipv4_numeric();
+  if ( listen_ip != 0 and header.dst != listen_ip ) {
+    return;
+  }
+
+  if ( seg.udinfo.dst_port != _adapter_config.source.port() ) {
+    return;
+  }
+
+  const FourTuple tuple { .local_ip = header.dst,
+                          .remote_ip = header.src,
+                          .local_port = seg.udinfo.dst_port,
+                          .remote_port = seg.udinfo.src_port };
+
+  shared_ptr<Connection> conn;
+  if ( const auto it = _connections.find( tuple ); it != _connections.end() ) {
+    conn = it->second;
+    if ( conn->state == Connection::State::SynReceived and seg.message.receiver->ackno.has_value()
+         and not seg.message.sender->RST and _established_full() ) {
+      const lock_guard lock { _accept_mutex };
+      ++_stats.acks_dropped;
+      return;
+    }
+  } else if ( seg.message.sender->RST ) {
+    return;
+  } else if ( seg.message.sender->SYN ) {
+    bool use_cookie {};
+    {
+      const lock_guard lock { _accept_mutex };
+      ++_stats.syns_received;
+      const bool syn_queue_full = _half_open >= _listen_config.syn_backlog;
+      if ( _accept_queue.size() >= _listen_config.accept_backlog
+           or ( syn_queue_full and _listen_config.syn_cookies == TCPListenerConfig::SynCookies::Off ) ) {
+        ++_stats.syns_dropped;
+        return;
+      }
+      use_cookie = syn_queue_full or _listen_config.syn_cookies == TCPListenerConfig::SynCookies::Always;
+      _stats.cookies_sent += use_cookie;
+    }
+
+    if ( use_cookie ) {
+      _send_cookie( tuple, seg.message.sender.get() );
+      return;
+    }
+    TCPConfig cfg = _tcp_config;
+    cfg.isn = Wrap32 { uniform_int_distribution<uint32_t> {}( _rand ) }; // (each connection its own)
+    conn = _admit( tuple, cfg );
+  } else if ( _listen_config.syn_cookies != TCPListenerConfig::SynCookies::Off
+              and seg.message.receiver->ackno.has_value() ) {
+    conn = _accept_cookie( tuple, seg.message );
+    if ( not conn ) {
+      return;
+    }
+  } else {
+    return;
+  }
+
+  _catch_up( *conn );
+  conn->peer.receive( move( seg.message ), [&]( const TCPMessage& x ) { _send( *conn, x ); } );
+  _update( conn );
+}
+
+//! Start tracking a new half-open connection
+shared_ptr<TCPMinnowListener::Connection> TCPMinnowListener::_admit( const FourTuple& tuple, const TCPConfig& cfg )
+{
+  {
+    const lock_guard lock { _accept_mutex };
+    ++_stats.active_connections;
+  }
+
+  ++_half_open;
+  return _connections
+    .emplace( tuple,
+              make_shared<Connection>(
+                tuple, cfg, _datagrams.duplicate(), timestamp_ms(), _adapter_config.checksum_trusted ) )
+    .first->second;
+}
+
+//! Answer a SYN with a SYN/ACK whose ISN is a cookie, without remembering anything about it
+void TCPMinnowListener::_send_cookie( const FourTuple& tuple, const TCPSenderMessage& syn )
+{
+  if ( _should_drop( true ) ) {
+    return;
+  }
+
+  TCPOverIPv4Adapter adapter;
+  adapter.config_mut().source = make_address( tuple.local_ip, tuple.local_port );
+  adapter.config_mut().destination = make_address( tuple.remote_ip, tuple.remote_port );
+  adapter.config_mut().checksum_trusted = _adapter_config.checksum_trusted;
+
+  TCPSenderMessage syn_ack { .seqno = _cookies.make( tuple, syn.seqno, timestamp_ms() ), .SYN = true };
+  const auto window = static_cast<uint16_t>( min<size_t>( _tcp_config.recv_capacity, UINT16_MAX ) );
+  TCPReceiverMessage ack { .ackno = syn.seqno + 1, .window_size = window };
+
+  // (a cookie is stateless, so rather than queue it behind a full device, drop it and let the peer retransmit)
+  if ( _datagrams.queued_writes() == 0 ) {
+    _datagrams.write( serialize( adapter.wrap_tcp_in_ip( { move( syn_ack ), move( ack ) } ) ) );
+  }
+}
+
+//! \details If `ack` acknowledges a cookie we issued to this four-tuple, rebuild the connection
+//! the cookie stands for: a TCPPeer whose ISN is the cookie and that has already seen the peer's
+//! SYN. The caller then gives it `ack` like any other segment, which completes the handshake.
+shared_ptr<TCPMinnowListener::Connection> TCPMinnowListener::_accept_cookie( const FourTuple& tuple,
+                                                                             const TCPMessage& ack )
+{
+  const Wrap32 client_isn = ack.sender->seqno + UINT32_MAX; // seqno - 1
+  const Wrap32 cookie = ack.receiver->ackno.value() + UINT32_MAX;
+  if ( not _cookies.check( tuple, client_isn, cookie, timestamp_ms() ) ) {
+    return {};
+  }
+
+  {
+    const lock_guard lock { _accept_mutex };
+    if ( _accept_queue.size() >= _listen_config.accept_backlog ) {
+      ++_stats.acks_dropped;
+      return {};
+    }
+    ++_stats.cookies_accepted;
+  }
+
+  TCPConfig cfg = _tcp_config;
+  cfg.isn = cookie;
+  auto conn = _admit( tuple, cfg );
+
+  // replay the SYN the cookie stands for; its SYN/ACK already went out when the cookie was issued
+  conn->peer.receive( { TCPSenderMessage { .seqno = client_isn, .SYN = true },
+                        TCPReceiverMessage { .window_size = ack.receiver->window_size } },
+                      []( const TCPMessage& ) {} );
+  return conn;
+}
+
+//! Tick the connections whose timers are due (and no others)
+void TCPMinnowListener::_expire_timers()
+{
+  _timers.advance( timestamp_ms(), [&]( const uint64_t deadline, const weak_ptr<Connection>& weak_conn ) {
+    const shared_ptr<Connection> conn = weak_conn.lock();
+    if ( not conn or conn->retired or conn->wakeup_ms != deadline ) {
+      return;
+    }
+    conn->wakeup_ms.reset();
+    _catch_up( *conn );
+    _update( conn );
+  } );
+}
+
+//! Tell the connection's TCPPeer how much time has passed since it last heard
+void TCPMinnowListener::_catch_up( Connection& conn )
+{
+  const uint64_t now = max( timestamp_ms(), conn.last_tick_ms );
+  if ( conn.peer.active() and now > conn.last_tick_ms ) {
+    conn.peer.tick( now - conn.last_tick_ms, [&]( const TCPMessage& x ) { _send( conn, x ); } );
+  }
+  conn.last_tick_ms = now;
+}
+
+//! Make sure the timer wheel wakes the connection no later than its TCPPeer's next timeout
+//! \details An existing wake-up that is earlier than needed is kept; when it fires, the
+//! connection is rescheduled for the right time. This keeps one live entry per connection.
+void TCPMinnowListener::_schedule_wakeup( const shared_ptr<Connection>& conn )
+{
+  const auto timeout = conn->peer.ms_until_timeout();
+  if ( not timeout.has_value() ) {
+    return;
+  }
+
+  const uint64_t deadline = conn->last_tick_ms + *timeout;
+  if ( not conn->wakeup_ms.has_value() or deadline < *conn->wakeup_ms ) {
+    conn->wakeup_ms = deadline;
+    _timers.schedule( deadline, conn );
+  }
+}
+
+//! Move a connection along after anything happened to it (segment received, bytes moved, time passed)
+void TCPMinnowListener::_update( const shared_ptr<Connection>& conn )
+{
+  if ( conn->retired ) {
+    return;
+  }
+
+  switch ( conn->state ) {
+    case Connection::State::SynReceived:
+      if ( not conn->peer.active()
+           or conn->peer.sender().consecutive_retransmissions() > TCPConfig::MAX_RETX_ATTEMPTS ) {
+        {
+          const lock_guard lock { _accept_mutex };
+          ++_stats.half_open_expired;
+        }
+        _retire( conn );
+      } else if ( conn->peer.has_ackno() and conn->peer.sender().sequence_numbers_in_flight() == 0 ) {
+        conn->state = Connection::State::Established;
+        --_half_open;
+        {
+          const lock_guard lock { _accept_mutex };
+          ++_stats.established;
+        }
+        cerr << "DEBUG: minnow new connection from " << conn->adapter.config().destination.to_string() << ".\n";
+        _established.push_back( conn );
+        _promote_established();
+      }
+      break;
+
+    case Connection::State::Established:
+      if ( not conn->peer.active() ) {
+        {
+          const lock_guard lock { _accept_mutex };
+          ++_stats.unaccepted_expired;
+        }
+        _retire( conn );
+      }
+      break;
+
+    case Connection::State::Promoted:
+      if ( not conn->peer.active() and conn->inbound_shutdown ) {
+        cerr << "DEBUG: minnow TCP connection from " << conn->adapter.config().destination.to_string()
+             << " finished " << ( conn->peer.inbound_reader().has_error() ? "uncleanly.\n" : "cleanly.\n" );
+        _retire( conn );
+      }
+      break;
+  }
+
+  if ( not conn->retired ) {
+    _schedule_wakeup( conn );
+  }
+}
+
+//! Hand established connections to the accept queue, as long as it has room
+void TCPMinnowListener::_promote_established()
+{
+  while ( not _established.empty() ) {
+    {
+      const lock_guard lock { _accept_mutex };
+      if ( _accept_queue.size() >= _listen_config.accept_backlog ) {
+        return;
+      }
+    }
+
+    const shared_ptr<Connection> conn = move( _established.front() );
+    _established.pop_front();
+
+    auto [owner_side, thread_side] = socket_pair_helper<LocalStreamSocket>( AF_UNIX, SOCK_STREAM );
+    thread_side.set_blocking( false );
+    conn->thread_data.emplace( move( thread_side ) );
+    conn->state = Connection::State::Promoted;
+    _add_connection_rules( conn );
+
+    {
+      const lock_guard lock { _accept_mutex };
+      _accept_queue.push_back(
+        { FileDescriptor { move( owner_side ) }, conn->adapter.config().destination, conn->finished } );
+    }
+    _accept_ready.notify_one();
+  }
+}
+
+//! Are as many established connections waiting for room in the accept queue as it can hold?
+bool TCPMinnowListener::_established_full() const
+{
+  return _established.size() >= _listen_config.accept_backlog;
+}
+
+//! Same data-moving rules as TCPMinnowSocket, one pair per promoted connection
+void TCPMinnowListener::_add_connection_rules( const shared_ptr<Connection>& conn )
+{
+  // read from the owner's writes into the outbound stream
+  conn->rules.push_back( _eventloop.add_rule(
+    _push_category,
+    *conn->thread_data,
+    Direction::In,
+    [this, conn] {
+      string data;
+      data.resize( conn->peer.outbound_writer().available_capacity() );
+      conn->thread_data->read( data );
+      _catch_up( *conn );
+      conn->peer.outbound_writer().push( move( data ) );
+
+      if ( conn->thread_data->eof() ) {
+        conn->peer.outbound_writer().close();
+        conn->outbound_shutdown = true;
+      }
+
+      conn->peer.push( [&]( const TCPMessage& x ) { _send( *conn, x ); } );
+      _update( conn );
+    },
+    [conn] {
+      return conn->peer.active() and ( not conn->outbound_shutdown )
+             and ( conn->peer.outbound_writer().available_capacity() > 0 );
+    },
+    [conn] {
+      conn->peer.outbound_writer().close();
+      conn->outbound_shutdown = true;
+    },
+    [conn] {
+      cerr << "DEBUG: minnow outbound stream had error.\n";
+      conn->peer.outbound_writer().set_error();
+    } ) );
+
+  // write from the inbound stream to the owner
+  conn->rules.push_back( _eventloop.add_rule(
+    _deliver_category,
+    *conn->thread_data,
+    Direction::Out,
+    [this, conn] {
+      Reader& inbound = conn->peer.inbound_reader();
+      if ( inbound.bytes_buffered() ) {
+        const string_view buffer = inbound.peek();
+        const auto bytes_written = conn->thread_data->write( buffer );
+        inbound.pop( bytes_written );
+      }
+
+      if ( inbound.is_finished() or inbound.has_error() ) {
+        conn->thread_data->shutdown( SHUT_WR );
+        conn->inbound_shutdown = true;
+      }
+      _update( conn );
+    },
+    [conn] {
+      const Reader& inbound = conn->peer.inbound_reader();
+      return inbound.bytes_buffered()
+             or ( ( inbound.is_finished() or inbound.has_error() ) and not conn->inbound_shutdown );
+    },
+    [this, conn] {
+      conn->inbound_shutdown = true;
+      _update( conn );
+    },
+    [conn] {
+      cerr << "DEBUG: minnow inbound stream had error.\n";
+      conn->peer.inbound_reader().set_error();
+    } ) );
+}
+
+void TCPMinnowListener::_retire( const shared_ptr<Connection>& conn )
+{
+  conn->retired = true;
+  for ( auto& rule : conn->rules ) {
+    rule.cancel();
+  }
+
+  if ( conn->state == Connection::State::SynReceived ) {
+    --_half_open;
+  } else if ( conn->state == Connection::State::Established ) {
+    erase( _established, conn );
+  }
+
+  _connections.erase( conn->tuple );
+  conn->finished_promise.set_value();
+
+  const lock_guard lock { _accept_mutex };
+  --_stats.active_connections;
+}
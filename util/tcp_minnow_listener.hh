@@ -0,0 +1,171 @@
+#pragma once
+
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "four_tuple.hh"
+#include "ipv4_header.hh"
+#include "random.hh"
+#include "socket.hh"
+#include "syn_cookie.hh"
+#include "tcp_config.hh"
+#include "tcp_segment.hh"
+#include "timer_wheel.hh"
+#include "work_stealing_executor.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+//! One connection handed out by TCPMinnowListener::accept(); read and write it like a stream socket
+class TCPMinnowConnection : public LocalStreamSocket
+{
+  Address _peer_address;
+  std::shared_future<void> _finished;
+
+public:
+  //! Constructed by TCPMinnowListener from the owner's end of the connection's socket pair
+  TCPMinnowConnection( FileDescriptor&& owner_side, Address peer_address, std::shared_future<void> finished );
+
+  //! Remote address and port of the connection
+  const Address& peer_address() const { return _peer_address; }
+
+  //! Shut down both directions and wait until the listener has finished the TCP connection
+  void wait_until_closed();
+
+  //! \name
+  //! Some methods of the parent Socket wouldn't work as expected on the TCP connection, so delete them
+
+  //!@{
+  void bind( const Address& address ) = delete;
+  Address local_address() const = delete;
+  void set_reuseaddr() = delete;
+  //!@}
+};
+
+//! A listening TCPPeer host that accepts many connections over one datagram device
+//! \details One background thread reads IPv4 datagrams from the device, demultiplexes them
+//! by four-tuple, and runs a TCPPeer for every connection. A SYN for an unknown four-tuple
+//! creates a half-open connection (if the SYN queue has room); once its handshake completes
+//! it moves to the accept queue, where accept() picks it up. If the owner falls behind, the
+//! final ACK of further handshakes is ignored until there is room again. With SYN cookies enabled
+//! (see TCPListenerConfig::SynCookies) the SYN/ACK is sent without creating any state, and
+//! the connection is created only when an ACK echoes a valid cookie. With
+//! TCPListenerConfig::parse_threads, datagrams are parsed and their checksums verified on a
+//! WorkStealingExecutor, in order per four-tuple, and only then handed back to the listener thread.
+class TCPMinnowListener
+{
+public:
+  //! Counters describing what the listener has done so far
+  struct Stats
+  {
+    uint64_t syns_received {};      //!< SYNs for previously unknown four-tuples
+    uint64_t syns_dropped {};       //!< SYNs ignored because the SYN or accept queue was full
+    uint64_t established {};        //!< Connections that completed the handshake
+    uint64_t half_open_expired {};  //!< Half-open connections that were reset or gave up
+    uint64_t active_connections {}; //!< Connections currently tracked by the listener thread
+    uint64_t cookies_sent {};       //!< SYNs answered with a stateless SYN cookie
+    uint64_t cookies_accepted {};   //!< ACKs that carried a valid SYN cookie and created a connection
+    uint64_t acks_dropped {};       //!< Handshake-completing ACKs ignored because too many await accept()
+    uint64_t unaccepted_expired {}; //!< Established connections that were reset before accept() took them
+  };
+
+  //! Construct from a TUN device (or any fd that carries exactly one IPv4 datagram per read or write)
+  explicit TCPMinnowListener( FileDescriptor&& datagram_fd );
+
+  //! Start listening on `c_ad.source` (address "0" accepts datagrams for any local address)
+  //! \param[in] c_tcp is the TCPConfig used for each accepted connection
+  //! \param[in] c_ad supplies the local address and port to listen on
+  //! \param[in] c_listen sets the SYN and accept queue limits
+  void listen( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad, const TCPListenerConfig& c_listen = {} );
+
+  //! Block until a connection has completed its handshake, then hand it to the caller
+  TCPMinnowConnection accept();
+
+  //! Snapshot of the listener's counters
+  Stats stats() const;
+
+  //! Stop the listener thread; connections that are still open are abandoned
+  ~TCPMinnowListener();
+
+  //! \name
+  //! This object cannot be safely moved or copied, since it is in use by two threads simultaneously
+
+  //!@{
+  TCPMinnowListener( const TCPMinnowListener& ) = delete;
+  TCPMinnowListener( TCPMinnowListener&& ) = delete;
+  TCPMinnowListener& operator=( const TCPMinnowListener& ) = delete;
+  TCPMinnowListener& operator=( TCPMinnowListener&& ) = delete;
+  //!@}
+
+private:
+  struct Connection;
+
+  //! A connection that is ready to be picked up by accept()
+  struct PendingConnection
+  {
+    FileDescriptor owner_side;
+    Address peer_address;
+    std::shared_future<void> finished;
+  };
+
+  FileDescriptor _datagrams;
+  TCPConfig _tcp_config {};
+  FdAdapterConfig _adapter_config {};
+  TCPListenerConfig _listen_config {};
+
+  //! Connections known to the listener thread (half-open, waiting for accept, or accepted)
+  std::unordered_map<FourTuple, std::shared_ptr<Connection>, FourTuple::Hash> _connections {};
+
+  //! Established connections that could not yet be moved to the (full) accept queue
+  //! (at most TCPListenerConfig::accept_backlog; beyond that, handshakes are left incomplete)
+  std::deque<std::shared_ptr<Connection>> _established {};
+
+  size_t _half_open {}; //!< Number of connections still in the SYN queue
+
+  SynCookieGenerator _cookies {};
+
+  //! Wake-up times of connections whose TCPPeer has a timer running (stale entries are ignored)
+  TimerWheel<std::weak_ptr<Connection>> _timers {};
+
+  std::unique_ptr<WorkStealingExecutor> _parsers {}; //!< (with parse_threads) Where datagrams are parsed
+  EventLoop _eventloop { EventLoop::Backend::Epoll };
+  size_t _push_category {};    //!< EventLoop category for "push bytes to TCPPeer" rules
+  size_t _deliver_category {}; //!< EventLoop category for "read bytes from inbound stream" rules
+
+  //! Fast RNG used by _should_drop() (honors the loss rates in FdAdapterConfig)
+  std::default_random_engine _rand { get_random_engine() };
+
+  //! Owner-facing queue of connections ready for accept(), protected by _accept_mutex
+  mutable std::mutex _accept_mutex {};
+  std::condition_variable _accept_ready {};
+  std::deque<PendingConnection> _accept_queue {};
+  Stats _stats {};
+  bool _stopped {};
+
+  std::atomic_bool _abort { false };
+  std::thread _listener_thread {};
+
+  void _listener_main();
+  void _receive_datagram();
+  void _deliver_segment( const IPv4Header& header, TCPSegment&& seg );
+  std::shared_ptr<Connection> _admit( const FourTuple& tuple, const TCPConfig& cfg );
+  void _send_cookie( const FourTuple& tuple, const TCPSenderMessage& syn );
+  std::shared_ptr<Connection> _accept_cookie( const FourTuple& tuple, const TCPMessage& ack );
+  void _expire_timers();
+  void _catch_up( Connection& conn );
+  void _schedule_wakeup( const std::shared_ptr<Connection>& conn );
+  void _update( const std::shared_ptr<Connection>& conn );
+  void _promote_established();
+  bool _established_full() const;
+  void _add_connection_rules( const std::shared_ptr<Connection>& conn );
+  void _retire( const std::shared_ptr<Connection>& conn );
+  bool _should_drop( bool uplink );
+  void _send( Connection& conn, const TCPMessage& msg );
+};
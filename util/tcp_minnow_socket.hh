@@ -1,16 +1,23 @@
 #pragma once
 
 #include "eventloop.hh"
+#include "eventloop_pool.hh"
 #include "file_descriptor.hh"
+#include "packet_ring_adapter.hh"
 #include "socket.hh"
 #include "tcp_config.hh"
 #include "tcp_peer.hh"
+#include "tcp_receive_coalescer.hh"
 #include "tuntap_adapter.hh"
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <optional>
 #include <thread>
+#include <vector>
 
 //! Multithreaded wrapper around TCPPeer that approximates the Unix sockets API
 template<TCPDatagramAdapter AdaptT>
@@ -20,6 +27,11 @@ public:
   //! Construct from the interface that the TCPPeer thread will use to read and write datagrams
   explicit TCPMinnowSocket( AdaptT&& datagram_interface );
 
+  //! Like the constructor above, but once connected, the TCPPeer runs on the `pool` thread that its
+  //! four-tuple hashes to, instead of on a thread of its own
+  //! \note The socket must not be destructed on one of the pool's threads, and the pool must outlive it.
+  TCPMinnowSocket( AdaptT&& datagram_interface, EventLoopPool& pool );
+
   //! Close socket, and wait for TCPPeer to finish
   //! \note Calling this function is only advisable if the socket has reached EOF,
   //! or else may wait foreever for remote peer to close the TCP connection.
@@ -67,23 +79,84 @@ private:
   //! Set up the TCPPeer and the event loop
   void _initialize_TCP( const TCPConfig& config );
 
+  //! Register the TCPPeer's rules with *_loop
+  void _add_rules();
+
   //! TCP state machine
   std::optional<TCPPeer> _tcp {};
 
+  //! Most datagrams read from the adapter in one event (all handed to the TCPPeer before the next event)
+  static constexpr size_t MAX_READS_PER_EVENT = 64;
+
+  //! Merges the in-order segments read in one event before the TCPPeer receives them
+  TCPReceiveCoalescer _coalescer {};
+
   //! eventloop that handles all the events (new inbound datagram, new outbound bytes, new inbound bytes)
   EventLoop _eventloop {};
 
+  EventLoopPool* _pool;             //!< If set, the TCPPeer moves to a shard of this pool once connected
+  size_t _shard {};                 //!< (pool) The shard its four-tuple hashes to
+  EventLoop* _loop { &_eventloop }; //!< The loop that the TCPPeer's rules and timer are registered with
+  std::vector<EventLoop::RuleHandle> _rules {}; //!< The TCPPeer's rules on *_loop
+  std::promise<void> _finished_promise {};      //!< (pool) Fulfilled once the shard is done with the TCPPeer
+  std::shared_future<void> _finished {};        //!< (pool) Valid once the TCPPeer has moved to the pool
+
   //! Process events while specified condition is true
   void _tcp_loop( const std::function<bool()>& condition );
 
+  //! Tick the TCPPeer, then send whatever the adapter has queued
+  void _tick();
+
+  //! (queueing adapter) If segments are still waiting for room in the link, set a timer to flush them again
+  void _retry_flush_later();
+
+  //! Tell the TCPPeer how much time has passed, and set a timer for its next timeout
+  void _tick_peer();
+
+  //! Hand a segment to the adapter (only queueing it, if the adapter can, for _tick to flush)
+  void _write_segment( const TCPMessage& seg );
+
+  uint64_t _last_tick_ms {};                       //!< Time up to which the TCPPeer has been ticked
+  size_t _timer_category {};                       //!< EventLoop category of the TCPPeer's timer
+  std::optional<EventLoop::TimerHandle> _timer {}; //!< Wakes up the EventLoop for the TCPPeer's next timeout
+  std::optional<uint64_t> _timer_deadline {};      //!< When _timer expires (empty once it has fired)
+
+  //! How long segments that the link had no room for wait before the next flush, if nothing else happens
+  static constexpr auto FLUSH_RETRY_INTERVAL = std::chrono::milliseconds { 1 };
+  std::optional<EventLoop::TimerHandle> _flush_retry {}; //!< (queueing adapter) See _retry_flush_later()
+
   //! Main loop of TCPPeer thread
   void _tcp_main();
 
+  //! Hand the connected TCPPeer to its own thread, or to a shard of the pool
+  void _start_background();
+
+  //! (pool) What _tcp_loop does after each event: tick the TCPPeer, and finish once there is nothing left to do
+  void _after_event();
+
+  //! (pool) Cancel the rules and timer, shut down the socket and release the TCPPeer (what _tcp_main does last)
+  void _finish();
+  bool _finish_called { false }; //!< (pool) Has _finish() run?
+
+  //! (pool) Wrap a callback of the TCPPeer's rules or timer so that an exception (e.g. from the adapter's write)
+  //! fails only this connection: it is reported, and the connection finishes. On a thread of its own, the
+  //! exception still ends the thread.
+  template<typename Callback>
+  std::function<void()> _guarded( Callback&& callback );
+
+  //! Does inbound data remain to be handed to the owner (or the end of the inbound stream to be signaled)?
+  bool _inbound_pending();
+
+  //! Print how the connection finished, and how much of what it received was merged
+  void _print_finished();
+
   //! Handle to the TCPPeer thread; owner thread calls join() in the destructor
   std::thread _tcp_thread {};
 
   //! Construct LocalStreamSocket fds from socket pair, initialize eventloop
-  TCPMinnowSocket( std::pair<FileDescriptor, FileDescriptor> data_socket_pair, AdaptT&& datagram_interface );
+  TCPMinnowSocket( std::pair<FileDescriptor, FileDescriptor> data_socket_pair,
+                   AdaptT&& datagram_interface,
+                   EventLoopPool* pool );
 
   std::atomic_bool _abort { false }; //!< Flag used by the owner to force the TCPPeer thread to shut down
 
@@ -96,6 +169,7 @@ private:
 
 using TCPOverIPv4MinnowSocket = TCPMinnowSocket<TCPOverIPv4OverTunFdAdapter>;
 using LossyTCPOverIPv4MinnowSocket = TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>;
+using TCPOverEthernetMinnowSocket = TCPMinnowSocket<TCPOverIPv4OverPacketRingAdapter>;
 
 //! \class TCPMinnowSocket
 //! This class involves the simultaneous operation of two threads.
@@ -109,9 +183,13 @@ using LossyTCPOverIPv4MinnowSocket = TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4O
 //! perform for a TCPSocket: reading and parsing datagrams from the wire, filtering out
 //! segments unrelated to the connection, etc.
 //!
+//! A socket constructed with an EventLoopPool runs its TCPPeer on the pool thread that the
+//! connection's four-tuple hashes to (once the handshake is done), sharing that thread and its
+//! EventLoop with the pool's other connections, instead of on a thread of its own.
+//!
 //! There are a few notable differences between the TCPMinnowSocket and TCPSocket interfaces:
 //!
-//! - a TCPMinnowSocket can only accept a single connection
+//! - a TCPMinnowSocket can only accept a single connection (TCPMinnowListener accepts many)
 //! - listen_and_accept() is a blocking function call that acts as both [listen(2)](\ref man2::listen)
 //!   and [accept(2)](\ref man2::accept)
 //! - if TCPMinnowSocket is destructed while a TCP connection is open, the connection is
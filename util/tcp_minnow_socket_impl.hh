@@ -1,7 +1,9 @@
 #include "tcp_minnow_socket.hh"
 
 #include "exception.hh"
+#include "four_tuple.hh"
 
+#include <chrono>
 #include <cstddef>
 #include <exception>
 #include <iostream>
@@ -10,8 +12,6 @@
 #include <sys/socket.h>
 #include <utility>
 
-static constexpr size_t TCP_TICK_MS = 10;
-
 inline uint64_t timestamp_ms()
 {
   static_assert( std::is_same_v<std::chrono::steady_clock::duration, std::chrono::nanoseconds> );
@@ -23,9 +23,13 @@ inline uint64_t timestamp_ms()
 template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition )
 {
-  auto base_time = timestamp_ms();
+  if ( not _tcp.has_value() ) {
+    throw std::runtime_error( "_tcp_loop entered before TCPPeer initialized" );
+  }
+
+  _tick();
   while ( condition() ) {
-    auto ret = _eventloop.wait_next_event( TCP_TICK_MS );
+    auto ret = _eventloop.wait_next_event( -1 );
     if ( ret == EventLoop::Result::Exit or _abort ) {
       break;
     }
@@ -34,32 +38,170 @@ void TCPMinnowSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition
       throw std::runtime_error( "_tcp_loop entered before TCPPeer initialized" );
     }
 
-    if ( _tcp.value().active() ) {
-      const auto next_time = timestamp_ms();
-      _tcp.value().tick( next_time - base_time, [&]( auto x ) { _datagram_adapter.write( x ); } );
-      _datagram_adapter.tick( next_time - base_time );
-      base_time = next_time;
+    _tick();
+  }
+}
+
+//! \details An adapter that can queue segments (see _write_segment) is flushed here, after every event, so all
+//! the segments of the event go out together (in one system call, or one io_uring submission).
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_tick()
+{
+  _tick_peer();
+  if constexpr ( TCPDatagramQueueingAdapter<AdaptT> ) {
+    _datagram_adapter.flush_writes();
+    _retry_flush_later();
+  }
+}
+
+//! \details Rule 4 flushes when the adapter says the link has room (writes_ready()), but a link such as a
+//! PacketRing never wakes the loop when room appears: its fd polls writable whether or not the ring is full. So
+//! while segments wait without room, a one-shot timer ticks (and so flushes) again after FLUSH_RETRY_INTERVAL.
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_retry_flush_later()
+{
+  if ( not _datagram_adapter.writes_queued() or _datagram_adapter.writes_ready() ) {
+    return;
+  }
+
+  const auto when = EventLoop::Clock::now() + FLUSH_RETRY_INTERVAL;
+  if ( _flush_retry.has_value() ) {
+    _loop->reschedule_timer( *_flush_retry, when );
+  } else {
+    _flush_retry.emplace( _loop->add_timer(
+      _loop->category_named( "flush queued TCP segments" ), when, _guarded( [&] { _after_event(); } ) ) );
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_write_segment( const TCPMessage& seg )
+{
+  if constexpr ( TCPDatagramQueueingAdapter<AdaptT> ) {
+    _datagram_adapter.defer_write( seg );
+  } else {
+    _datagram_adapter.write( seg );
+  }
+}
+
+//! \details The EventLoop sleeps until the next event or until the TCPPeer's next timeout (retransmission
+//! or the end of lingering), whichever comes first. An idle connection with nothing in flight has no
+//! timer at all.
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_tick_peer()
+{
+  if ( not _tcp.value().active() ) {
+    if ( _timer.has_value() ) {
+      _timer->cancel();
+      _timer.reset();
+    }
+    return;
+  }
+
+  const auto now = std::max( timestamp_ms(), _last_tick_ms );
+  _tcp.value().tick( now - _last_tick_ms, [&]( auto x ) { _write_segment( x ); } );
+  _datagram_adapter.tick( now - _last_tick_ms );
+  _last_tick_ms = now;
+
+  const auto timeout = _tcp.value().ms_until_timeout();
+  if ( not timeout.has_value() ) {
+    if ( _timer.has_value() ) {
+      _timer->cancel();
+      _timer.reset();
     }
+    return;
+  }
+
+  const uint64_t deadline = now + *timeout;
+  if ( _timer.has_value() and _timer_deadline == deadline ) {
+    return;
+  }
+
+  _timer_deadline = deadline;
+  const EventLoop::Clock::time_point when { std::chrono::milliseconds { deadline } };
+  if ( _timer.has_value() ) {
+    _loop->reschedule_timer( *_timer, when );
+  } else {
+    _timer.emplace( _loop->add_timer( _timer_category, when, _guarded( [&] {
+      _timer_deadline.reset();
+      _after_event();
+    } ) ) );
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_after_event()
+{
+  if ( _loop == &_eventloop or not _tcp.has_value() ) {
+    return;
+  }
+
+  _tick();
+  if ( not _tcp->active() and not _inbound_pending() ) {
+    _finish();
   }
 }
 
+template<TCPDatagramAdapter AdaptT>
+template<typename Callback>
+std::function<void()> TCPMinnowSocket<AdaptT>::_guarded( Callback&& callback )
+{
+  return [this, callback = std::forward<Callback>( callback )] {
+    if ( _loop == &_eventloop ) {
+      callback();
+      return;
+    }
+
+    try {
+      callback();
+    } catch ( const std::exception& e ) {
+      std::cerr << "Exception in TCPMinnowSocket on an EventLoopPool thread: " << e.what() << "\n";
+      if ( _tcp.has_value() ) {
+        _tcp->inbound_reader().set_error();
+      }
+      _finish(); // (the other connections on the shard carry on)
+    }
+  };
+}
+
+template<TCPDatagramAdapter AdaptT>
+bool TCPMinnowSocket<AdaptT>::_inbound_pending()
+{
+  return _tcp->inbound_reader().bytes_buffered()
+         or ( ( _tcp->inbound_reader().is_finished() or _tcp->inbound_reader().has_error() )
+              and not _inbound_shutdown );
+}
+
 //! \param[in] data_socket_pair is a pair of connected AF_UNIX SOCK_STREAM sockets
 //! \param[in] datagram_interface is the interface for reading and writing datagrams
+//! \param[in] pool is the EventLoopPool to run the TCPPeer on once connected (or nullptr for a thread of its own)
 template<TCPDatagramAdapter AdaptT>
 TCPMinnowSocket<AdaptT>::TCPMinnowSocket( std::pair<FileDescriptor, FileDescriptor> data_socket_pair,
-                                          AdaptT&& datagram_interface )
+                                          AdaptT&& datagram_interface,
+                                          EventLoopPool* pool )
   : LocalStreamSocket( std::move( data_socket_pair.first ) )
   , _datagram_adapter( std::move( datagram_interface ) )
   , _thread_data( std::move( data_socket_pair.second ) )
+  , _pool( pool )
 {
   _thread_data.set_blocking( false );
   set_blocking( false );
+  _datagram_adapter.fd().set_blocking( false ); // (outgoing segments wait in its write queue if it's full)
 }
 
 template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
 {
   _tcp.emplace( config );
+  _last_tick_ms = timestamp_ms();
+  _add_rules();
+}
+
+//! \details Rules and categories are looked up by name, so that the many TCPPeers sharing a pool's loop
+//! share their categories too. With a pool, every callback ends with _after_event().
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_add_rules()
+{
+  _timer_category = _loop->category_named( "TCPPeer timeout" );
 
   // Set up the event loop
 
@@ -74,15 +216,43 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
   // 3) Incoming bytes reassembled by the Reassembler
   //    (needs to be read from the inbound_stream and written
   //    to the local stream socket back to the application)
-
-  // rule 1: read from filtered packet stream and dump into TCPConnection
-  _eventloop.add_rule(
-    "receive TCP segment from the network",
+  //
+  // 4) Outgoing segments that the adapter queued
+  //    (that didn't fit in the datagram fd, or that it keeps for one batched write; need to be written once
+  //    it's writable)
+
+  // rule 1: read from filtered packet stream and dump into TCPConnection (everything that has arrived, up to
+  // MAX_READS_PER_EVENT datagrams, so that consecutive in-order segments can be merged first; with one batched
+  // read, if the adapter can)
+  _rules.push_back( _loop->add_rule(
+    _loop->category_named( "receive TCP segment from the network" ),
     _datagram_adapter.fd(),
     Direction::In,
-    [&] {
-      if ( auto seg = _datagram_adapter.read() ) {
-        _tcp->receive( std::move( seg.value() ), [&]( auto x ) { _datagram_adapter.write( x ); } );
+    _guarded( [&] {
+      const auto transmit = [&]( auto x ) { _write_segment( x ); };
+      if constexpr ( TCPDatagramBatchAdapter<AdaptT> ) {
+        std::vector<TCPMessage> segments;
+        _datagram_adapter.read_batch( MAX_READS_PER_EVENT, segments );
+        for ( auto& seg : segments ) {
+          if ( auto ready = _coalescer.push( std::move( seg ) ) ) {
+            _tcp->receive( std::move( ready.value() ), transmit );
+          }
+        }
+      } else {
+        for ( size_t i = 0; i < MAX_READS_PER_EVENT; i++ ) {
+          const unsigned int reads = _datagram_adapter.fd().read_count();
+          if ( auto seg = _datagram_adapter.read() ) {
+            if ( auto ready = _coalescer.push( std::move( seg.value() ) ) ) {
+              _tcp->receive( std::move( ready.value() ), transmit );
+            }
+          }
+          if ( _datagram_adapter.fd().read_count() == reads or _datagram_adapter.fd().eof() ) {
+            break; // (nothing more has arrived)
+          }
+        }
+      }
+      if ( auto ready = _coalescer.flush() ) {
+        _tcp->receive( std::move( ready.value() ), transmit );
       }
 
       // debugging output:
@@ -91,15 +261,16 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
                   << " has been fully acknowledged.\n";
         _fully_acked = true;
       }
-    },
-    [&] { return _tcp->active(); } );
+      _after_event();
+    } ),
+    [&] { return _tcp->active(); } ) );
 
   // rule 2: read from pipe into outbound buffer
-  _eventloop.add_rule(
-    "push bytes to TCPPeer",
+  _rules.push_back( _loop->add_rule(
+    _loop->category_named( "push bytes to TCPPeer" ),
     _thread_data,
     Direction::In,
-    [&] {
+    _guarded( [&] {
       std::string data;
       data.resize( _tcp->outbound_writer().available_capacity() );
       _thread_data.read( data );
@@ -116,27 +287,29 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
                   << " still in flight).\n";
       }
 
-      _tcp->push( [&]( auto x ) { _datagram_adapter.write( x ); } );
-    },
+      _tcp->push( [&]( auto x ) { _write_segment( x ); } );
+      _after_event();
+    } ),
     [&] {
       return ( _tcp->active() ) and ( not _outbound_shutdown )
              and ( _tcp->outbound_writer().available_capacity() > 0 );
     },
-    [&] {
+    _guarded( [&] {
       _tcp->outbound_writer().close();
       _outbound_shutdown = true;
-    },
-    [&] {
+      _after_event();
+    } ),
+    _guarded( [&] {
       std::cerr << "DEBUG: minnow outbound stream had error.\n";
       _tcp->outbound_writer().set_error();
-    } );
+    } ) ) );
 
   // rule 3: read from inbound buffer into pipe
-  _eventloop.add_rule(
-    "read bytes from inbound stream",
+  _rules.push_back( _loop->add_rule(
+    _loop->category_named( "read bytes from inbound stream" ),
     _thread_data,
     Direction::Out,
-    [&] {
+    _guarded( [&] {
       Reader& inbound = _tcp->inbound_reader();
       // Write from the inbound_stream into
       // the pipe, handling the possibility of a partial
@@ -155,17 +328,31 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
         std::cerr << "DEBUG: minnow inbound stream from " << _datagram_adapter.config().destination.to_string()
                   << " finished " << ( inbound.has_error() ? "uncleanly.\n" : "cleanly.\n" );
       }
-    },
-    [&] {
-      return _tcp->inbound_reader().bytes_buffered()
-             or ( ( _tcp->inbound_reader().is_finished() or _tcp->inbound_reader().has_error() )
-                  and not _inbound_shutdown );
-    },
-    [&] {},
-    [&] {
+      _after_event();
+    } ),
+    [&] { return _inbound_pending(); },
+    _guarded( [&] {
+      _inbound_shutdown = true; // the owner hung up
+      _after_event();
+    } ),
+    _guarded( [&] {
       std::cerr << "DEBUG: minnow inbound stream had error.\n";
       _tcp->inbound_reader().set_error();
-    } );
+    } ) ) );
+
+  // rule 4: write queued segments to the network (for an adapter that queues them, the ones the link had
+  // no room for when _tick flushed it)
+  if constexpr ( TCPDatagramQueueingAdapter<AdaptT> ) {
+    _rules.push_back( _loop->add_rule(
+      _loop->category_named( "flush queued TCP segments" ),
+      _datagram_adapter.fd(),
+      Direction::Out,
+      _guarded( [&] { _datagram_adapter.flush_writes(); } ),
+      [&] { return _datagram_adapter.writes_ready(); } ) );
+  } else {
+    _rules.push_back(
+      _loop->add_flush_rule( _loop->category_named( "flush queued TCP segments" ), _datagram_adapter.fd() ) );
+  }
 }
 
 //! \brief Call [socketpair](\ref man2::socketpair) and return connected Unix-domain sockets of specified type
@@ -183,17 +370,46 @@ inline std::pair<SocketType, SocketType> socket_pair_helper( int domain, int typ
 template<TCPDatagramAdapter AdaptT>
 TCPMinnowSocket<AdaptT>::TCPMinnowSocket( AdaptT&& datagram_interface )
   : TCPMinnowSocket( socket_pair_helper<LocalStreamSocket>( AF_UNIX, SOCK_STREAM ),
-                     std::move( datagram_interface ) )
+                     std::move( datagram_interface ),
+                     nullptr )
+{}
+
+//! \param[in] datagram_interface is the underlying interface (e.g. to UDP, IP, or Ethernet)
+//! \param[in] pool is the EventLoopPool that will run the TCPPeer once it is connected
+template<TCPDatagramAdapter AdaptT>
+TCPMinnowSocket<AdaptT>::TCPMinnowSocket( AdaptT&& datagram_interface, EventLoopPool& pool )
+  : TCPMinnowSocket( socket_pair_helper<LocalStreamSocket>( AF_UNIX, SOCK_STREAM ),
+                     std::move( datagram_interface ),
+                     &pool )
 {}
 
 template<TCPDatagramAdapter AdaptT>
 TCPMinnowSocket<AdaptT>::~TCPMinnowSocket()
 {
   try {
-    if ( _tcp_thread.joinable() ) {
+    if ( _finished.valid() ) {
+      if ( _finished.wait_for( std::chrono::seconds { 0 } ) != std::future_status::ready ) {
+        std::cerr << "Warning: unclean shutdown of TCPMinnowSocket\n";
+      }
+      // make sure the shard is done with this object (even if it has just finished by itself)
+      std::promise<void> done;
+      const std::future<void> shard_done = done.get_future();
+      _pool->post( _shard, [&]( EventLoop& ) {
+        _finish();
+        done.set_value();
+      } );
+      // (a shard whose thread has stopped will never run the task, and no longer touches this object)
+      while ( shard_done.wait_for( std::chrono::milliseconds { 100 } ) != std::future_status::ready ) {
+        if ( _pool->stopped( _shard ) ) {
+          std::cerr << "Warning: TCPMinnowSocket's EventLoopPool thread has stopped\n";
+          break;
+        }
+      }
+    } else if ( _tcp_thread.joinable() ) {
       std::cerr << "Warning: unclean shutdown of TCPMinnowSocket\n";
-      // force the other side to exit
+      // force the other side to exit (shutting down our end of the stream wakes up its EventLoop)
       _abort.store( true );
+      shutdown( SHUT_RDWR );
       _tcp_thread.join();
     }
   } catch ( const std::exception& e ) {
@@ -205,7 +421,11 @@ template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::wait_until_closed()
 {
   shutdown( SHUT_RDWR );
-  if ( _tcp_thread.joinable() ) {
+  if ( _finished.valid() ) {
+    std::cerr << "DEBUG: minnow waiting for clean shutdown... ";
+    _finished.wait();
+    std::cerr << "done.\n";
+  } else if ( _tcp_thread.joinable() ) {
     std::cerr << "DEBUG: minnow waiting for clean shutdown... ";
     _tcp_thread.join();
     std::cerr << "done.\n";
@@ -231,7 +451,7 @@ void TCPMinnowSocket<AdaptT>::connect( const TCPConfig& c_tcp, const FdAdapterCo
     throw std::runtime_error( "TCPPeer not successfully initialized" );
   }
 
-  _tcp->push( [&]( auto x ) { _datagram_adapter.write( x ); } );
+  _tcp->push( [&]( auto x ) { _write_segment( x ); } );
 
   if ( _tcp->sender().sequence_numbers_in_flight() != 1 ) {
     throw std::runtime_error( "After TCPConnection::connect(), expected sequence_numbers_in_flight() == 1" );
@@ -244,7 +464,7 @@ void TCPMinnowSocket<AdaptT>::connect( const TCPConfig& c_tcp, const FdAdapterCo
     std::cerr << "DEBUG: minnow successfully connected to " << c_ad.destination.to_string() << ".\n";
   }
 
-  _tcp_thread = std::thread( &TCPMinnowSocket::_tcp_main, this );
+  _start_background();
 }
 
 //! \param[in] c_tcp is the TCPConfig for the TCPConnection
@@ -265,7 +485,105 @@ void TCPMinnowSocket<AdaptT>::listen_and_accept( const TCPConfig& c_tcp, const F
   _tcp_loop( [&] { return ( not _tcp->has_ackno() ) or ( _tcp->sender().sequence_numbers_in_flight() ); } );
   std::cerr << "DEBUG: minnow new connection from " << _datagram_adapter.config().destination.to_string() << ".\n";
 
-  _tcp_thread = std::thread( &TCPMinnowSocket::_tcp_main, this );
+  _start_background();
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_start_background()
+{
+  if ( _pool == nullptr ) {
+    _tcp_thread = std::thread( &TCPMinnowSocket::_tcp_main, this );
+    return;
+  }
+
+  // move the TCPPeer from the loop that ran the handshake to its shard's loop
+  for ( auto& rule : _rules ) {
+    rule.cancel();
+  }
+  _rules.clear();
+  if ( _timer.has_value() ) {
+    _timer->cancel();
+    _timer.reset();
+    _timer_deadline.reset();
+  }
+  if ( _flush_retry.has_value() ) {
+    _flush_retry->cancel();
+    _flush_retry.reset();
+  }
+
+  const FdAdapterConfig& config = _datagram_adapter.config();
+  const FourTuple tuple { .local_ip = config.source.ipv4_numeric(),
+                          .remote_ip = config.destination.ipv4_numeric(),
+                          .local_port = config.source.port(),
+                          .remote_port = config.destination.port() };
+  _shard = _pool->shard_for( tuple.hash() );
+  _finished = _finished_promise.get_future().share();
+  _pool->post( _shard, [this]( EventLoop& loop ) {
+    _loop = &loop;
+    _guarded( [&] {
+      _add_rules();
+      _after_event();
+    } )();
+  } );
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_finish()
+{
+  if ( _finish_called ) {
+    return;
+  }
+  _finish_called = true;
+
+  try {
+    // (last chance for the final segments; the rest are dropped)
+    if constexpr ( TCPDatagramQueueingAdapter<AdaptT> ) {
+      _datagram_adapter.flush_writes();
+    } else {
+      _datagram_adapter.fd().flush_writes();
+    }
+  } catch ( const std::exception& e ) {
+    std::cerr << "Exception flushing TCPMinnowSocket: " << e.what() << "\n";
+  }
+
+  for ( auto& rule : _rules ) {
+    rule.cancel();
+  }
+  _rules.clear();
+  if ( _timer.has_value() ) {
+    _timer->cancel();
+    _timer.reset();
+  }
+  if ( _flush_retry.has_value() ) {
+    _flush_retry->cancel();
+    _flush_retry.reset();
+  }
+
+  try {
+    shutdown( SHUT_RDWR );
+  } catch ( const std::exception& e ) {
+    std::cerr << "Exception shutting down TCPMinnowSocket: " << e.what() << "\n";
+  }
+  if ( _tcp.has_value() ) {
+    _print_finished();
+  }
+  _tcp.reset();
+  _finished_promise.set_value();
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_print_finished()
+{
+  if ( not _tcp.value().active() ) {
+    std::cerr << "DEBUG: minnow TCP connection finished "
+              << ( _tcp->inbound_reader().has_error() ? "uncleanly.\n" : "cleanly.\n" );
+  }
+
+  const TCPReceiveCoalescer::Stats& stats = _coalescer.stats();
+  if ( stats.segments_in > stats.segments_out ) {
+    std::cerr << "DEBUG: minnow merged " << stats.segments_in << " received segments into " << stats.segments_out
+              << " (" << stats.merge_ratio() << " per segment).\n";
+  }
 }
 
 template<TCPDatagramAdapter AdaptT>
@@ -277,10 +595,7 @@ void TCPMinnowSocket<AdaptT>::_tcp_main()
     }
     _tcp_loop( [] { return true; } );
     shutdown( SHUT_RDWR );
-    if ( not _tcp.value().active() ) {
-      std::cerr << "DEBUG: minnow TCP connection finished "
-                << ( _tcp->inbound_reader().has_error() ? "uncleanly.\n" : "cleanly.\n" );
-    }
+    _print_finished();
     _tcp.reset();
   } catch ( const std::exception& e ) {
     std::cerr << "Exception in TCPConnection runner thread: " << e.what() << "\n";
@@ -23,6 +23,12 @@ using namespace std;
 //! from the TCP header; it uses this information to filter future reads.
 //! \returns a std::optional<TCPSegment> that is empty if the segment was invalid or unrelated
 optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( InternetDatagram ip_dgram )
+{
+  return unwrap_tcp_in_ip( move( ip_dgram ), not config().checksum_trusted );
+}
+
+//! \param[in] verify_checksum is `false` if the link vouches for the TCP checksum (or doesn't need one)
+optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( InternetDatagram ip_dgram, const bool verify_checksum )
 {
   // is the IPv4 datagram for us?
   // Note: it's valid to bind to address "0" (INADDR_ANY) and reply from actual address contacted
@@ -42,7 +48,8 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( InternetDatagram ip_d
 
   // is the payload a valid TCP segment?
   TCPSegment tcp_seg;
-  if ( not parse( tcp_seg, move( ip_dgram.payload ), ip_dgram.header.pseudo_checksum() ) ) {
+  if ( verify_checksum ? not parse( tcp_seg, move( ip_dgram.payload ), ip_dgram.header.pseudo_checksum() )
+                       : not parse( tcp_seg, move( ip_dgram.payload ) ) ) {
     return {};
   }
 
@@ -74,6 +81,12 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( InternetDatagram ip_d
 //! Takes a TCP segment, sets port numbers as necessary, and wraps it in an IPv4 datagram
 //! \param[in] seg is the TCP segment to convert
 InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
+{
+  return wrap_tcp_in_ip( msg, config().checksum_trusted ? TCPChecksum::Omitted : TCPChecksum::Full );
+}
+
+//! \param[in] checksum says what to put in the TCP checksum field
+InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg, const TCPChecksum checksum )
 {
   const size_t payload_size = msg.sender->payload.size();
   TCPSegment seg { .message = { msg.sender.borrow(), msg.receiver.borrow() } };
@@ -88,7 +101,21 @@ InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
   ip_dgram.header.len = ip_dgram.header.hlen * 4 + 20 /* tcp header len */ + payload_size;
 
   // set payload, calculating TCP checksum using information from IP header
-  seg.compute_checksum( ip_dgram.header.pseudo_checksum() );
+  switch ( checksum ) {
+    case TCPChecksum::Full:
+      seg.compute_checksum( ip_dgram.header.pseudo_checksum() );
+      break;
+    case TCPChecksum::PseudoHeader: {
+      uint32_t sum = ip_dgram.header.pseudo_checksum();
+      while ( sum > 0xffff ) {
+        sum = ( sum >> 16 ) + static_cast<uint16_t>( sum );
+      }
+      seg.udinfo.cksum = static_cast<uint16_t>( sum );
+      break;
+    }
+    case TCPChecksum::Omitted:
+      break;
+  }
   ip_dgram.header.compute_checksum();
   ip_dgram.payload = serialize( seg );
 
@@ -7,10 +7,21 @@
 #include <optional>
 
 //! \brief A converter from TCP segments to serialized IPv4 datagrams
+//! \details On a link marked FdAdapterConfig::checksum_trusted, TCP checksums are left zero and not verified.
 class TCPOverIPv4Adapter : public FdAdapterBase
 {
 public:
+  //! What wrap_tcp_in_ip puts in the TCP checksum field
+  enum class TCPChecksum : uint8_t
+  {
+    Full,         //!< The checksum
+    PseudoHeader, //!< Just the pseudo-header's folded sum, for a link that completes the checksum itself
+    Omitted       //!< Zero
+  };
+
   std::optional<TCPMessage> unwrap_tcp_in_ip( InternetDatagram ip_dgram );
+  std::optional<TCPMessage> unwrap_tcp_in_ip( InternetDatagram ip_dgram, bool verify_checksum );
 
   InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg );
+  InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg, TCPChecksum checksum );
 };
@@ -7,6 +7,7 @@
 #include "tcp_sender.hh"
 #include "tcp_sender_message.hh"
 
+#include <algorithm>
 #include <functional>
 #include <optional>
 
@@ -35,6 +36,17 @@ public:
   }
   bool has_ackno() const { return receiver_.send().ackno.has_value(); }
 
+  /* How many milliseconds until tick() next has something to do (retransmit, or stop lingering)? */
+  std::optional<uint64_t> ms_until_timeout() const
+  {
+    std::optional<uint64_t> ret = sender_.ms_until_retransmission();
+    const uint64_t linger_end = time_of_last_receipt_ + 10UL * cfg_.rt_timeout;
+    if ( linger_after_streams_finish_ and cumulative_time_ < linger_end ) {
+      ret = std::min( ret.value_or( UINT64_MAX ), linger_end - cumulative_time_ );
+    }
+    return ret;
+  }
+
   /* Is the peer still active? */
   bool active() const
   {
@@ -88,7 +100,7 @@ public:
 
 private:
   TCPConfig cfg_;
-  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout };
+  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout, cfg_.super_segment_size };
   TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } } };
 
   bool need_send_ {};
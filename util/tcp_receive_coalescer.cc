@@ -0,0 +1,66 @@
+#include "tcp_receive_coalescer.hh"
+
+#include <utility>
+
+using namespace std;
+
+double TCPReceiveCoalescer::Stats::merge_ratio() const
+{
+  return segments_out == 0 ? 1 : static_cast<double>( segments_in ) / static_cast<double>( segments_out );
+}
+
+bool TCPReceiveCoalescer::_can_merge( const TCPMessage& msg ) const
+{
+  if ( not _held.has_value() ) {
+    return false;
+  }
+
+  const TCPSenderMessage& held = _held->sender.get();
+  const TCPSenderMessage& next = msg.sender.get();
+  if ( held.SYN or held.FIN or held.RST or held.payload.empty() or next.SYN or next.RST or next.payload.empty() ) {
+    return false;
+  }
+  if ( held.payload.size() + next.payload.size() > _max_payload_size ) {
+    return false;
+  }
+  if ( next.seqno != held.seqno + static_cast<uint32_t>( held.payload.size() ) ) {
+    return false; // (out of order, or a retransmission)
+  }
+
+  const TCPReceiverMessage& held_ack = _held->receiver.get();
+  const TCPReceiverMessage& next_ack = msg.receiver.get();
+  return held_ack.ackno == next_ack.ackno and not held_ack.RST and not next_ack.RST;
+}
+
+optional<TCPMessage> TCPReceiveCoalescer::push( TCPMessage&& msg )
+{
+  ++_stats.segments_in;
+  if ( not _can_merge( msg ) ) {
+    optional<TCPMessage> ready = flush();
+    _held.emplace( move( msg ) );
+    return ready;
+  }
+
+  if ( _held->sender.is_borrowed() ) {
+    _held->sender = TCPSenderMessage { _held->sender.get() };
+  }
+  TCPSenderMessage& held = _held->sender.get_mut();
+  const TCPSenderMessage& next = msg.sender.get();
+  if ( held.payload.capacity() < _max_payload_size ) {
+    held.payload.reserve( _max_payload_size ); // (once per merged segment)
+  }
+  held.payload += next.payload;
+  held.payload_sum.reset();
+  held.FIN = next.FIN;
+  _held->receiver = move( msg.receiver ); // (the newer window)
+  return {};
+}
+
+optional<TCPMessage> TCPReceiveCoalescer::flush()
+{
+  if ( not _held.has_value() ) {
+    return {};
+  }
+  ++_stats.segments_out;
+  return exchange( _held, nullopt );
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "tcp_config.hh"
+#include "tcp_segment.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+//! \brief Merges consecutive in-order segments of one connection into larger ones, before a TCPPeer receives
+//! them (in the style of GRO, generic receive offload)
+//! \details Segments read together (e.g. all that a TUN device had ready in one event-loop iteration) are
+//! offered one at a time with push(), then flush() ends the batch. A segment is merged into the one held if it
+//! carries payload starting right where the held one's ends, with the same ackno and neither segment carrying
+//! SYN, RST or (in the held one) FIN; the merged segment takes the newer window and FIN. The TCPPeer then
+//! reassembles, acknowledges and pushes once per merged segment, not once per segment read.
+class TCPReceiveCoalescer
+{
+public:
+  //! Counters of what has been merged
+  struct Stats
+  {
+    uint64_t segments_in {};  //!< Segments offered
+    uint64_t segments_out {}; //!< Segments handed on (merged or not)
+
+    //! Segments offered per segment handed on (1 if nothing was merged)
+    double merge_ratio() const;
+  };
+
+  //! \param[in] max_payload_size is the most payload a merged segment may carry
+  explicit TCPReceiveCoalescer( size_t max_payload_size = TCPConfig::MAX_SUPER_SEGMENT_SIZE )
+    : _max_payload_size( max_payload_size )
+  {}
+
+  //! Merge `msg` into the held segment if it continues it, or else hold it instead
+  //! \returns the segment held before, once `msg` can't be merged into it
+  std::optional<TCPMessage> push( TCPMessage&& msg );
+
+  //! \returns the held segment, if any (at the end of a batch)
+  std::optional<TCPMessage> flush();
+
+  const Stats& stats() const { return _stats; }
+
+private:
+  size_t _max_payload_size;
+  std::optional<TCPMessage> _held {};
+  Stats _stats {};
+
+  bool _can_merge( const TCPMessage& msg ) const;
+};
@@ -1,4 +1,5 @@
 #include "tcp_segment.hh"
+#include "buffer_pool.hh"
 #include "checksum.hh"
 #include "helpers.hh"
 #include "wrapping_integers.hh"
@@ -19,6 +20,11 @@ void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum
     return;
   }
 
+  parse( parser );
+}
+
+void TCPSegment::parse( Parser& parser )
+{
   uint32_t raw32 {};
   uint16_t raw16 {};
   uint8_t octet {};
@@ -56,6 +62,8 @@ void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum
   parser.remove_prefix( data_offset * 4 - HEADER_LENGTH );
 
   parser.concatenate_all_remaining( message.sender->payload );
+  message.sender->payload_sum.reset();
+  message.sender->segment_size.reset();
 }
 
 class Wrap32Serializable : public Wrap32
@@ -65,6 +73,12 @@ public:
 };
 
 void TCPSegment::serialize( Serializer& serializer ) const
+{
+  serialize_header( serializer );
+  serializer.buffer( message.sender->payload );
+}
+
+void TCPSegment::serialize_header( Serializer& serializer ) const
 {
   serializer.integer( udinfo.src_port );
   serializer.integer( udinfo.dst_port );
@@ -78,16 +92,20 @@ void TCPSegment::serialize( Serializer& serializer ) const
   serializer.integer( message.receiver->window_size );
   serializer.integer( udinfo.cksum );
   serializer.integer( uint16_t { 0 } ); // urgent pointer
-  serializer.buffer( message.sender->payload );
 }
 
 void TCPSegment::compute_checksum( uint32_t datagram_layer_pseudo_checksum )
 {
   udinfo.cksum = 0;
-  Serializer s;
-  serialize( s );
+  Serializer s { BufferPool::take_small() };
+  const auto& payload_sum = message.sender.get().payload_sum;
+  if ( payload_sum.has_value() ) {
+    serialize_header( s ); // (the header's length is even, so the payload's words line up with its sum)
+  } else {
+    serialize( s );
+  }
 
-  InternetChecksum check { datagram_layer_pseudo_checksum };
+  InternetChecksum check { datagram_layer_pseudo_checksum + payload_sum.value_or( 0 ) };
   check.add( s.finish() );
   udinfo.cksum = check.value();
 }
@@ -23,8 +23,11 @@ struct TCPSegment
   UserDatagramInfo udinfo {};
 
   void parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum );
+  void parse( Parser& parser ); // (without verifying the checksum)
   void serialize( Serializer& serializer ) const;
+  void serialize_header( Serializer& serializer ) const; // (everything but the payload)
 
+  // (reads only the header if the sender message carries its payload's sum)
   void compute_checksum( uint32_t datagram_layer_pseudo_checksum );
 
   static constexpr uint8_t HEADER_LENGTH = 20; // TCP header length, not including options
@@ -2,6 +2,8 @@
 
 #include "wrapping_integers.hh"
 
+#include <cstdint>
+#include <optional>
 #include <string>
 
 /*
@@ -20,6 +22,13 @@
  * 4) The FIN flag. If set, the payload represents the ending of the byte stream.
  *
  * 5) The RST (reset) flag. If set, the stream has suffered an error and the connection should be aborted.
+ *
+ * It can also carry the payload's partial Internet checksum (InternetChecksum::partial()), if the sender summed
+ * the payload while copying it out of the stream, so that checksumming the segment need not read it again.
+ * Whoever changes the payload must reset this.
+ *
+ * A super-segment (see TCPConfig::super_segment_size) carries the payloads of several consecutive segments, each
+ * segment_size bytes but perhaps the last, for the link to cut apart again.
  */
 
 struct TCPSenderMessage
@@ -32,6 +41,9 @@ struct TCPSenderMessage
 
   bool RST {};
 
+  std::optional<uint16_t> payload_sum {};
+  std::optional<uint16_t> segment_size {};
+
   // How many sequence numbers does this segment use?
   size_t sequence_length() const { return SYN + payload.size() + FIN; };
 };
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//! \brief A hierarchical timing wheel (Varghese and Lauck) of millisecond deadlines
+//! \details Level 0 has one slot per millisecond, and each higher level has slots SLOTS times
+//! as wide as the level below. A timer sits in the lowest level whose slot span separates its
+//! deadline from the current time; when time reaches the start of a higher-level slot, that
+//! slot's timers are redistributed to lower levels. Deadlines beyond the top level wait in an
+//! overflow list. An occupancy bitmap per level lets advance() jump straight to the next slot
+//! that holds anything, so advancing costs O(expired + redistributed) rather than O(timers)
+//! or O(milliseconds elapsed).
+//!
+//! Timers cannot be removed. Owners that reschedule or give up a timer should record the
+//! deadline they currently care about and ignore expirations that don't match it.
+template<typename T>
+class TimerWheel
+{
+public:
+  static constexpr unsigned SLOT_BITS = 6;
+  static constexpr size_t SLOTS = size_t { 1 } << SLOT_BITS;
+  static constexpr unsigned LEVELS = 4; //!< Deadlines less than 2^24 ms (4.6 hours) away skip the overflow list
+
+  //! Construct a wheel whose clock starts at `now` (in milliseconds)
+  explicit TimerWheel( uint64_t now = 0 ) : _now( now ) {}
+
+  //! Current time of the wheel: the latest time passed to advance()
+  uint64_t now() const { return _now; }
+
+  //! Number of timers that have not yet expired
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  //! Add a timer that expires at absolute time `deadline` (a deadline in the past expires on the next advance)
+  void schedule( uint64_t deadline, T value )
+  {
+    ++_size;
+    _place( { deadline, std::move( value ) } );
+  }
+
+  //! Earliest time at which advance() could have anything to do, or empty if there are no timers
+  //! \details This is a lower bound on the next deadline (it may be the time a higher-level slot gets
+  //! redistributed), which makes it suitable as a wake-up time for an event loop.
+  std::optional<uint64_t> next_event() const
+  {
+    if ( not _due.empty() ) {
+      return _now;
+    }
+    return _next_event_time();
+  }
+
+  //! Move the clock forward to `now`, calling `on_expire( deadline, value )` for every timer whose
+  //! deadline is at or before `now`. Timers expire a millisecond slot at a time, earliest first (timers
+  //! scheduled in the past expire right away). `on_expire` may schedule new timers.
+  template<typename Callback>
+  void advance( uint64_t now, Callback&& on_expire )
+  {
+    if ( now < _now ) {
+      now = _now;
+    }
+
+    while ( true ) {
+      _fire_due( on_expire );
+
+      const auto next = _next_event_time();
+      if ( not next.has_value() or *next > now ) {
+        break;
+      }
+
+      _now = *next;
+      for ( unsigned level = LEVELS; level-- > 1; ) {
+        if ( _aligned( _now, level ) ) {
+          _redistribute( level );
+        }
+      }
+      if ( _aligned( _now, LEVELS ) ) {
+        _redistribute_overflow();
+      }
+
+      // everything still in the current level-0 slot expires now
+      _take_slot( 0, _index( _now, 0 ), _due );
+    }
+
+    _now = now;
+  }
+
+private:
+  struct Timer
+  {
+    uint64_t deadline;
+    T value;
+  };
+
+  using Slot = std::vector<Timer>;
+
+  std::array<std::array<Slot, SLOTS>, LEVELS> _levels {};
+  std::array<uint64_t, LEVELS> _occupied {}; //!< Bit i of _occupied[l] is set iff _levels[l][i] is non-empty
+  std::vector<Timer> _overflow {};
+  std::vector<Timer> _due {}; //!< Timers whose deadline has already passed
+  uint64_t _now;
+  size_t _size {};
+
+  static uint64_t _index( const uint64_t time, const unsigned level )
+  {
+    return ( time >> ( SLOT_BITS * level ) ) & ( SLOTS - 1 );
+  }
+
+  //! Do `a` and `b` fall in the same slot of level `level` (or, for level == LEVELS, the same overflow epoch)?
+  static bool _same_block( const uint64_t a, const uint64_t b, const unsigned level )
+  {
+    return ( a >> ( SLOT_BITS * level ) ) == ( b >> ( SLOT_BITS * level ) );
+  }
+
+  static bool _aligned( const uint64_t time, const unsigned level )
+  {
+    return ( time & ( ( uint64_t { 1 } << ( SLOT_BITS * level ) ) - 1 ) ) == 0;
+  }
+
+  void _place( Timer&& timer )
+  {
+    if ( timer.deadline <= _now ) {
+      _due.push_back( std::move( timer ) );
+      return;
+    }
+
+    for ( unsigned level = 0; level < LEVELS; level++ ) {
+      if ( _same_block( timer.deadline, _now, level + 1 ) ) {
+        const auto index = _index( timer.deadline, level );
+        _levels[level][index].push_back( std::move( timer ) );
+        _occupied[level] |= uint64_t { 1 } << index;
+        return;
+      }
+    }
+
+    _overflow.push_back( std::move( timer ) );
+  }
+
+  void _take_slot( const unsigned level, const uint64_t index, std::vector<Timer>& out )
+  {
+    if ( not( _occupied[level] & ( uint64_t { 1 } << index ) ) ) {
+      return;
+    }
+    Slot& slot = _levels[level][index];
+    if ( out.empty() ) {
+      std::swap( out, slot );
+    } else {
+      for ( auto& timer : slot ) {
+        out.push_back( std::move( timer ) );
+      }
+      slot.clear();
+    }
+    _occupied[level] &= ~( uint64_t { 1 } << index );
+  }
+
+  void _redistribute( const unsigned level )
+  {
+    std::vector<Timer> timers;
+    _take_slot( level, _index( _now, level ), timers );
+    for ( auto& timer : timers ) {
+      _place( std::move( timer ) );
+    }
+  }
+
+  void _redistribute_overflow()
+  {
+    std::vector<Timer> timers;
+    std::swap( timers, _overflow );
+    for ( auto& timer : timers ) {
+      _place( std::move( timer ) );
+    }
+  }
+
+  //! The earliest time at which a level-0 slot expires or a higher-level slot must be redistributed
+  std::optional<uint64_t> _next_event_time() const
+  {
+    // every occupied slot lies strictly after the current index at its level, within the current block
+    for ( unsigned level = 0; level < LEVELS; level++ ) {
+      const uint64_t current = _index( _now, level );
+      const uint64_t later = current == SLOTS - 1 ? 0 : _occupied[level] & ( ~uint64_t { 0 } << ( current + 1 ) );
+      if ( later ) {
+        const uint64_t block_start = ( _now >> ( SLOT_BITS * ( level + 1 ) ) ) << ( SLOT_BITS * ( level + 1 ) );
+        return block_start + ( static_cast<uint64_t>( std::countr_zero( later ) ) << ( SLOT_BITS * level ) );
+      }
+    }
+
+    if ( not _overflow.empty() ) {
+      return ( ( _now >> ( SLOT_BITS * LEVELS ) ) + 1 ) << ( SLOT_BITS * LEVELS );
+    }
+
+    return {};
+  }
+
+  template<typename Callback>
+  void _fire_due( Callback& on_expire )
+  {
+    while ( not _due.empty() ) {
+      std::vector<Timer> expired;
+      std::swap( expired, _due );
+      _size -= expired.size();
+      for ( auto& timer : expired ) {
+        on_expire( timer.deadline, std::move( timer.value ) );
+      }
+    }
+  }
+};
@@ -5,29 +5,45 @@
 #include <fcntl.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <stdexcept>
 #include <sys/ioctl.h>
 
 static constexpr const char* CLONEDEV = "/dev/net/tun";
 
+// UDP segmentation offload (TUN_F_USO4 and TUN_F_USO6, from Linux 6.2, which older <linux/if_tun.h> lack)
+static constexpr unsigned int OFFLOAD_USO = 0x20 | 0x40;
+
 using namespace std;
 
 //! \param[in] devname is the name of the TUN or TAP device, specified at its creation.
 //! \param[in] is_tun is `true` for a TUN device (expects IP datagrams), or `false` for a TAP device (expects
 //! Ethernet frames)
+//! \param[in] options says whether packets carry a VirtioNetHeader (and may then be super-segments), and
+//! whether the device has several queues, of which this is one
 //!
 //! To create a TUN device, you should already have run
 //!
 //!     ip tuntap add mode tun user `username` name `devname`
 //!
-//! as root before calling this function.
+//! as root before calling this function (adding `multi_queue` for TunTapOptions::multi_queue).
 
-TunTapFD::TunTapFD( const string& devname, const bool is_tun )
-  : FileDescriptor( ::CheckSystemCall( "open", open( CLONEDEV, O_RDWR | O_CLOEXEC ) ) )
+TunTapFD::TunTapFD( const string& devname, const bool is_tun, const TunTapOptions& options )
+  : FileDescriptor( ::CheckSystemCall( "open", open( CLONEDEV, O_RDWR | O_CLOEXEC ) ) ), options_( options )
 {
+  if ( options.gso and not options.vnet_hdr ) {
+    throw runtime_error( "TunTapFD: segmentation offload needs a virtio-net header" );
+  }
+
   struct ifreq tun_req
   {};
 
   tun_req.ifr_flags = static_cast<int16_t>( ( is_tun ? IFF_TUN : IFF_TAP ) | IFF_NO_PI ); // no packetinfo
+  if ( options.vnet_hdr ) {
+    tun_req.ifr_flags = static_cast<int16_t>( tun_req.ifr_flags | IFF_VNET_HDR );
+  }
+  if ( options.multi_queue ) {
+    tun_req.ifr_flags = static_cast<int16_t>( tun_req.ifr_flags | IFF_MULTI_QUEUE );
+  }
 
   // copy devname to ifr_name, making sure to null terminate
 
@@ -35,4 +51,31 @@ TunTapFD::TunTapFD( const string& devname, const bool is_tun )
   tun_req.ifr_name[IFNAMSIZ - 1] = '\0';
 
   CheckSystemCall( "ioctl", ioctl( fd_num(), TUNSETIFF, static_cast<void*>( &tun_req ) ) );
+
+  // let the kernel leave checksums for this end to complete (or to skip verifying), and hand over super-segments,
+  // or clear any such offload left on the device by an earlier user, since without the header this end could
+  // not tell
+  unsigned int offload = 0;
+  if ( options.vnet_hdr ) {
+    offload |= TUN_F_CSUM;
+  }
+  if ( options.gso ) {
+    offload |= TUN_F_TSO4 | TUN_F_TSO6;
+    if ( ioctl( fd_num(), TUNSETOFFLOAD, offload | OFFLOAD_USO ) == 0 ) {
+      return;
+    }
+    // (an older kernel, without UDP segmentation offload)
+  }
+  CheckSystemCall( "ioctl", ioctl( fd_num(), TUNSETOFFLOAD, offload ) );
+}
+
+vector<TunFD> TunFD::open_queues( const string& devname, const size_t count, TunTapOptions options )
+{
+  options.multi_queue = true;
+  vector<TunFD> queues;
+  queues.reserve( count );
+  for ( size_t i = 0; i < count; i++ ) {
+    queues.emplace_back( devname, options );
+  }
+  return queues;
 }
@@ -2,15 +2,67 @@
 
 #include "file_descriptor.hh"
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
+
+//! The header before each packet on a TUN/TAP device with IFF_VNET_HDR: `struct virtio_net_hdr` (from
+//! <linux/virtio_net.h>, which doesn't compile as C++), in the machine's byte order
+struct VirtioNetHeader
+{
+  static constexpr uint8_t F_NEEDS_CSUM = 1; //!< Checksum from csum_start to the end, storing it at csum_offset
+  static constexpr uint8_t F_DATA_VALID = 2; //!< The checksum has been verified
+  static constexpr uint8_t GSO_NONE = 0;     //!< Not a segmentation-offload packet
+  static constexpr uint8_t GSO_TCPV4 = 1;    //!< A TCP/IPv4 super-segment, to be cut into gso_size pieces
+  static constexpr uint8_t GSO_TCPV6 = 4;    //!< A TCP/IPv6 super-segment
+  static constexpr uint8_t GSO_UDP_L4 = 5;   //!< A UDP super-datagram, to be cut into gso_size datagrams
+  static constexpr uint8_t GSO_ECN = 0x80;   //!< (with GSO_TCPV4 or GSO_TCPV6) The segment has CWR set
+
+  uint8_t flags {};
+  uint8_t gso_type { GSO_NONE };
+  uint16_t hdr_len {};     //!< Length of the headers to copy into each segment (GSO)
+  uint16_t gso_size {};    //!< Payload bytes per segment (GSO)
+  uint16_t csum_start {};  //!< Where the checksummed bytes start (F_NEEDS_CSUM)
+  uint16_t csum_offset {}; //!< Where the checksum goes, from csum_start (F_NEEDS_CSUM)
+};
+
+static_assert( sizeof( VirtioNetHeader ) == 10 );
+
+//! How to open a TUN/TAP device
+struct TunTapOptions
+{
+  //! Start each packet read or written with a VirtioNetHeader (IFF_VNET_HDR), through which the kernel and this
+  //! end offload TCP checksums to each other
+  bool vnet_hdr = false;
+
+  //! Also let the kernel hand over (and take) TCP super-segments (and UDP super-datagrams, on Linux 6.2 and
+  //! later) of up to 64 KiB, which it cuts up only if they leave the machine (TSO/USO/GRO; needs vnet_hdr)
+  bool gso = false;
+
+  //! Open one of the queues of a device created with `multi_queue` (IFF_MULTI_QUEUE)
+  bool multi_queue = false;
+};
 
 //! A FileDescriptor to a [Linux TUN/TAP](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
 class TunTapFD : public FileDescriptor
 {
+  TunTapOptions options_;
+
 public:
+  //! The most a packet read from a device with TunTapOptions::gso can hold (a 64 KiB IP datagram, after its
+  //! VirtioNetHeader)
+  static constexpr size_t MAX_GSO_PACKET = 65535 + sizeof( VirtioNetHeader );
+
   //! Open an existing persistent [TUN or TAP
   //! device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-  explicit TunTapFD( const std::string& devname, bool is_tun );
+  explicit TunTapFD( const std::string& devname, bool is_tun, const TunTapOptions& options = {} );
+
+  //! Does each packet read or written start with a VirtioNetHeader (IFF_VNET_HDR)?
+  bool vnet_hdr() const { return options_.vnet_hdr; }
+
+  //! May packets be TCP super-segments, larger than the device's MTU?
+  bool gso() const { return options_.gso; }
 };
 
 //! A FileDescriptor to a [Linux TUN](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
@@ -18,7 +70,14 @@ class TunFD : public TunTapFD
 {
 public:
   //! Open an existing persistent [TUN device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-  explicit TunFD( const std::string& devname ) : TunTapFD( devname, true ) {}
+  explicit TunFD( const std::string& devname, const TunTapOptions& options = {} )
+    : TunTapFD( devname, true, options )
+  {}
+
+  //! Open `count` queues of an existing multi-queue TUN device (`ip tuntap add mode tun multi_queue ...`).
+  //! The kernel spreads flows among the queues by hash, so each queue can be read and written by a thread
+  //! of its own (e.g. one per EventLoopPool shard).
+  static std::vector<TunFD> open_queues( const std::string& devname, size_t count, TunTapOptions options = {} );
 };
 
 //! A FileDescriptor to a [Linux TAP](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
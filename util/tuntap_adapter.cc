@@ -1,25 +1,132 @@
 #include "tuntap_adapter.hh"
+#include "buffer_pool.hh"
 #include "helpers.hh"
 
+#include <cstring>
+
 using namespace std;
 
-optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
+namespace {
+constexpr uint16_t TCP_CHECKSUM_OFFSET = 16; // offset of the checksum field in the TCP header
+} // namespace
+
+vector<Ref<string>> TCPOverIPv4OverTunFdAdapter::_take_buffers() const
+{
+  auto buffers
+    = _tun.vnet_hdr()
+        ? BufferPool::take_for_headers(
+          { sizeof( VirtioNetHeader ), IPv4Header::LENGTH, TCPSegment::HEADER_LENGTH } )
+        : BufferPool::take_for_headers( { IPv4Header::LENGTH, TCPSegment::HEADER_LENGTH } );
+  if ( _tun.gso() ) {
+    // room for a super-segment: more pooled buffers ahead of the payload buffer (which read() sizes itself)
+    size_t room = sizeof( VirtioNetHeader ) + IPv4Header::LENGTH + TCPSegment::HEADER_LENGTH;
+    room += BufferPool::kBufferSize;
+    while ( room < TunTapFD::MAX_GSO_PACKET ) {
+      auto extra = BufferPool::take();
+      extra->resize( BufferPool::kBufferSize );
+      buffers.insert( buffers.end() - 1, move( extra ) );
+      room += BufferPool::kBufferSize;
+    }
+  }
+  return buffers;
+}
+
+optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::_unwrap( vector<Ref<string>>&& buffers )
 {
-  vector<string> strs( 3 );
-  strs[0].resize( IPv4Header::LENGTH );
-  strs[1].resize( TCPSegment::HEADER_LENGTH );
-  _tun.read( strs );
+  bool verify_checksum = not config().checksum_trusted;
+  if ( _tun.vnet_hdr() ) {
+    if ( buffers.empty() or buffers.front()->size() != sizeof( VirtioNetHeader ) ) {
+      return {};
+    }
+
+    // the kernel has already verified the checksum, or has left it incomplete because it never left this machine
+    VirtioNetHeader header {};
+    memcpy( &header, buffers.front()->data(), sizeof( header ) );
+    if ( header.flags & ( VirtioNetHeader::F_NEEDS_CSUM | VirtioNetHeader::F_DATA_VALID ) ) {
+      verify_checksum = false;
+    }
+    buffers.erase( buffers.begin() );
+  }
 
   InternetDatagram ip_dgram;
-  if ( parse( ip_dgram, move( strs ) ) ) {
-    return unwrap_tcp_in_ip( move( ip_dgram ) );
+  if ( parse( ip_dgram, move( buffers ) ) ) {
+    return unwrap_tcp_in_ip( move( ip_dgram ), verify_checksum );
   }
   return {};
 }
 
-void TCPOverIPv4OverTunFdAdapter::write( const TCPMessage& seg )
+optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
+{
+  auto buffers = _take_buffers();
+  _tun.read( buffers );
+  return _unwrap( move( buffers ) );
+}
+
+size_t TCPOverIPv4OverTunFdAdapter::read_batch( const size_t max_datagrams, vector<TCPMessage>& segments )
+{
+  vector<vector<Ref<string>>> datagrams;
+  datagrams.reserve( max_datagrams );
+  for ( size_t i = 0; i < max_datagrams; i++ ) {
+    datagrams.push_back( _take_buffers() );
+  }
+
+  const size_t count = _tun.read_batch( datagrams );
+  for ( auto& buffers : datagrams ) {
+    if ( auto seg = _unwrap( move( buffers ) ) ) {
+      segments.push_back( move( seg.value() ) );
+    }
+  }
+  return count;
+}
+
+void TCPOverIPv4OverTunFdAdapter::_write( const TCPMessage& seg, const bool defer )
 {
-  _tun.write( serialize( wrap_tcp_in_ip( seg ) ) );
+  // (a datagram that finds the queue full is dropped, as a full device would drop it; TCP sends it again)
+  const auto emit = [&]( vector<Ref<string>>&& datagram ) {
+    if ( defer ) {
+      _tun.defer_write( move( datagram ) );
+    } else {
+      _tun.queue_write( move( datagram ) );
+    }
+  };
+
+  const TCPSenderMessage& sender = seg.sender.get();
+  if ( sender.segment_size.has_value() and not _tun.gso() ) {
+    // a super-segment the device can't cut apart: write its segments one by one
+    const size_t segment_size = sender.segment_size.value();
+    for ( size_t offset = 0; offset < sender.payload.size(); offset += segment_size ) {
+      const bool last = offset + segment_size >= sender.payload.size();
+      _write( { TCPSenderMessage { .seqno = sender.seqno + static_cast<uint32_t>( offset ),
+                                   .payload = sender.payload.substr( offset, segment_size ),
+                                   .FIN = last and sender.FIN,
+                                   .RST = sender.RST },
+                seg.receiver.borrow() },
+              defer );
+    }
+    return;
+  }
+
+  if ( not _tun.vnet_hdr() ) {
+    // (the kernel verifies what it reads from a plain TUN device, even from a checksum-trusted link)
+    emit( serialize( wrap_tcp_in_ip( seg, TCPChecksum::Full ) ) );
+    return;
+  }
+
+  // leave the checksum for the kernel to complete, if the segment leaves this machine (hdr_len keeps both
+  // headers in the kernel's linear buffer, where its TCP code expects them), and a super-segment for it to cut
+  // apart, if it must
+  const bool super = sender.segment_size.has_value() and sender.payload.size() > sender.segment_size.value();
+  const VirtioNetHeader header { .flags = VirtioNetHeader::F_NEEDS_CSUM,
+                                 .gso_type = super ? VirtioNetHeader::GSO_TCPV4 : VirtioNetHeader::GSO_NONE,
+                                 .hdr_len = IPv4Header::LENGTH + TCPSegment::HEADER_LENGTH,
+                                 .gso_size = super ? sender.segment_size.value() : uint16_t {},
+                                 .csum_start = IPv4Header::LENGTH,
+                                 .csum_offset = TCP_CHECKSUM_OFFSET };
+  const InternetDatagram dgram = wrap_tcp_in_ip( seg, TCPChecksum::PseudoHeader ); // (must outlive the write)
+  Serializer serializer { BufferPool::take_small() };
+  serializer.buffer( string { reinterpret_cast<const char*>( &header ), sizeof( header ) } );
+  dgram.serialize( serializer );
+  emit( serializer.finish() );
 }
 
 //! Specialize LossyFdAdapter to TCPOverIPv4OverTunFdAdapter
@@ -5,9 +5,12 @@
 #include "tcp_segment.hh"
 #include "tun.hh"
 
+#include <cstddef>
 #include <optional>
 #include <utility>
+#include <vector>
 
+//! Sends and receives TCP segments over some link: write() hands a segment to the link right away
 template<class T>
 concept TCPDatagramAdapter = requires( T a, TCPMessage seg ) {
   { a.write( seg ) } -> std::same_as<void>;
@@ -15,12 +18,44 @@ concept TCPDatagramAdapter = requires( T a, TCPMessage seg ) {
   { a.read() } -> std::same_as<std::optional<TCPMessage>>;
 };
 
+//! A TCPDatagramAdapter that can also read several datagrams at once (see TCPOverIPv4OverTunFdAdapter::read_batch)
+template<class T>
+concept TCPDatagramBatchAdapter = TCPDatagramAdapter<T> and requires( T a, std::vector<TCPMessage> segments ) {
+  { a.read_batch( size_t {}, segments ) } -> std::same_as<size_t>;
+};
+
+//! A TCPDatagramAdapter that can also queue segments with defer_write(), to send all of them at once with
+//! flush_writes(). A deferred segment goes nowhere until then, so whoever defers must flush: after each batch
+//! of writes (e.g. each event), and again when fd() is writable while writes_ready() (the link may have had no
+//! room for everything, and fd() alone may poll writable while it still has none). While writes_queued() but
+//! not writes_ready(), the link has no room yet and may not say when it does, so retry the flush on a timer.
+template<class T>
+concept TCPDatagramQueueingAdapter = TCPDatagramAdapter<T> and requires( T a, const T ca, TCPMessage seg ) {
+  { a.defer_write( seg ) } -> std::same_as<void>;
+  { a.flush_writes() } -> std::same_as<void>;
+  { ca.writes_ready() } -> std::same_as<bool>;
+  { ca.writes_queued() } -> std::same_as<bool>;
+};
+
 //! \brief A FD adapter for IPv4 datagrams read from and written to a TUN device
+//! \details If the TunFD has a virtio-net header, TCP checksums are offloaded: outgoing segments carry only the
+//! pseudo-header's sum for the kernel to complete, and incoming ones the kernel vouches for aren't verified.
+//! Without one, outgoing segments always carry a full checksum, because the kernel checks them. A TunFD opened
+//! with TunTapOptions::gso may also hand over TCP super-segments, which are read whole, as one segment.
 class TCPOverIPv4OverTunFdAdapter : public TCPOverIPv4Adapter
 {
 private:
   TunFD _tun;
 
+  //! Pooled buffers to read one datagram into (split at the headers, and with room for a super-segment)
+  std::vector<Ref<std::string>> _take_buffers() const;
+
+  //! Parses a datagram read into _take_buffers(), if it holds a TCP segment related to the current connection
+  std::optional<TCPMessage> _unwrap( std::vector<Ref<std::string>>&& buffers );
+
+  //! write() or defer_write()
+  void _write( const TCPMessage& seg, bool defer );
+
 public:
   //! Construct from a TunFD
   explicit TCPOverIPv4OverTunFdAdapter( TunFD&& tun ) : _tun( std::move( tun ) ) {}
@@ -28,8 +63,26 @@ public:
   //! Attempts to read and parse an IPv4 datagram containing a TCP segment related to the current connection
   std::optional<TCPMessage> read();
 
-  //! Creates an IPv4 datagram from a TCP segment and writes it to the TUN device
-  void write( const TCPMessage& seg );
+  //! Reads up to `max_datagrams` datagrams at once (see FileDescriptor::read_batch), and appends the TCP
+  //! segments related to the current connection to `segments`; returns the number of datagrams read
+  size_t read_batch( size_t max_datagrams, std::vector<TCPMessage>& segments );
+
+  //! Creates an IPv4 datagram from a TCP segment and writes it to the TUN device (see FileDescriptor::queue_write:
+  //! what a full non-blocking device doesn't take waits in fd()'s write queue). A super-segment is written
+  //! whole, for the kernel to cut apart, if the device was opened with TunTapOptions::gso, or else as its
+  //! segments.
+  void write( const TCPMessage& seg ) { _write( seg, false ); }
+
+  //! Like write(), but only queues the datagram: the next flush_writes() writes everything queued by then,
+  //! in one batch
+  void defer_write( const TCPMessage& seg ) { _write( seg, true ); }
+
+  //! Writes as much of the queue as the TUN device takes
+  void flush_writes() { _tun.flush_writes(); }
+
+  //! Is anything left in the queue (for flush_writes() once fd() is writable)?
+  bool writes_ready() const { return _tun.queued_writes() > 0; }
+  bool writes_queued() const { return writes_ready(); } //!< (the TunFD polls writable once it has room)
 
   //! Access the underlying TUN device
   explicit operator TunFD&() { return _tun; }
@@ -41,5 +94,7 @@ public:
   FileDescriptor& fd() { return _tun; }
 };
 
-static_assert( TCPDatagramAdapter<TCPOverIPv4OverTunFdAdapter> );
-static_assert( TCPDatagramAdapter<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>> );
+static_assert( TCPDatagramBatchAdapter<TCPOverIPv4OverTunFdAdapter> );
+static_assert( TCPDatagramBatchAdapter<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>> );
+static_assert( TCPDatagramQueueingAdapter<TCPOverIPv4OverTunFdAdapter> );
+static_assert( TCPDatagramQueueingAdapter<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>> );
@@ -0,0 +1,188 @@
+#include "work_stealing_executor.hh"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+// the executor and worker index of the current thread, if it is a worker (so that strands it schedules stay local)
+thread_local const WorkStealingExecutor* current_executor = nullptr;
+thread_local size_t current_worker = 0;
+}
+
+WorkStealingExecutor::WorkStealingExecutor( const size_t threads )
+{
+  if ( threads == 0 ) {
+    throw runtime_error( "WorkStealingExecutor needs at least one thread" );
+  }
+
+  _workers.reserve( threads );
+  for ( size_t i = 0; i < threads; i++ ) {
+    _workers.push_back( make_unique<Worker>() );
+  }
+
+  for ( size_t i = 0; i < threads; i++ ) {
+    _workers[i]->thread = thread( &WorkStealingExecutor::_run, this, i );
+  }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor()
+{
+  try {
+    {
+      const lock_guard lock { _idle_mutex };
+      _stopping = true;
+    }
+    _work_available.notify_all();
+    for ( auto& worker : _workers ) {
+      if ( worker->thread.joinable() ) {
+        worker->thread.join();
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception destructing WorkStealingExecutor: " << e.what() << "\n";
+  }
+}
+
+size_t WorkStealingExecutor::default_threads()
+{
+  return max( 1U, thread::hardware_concurrency() );
+}
+
+void WorkStealingExecutor::submit( const uint64_t key, Task&& task )
+{
+  shared_ptr<Strand> strand;
+  {
+    const lock_guard lock { _strands_mutex };
+    auto& entry = _strands[key];
+    if ( not entry ) {
+      entry = make_shared<Strand>( key );
+    }
+    entry->tasks.push_back( move( task ) );
+    if ( entry->scheduled ) {
+      return; // it will get to this task after the earlier ones
+    }
+    entry->scheduled = true;
+    strand = entry;
+  }
+
+  _schedule( strand, false );
+}
+
+void WorkStealingExecutor::_schedule( const shared_ptr<Strand>& strand, const bool to_front )
+{
+  const size_t index = current_executor == this ? current_worker : _next_worker++ % _workers.size();
+  Worker& worker = *_workers[index];
+  {
+    const lock_guard lock { worker.mutex };
+    if ( to_front ) {
+      worker.strands.push_front( strand );
+    } else {
+      worker.strands.push_back( strand );
+    }
+  }
+
+  {
+    // (holding the mutex means a worker can't check for work and then miss this notification)
+    const lock_guard lock { _idle_mutex };
+    ++_queued;
+  }
+  _work_available.notify_one();
+}
+
+shared_ptr<WorkStealingExecutor::Strand> WorkStealingExecutor::_take( const size_t index )
+{
+  // newest strand from the worker's own deque...
+  shared_ptr<Strand> strand;
+  {
+    Worker& own = *_workers[index];
+    const lock_guard lock { own.mutex };
+    if ( not own.strands.empty() ) {
+      strand = move( own.strands.back() );
+      own.strands.pop_back();
+    }
+  }
+  if ( strand ) {
+    _count_taken();
+    return strand;
+  }
+
+  // ... or the oldest from someone else's
+  for ( size_t i = 1; i < _workers.size(); i++ ) {
+    Worker& victim = *_workers[( index + i ) % _workers.size()];
+    {
+      const lock_guard lock { victim.mutex };
+      if ( not victim.strands.empty() ) {
+        strand = move( victim.strands.front() );
+        victim.strands.pop_front();
+      }
+    }
+    if ( strand ) {
+      _count_taken();
+      _steals.fetch_add( 1, memory_order_relaxed );
+      return strand;
+    }
+  }
+
+  return {};
+}
+
+//! \details _queued is only touched under _idle_mutex, so an idle worker's check of it in _run() can't
+//! interleave with a change. (Between a strand leaving its deque and this, _queued is one too high, so an idle
+//! worker may wake to find nothing to take; it just waits again.)
+void WorkStealingExecutor::_count_taken()
+{
+  const lock_guard lock { _idle_mutex };
+  --_queued;
+}
+
+void WorkStealingExecutor::_run_one( const shared_ptr<Strand>& strand )
+{
+  Task task;
+  {
+    const lock_guard lock { _strands_mutex };
+    task = move( strand->tasks.front() );
+    strand->tasks.pop_front();
+  }
+
+  try {
+    task();
+  } catch ( const exception& e ) {
+    cerr << "Exception in WorkStealingExecutor task: " << e.what() << "\n";
+  }
+
+  {
+    const lock_guard lock { _strands_mutex };
+    if ( strand->tasks.empty() ) {
+      strand->scheduled = false;
+      _strands.erase( strand->key ); // a later submit() starts a new strand
+      return;
+    }
+  }
+
+  // more to do: let the strands that were waiting behind this one go first
+  _schedule( strand, true );
+}
+
+void WorkStealingExecutor::_run( const size_t index )
+{
+  current_executor = this;
+  current_worker = index;
+
+  while ( true ) {
+    auto strand = _take( index );
+    if ( strand ) {
+      _run_one( strand );
+      continue;
+    }
+
+    unique_lock lock { _idle_mutex };
+    _work_available.wait( lock, [&] { return _queued > 0 or _stopping; } );
+    if ( _stopping and _queued == 0 ) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//! \brief A pool of worker threads that runs tasks, in order per key, with work stealing
+//! \details Tasks submitted with the same key (e.g. a connection's FourTuple hash) form a strand:
+//! they run one at a time, in the order they were submitted. Different strands run in parallel.
+//! Each worker keeps a deque of strands that have work; it takes strands from the back of its own
+//! deque and, when that is empty, steals from the front of another worker's. A strand runs one task
+//! per turn and then goes to the front of its worker's deque, so a busy strand can't keep a worker from
+//! the others (and the others can be stolen meanwhile).
+class WorkStealingExecutor
+{
+public:
+  using Task = std::function<void()>;
+
+  //! Start `threads` workers (by default, one per core)
+  explicit WorkStealingExecutor( size_t threads = default_threads() );
+
+  //! Run every task already submitted, then stop the workers
+  ~WorkStealingExecutor();
+
+  //! Run `task` on a worker, after every earlier task with the same `key` has finished
+  void submit( uint64_t key, Task&& task );
+
+  //! One worker per core, as reported by the standard library (at least one)
+  static size_t default_threads();
+
+  size_t size() const { return _workers.size(); }
+
+  //! How many times a worker took a strand from another worker's deque
+  uint64_t steals() const { return _steals.load( std::memory_order_relaxed ); }
+
+  //! \name
+  //! The workers refer to this object, so it can't be copied or moved
+  //!@{
+  WorkStealingExecutor( const WorkStealingExecutor& other ) = delete;
+  WorkStealingExecutor& operator=( const WorkStealingExecutor& other ) = delete;
+  WorkStealingExecutor( WorkStealingExecutor&& other ) = delete;
+  WorkStealingExecutor& operator=( WorkStealingExecutor&& other ) = delete;
+  //!@}
+
+private:
+  //! The tasks of one key that have not run yet
+  struct Strand
+  {
+    uint64_t key;
+    std::deque<Task> tasks {}; //!< Protected by _strands_mutex
+    bool scheduled {};         //!< Is the strand in a worker's deque or running? (protected by _strands_mutex)
+
+    explicit Strand( uint64_t s_key ) : key( s_key ) {}
+  };
+
+  struct Worker
+  {
+    std::mutex mutex {};
+    std::deque<std::shared_ptr<Strand>> strands {}; //!< Protected by mutex
+    std::thread thread {};
+  };
+
+  std::vector<std::unique_ptr<Worker>> _workers {};
+
+  //! Strands with unfinished tasks (a strand is forgotten once it runs out of tasks)
+  std::mutex _strands_mutex {};
+  std::unordered_map<uint64_t, std::shared_ptr<Strand>> _strands {};
+
+  std::mutex _idle_mutex {};
+  std::condition_variable _work_available {};
+  size_t _queued {};                   //!< Strands waiting in some worker's deque (protected by _idle_mutex)
+  bool _stopping {};                   //!< Protected by _idle_mutex
+  std::atomic<size_t> _next_worker {}; //!< Where strands scheduled from outside the pool go (round robin)
+  std::atomic<uint64_t> _steals {};
+
+  void _run( size_t index );
+  void _schedule( const std::shared_ptr<Strand>& strand, bool to_front );
+  std::shared_ptr<Strand> _take( size_t index );
+  void _count_taken();
+  void _run_one( const std::shared_ptr<Strand>& strand );
+};